@@ -17,6 +17,19 @@ __memcpy_fwd:
 	mov esi, [esp + 16]
 	mov ecx, [esp + 20]
 	mov eax, edi
+	// Use `rep movsb` if fast on the CPU (see `__libc_features`)
+	test dword ptr [__libc_features], 4 # LIBC_FSRM
+	jnz 3f
+	cmp ecx, 128
+	jb 4f
+	test dword ptr [__libc_features], 2 # LIBC_ERMS
+	jz 4f
+3:
+	rep movsb
+	pop edi
+	pop esi
+	ret
+4:
 	cmp ecx, 4
 	jc 1f
 	test edi, 3
@@ -59,6 +59,17 @@ memset:
 
 2:
 	movzb eax, [esp + 8]
+	// Use `rep stosb` if fast on the CPU (see `__libc_features`)
+	test dword ptr [__libc_features], 2 # LIBC_ERMS
+	jz 3f
+	mov edx, edi
+	mov edi, [esp + 4]
+	rep stosb
+	mov edi, edx
+	mov eax, [esp + 4]
+	ret
+
+3:
 	mov [esp + 12], edi
 	imul eax, 0x1010101
 	mov edi, [esp + 4]
@@ -24,6 +24,7 @@
 
 .global raw_copy
 .global raw_zero
+.global raw_cmpxchg
 .global raw_fault
 
 // The order of functions is important for bound checking in the exception handler
@@ -58,6 +59,23 @@ raw_zero:
 	mov eax, 1
 	ret
 
+raw_cmpxchg:
+	push esi
+	push edi
+
+	mov edi, 12[esp]
+	mov eax, 16[esp]
+	mov ecx, 20[esp]
+
+	lock cmpxchg [edi], ecx
+	mov esi, 24[esp]
+	mov [esi], eax
+
+	pop edi
+	pop esi
+	mov eax, 1
+	ret
+
 raw_fault:
 	pop edi
 	pop esi
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SSE2 variants of string and memory functions
+//
+// The kernel does not save the userspace FPU state on entry, so each function saves and restores
+// the SIMD registers it uses.
+//
+// Those functions are called by their generic counterparts in `src/libc` when supported.
+
+.intel_syntax noprefix
+
+.section .text
+
+.global __memcmp_sse2
+.global __strlen_sse2
+.global __memchr_sse2
+
+.type __memcmp_sse2, @function
+.type __strlen_sse2, @function
+.type __memchr_sse2, @function
+
+// Arguments: left buffer, right buffer, size (at least 16)
+__memcmp_sse2:
+	push esi
+	push edi
+	sub esp, 32
+	movdqu [esp], xmm0
+	movdqu [esp + 16], xmm1
+	mov esi, [esp + 44]
+	mov edi, [esp + 48]
+	mov edx, [esp + 52]
+	xor ecx, ecx
+1:
+	movdqu xmm0, [esi + ecx]
+	movdqu xmm1, [edi + ecx]
+	pcmpeqb xmm0, xmm1
+	pmovmskb eax, xmm0
+	cmp eax, 0xffff
+	jne 3f
+	add ecx, 16
+	lea eax, [ecx + 16]
+	cmp eax, edx
+	jbe 1b
+	// Compare the last 16 bytes, overlapping with the previous block
+	cmp ecx, edx
+	je 2f
+	lea ecx, [edx - 16]
+	movdqu xmm0, [esi + ecx]
+	movdqu xmm1, [edi + ecx]
+	pcmpeqb xmm0, xmm1
+	pmovmskb eax, xmm0
+	cmp eax, 0xffff
+	jne 3f
+2:
+	xor eax, eax
+	jmp 4f
+3:
+	// Compute the difference of the first mismatching bytes
+	not eax
+	bsf eax, eax
+	add ecx, eax
+	movzx eax, byte ptr [esi + ecx]
+	movzx edx, byte ptr [edi + ecx]
+	sub eax, edx
+4:
+	movdqu xmm0, [esp]
+	movdqu xmm1, [esp + 16]
+	add esp, 32
+	pop edi
+	pop esi
+	ret
+
+// Arguments: string
+//
+// Loads are aligned on 16 bytes so that they never cross a page boundary.
+__strlen_sse2:
+	push esi
+	sub esp, 32
+	movdqu [esp], xmm0
+	movdqu [esp + 16], xmm1
+	mov esi, [esp + 40]
+	pxor xmm0, xmm0
+	mov eax, esi
+	and eax, -16
+	mov ecx, esi
+	and ecx, 15
+	// First block: ignore bytes before the beginning of the string
+	movdqa xmm1, [eax]
+	pcmpeqb xmm1, xmm0
+	pmovmskb edx, xmm1
+	shr edx, cl
+	test edx, edx
+	jz 1f
+	bsf eax, edx
+	jmp 2f
+1:
+	add eax, 16
+	movdqa xmm1, [eax]
+	pcmpeqb xmm1, xmm0
+	pmovmskb edx, xmm1
+	test edx, edx
+	jz 1b
+	bsf edx, edx
+	add eax, edx
+	sub eax, esi
+2:
+	movdqu xmm0, [esp]
+	movdqu xmm1, [esp + 16]
+	add esp, 32
+	pop esi
+	ret
+
+// Arguments: buffer, byte to find, size (at least 16)
+__memchr_sse2:
+	push esi
+	sub esp, 32
+	movdqu [esp], xmm0
+	movdqu [esp + 16], xmm1
+	mov esi, [esp + 40]
+	// Broadcast the byte to find
+	movd xmm0, [esp + 44]
+	punpcklbw xmm0, xmm0
+	punpcklwd xmm0, xmm0
+	pshufd xmm0, xmm0, 0
+	mov edx, [esp + 48]
+	xor ecx, ecx
+1:
+	movdqu xmm1, [esi + ecx]
+	pcmpeqb xmm1, xmm0
+	pmovmskb eax, xmm1
+	test eax, eax
+	jnz 3f
+	add ecx, 16
+	lea eax, [ecx + 16]
+	cmp eax, edx
+	jbe 1b
+	// Check the last 16 bytes, overlapping with the previous block
+	cmp ecx, edx
+	je 2f
+	lea ecx, [edx - 16]
+	movdqu xmm1, [esi + ecx]
+	pcmpeqb xmm1, xmm0
+	pmovmskb eax, xmm1
+	test eax, eax
+	jnz 3f
+2:
+	xor eax, eax
+	jmp 4f
+3:
+	bsf eax, eax
+	add ecx, eax
+	lea eax, [esi + ecx]
+4:
+	movdqu xmm0, [esp]
+	movdqu xmm1, [esp + 16]
+	add esp, 32
+	pop esi
+	ret
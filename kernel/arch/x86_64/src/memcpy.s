@@ -12,6 +12,18 @@
 memcpy:
 __memcpy_fwd:
     mov rax, rdi
+    // Use `rep movsb` if fast on the CPU (see `__libc_features`)
+    test dword ptr [rip + __libc_features], 4 # LIBC_FSRM
+    jnz 3f
+    cmp rdx, 128
+    jb 4f
+    test dword ptr [rip + __libc_features], 2 # LIBC_ERMS
+    jz 4f
+3:
+    mov rcx, rdx
+    rep movsb
+    ret
+4:
     cmp rdx, 8
     jc 1f
     test edi, 7
@@ -57,6 +57,16 @@ memset:
     ret
 
 2:
+    // Use `rep stosb` if fast on the CPU (see `__libc_features`)
+    test dword ptr [rip + __libc_features], 2 # LIBC_ERMS
+    jz 3f
+    mov r8, rdi
+    mov rcx, rdx
+    rep stosb
+    mov rax, r8
+    ret
+
+3:
     test edi, 15
     mov r8, rdi
     mov [rdi + rdx - 8], rax
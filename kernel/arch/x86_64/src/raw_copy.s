@@ -24,6 +24,7 @@
 
 .global raw_copy
 .global raw_zero
+.global raw_cmpxchg
 .global raw_fault
 
 // The order of functions is important for bound checking in the exception handler
@@ -41,6 +42,13 @@ raw_zero:
 	mov rax, 1
 	ret
 
+raw_cmpxchg:
+	mov eax, esi
+	lock cmpxchg [rdi], edx
+	mov [rcx], eax
+	mov rax, 1
+	ret
+
 raw_fault:
 	xor rax, rax
 	ret
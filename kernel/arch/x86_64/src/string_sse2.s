@@ -0,0 +1,162 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SSE2 variants of string and memory functions
+//
+// The kernel does not save the userspace FPU state on entry, so each function saves and restores
+// the SIMD registers it uses.
+//
+// Those functions are called by their generic counterparts in `src/libc` when supported.
+
+.intel_syntax noprefix
+
+.section .text
+
+.global __memcmp_sse2
+.global __strlen_sse2
+.global __memchr_sse2
+
+.type __memcmp_sse2, @function
+.type __strlen_sse2, @function
+.type __memchr_sse2, @function
+
+// Arguments: rdi = left buffer, rsi = right buffer, rdx = size (at least 16)
+__memcmp_sse2:
+	sub rsp, 32
+	movdqu [rsp], xmm0
+	movdqu [rsp + 16], xmm1
+	xor ecx, ecx
+	mov r8, rdx
+	and r8, -16
+1:
+	movdqu xmm0, [rdi + rcx]
+	movdqu xmm1, [rsi + rcx]
+	pcmpeqb xmm0, xmm1
+	pmovmskb eax, xmm0
+	cmp eax, 0xffff
+	jne 3f
+	add rcx, 16
+	cmp rcx, r8
+	jb 1b
+	// Compare the last 16 bytes, overlapping with the previous block
+	cmp rcx, rdx
+	je 2f
+	lea rcx, [rdx - 16]
+	movdqu xmm0, [rdi + rcx]
+	movdqu xmm1, [rsi + rcx]
+	pcmpeqb xmm0, xmm1
+	pmovmskb eax, xmm0
+	cmp eax, 0xffff
+	jne 3f
+2:
+	xor eax, eax
+	jmp 4f
+3:
+	// Compute the difference of the first mismatching bytes
+	not eax
+	bsf eax, eax
+	add rcx, rax
+	movzx eax, byte ptr [rdi + rcx]
+	movzx edx, byte ptr [rsi + rcx]
+	sub eax, edx
+4:
+	movdqu xmm0, [rsp]
+	movdqu xmm1, [rsp + 16]
+	add rsp, 32
+	ret
+
+// Arguments: rdi = string
+//
+// Loads are aligned on 16 bytes so that they never cross a page boundary.
+__strlen_sse2:
+	sub rsp, 32
+	movdqu [rsp], xmm0
+	movdqu [rsp + 16], xmm1
+	pxor xmm0, xmm0
+	mov rax, rdi
+	and rax, -16
+	mov ecx, edi
+	and ecx, 15
+	// First block: ignore bytes before the beginning of the string
+	movdqa xmm1, [rax]
+	pcmpeqb xmm1, xmm0
+	pmovmskb edx, xmm1
+	shr edx, cl
+	test edx, edx
+	jz 1f
+	bsf eax, edx
+	jmp 2f
+1:
+	add rax, 16
+	movdqa xmm1, [rax]
+	pcmpeqb xmm1, xmm0
+	pmovmskb edx, xmm1
+	test edx, edx
+	jz 1b
+	bsf edx, edx
+	add rax, rdx
+	sub rax, rdi
+2:
+	movdqu xmm0, [rsp]
+	movdqu xmm1, [rsp + 16]
+	add rsp, 32
+	ret
+
+// Arguments: rdi = buffer, esi = byte to find, rdx = size (at least 16)
+__memchr_sse2:
+	sub rsp, 32
+	movdqu [rsp], xmm0
+	movdqu [rsp + 16], xmm1
+	// Broadcast the byte to find
+	movd xmm0, esi
+	punpcklbw xmm0, xmm0
+	punpcklwd xmm0, xmm0
+	pshufd xmm0, xmm0, 0
+	xor ecx, ecx
+	mov r8, rdx
+	and r8, -16
+1:
+	movdqu xmm1, [rdi + rcx]
+	pcmpeqb xmm1, xmm0
+	pmovmskb eax, xmm1
+	test eax, eax
+	jnz 3f
+	add rcx, 16
+	cmp rcx, r8
+	jb 1b
+	// Check the last 16 bytes, overlapping with the previous block
+	cmp rcx, rdx
+	je 2f
+	lea rcx, [rdx - 16]
+	movdqu xmm1, [rdi + rcx]
+	pcmpeqb xmm1, xmm0
+	pmovmskb eax, xmm1
+	test eax, eax
+	jnz 3f
+2:
+	xor eax, eax
+	jmp 4f
+3:
+	bsf eax, eax
+	add rcx, rax
+	lea rax, [rdi + rcx]
+4:
+	movdqu xmm0, [rsp]
+	movdqu xmm1, [rsp + 16]
+	add rsp, 32
+	ret
@@ -84,6 +84,7 @@ pub fn compile_c(env: &Env, target: &Target) -> io::Result<()> {
 	for f in &files {
 		println!("cargo:rerun-if-changed={}", f.display());
 	}
+	println!("cargo:rerun-if-changed=src/libc/libc.h");
 	cc::Build::new()
 		.flag("-nostdlib")
 		.flag("-ffreestanding")
@@ -21,7 +21,7 @@
 use crate::{
 	arch::x86::cpu::{enumerate_cpus, topology_add},
 	println, process,
-	process::scheduler::cpu::{per_cpu, store_per_cpu},
+	process::scheduler::cpu::{init_per_cpu, per_cpu, store_per_cpu},
 	sync::once::OnceInit,
 };
 use utils::errno::AllocResult;
@@ -50,6 +50,7 @@ pub(crate) fn init1(first: bool) {
 	{
 		use x86::*;
 		cli();
+		init_per_cpu();
 		if !has_sse() {
 			panic!("SSE support is required to run this kernel :(");
 		}
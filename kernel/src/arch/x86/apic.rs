@@ -46,6 +46,8 @@ pub const REG_ICR_LO: usize = 0x300;
 pub const REG_ICR_HI: usize = 0x310;
 /// APIC register: LVT Timer
 pub const REG_LVT_TIMER: usize = 0x320;
+/// APIC register: LVT Performance Monitoring Counters
+pub const REG_LVT_PERF: usize = 0x340;
 /// APIC register: Initial Count Register
 pub const REG_TIMER_INIT_COUNT: usize = 0x380;
 /// APIC register: Current Count Register
@@ -102,3 +102,38 @@ pub fn has_package_bits() -> bool {
 	let edx = cpuid(1, 0).3;
 	edx & (1 << 28) != 0
 }
+
+/// Tells whether the CPU supports SSE2.
+#[inline]
+pub fn has_sse2() -> bool {
+	cpuid(1, 0).3 & (1 << 26) != 0
+}
+
+/// Tells whether the CPU supports *Enhanced REP MOVSB/STOSB* (ERMS).
+///
+/// If supported, `rep movsb` and `rep stosb` are the fastest way to copy or fill large buffers.
+#[inline]
+pub fn has_erms() -> bool {
+	base_max_leaf() >= 7 && cpuid(7, 0).1 & (1 << 9) != 0
+}
+
+/// Tells whether the CPU's TSC is invariant, meaning it runs at a constant rate regardless of
+/// power states.
+#[inline]
+pub fn has_invariant_tsc() -> bool {
+	extended_max_leaf() >= 0x80000007 && cpuid(0x80000007, 0).3 & (1 << 8) != 0
+}
+
+/// Tells whether the CPU supports the `rdtscp` instruction.
+#[inline]
+pub fn has_rdtscp() -> bool {
+	extended_max_leaf() >= 0x80000001 && cpuid(0x80000001, 0).3 & (1 << 27) != 0
+}
+
+/// Tells whether the CPU supports *Fast Short REP MOV* (FSRM).
+///
+/// If supported, `rep movsb` is fast even for small buffers.
+#[inline]
+pub fn has_fsrm() -> bool {
+	base_max_leaf() >= 7 && cpuid(7, 0).3 & (1 << 4) != 0
+}
@@ -28,6 +28,7 @@ pub mod idt;
 pub mod io;
 pub mod paging;
 pub mod pic;
+pub mod pmu;
 pub mod smp;
 pub mod timer;
 pub mod tss;
@@ -45,6 +46,8 @@ pub const IA32_FS_BASE: u32 = 0xc0000100;
 pub const IA32_GS_BASE: u32 = 0xc0000101;
 /// MSR: Kernel GS base
 pub const IA32_KERNEL_GS_BASE: u32 = 0xc0000102;
+/// MSR: auxiliary value returned by `rdtscp`
+pub const IA32_TSC_AUX: u32 = 0xc0000103;
 
 /// Process default `rflags`
 pub const DEFAULT_FLAGS: usize = 0x202;
@@ -159,17 +159,19 @@ impl Table {
 			return;
 		}
 		let flags = val & (FLAGS_MASK & !FLAG_PAGE_SIZE);
-		let stride = if level == 1 {
-			PAGE_SIZE
+		// Entries of the new table are PSE too, unless they are at level `0`
+		let child_flags = if level > 1 {
+			flags | FLAG_PAGE_SIZE
 		} else {
-			PAGE_SIZE * PAGE_SIZE
+			flags
 		};
+		let stride = PAGE_SIZE * ENTRIES_PER_TABLE.pow(level as u32 - 1);
 		// Create table
 		let mut new_table = alloc_table();
 		let new_table_ref = unsafe { new_table.as_mut() };
 		new_table_ref.iter_mut().enumerate().for_each(|(i, e)| {
 			let addr = PhysAddr(val & ADDR_MASK) + i * stride;
-			e.store(to_entry(addr, flags), Relaxed);
+			e.store(to_entry(addr, child_flags), Relaxed);
 		});
 		// Set new entry
 		let addr = VirtAddr::from(new_table).kernel_to_physical().unwrap();
@@ -309,12 +311,53 @@ fn can_remove_table(level: usize, index: usize) -> bool {
 	(1..(DEPTH - 1)).contains(&level) || (level == DEPTH - 1 && index < USERSPACE_TABLES)
 }
 
-const PAGE_SIZE_ORDER_1: u8 = if cfg!(target_arch = "x86") { 10 } else { 9 };
+/// The page order of entries with [`FLAG_PAGE_SIZE`] at level `1`.
+pub const PAGE_SIZE_ORDER_1: u8 = if cfg!(target_arch = "x86") { 10 } else { 9 };
+/// The page order of entries with [`FLAG_PAGE_SIZE`] at level `2`.
 const PAGE_SIZE_ORDER_2: u8 = PAGE_SIZE_ORDER_1 * 2;
 
+/// A table that has been detached from a page directory, but that CPUs may still reach through
+/// their paging-structure caches.
+///
+/// It must be freed with [`Self::free`] once these caches have been invalidated on every CPU
+/// that may have used the page directory. Dropping it without doing so leaks the table.
+#[must_use = "the table must be freed once caches have been invalidated"]
+#[derive(Debug)]
+pub struct StaleTable {
+	/// The table
+	table: NonNull<Table>,
+	/// The depth of the table in the page directory
+	depth: usize,
+}
+
+impl StaleTable {
+	/// Frees the table, along with its children tables.
+	///
+	/// # Safety
+	///
+	/// No CPU may still reach the table through its paging-structure caches.
+	pub unsafe fn free(self) {
+		unsafe {
+			free_impl(self.table, self.depth);
+		}
+	}
+}
+
+/// Stores the PSE entry `val` in `ent`, at level `level`.
+///
+/// If a table was present in the entry, it is returned.
+fn store_pse(ent: &Entry, val: usize, level: usize) -> Option<StaleTable> {
+	let prev = ent.swap(val, Relaxed);
+	(prev & (FLAG_PRESENT | FLAG_PAGE_SIZE) == FLAG_PRESENT).then(|| StaleTable {
+		table: unwrap_entry(prev).0,
+		depth: DEPTH - level,
+	})
+}
+
 /// Inner implementation of [`crate::memory::vmem::VMem::map`] for x86.
 ///
-/// The function returns the size of the mapped entry in bytes.
+/// The function returns the size of the mapped entry in bytes, along with the table the entry
+/// replaced, if any.
 ///
 /// # Safety
 ///
@@ -329,22 +372,22 @@ pub unsafe fn map(
 	virtaddr: VirtAddr,
 	flags: usize,
 	page_size_order: u8,
-) -> usize {
+) -> (usize, Option<StaleTable>) {
 	for level in (0..DEPTH).rev() {
 		let ent = &table[get_addr_element_index(virtaddr, level)];
 		match (level, flags & FLAG_PAGE_SIZE != 0, page_size_order) {
 			(0, ..) => {
 				ent.store(to_entry(physaddr, flags & !FLAG_PAGE_SIZE), Relaxed);
-				return PAGE_SIZE;
+				return (PAGE_SIZE, None);
 			}
 			// Use PAGE_SIZE if appropriate
 			(1, true, PAGE_SIZE_ORDER_1..) => {
-				ent.store(to_entry(physaddr, flags), Relaxed);
-				return PAGE_SIZE << PAGE_SIZE_ORDER_1;
+				let stale = store_pse(ent, to_entry(physaddr, flags), level);
+				return (PAGE_SIZE << PAGE_SIZE_ORDER_1, stale);
 			}
 			(2, true, PAGE_SIZE_ORDER_2..) if likely(*PAGE_SIZE_1GB) => {
-				ent.store(to_entry(physaddr, flags), Relaxed);
-				return PAGE_SIZE << PAGE_SIZE_ORDER_2;
+				let stale = store_pse(ent, to_entry(physaddr, flags), level);
+				return (PAGE_SIZE << PAGE_SIZE_ORDER_2, stale);
 			}
 			_ => {
 				// Disable FLAG_XD because it is inverted relative to other flags. Also
@@ -390,38 +433,61 @@ pub unsafe fn map_range(
 ) {
 	let end = virtaddr + pages * PAGE_SIZE;
 	while virtaddr < end {
+		// Use the largest page that is aligned on both sides and fits in the remaining range.
 		// log2(PAGE_SIZE) = 12
-		let align_order = (physaddr.0 | (end.0 - virtaddr.0)).trailing_zeros() as u8 - 12;
-		let off = map(
+		let align = (physaddr.0 | virtaddr.0).trailing_zeros();
+		let align_order = align.min((end.0 - virtaddr.0).ilog2()) as u8 - 12;
+		let (off, stale) = map(
 			table,
 			physaddr,
 			virtaddr,
 			flags | FLAG_PAGE_SIZE,
 			align_order,
 		);
+		// The caller is responsible for the range not being in use
+		if let Some(stale) = stale {
+			unsafe {
+				stale.free();
+			}
+		}
 		*physaddr += off;
 		*virtaddr += off;
 	}
 }
 
-/// Inner implementation of [`crate::memory::vmem::VMem::unmap`] for x86.
+/// Unmaps memory at `virtaddr`, covering at most `pages` pages.
 ///
-/// # Safety
+/// If a PSE entry is entirely covered, it is removed at once. Else, it is expanded so that only
+/// the first page is unmapped.
 ///
-/// In case the unmapped memory is in kernelspace, the caller must ensure the code and stack of the
-/// kernel remain accessible and valid.
-pub unsafe fn unmap(mut table: &Table, virtaddr: VirtAddr) {
+/// The function returns the number of pages that have been unmapped, or that were not mapped.
+unsafe fn unmap_impl(mut table: &Table, virtaddr: VirtAddr, pages: usize) -> usize {
 	// Read entries
 	let mut tables: [Option<(NonNull<Table>, usize)>; DEPTH] = [None; DEPTH];
+	let mut count = 1;
 	for level in (0..DEPTH).rev() {
 		let index = get_addr_element_index(virtaddr, level);
-		let entry = table[index].load(Relaxed);
+		let ent = &table[index];
 		tables[level] = Some((NonNull::from(table), index));
-		if level == 0 || entry & FLAG_PRESENT == 0 || entry & FLAG_PAGE_SIZE != 0 {
+		let entry = ent.load(Relaxed);
+		// The number of pages covered by the entry
+		let entry_pages = ENTRIES_PER_TABLE.pow(level as _);
+		if level == 0 || entry & FLAG_PRESENT == 0 {
+			// Skip the whole range covered by the entry
+			let off = (virtaddr.0 / PAGE_SIZE) & (entry_pages - 1);
+			count = entry_pages - off;
 			break;
 		}
+		if entry & FLAG_PAGE_SIZE != 0 {
+			if virtaddr.is_aligned_to(entry_pages * PAGE_SIZE) && pages >= entry_pages {
+				count = entry_pages;
+				break;
+			}
+			// The entry is partially unmapped
+			Table::expand(ent, level);
+		}
 		// Jump to next table
-		table = unsafe { unwrap_entry(entry).0.as_mut() };
+		table = unsafe { unwrap_entry(ent.load(Relaxed)).0.as_mut() };
 	}
 	// Remove entry and go up to remove tables that are now empty
 	for t in tables {
@@ -434,6 +500,17 @@ pub unsafe fn unmap(mut table: &Table, virtaddr: VirtAddr) {
 			break;
 		}
 	}
+	count.min(pages).max(1)
+}
+
+/// Inner implementation of [`crate::memory::vmem::VMem::unmap`] for x86.
+///
+/// # Safety
+///
+/// In case the unmapped memory is in kernelspace, the caller must ensure the code and stack of the
+/// kernel remain accessible and valid.
+pub unsafe fn unmap(table: &Table, virtaddr: VirtAddr) {
+	unmap_impl(table, virtaddr, 1);
 }
 
 /// Inner implementation of [`crate::memory::vmem::VMem::unmap_range`] for x86.
@@ -443,12 +520,95 @@ pub unsafe fn unmap(mut table: &Table, virtaddr: VirtAddr) {
 /// In case the mapped memory is in kernelspace, the caller must ensure the code and stack of the
 /// kernel remain accessible and valid.
 pub unsafe fn unmap_range(table: &Table, virtaddr: VirtAddr, pages: usize) {
-	for i in 0..pages {
-		let virtaddr = virtaddr + i * PAGE_SIZE;
-		unmap(table, virtaddr);
+	let mut i = 0;
+	while i < pages {
+		i += unmap_impl(table, virtaddr + i * PAGE_SIZE, pages - i);
 	}
 }
 
+/// Copies the entries of `src` at level `level` covering the range `virtaddr..end` to `dst`.
+///
+/// If `write_protect` is set, [`FLAG_WRITE`] is cleared from the copied leaf entries, on both
+/// sides.
+unsafe fn fork_impl(
+	src: &Table,
+	dst: &Table,
+	level: usize,
+	mut virtaddr: VirtAddr,
+	end: VirtAddr,
+	write_protect: bool,
+) {
+	let entry_size = PAGE_SIZE * ENTRIES_PER_TABLE.pow(level as u32);
+	while virtaddr < end {
+		let index = get_addr_element_index(virtaddr, level);
+		// The end of the range covered by the entry
+		let next = VirtAddr((virtaddr.0 & !(entry_size - 1)) + entry_size).min(end);
+		let src_ent = &src[index];
+		let val = src_ent.load(Relaxed);
+		if val & FLAG_PRESENT == 0 {
+			virtaddr = next;
+			continue;
+		}
+		let leaf = level == 0 || val & FLAG_PAGE_SIZE != 0;
+		let covered = virtaddr.is_aligned_to(entry_size) && next.0 - virtaddr.0 == entry_size;
+		if leaf && (level == 0 || covered) {
+			// Copy the entry at once
+			let val = if write_protect {
+				src_ent.fetch_and(!FLAG_WRITE, Relaxed) & !FLAG_WRITE
+			} else {
+				val
+			};
+			let val = val & !(FLAG_ACCESSED | FLAG_DIRTY);
+			if level == 0 {
+				dst[index].store(val, Relaxed);
+			} else {
+				store_pse(&dst[index], val, level);
+			}
+		} else {
+			// The entry is partially covered: expand it, so that only the range is affected
+			if leaf {
+				Table::expand(src_ent, level);
+			}
+			let val = src_ent.load(Relaxed);
+			let dst_ent = &dst[index];
+			if dst_ent.load(Relaxed) & FLAG_PRESENT == 0 {
+				let new_table = alloc_table();
+				let addr = VirtAddr::from(new_table).kernel_to_physical().unwrap();
+				dst_ent.store(to_entry(addr, val & FLAGS_MASK), Relaxed);
+			} else {
+				dst_ent.fetch_or(val & FLAGS_MASK, Relaxed);
+			}
+			let src_table = unwrap_entry(val).0.as_ref();
+			let dst_table = unwrap_entry(dst_ent.load(Relaxed)).0.as_ref();
+			fork_impl(
+				src_table,
+				dst_table,
+				level - 1,
+				virtaddr,
+				next,
+				write_protect,
+			);
+		}
+		virtaddr = next;
+	}
+}
+
+/// Inner implementation of [`crate::memory::vmem::VMem::fork_range`] for x86.
+///
+/// # Safety
+///
+/// The range must be in userspace. No other context may modify `dst` concurrently.
+pub unsafe fn fork_range(
+	src: &Table,
+	dst: &Table,
+	virtaddr: VirtAddr,
+	pages: usize,
+	write_protect: bool,
+) {
+	let end = virtaddr + pages * PAGE_SIZE;
+	fork_impl(src, dst, DEPTH - 1, virtaddr, end, write_protect);
+}
+
 /// Inner implementation of [`crate::memory::vmem::VMem::poll_dirty`] for x86.
 ///
 /// The function returns:
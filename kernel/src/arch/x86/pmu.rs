@@ -0,0 +1,104 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! Architectural Performance Monitoring.
+//!
+//! The first general-purpose counter is used to count unhalted core cycles and to fire an
+//! interrupt, through the local APIC, each time a given number of cycles elapsed.
+//!
+//! See the Intel Software Developer Manual, volume 3, chapter *Performance Monitoring*.
+
+use super::{
+	apic,
+	apic::REG_LVT_PERF,
+	cpuid::{base_max_leaf, cpuid},
+	wrmsr,
+};
+
+/// MSR: General-purpose performance counter 0
+const IA32_PMC0: u32 = 0xc1;
+/// MSR: Event select for the general-purpose performance counter 0
+const IA32_PERFEVTSEL0: u32 = 0x186;
+/// MSR: Global enable of the performance counters
+const IA32_PERF_GLOBAL_CTRL: u32 = 0x38f;
+/// MSR: Reset of the overflow status of the performance counters
+const IA32_PERF_GLOBAL_OVF_CTRL: u32 = 0x390;
+
+/// Event select: *UnHalted Core Cycles*
+const EVENT_CORE_CYCLES: u64 = 0x3c;
+/// Event select flag: count in user mode
+const EVTSEL_USR: u64 = 1 << 16;
+/// Event select flag: count in kernel mode
+const EVTSEL_OS: u64 = 1 << 17;
+/// Event select flag: fire an interrupt on overflow
+const EVTSEL_INT: u64 = 1 << 20;
+/// Event select flag: enable the counter
+const EVTSEL_EN: u64 = 1 << 22;
+
+/// Tells whether the CPU supports counting core cycles with overflow interrupts.
+///
+/// This requires version 2 of architectural performance monitoring, for the global control
+/// registers.
+pub fn is_present() -> bool {
+	if !apic::is_present() || base_max_leaf() < 0xa {
+		return false;
+	}
+	let (eax, ebx, ..) = cpuid(0xa, 0);
+	let version = eax & 0xff;
+	let counters = (eax >> 8) & 0xff;
+	let vector_len = (eax >> 24) & 0xff;
+	// A set bit in `ebx` means the event is *not* available
+	version >= 2 && counters >= 1 && vector_len >= 1 && ebx & 1 == 0
+}
+
+/// Reloads the counter so that it overflows after `period` cycles, and unmasks its interrupt.
+///
+/// This must be called from the overflow interrupt handler, since the local APIC masks the
+/// interrupt on delivery.
+///
+/// `period` must be lower than `2^31`, since only the lowest 32 bits of the counter can be written
+/// on all CPUs, the value being sign-extended.
+pub fn rearm(vector: u8, period: u32) {
+	wrmsr(IA32_PMC0, (period as u64).wrapping_neg());
+	wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+	unsafe {
+		apic::write_reg(REG_LVT_PERF, vector as _);
+	}
+}
+
+/// Starts counting core cycles on the current CPU core, firing the interrupt `vector` every
+/// `period` cycles.
+///
+/// The interrupt handler must call [`rearm`].
+pub fn start(vector: u8, period: u32) {
+	wrmsr(IA32_PERFEVTSEL0, 0);
+	rearm(vector, period);
+	wrmsr(
+		IA32_PERFEVTSEL0,
+		EVENT_CORE_CYCLES | EVTSEL_USR | EVTSEL_OS | EVTSEL_INT | EVTSEL_EN,
+	);
+	wrmsr(IA32_PERF_GLOBAL_CTRL, 1);
+}
+
+/// Stops counting on the current CPU core.
+pub fn stop() {
+	wrmsr(IA32_PERF_GLOBAL_CTRL, 0);
+	wrmsr(IA32_PERFEVTSEL0, 0);
+	unsafe {
+		apic::write_reg(REG_LVT_PERF, apic::LVT_MASKED);
+	}
+}
@@ -81,8 +81,10 @@ unsafe fn reg_write(base_addr: *mut u64, off: usize, val: u64) {
 pub struct Hpet {
 	/// The HPET registers' map
 	pub mmio: Mmio,
-	/// The period of a tick in nanoseconds
+	/// The period of a tick in nanoseconds, rounded up
 	pub tick_period: u32,
+	/// The exact period of a tick in femtoseconds
+	pub tick_period_fs: u32,
 }
 
 /// The HPET's information.
@@ -94,11 +96,11 @@ pub(crate) fn init(acpi_info: &'static AcpiHpet) -> AllocResult<()> {
 	let physaddr = PhysAddr(acpi_info.base_address.address as _);
 	let mmio = Mmio::new(physaddr, NonZeroUsize::new(1).unwrap(), false)?;
 	// Read period
-	let tick_period =
-		unsafe { (reg_read(mmio.as_ptr(), REG_CAP_ID) >> 32) as u32 }.div_ceil(1_000_000);
+	let tick_period_fs = unsafe { (reg_read(mmio.as_ptr(), REG_CAP_ID) >> 32) as u32 };
 	let info = Hpet {
 		mmio,
-		tick_period,
+		tick_period: tick_period_fs.div_ceil(1_000_000),
+		tick_period_fs,
 	};
 	unsafe {
 		OnceInit::init(&INFO, info);
@@ -32,15 +32,11 @@
 //!
 //! The kernel will attempt to detect the presence of an HPET.
 //!
+//! If the TSC is invariant, it is calibrated with the HPET as well, and used for timekeeping
+//! between clock updates.
+//!
 //! TODO: if the HPET is net present, fallback on the PIT
 
-// TODO calibrate the TSC if present and use it for timekeeping.
-// If the TSC is unavailable, fallback in this order:
-// - HPET
-// - APIC
-// - RTC
-// - PIT
-
 use crate::{
 	acpi,
 	arch::{x86, x86::timer::hpet::AcpiHpet},
@@ -51,6 +47,7 @@ pub mod apic;
 pub mod hpet;
 pub mod pit;
 pub mod rtc;
+pub mod tsc;
 
 /// Makes the current CPU cores wait for at least `ms` milliseconds.
 #[inline]
@@ -86,6 +83,7 @@ pub(crate) fn init(first: bool) -> AllocResult<()> {
 	if let Some(hpet) = acpi::get_table::<AcpiHpet>() {
 		if first {
 			hpet::init(hpet)?;
+			tsc::calibrate_hpet();
 		}
 		apic::calibrate_hpet()?;
 	} else {
@@ -95,5 +93,6 @@ pub(crate) fn init(first: bool) -> AllocResult<()> {
 		}
 		apic::calibrate_pit();
 	}
+	tsc::init_core();
 	Ok(())
 }
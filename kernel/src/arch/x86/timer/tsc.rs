@@ -0,0 +1,99 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! The Time Stamp Counter (TSC) is a per-core counter incremented at each cycle.
+//!
+//! If the TSC is invariant, it increments at a constant rate and is synchronized across cores,
+//! which makes it suitable for timekeeping. Its frequency is unknown, so it has to be calibrated.
+
+use crate::arch::{
+	core_id,
+	x86::{IA32_TSC_AUX, cpuid, timer::hpet, wrmsr},
+};
+use core::{
+	arch::asm,
+	hint,
+	sync::atomic::{AtomicU32, Ordering::Relaxed},
+};
+
+/// The duration over which the TSC is calibrated, in nanoseconds.
+const CALIBRATION_NS: u64 = 10_000_000;
+
+/// The frequency of the TSC in kHz. If zero, the TSC is not usable for timekeeping.
+static FREQUENCY_KHZ: AtomicU32 = AtomicU32::new(0);
+
+/// Reads the current value of the TSC.
+#[inline]
+pub fn read() -> u64 {
+	let edx: u32;
+	let eax: u32;
+	unsafe {
+		// `lfence` prevents the read from being executed before previous instructions
+		asm!(
+			"lfence",
+			"rdtsc",
+			out("edx") edx,
+			out("eax") eax,
+			options(nomem, nostack)
+		);
+	}
+	((edx as u64) << 32) | eax as u64
+}
+
+/// Returns the frequency of the TSC in kHz.
+///
+/// If the TSC is not usable for timekeeping, the function returns `None`.
+#[inline]
+pub fn frequency_khz() -> Option<u32> {
+	let freq = FREQUENCY_KHZ.load(Relaxed);
+	(freq != 0).then_some(freq)
+}
+
+/// Measures the frequency of the TSC, using the HPET.
+///
+/// If the TSC is not invariant, the function does nothing.
+pub(super) fn calibrate_hpet() {
+	if !cpuid::has_invariant_tsc() {
+		return;
+	}
+	hpet::set_enabled(true);
+	// Use the exact period, since rounding it would skew the frequency
+	let period_fs = hpet::INFO.tick_period_fs as u64;
+	let ticks = (CALIBRATION_NS * 1_000_000).div_ceil(period_fs);
+	let hpet_before = hpet::read_counter();
+	let tsc_before = read();
+	while hpet::read_counter() - hpet_before < ticks {
+		hint::spin_loop();
+	}
+	let tsc_delta = read() - tsc_before;
+	let hpet_delta = hpet::read_counter() - hpet_before;
+	hpet::set_enabled(false);
+	let fs = hpet_delta as u128 * period_fs as u128;
+	let freq = tsc_delta as u128 * 1_000_000_000_000 / fs;
+	FREQUENCY_KHZ.store(freq.try_into().unwrap_or(0), Relaxed);
+}
+
+/// Initializes the TSC on the current core.
+///
+/// If supported, `TSC_AUX` is set to the ID of the core, so that userspace can retrieve it with
+/// `rdtscp`.
+pub(super) fn init_core() {
+	if cpuid::has_rdtscp() {
+		wrmsr(IA32_TSC_AUX, core_id() as _);
+	}
+}
@@ -0,0 +1,412 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! In-kernel microbenchmarks.
+//!
+//! When `-bench` is passed on the command line, the benchmarks are run in a kernel thread once the
+//! system has booted. Each benchmark times iterations of an operation with the TSC, then prints a
+//! line on the kernel log, which is mirrored on the serial port:
+//!
+//! ```text
+//! bench {"name":"malloc/64","iters":4096,"min":52,"p50":61,"p90":70,"p99":132,"max":2210}
+//! ```
+//!
+//! Values are in TSC cycles, with the cost of reading the TSC subtracted. A benchmark that cannot
+//! run prints an `error` field instead. The end of the suite is marked by a `bench done` line.
+//!
+//! Ping-pong benchmarks measure a round trip between two kernel threads, which includes two
+//! wake-ups and two context switches.
+
+#[cfg(config_debug_qemu)]
+use crate::debug::qemu;
+use crate::{
+	arch::x86::{
+		paging::{PAGE_FAULT_USER, PAGE_FAULT_WRITE},
+		timer::tsc,
+	},
+	device::{
+		BLK_DEVICES, BlkDev,
+		request::{BlkRequest, IoCompletion, IoDir},
+	},
+	file::{
+		FileType, Stat,
+		pipe::PipeBuffer,
+		vfs,
+		vfs::{ResolutionSettings, Resolved},
+	},
+	memory::{
+		VirtAddr, buddy,
+		buddy::{FrameOrder, ZONE_KERNEL},
+		cache::RcPage,
+		malloc::{__alloc, __dealloc},
+		user::UserSlice,
+	},
+	println,
+	process::{
+		Process,
+		mem_space::{MAP_ANONYMOUS, MAP_PRIVATE, MemSpace, PROT_READ, PROT_WRITE},
+		scheduler,
+		scheduler::{cpu::cpus, schedule},
+	},
+	sync::wait_queue::WaitQueue,
+};
+use core::{
+	alloc::Layout,
+	ffi::{c_char, c_int, c_void},
+	fmt,
+	hint::black_box,
+	num::NonZeroUsize,
+	slice,
+	sync::atomic::{
+		AtomicU64, AtomicUsize,
+		Ordering::{Acquire, Relaxed, Release},
+	},
+};
+use utils::{
+	collections::{path::Path, vec::Vec},
+	errno::EResult,
+	limits::PAGE_SIZE,
+	ptr::arc::Arc,
+	vec,
+};
+
+unsafe extern "C" {
+	fn memcmp(s1: *const c_void, s2: *const c_void, n: usize) -> c_int;
+	fn strlen(s: *const c_char) -> usize;
+}
+
+/// The default number of iterations of a benchmark.
+const ITERS: usize = 4096;
+
+/// The number of TSC cycles taken by an empty measurement.
+static OVERHEAD: AtomicU64 = AtomicU64::new(0);
+
+/// Runs `f` for `iters` iterations, passing the index of the iteration, and returns the number of
+/// TSC cycles taken by each.
+fn measure<F: FnMut(usize) -> EResult<()>>(iters: usize, mut f: F) -> EResult<Vec<u64>> {
+	let overhead = OVERHEAD.load(Relaxed);
+	let mut samples = Vec::with_capacity(iters)?;
+	for i in 0..iters {
+		let start = tsc::read();
+		f(i)?;
+		let end = tsc::read();
+		samples.push(end.wrapping_sub(start).saturating_sub(overhead))?;
+	}
+	Ok(samples)
+}
+
+/// Prints the results of the benchmark `name`.
+fn report(name: fmt::Arguments, res: EResult<Vec<u64>>) {
+	let mut samples = match res {
+		Ok(samples) if !samples.is_empty() => samples,
+		Ok(_) => return,
+		Err(e) => {
+			println!("bench {{\"name\":\"{name}\",\"error\":\"{e}\"}}");
+			return;
+		}
+	};
+	samples.sort_unstable();
+	let percentile = |p: usize| samples[(samples.len() - 1) * p / 100];
+	println!(
+		"bench {{\"name\":\"{name}\",\"iters\":{iters},\"min\":{min},\"p50\":{p50},\"p90\":{p90},\"p99\":{p99},\"max\":{max}}}",
+		iters = samples.len(),
+		min = samples[0],
+		p50 = percentile(50),
+		p90 = percentile(90),
+		p99 = percentile(99),
+		max = samples[samples.len() - 1],
+	);
+}
+
+/// Measures the cost of reading the TSC, to be subtracted from other measurements.
+fn calibrate() {
+	let overhead = measure(ITERS, |_| Ok(()))
+		.ok()
+		.and_then(|samples| samples.iter().copied().min())
+		.unwrap_or(0);
+	OVERHEAD.store(overhead, Relaxed);
+}
+
+/// Allocation and freeing of an object, for each size class of the allocator.
+fn bench_malloc() {
+	for size in [16, 32, 64, 128, 256, 512, 1024, 4096, 16384] {
+		let layout = Layout::from_size_align(size, 8).unwrap();
+		let res = measure(ITERS, |_| unsafe {
+			let ptr = __alloc(layout)?;
+			__dealloc(black_box(ptr).cast(), layout);
+			Ok(())
+		});
+		report(format_args!("malloc/{size}"), res);
+	}
+}
+
+/// Allocation and freeing of frames, for each order.
+fn bench_buddy() {
+	for order in 0..=4 as FrameOrder {
+		let res = measure(ITERS, |_| unsafe {
+			let addr = buddy::alloc(order, ZONE_KERNEL)?;
+			buddy::free(black_box(addr), order);
+			Ok(())
+		});
+		report(format_args!("buddy/{order}"), res);
+	}
+}
+
+/// The C library's functions.
+fn bench_libc() -> EResult<()> {
+	for size in [64, 4096] {
+		let mut a = vec![0x2au8; size]?;
+		let b = Vec::try_from(a.as_slice())?;
+		let res = measure(ITERS, |_| {
+			black_box(unsafe { memcmp(a.as_ptr() as _, b.as_ptr() as _, size) });
+			Ok(())
+		});
+		report(format_args!("memcmp/{size}"), res);
+		a[size - 1] = 0;
+		let res = measure(ITERS, |_| {
+			black_box(unsafe { strlen(a.as_ptr() as _) });
+			Ok(())
+		});
+		report(format_args!("strlen/{size}"), res);
+	}
+	Ok(())
+}
+
+/// Handling of page faults, on anonymous memory then on copy-on-write memory.
+fn bench_faults() -> EResult<()> {
+	const PAGES: usize = 1024;
+	const CODE: u32 = PAGE_FAULT_WRITE | PAGE_FAULT_USER;
+	let mem_space = MemSpace::new(vfs::ROOT.clone(), VirtAddr::default(), false)?;
+	let addr = mem_space.map(
+		VirtAddr::default(),
+		NonZeroUsize::new(PAGES).unwrap(),
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS,
+		None,
+		0,
+	)?;
+	// Faults map pages through their user address, so the memory space has to be bound
+	MemSpace::switch(&mem_space, |mem_space| -> EResult<()> {
+		let fault = |i: usize| {
+			mem_space.handle_page_fault(addr + i * PAGE_SIZE, CODE)?;
+			Ok(())
+		};
+		report(format_args!("fault/anon"), measure(PAGES, fault));
+		// Keep the child alive so that pages remain shared with it
+		let _child = mem_space.fork()?;
+		report(format_args!("fault/cow"), measure(PAGES, fault));
+		Ok(())
+	})
+}
+
+/// Path resolution, for increasing numbers of components.
+fn bench_resolve_path() -> EResult<()> {
+	const DEPTH: usize = 8;
+	let settings = ResolutionSettings {
+		root: vfs::ROOT.clone(),
+		cwd: None,
+
+		create: false,
+		follow_link: true,
+	};
+	let (mut parent, mut path) = match vfs::resolve_path(Path::new(b"/tmp")?, &settings) {
+		Ok(Resolved::Found(tmp)) => (tmp, Vec::try_from(b"/tmp".as_slice())?),
+		_ => (vfs::ROOT.clone(), Vec::new()),
+	};
+	let stat = Stat {
+		mode: FileType::Directory.to_mode() | 0o755,
+		..Default::default()
+	};
+	// Create a chain of directories, removed afterwards
+	let mut dirs: Vec<Arc<vfs::Entry>> = Vec::new();
+	let res = (|| {
+		for depth in 0..DEPTH {
+			let name: &[u8] = if depth == 0 { b"bench" } else { b"d" };
+			parent = vfs::create_file(parent.clone(), name, stat.clone())?;
+			dirs.push(parent.clone())?;
+			path.push(b'/')?;
+			path.extend_from_slice(name)?;
+			let p = Path::new(&path)?;
+			let res = measure(ITERS, |_| {
+				black_box(vfs::resolve_path(p, &settings)?);
+				Ok(())
+			});
+			report(format_args!("resolve_path/{}", p.components().count()), res);
+		}
+		EResult::Ok(())
+	})();
+	while let Some(dir) = dirs.pop() {
+		vfs::unlink(dir)?;
+	}
+	res
+}
+
+/// Writing then reading a page through a pipe.
+fn bench_pipe() -> EResult<()> {
+	let pipe = PipeBuffer::direct()?;
+	let mut buf = vec![0u8; PAGE_SIZE]?;
+	let res = measure(ITERS, |_| {
+		pipe.write_user(UserSlice::from_slice_mut(&mut buf), true)?;
+		pipe.read_user(UserSlice::from_slice_mut(&mut buf), true)?;
+		Ok(())
+	});
+	report(format_args!("pipe/{PAGE_SIZE}"), res);
+	Ok(())
+}
+
+/// Index of the benchmark thread in [`PingPong`].
+const MAIN: usize = 0;
+/// Index of the peer thread in [`PingPong`].
+const PEER: usize = 1;
+
+/// State shared by the two threads of a ping-pong.
+struct PingPong {
+	/// The index of the thread whose turn it is
+	turn: AtomicUsize,
+	/// The queue of each thread
+	queues: [WaitQueue; 2],
+}
+
+/// The state of ping-pong benchmarks.
+static PING_PONG: PingPong = PingPong {
+	turn: AtomicUsize::new(MAIN),
+	queues: [WaitQueue::new(), WaitQueue::new()],
+};
+
+/// Waits until it is the turn of the thread `this`.
+fn wait_turn(this: usize) -> EResult<()> {
+	PING_PONG.queues[this].wait_until(|| (PING_PONG.turn.load(Acquire) == this).then_some(()))
+}
+
+/// Gives the turn to the thread `other`.
+fn give_turn(other: usize) {
+	PING_PONG.turn.store(other, Release);
+	PING_PONG.queues[other].wake_next();
+}
+
+/// The peer thread of ping-pong benchmarks, answering each ping from the benchmark thread.
+fn peer_task() -> ! {
+	loop {
+		let _ = wait_turn(PEER);
+		give_turn(MAIN);
+	}
+}
+
+/// Restricts `proc` to run on the CPU core `cpu`.
+fn pin(proc: &Process, cpu: usize) {
+	for i in 0..cpus().len() {
+		if i == cpu {
+			proc.affinity.set_bit(i);
+		} else {
+			proc.affinity.clear_bit(i);
+		}
+	}
+	scheduler::affinity_changed(proc);
+}
+
+/// Round trips between two threads, on the same core then on different cores.
+fn bench_ping_pong() -> EResult<()> {
+	let peer = Process::new_kthread(None, peer_task, true)?;
+	let run = |name: &str, main_cpu: usize, peer_cpu: usize| {
+		pin(&Process::current(), main_cpu);
+		pin(&peer, peer_cpu);
+		// Let the scheduler migrate the current thread
+		schedule();
+		let res = measure(ITERS, |_| {
+			give_turn(PEER);
+			wait_turn(MAIN)
+		});
+		report(format_args!("{name}"), res);
+	};
+	run("sched/pingpong", 0, 0);
+	if cpus().len() > 1 {
+		run("wake/pingpong", 0, 1);
+	}
+	Ok(())
+}
+
+/// Read latency of NVMe drives, for small and large requests.
+fn bench_blk() -> EResult<()> {
+	let devs: Vec<Arc<BlkDev>> = {
+		let mut devs = Vec::new();
+		for (_, dev) in BLK_DEVICES.lock().iter() {
+			if !dev.is_partition && dev.path.file_name().is_some_and(|n| n.starts_with(b"nvme")) {
+				devs.push(dev.clone())?;
+			}
+		}
+		devs
+	};
+	for dev in devs {
+		let name = dev.path.file_name().unwrap_or_default();
+		for pages in [1, 32] {
+			let mut req = BlkRequest {
+				dir: IoDir::Read,
+				off: 0,
+				pages: Vec::with_capacity(pages)?,
+			};
+			for _ in 0..pages {
+				req.pages.push(RcPage::new(ZONE_KERNEL, None, 0)?)?;
+			}
+			let res = measure(256, |_| {
+				let completion = IoCompletion::new()?;
+				completion.start();
+				let res = dev.ops.submit(&dev, slice::from_ref(&req), &completion);
+				completion.end(res.is_ok());
+				res?;
+				completion.wait()
+			});
+			report(
+				format_args!(
+					"blk/{}/{}k",
+					utils::DisplayableStr(name),
+					pages * PAGE_SIZE / 1024
+				),
+				res,
+			);
+		}
+	}
+	Ok(())
+}
+
+/// Runs the benchmark suite, then exits the emulator if possible.
+pub(crate) fn bench_task() -> ! {
+	println!("Running benchmarks");
+	calibrate();
+	bench_malloc();
+	bench_buddy();
+	let suites: [(&str, fn() -> EResult<()>); 6] = [
+		("libc", bench_libc),
+		("fault", bench_faults),
+		("resolve_path", bench_resolve_path),
+		("pipe", bench_pipe),
+		("pingpong", bench_ping_pong),
+		("blk", bench_blk),
+	];
+	for (name, f) in suites {
+		if let Err(e) = f() {
+			println!("bench {{\"name\":\"{name}\",\"error\":\"{e}\"}}");
+		}
+	}
+	println!("bench done");
+	#[cfg(config_debug_qemu)]
+	qemu::exit(qemu::SUCCESS);
+	// Nothing left to do
+	let queue = WaitQueue::new();
+	loop {
+		let _ = queue.wait_until(|| None::<()>);
+	}
+}
@@ -131,6 +131,8 @@ pub struct ArgsParser<'s> {
 	init: Option<&'s [u8]>,
 	/// Whether the kernel boots silently.
 	silent: bool,
+	/// Whether the kernel runs its benchmark suite after booting.
+	bench: bool,
 }
 
 impl<'s> ArgsParser<'s> {
@@ -140,6 +142,7 @@ impl<'s> ArgsParser<'s> {
 			root: None,
 			init: None,
 			silent: false,
+			bench: false,
 		};
 
 		let mut iter = TokenIterator {
@@ -192,6 +195,8 @@ impl<'s> ArgsParser<'s> {
 
 				b"-silent" => s.silent = true,
 
+				b"-bench" => s.bench = true,
+
 				_ => {
 					return Err(ParseError {
 						cmdline,
@@ -219,6 +224,11 @@ impl<'s> ArgsParser<'s> {
 	pub fn is_silent(&self) -> bool {
 		self.silent
 	}
+
+	/// If `true`, the kernel runs its benchmark suite after booting. See [`crate::bench`].
+	pub fn is_bench(&self) -> bool {
+		self.bench
+	}
 }
 
 #[cfg(test)]
@@ -264,4 +274,11 @@ mod test {
 	fn cmdline7() {
 		assert!(ArgsParser::parse(b"-root 1 0 -init bleh -silent").is_ok());
 	}
+
+	#[test_case]
+	fn cmdline8() {
+		let args = ArgsParser::parse(b"-root 1 0 -bench").unwrap();
+		assert!(args.is_bench());
+		assert!(!ArgsParser::parse(b"-root 1 0").unwrap().is_bench());
+	}
 }
@@ -52,6 +52,10 @@ pub enum Bar {
 	},
 }
 
+// Registers are accessed with volatile operations, from any CPU core
+unsafe impl Send for Bar {}
+unsafe impl Sync for Bar {}
+
 impl Bar {
 	/// Returns the amount of memory.
 	pub fn get_size(&self) -> usize {
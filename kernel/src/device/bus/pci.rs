@@ -45,7 +45,7 @@ use core::{
 	cmp::min,
 	hint::unlikely,
 	iter,
-	mem::size_of,
+	mem::{offset_of, size_of},
 	num::{NonZero, NonZeroU16, NonZeroUsize},
 };
 use utils::{
@@ -197,46 +197,88 @@ pub struct MsiX<'d> {
 }
 
 impl MsiX<'_> {
-	/// Sets the `n`'s entry of the message table.
+	/// Returns the number of entries in the message table.
+	#[inline]
+	pub fn entries_count(&self) -> u16 {
+		self.entries.get()
+	}
+
+	/// Returns a handle to the `n`th entry of the message table.
 	///
-	/// Arguments:
-	/// - `core_id` is the ID of the core receiving the interrupt
-	/// - `edge_trigger` tells whether the interrupt is edge-triggered
-	/// - `deassert` tells whether the interrupt is active-low
-	/// - `vector` is the vector to send the interrupt on
-	pub fn set(
-		&self,
-		n: u16,
-		core_id: u8,
-		edge_trigger: bool,
-		deassert: bool,
-		vector: u32,
-	) -> EResult<()> {
+	/// The handle remains usable after the [`MsiX`] is dropped, which allows to move the
+	/// interrupt to another core later.
+	pub fn entry(&self, n: u16) -> EResult<MsiXEntry> {
 		if unlikely(n >= self.entries.get()) {
 			return Err(errno!(EINVAL));
 		}
 		let bir = self.message_table & 0b111;
 		let off = (self.message_table & !0b111) as usize + n as usize * size_of::<MsiXMessage>();
-		let bir = self
+		let bar = self
 			.dev
 			.get_bars()
 			.get(bir as usize)
 			.and_then(Option::as_ref)
 			.ok_or_else(|| errno!(EINVAL))?;
+		Ok(MsiXEntry {
+			bar: bar.clone(),
+			off,
+		})
+	}
+
+	/// Sets the `n`'s entry of the message table.
+	///
+	/// Arguments are the same as for [`MsiXEntry::set`].
+	pub fn set(
+		&self,
+		n: u16,
+		core_id: u8,
+		edge_trigger: bool,
+		deassert: bool,
+		vector: u32,
+	) -> EResult<()> {
+		self.entry(n)?.set(core_id, edge_trigger, deassert, vector);
+		Ok(())
+	}
+}
+
+/// An entry of the MSI-X message table of a device.
+#[derive(Clone, Debug)]
+pub struct MsiXEntry {
+	/// The BAR containing the message table
+	bar: Bar,
+	/// The offset of the entry in the BAR
+	off: usize,
+}
+
+impl MsiXEntry {
+	/// Sets the entry.
+	///
+	/// Arguments:
+	/// - `core_id` is the ID of the core receiving the interrupt
+	/// - `edge_trigger` tells whether the interrupt is edge-triggered
+	/// - `deassert` tells whether the interrupt is active-low
+	/// - `vector` is the vector to send the interrupt on
+	///
+	/// The entry is masked while being updated, so that the device does not send a message made
+	/// of both the old and new values. Messages arising in the meantime are sent once the entry is
+	/// unmasked.
+	///
+	/// The table is accessed with DWORD stores only, as required by the PCIe specification. Volatile
+	/// stores to uncacheable memory are performed in order, so the entry is unmasked last.
+	pub fn set(&self, core_id: u8, edge_trigger: bool, deassert: bool, vector: u32) {
 		let addr = x86::apic::msi_message_address(core_id);
 		let data = x86::apic::msi_message_data(edge_trigger, deassert, vector);
+		let field = |off: usize| self.off + off;
 		unsafe {
-			bir.write(
-				off,
-				MsiXMessage {
-					addr_low: addr as u32,
-					addr_high: (addr >> 32) as u32,
-					data,
-					ctrl: 0,
-				},
-			);
+			self.bar.write::<u32>(field(offset_of!(MsiXMessage, ctrl)), 1);
+			self.bar
+				.write::<u32>(field(offset_of!(MsiXMessage, addr_low)), addr as u32);
+			self.bar
+				.write::<u32>(field(offset_of!(MsiXMessage, addr_high)), (addr >> 32) as u32);
+			self.bar
+				.write::<u32>(field(offset_of!(MsiXMessage, data)), data);
+			self.bar.write::<u32>(field(offset_of!(MsiXMessage, ctrl)), 0);
 		}
-		Ok(())
 	}
 }
 
@@ -38,6 +38,7 @@ pub mod fb;
 pub mod id;
 pub mod keyboard;
 pub mod manager;
+pub mod request;
 pub mod serial;
 pub mod storage;
 pub mod tty;
@@ -46,6 +47,7 @@ use crate::{
 	device::{
 		fb::Framebuffer,
 		manager::DeviceManager,
+		request::{BlkRequest, IoCompletion, IoDir},
 		storage::{PartitionOps, partition::Partition},
 	},
 	file,
@@ -57,6 +59,7 @@ use crate::{
 	},
 	memory::{
 		buddy::ZONE_KERNEL,
+		cache,
 		cache::{MappedNode, RcPage},
 		user::UserSlice,
 	},
@@ -179,11 +182,88 @@ pub trait BlockDeviceOps: fmt::Debug {
 	/// `off` is the offset of the page, in pages
 	fn read_page(&self, dev: &Arc<BlkDev>, off: u64) -> EResult<RcPage>;
 
+	/// Starts reading the `count` pages at offset `off` on the device into its page cache,
+	/// without waiting for the reads to complete.
+	///
+	/// The function returns the pages, in order. Pages that are not yet read are marked as such
+	/// (see [`RcPage::set_read_pending`]).
+	///
+	/// The default implementation looks the pages up in `dev`'s cache and submits the missing
+	/// ones with [`Self::submit`].
+	fn start_read(&self, dev: &Arc<BlkDev>, off: u64, count: u64) -> EResult<Vec<RcPage>> {
+		let end = off.checked_add(count).ok_or_else(|| errno!(EOVERFLOW))?;
+		let completion = IoCompletion::new()?;
+		let mut pages = Vec::with_capacity(count as _)?;
+		let mut reqs: Vec<BlkRequest> = Vec::new();
+		// Keep the completion pending until all requests are submitted, since devices may
+		// complete them synchronously
+		completion.start();
+		let res = (|| {
+			for off in off..end {
+				if let Some(page) = dev.mapped.get(off) {
+					pages.push(page)?;
+					continue;
+				}
+				let page = BlkDev::new_page(dev, off)?;
+				page.set_read_pending(completion.clone());
+				if !dev.mapped.insert(off, &page)? {
+					// Inserted concurrently
+					let page = dev.mapped.get(off).unwrap_or(page);
+					pages.push(page)?;
+					continue;
+				}
+				match reqs.last_mut() {
+					Some(last) if last.end() == Some(off) => last.pages.push(page.clone())?,
+					_ => reqs.push(BlkRequest::single(IoDir::Read, off, page.clone())?)?,
+				}
+				pages.push(page)?;
+			}
+			let count = reqs.iter().map(|req| req.pages.len()).sum();
+			request::account_io(IoDir::Read, count);
+			self.submit(dev, &reqs, &completion)
+		})();
+		completion.end(res.is_ok());
+		res?;
+		Ok(pages)
+	}
+
+	/// Returns the page at offset `off` on the device, filled with zeros and marked dirty, without
+	/// reading it from the device.
+	///
+	/// This is meant to initialize newly allocated blocks.
+	///
+	/// The default implementation looks the page up in `dev`'s cache, inserting it if missing. If
+	/// a read of the page is pending, it is waited for so that it does not overwrite the zeros.
+	fn zero_page(&self, dev: &Arc<BlkDev>, off: u64) -> EResult<RcPage> {
+		let page = dev
+			.mapped
+			.get_or_insert_page(off, || Ok(BlkDev::new_page(dev, off)?))?;
+		unsafe {
+			page.slice_mut::<u8>().fill(0);
+		}
+		page.mark_dirty();
+		Ok(page)
+	}
+
 	/// Writes a page of data back to the device.
 	///
 	/// `off` is the offset of the page, in pages
 	fn writeback(&self, dev: &BlkDev, off: u64, page: &RcPage) -> EResult<()>;
 
+	/// Submits the I/O requests `reqs` to the device, without waiting for them to complete.
+	///
+	/// Each submitted request is accounted for in `completion`, which is notified when the
+	/// request is over. If the function returns an error, the requests remaining after the
+	/// failing one are not submitted.
+	///
+	/// Devices that cannot perform I/O asynchronously complete requests before returning.
+	fn submit(
+		&self,
+		dev: &BlkDev,
+		reqs: &[BlkRequest],
+		completion: &Arc<IoCompletion>,
+	) -> EResult<()>;
+
 	/// Polls the device with the given mask.
 	fn poll(&self, dev: &BlkDev, mask: u32) -> EResult<u32> {
 		let _ = (dev, mask);
@@ -436,6 +516,7 @@ impl FileOps for BlkDevFileOps {
 			buf_off += len;
 			off += len as u64;
 		}
+		cache::balance_dirty_pages();
 		Ok(buf_off)
 	}
 
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! Block I/O requests.
+//!
+//! Requests are submitted to a block device with [`super::BlockDeviceOps::submit`], which does
+//! not wait for them to complete. This allows to keep several requests in flight at once.
+//!
+//! Completion of a group of requests is tracked by an [`IoCompletion`], which the submitter
+//! waits on, or on which it registers a callback.
+
+use crate::{
+	memory::cache::RcPage,
+	process,
+	process::{
+		Process, State,
+		rusage::RusageCounters,
+		scheduler::{
+			cpu::{counter, counter::Counter},
+			schedule,
+		},
+	},
+	sync::spin::IntSpin,
+	trace,
+	trace::Kind,
+};
+use core::{
+	fmt,
+	fmt::Formatter,
+	mem, ptr,
+	sync::atomic::{
+		AtomicBool, AtomicUsize,
+		Ordering::{AcqRel, Acquire, Relaxed, Release},
+	},
+};
+use utils::{
+	collections::vec::Vec,
+	errno,
+	errno::{AllocResult, EResult},
+	limits::PAGE_SIZE,
+	list, list_type,
+	ptr::arc::Arc,
+	vec,
+};
+
+/// The direction of a block I/O request.
+#[derive(Clone, Copy, Debug, Eq, PartialEq)]
+pub enum IoDir {
+	/// Read from the device to memory
+	Read,
+	/// Write from memory to the device
+	Write,
+}
+
+/// Accounts for the transfer of `pages` pages in the direction `dir`, on behalf of the current
+/// process.
+pub fn account_io(dir: IoDir, pages: usize) {
+	let rusage = &Process::current().rusage;
+	let (counter, rusage) = match dir {
+		IoDir::Read => (Counter::PagesIn, &rusage.inblock),
+		IoDir::Write => (Counter::PagesOut, &rusage.oublock),
+	};
+	counter::add(counter, pages as _);
+	// `rusage` counts in units of 512 bytes
+	RusageCounters::add(rusage, (pages * (PAGE_SIZE / 512)) as _);
+}
+
+/// A request to transfer a contiguous range of a block device from or to memory.
+///
+/// The range does not need to be contiguous in memory: it is made of several pages, which the
+/// device gathers or scatters.
+#[derive(Debug)]
+pub struct BlkRequest {
+	/// The direction of the transfer
+	pub dir: IoDir,
+	/// The offset of the first page on the device, in pages
+	pub off: u64,
+	/// The pages to transfer from or to, in order
+	pub pages: Vec<RcPage>,
+}
+
+impl BlkRequest {
+	/// Creates a request for the single page `page`, at offset `off` on the device.
+	pub fn single(dir: IoDir, off: u64, page: RcPage) -> AllocResult<Self> {
+		Ok(Self {
+			dir,
+			off,
+			pages: vec![page]?,
+		})
+	}
+
+	/// Returns the offset of the end of the range on the device, in pages.
+	///
+	/// If the offset overflows, the function returns `None`.
+	#[inline]
+	pub fn end(&self) -> Option<u64> {
+		self.off.checked_add(self.pages.len() as u64)
+	}
+}
+
+/// Tracks the completion of a group of I/O requests.
+///
+/// Drivers call [`Self::start`] for each request before handing it to the device, then
+/// [`Self::end`] once the request is over, possibly from an interrupt handler.
+///
+/// Several processes may wait for the same completion.
+pub struct IoCompletion {
+	/// The number of requests that are still in flight
+	pending: AtomicUsize,
+	/// Tells whether at least one request failed
+	failed: AtomicBool,
+	/// The processes waiting for completion
+	waiters: IntSpin<list_type!(Process, io_wait)>,
+	/// The callbacks to call on completion
+	callbacks: IntSpin<Vec<Arc<dyn Fn() + Send + Sync>>>,
+}
+
+impl IoCompletion {
+	/// Creates a new instance, with no request in flight.
+	pub fn new() -> AllocResult<Arc<Self>> {
+		Arc::new(Self {
+			pending: AtomicUsize::new(0),
+			failed: AtomicBool::new(false),
+			waiters: IntSpin::new(list!(Process, io_wait)),
+			callbacks: IntSpin::new(Vec::new()),
+		})
+	}
+
+	/// Accounts for a new request in flight.
+	#[inline]
+	pub fn start(&self) {
+		let pending = self.pending.fetch_add(1, Relaxed) + 1;
+		trace::event(
+			Kind::BlkSubmit,
+			ptr::from_ref(self) as usize as _,
+			pending as _,
+		);
+	}
+
+	/// Marks a request as over, with the given success status.
+	///
+	/// If this was the last request in flight, the waiting processes are woken up and callbacks
+	/// are called.
+	pub fn end(&self, success: bool) {
+		trace::event(
+			Kind::BlkComplete,
+			ptr::from_ref(self) as usize as _,
+			success as _,
+		);
+		if !success {
+			self.failed.store(true, Release);
+		}
+		if self.pending.fetch_sub(1, AcqRel) == 1 {
+			let mut waiters = self.waiters.lock();
+			while let Some(proc) = waiters.remove_front() {
+				Process::wake_from(&proc, State::Sleeping as _);
+			}
+			drop(waiters);
+			let callbacks = mem::take(&mut *self.callbacks.lock());
+			for callback in callbacks {
+				callback();
+			}
+		}
+	}
+
+	/// Registers `callback` to be called once all requests are over, possibly from an interrupt
+	/// handler.
+	///
+	/// If no request is in flight anymore, the callback is not registered and the function
+	/// returns `false`.
+	pub fn on_done(&self, callback: Arc<dyn Fn() + Send + Sync>) -> AllocResult<bool> {
+		let mut callbacks = self.callbacks.lock();
+		// `end` takes the callbacks after the last request is over, so checking under the lock
+		// ensures the callback is either called or not registered
+		if self.is_done() {
+			return Ok(false);
+		}
+		callbacks.push(callback)?;
+		Ok(true)
+	}
+
+	/// Tells whether there is no request in flight anymore.
+	#[inline]
+	pub fn is_done(&self) -> bool {
+		self.pending.load(Acquire) == 0
+	}
+
+	/// Tells whether at least one request failed.
+	#[inline]
+	pub fn has_failed(&self) -> bool {
+		self.failed.load(Acquire)
+	}
+
+	/// Waits until all requests are over.
+	///
+	/// The wait cannot be interrupted: requests in flight keep references to their pages, which
+	/// the callers may only release or reuse once the device is done with them.
+	///
+	/// If at least one request failed, the function returns [`errno::EIO`].
+	pub fn wait(&self) -> EResult<()> {
+		loop {
+			{
+				let mut waiters = self.waiters.lock();
+				if self.is_done() {
+					break;
+				}
+				// Put to sleep before releasing the spinlock to make sure the last request does
+				// not try to wake us up before we sleep
+				waiters.insert_back(Process::current());
+				process::set_state(State::Sleeping);
+			}
+			schedule();
+			// Make sure the process is dequeued
+			unsafe {
+				self.waiters.lock().remove(&Process::current());
+			}
+		}
+		if self.has_failed() {
+			return Err(errno!(EIO));
+		}
+		Ok(())
+	}
+}
+
+impl fmt::Debug for IoCompletion {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.debug_struct("IoCompletion")
+			.field("pending", &self.pending)
+			.field("failed", &self.failed)
+			.finish()
+	}
+}
@@ -29,6 +29,7 @@ use crate::{
 		bus::pci,
 		id::MajorBlock,
 		manager::{DeviceManager, PhysicalDevice},
+		request::{BlkRequest, IoCompletion},
 		storage::partition::read_partitions,
 	},
 	file::Mode,
@@ -37,7 +38,7 @@ use crate::{
 };
 use core::{
 	ffi::{c_uchar, c_ulong, c_ushort, c_void},
-	hint::likely,
+	hint::{likely, unlikely},
 };
 use partition::Partition;
 use utils::{
@@ -91,6 +92,29 @@ impl BlockDeviceOps for PartitionOps {
 		}
 	}
 
+	fn start_read(&self, _dev: &Arc<BlkDev>, off: u64, count: u64) -> EResult<Vec<RcPage>> {
+		if likely(
+			off.checked_add(count)
+				.is_some_and(|end| end <= self.partition.size),
+		) {
+			self.dev
+				.ops
+				.start_read(&self.dev, self.partition.offset + off, count)
+		} else {
+			Err(errno!(EINVAL))
+		}
+	}
+
+	fn zero_page(&self, _dev: &Arc<BlkDev>, off: u64) -> EResult<RcPage> {
+		if likely(off < self.partition.size) {
+			self.dev
+				.ops
+				.zero_page(&self.dev, self.partition.offset + off)
+		} else {
+			Err(errno!(EINVAL))
+		}
+	}
+
 	fn writeback(&self, _dev: &BlkDev, off: u64, blk: &RcPage) -> EResult<()> {
 		if likely(off < self.partition.size) {
 			self.dev
@@ -101,6 +125,27 @@ impl BlockDeviceOps for PartitionOps {
 		}
 	}
 
+	fn submit(
+		&self,
+		_dev: &BlkDev,
+		reqs: &[BlkRequest],
+		completion: &Arc<IoCompletion>,
+	) -> EResult<()> {
+		let in_bounds = |req: &BlkRequest| req.end().is_some_and(|end| end <= self.partition.size);
+		if unlikely(!reqs.iter().all(in_bounds)) {
+			return Err(errno!(EINVAL));
+		}
+		let mut translated = Vec::with_capacity(reqs.len())?;
+		for req in reqs {
+			translated.push(BlkRequest {
+				dir: req.dir,
+				off: self.partition.offset + req.off,
+				pages: Vec::try_from(req.pages.as_slice())?,
+			})?;
+		}
+		self.dev.ops.submit(&self.dev, &translated, completion)
+	}
+
 	fn ioctl(&self, dev: &BlkDev, request: ioctl::Request, argp: *const c_void) -> EResult<u32> {
 		match request.get_old_format() {
 			ioctl::HDIO_GETGEO => {
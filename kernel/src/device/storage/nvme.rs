@@ -29,13 +29,20 @@ use crate::{
 		id::{BLOCK_EXTENDED_MAJOR, BLOCK_EXTENDED_MAJOR_HANDLE},
 		manager::PhysicalDevice,
 		register_blk,
+		request::{BlkRequest, IoCompletion, IoDir},
 		storage::{STORAGE_MODE, partition::read_partitions},
 	},
 	int,
-	int::CallbackHandle,
+	int::Irq,
 	memory::{VirtAddr, buddy, cache::RcPage},
 	println, process,
-	process::{Process, State, scheduler::schedule},
+	process::{
+		Process, State,
+		scheduler::{
+			cpu::{iter_online, per_cpu},
+			schedule,
+		},
+	},
 	sync::{rwlock::RwLock, semaphore::Semaphore, spin::Spin},
 };
 use core::{
@@ -48,13 +55,13 @@ use core::{
 	mem::MaybeUninit,
 	num::NonZeroU64,
 	ptr::NonNull,
-	sync::atomic::{AtomicU32, Ordering::Relaxed},
+	sync::atomic::{AtomicU32, AtomicUsize, Ordering::Relaxed},
 };
 use utils::{
 	boxed::Box,
 	collections::{path::PathBuf, vec::Vec},
 	errno,
-	errno::{AllocResult, EResult},
+	errno::{AllocResult, CollectResult, EResult},
 	format,
 	limits::PAGE_SIZE,
 	math,
@@ -89,6 +96,11 @@ const ADMIN_CMD_CREATE_IO_SQ: u32 = 0x1;
 const ADMIN_CMD_CREATE_IO_CQ: u32 = 0x5;
 /// Admin command opcode: Identify
 const ADMIN_CMD_IDENTIFY: u32 = 0x6;
+/// Admin command opcode: Set Features
+const ADMIN_CMD_SET_FEATURES: u32 = 0x9;
+
+/// Feature identifier: Number of Queues
+const FEATURE_NUMBER_OF_QUEUES: u32 = 0x7;
 
 /// Command opcode: Write
 const CMD_WRITE: u32 = 0x1;
@@ -104,6 +116,8 @@ const CNS_NAMESPACE_LIST: u32 = 2;
 
 const SQ_LEN: usize = (PAGE_SIZE << 2) / size_of::<SubmissionQueueEntry>();
 const CQ_LEN: usize = PAGE_SIZE / size_of::<CompletionQueueEntry>();
+/// The number of entries in a PRP list
+const PRP_LIST_LEN: usize = PAGE_SIZE / size_of::<u64>();
 
 /// Returns the register offset for the doorbell property of the given `queue`.
 ///
@@ -515,63 +529,94 @@ impl BlockDeviceOps for NamespaceOps {
 	}
 
 	fn read_page(&self, dev: &Arc<BlkDev>, off: u64) -> EResult<RcPage> {
-		let blocks = PAGE_SIZE as u64 / dev.blk_size.get();
-		let lba = off * blocks;
-		// Bound check
-		let end_lba = lba.checked_add(blocks).ok_or_else(|| errno!(EOVERFLOW))?;
-		if unlikely(end_lba > dev.blk_count) {
-			return Err(errno!(EOVERFLOW));
-		}
 		dev.mapped.get_or_insert_page(off, || {
 			let blk = BlkDev::new_page(dev, off)?;
-			let qp = &self.ctrlr.queues.read()[0];
-			let cqe = self.ctrlr.submit_cmd_sync(
-				qp,
-				SubmissionQueueEntry {
-					cdw0: CMD_READ,
-					nsid: self.nsid,
-					cdw12: [0, 0],
-					mptr: [0, 0],
-					dptr: [blk.phys_addr().0 as _, 0],
-					cdw: [lba as u32, (lba >> 32) as u32, (blocks - 1) as _, 0, 0, 0],
-				},
-			);
-			if unlikely(cqe.status() != 0) {
-				// TODO print log?
-				return Err(errno!(EIO));
-			}
+			self.transfer_sync(dev, IoDir::Read, off, &blk)?;
 			Ok(blk)
 		})
 	}
 
 	fn writeback(&self, dev: &BlkDev, off: u64, blk: &RcPage) -> EResult<()> {
+		self.transfer_sync(dev, IoDir::Write, off, blk)
+	}
+
+	fn submit(
+		&self,
+		dev: &BlkDev,
+		reqs: &[BlkRequest],
+		completion: &Arc<IoCompletion>,
+	) -> EResult<()> {
 		let blocks = PAGE_SIZE as u64 / dev.blk_size.get();
-		let lba = off * blocks;
-		// Bound check
-		let end_lba = lba.checked_add(blocks).ok_or_else(|| errno!(EOVERFLOW))?;
-		if unlikely(end_lba > dev.blk_count) {
-			return Err(errno!(EOVERFLOW));
-		}
-		let qp = &self.ctrlr.queues.read()[0];
-		let cqe = self.ctrlr.submit_cmd_sync(
-			qp,
-			SubmissionQueueEntry {
-				cdw0: CMD_WRITE,
-				nsid: self.nsid,
-				cdw12: [0, 0],
-				mptr: [0, 0],
-				dptr: [blk.phys_addr().0 as _, 0],
-				cdw: [lba as u32, (lba >> 32) as u32, (blocks - 1) as _, 0, 0, 0],
-			},
-		);
-		if unlikely(cqe.status() != 0) {
-			// TODO print log?
-			return Err(errno!(EIO));
+		// Bound check before submitting anything
+		for req in reqs {
+			let end_lba = req.end().and_then(|end| end.checked_mul(blocks));
+			if unlikely(!end_lba.is_some_and(|end_lba| end_lba <= dev.blk_count)) {
+				return Err(errno!(EOVERFLOW));
+			}
 		}
+		// Requests larger than what the controller accepts are split into several commands
+		let max = self.ctrlr.max_pages(blocks);
+		let queues = self.ctrlr.queues.read();
+		let qp = self.ctrlr.io_queue(&queues);
+		let cmds = reqs.iter().flat_map(|req| {
+			(req.off..)
+				.step_by(max)
+				.zip(req.pages.chunks(max))
+				.map(move |(off, pages)| self.rw_cmd(req.dir, off * blocks, blocks, pages))
+		});
+		self.ctrlr.submit_cmds(qp, cmds, completion)?;
 		Ok(())
 	}
 }
 
+impl NamespaceOps {
+	/// Builds a read or write command for `pages`, starting at the logical block `lba`.
+	///
+	/// `blocks` is the number of logical blocks per page.
+	fn rw_cmd(
+		&self,
+		dir: IoDir,
+		lba: u64,
+		blocks: u64,
+		pages: &[RcPage],
+	) -> AllocResult<(SubmissionQueueEntry, Option<PrpList>)> {
+		let opcode = match dir {
+			IoDir::Read => CMD_READ,
+			IoDir::Write => CMD_WRITE,
+		};
+		// The first page is always in PRP1. If there are only two pages, the second is in PRP2.
+		// Else, PRP2 points to a list of the remaining pages
+		let prp_list = if pages.len() > 2 {
+			Some(PrpList::new(&pages[1..])?)
+		} else {
+			None
+		};
+		let prp2 = match (&prp_list, pages.get(1)) {
+			(Some(list), _) => list.phys_addr(),
+			(None, Some(page)) => page.phys_addr().0 as _,
+			(None, None) => 0,
+		};
+		let nlb = pages.len() as u64 * blocks - 1;
+		let cmd = SubmissionQueueEntry {
+			cdw0: opcode,
+			nsid: self.nsid,
+			cdw12: [0, 0],
+			mptr: [0, 0],
+			dptr: [pages[0].phys_addr().0 as _, prp2],
+			cdw: [lba as u32, (lba >> 32) as u32, nlb as _, 0, 0, 0],
+		};
+		Ok((cmd, prp_list))
+	}
+
+	/// Transfers the page at offset `off` and waits for completion.
+	fn transfer_sync(&self, dev: &BlkDev, dir: IoDir, off: u64, page: &RcPage) -> EResult<()> {
+		let completion = IoCompletion::new()?;
+		let req = BlkRequest::single(dir, off, page.clone())?;
+		self.submit(dev, &[req], &completion)?;
+		completion.wait()
+	}
+}
+
 impl fmt::Debug for NamespaceOps {
 	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
 		f.debug_struct("NamespaceOps")
@@ -580,10 +625,51 @@ impl fmt::Debug for NamespaceOps {
 	}
 }
 
+/// A page holding a list of Physical Region Page entries, used for commands transferring more
+/// than two pages.
+struct PrpList(NonNull<u64>);
+
+impl PrpList {
+	/// Allocates a list containing the addresses of `pages`.
+	///
+	/// There must be at most [`PRP_LIST_LEN`] pages.
+	fn new(pages: &[RcPage]) -> AllocResult<Self> {
+		debug_assert!(pages.len() <= PRP_LIST_LEN);
+		let list: NonNull<u64> = buddy::alloc_kernel(0, 0)?.cast();
+		for (i, page) in pages.iter().enumerate() {
+			unsafe {
+				list.add(i).write(page.phys_addr().0 as _);
+			}
+		}
+		Ok(Self(list))
+	}
+
+	/// Returns the physical address of the list.
+	#[inline]
+	fn phys_addr(&self) -> u64 {
+		VirtAddr::from(self.0).kernel_to_physical().unwrap().0 as _
+	}
+}
+
+impl Drop for PrpList {
+	fn drop(&mut self) {
+		unsafe {
+			buddy::free_kernel(self.0.cast().as_ptr(), 0);
+		}
+	}
+}
+
+/// Data associated with a command identifier.
 enum QueueEntry {
+	/// The identifier is free
 	Empty,
+	/// The command has been submitted and the process is waiting for its completion
 	Submitted(Arc<Process>),
+	/// The command is complete and the result is waiting to be retrieved
 	Completed(CompletionQueueEntry),
+	/// The command has been submitted asynchronously. The completion is notified when it is over,
+	/// and the PRP list, if any, is kept until then
+	Async(Arc<IoCompletion>, Option<PrpList>),
 }
 
 struct QueuePairInner {
@@ -591,6 +677,8 @@ struct QueuePairInner {
 	sq_tail: u32,
 	/// Completion queues head
 	cq_head: u32,
+	/// The next command identifier to try when looking for a free one
+	next_cid: u16,
 
 	completion_phase: bool,
 	/// Associated data for each submission entry.
@@ -612,6 +700,7 @@ impl QueuePairInner {
 		Ok(Self {
 			sq_tail: 0,
 			cq_head: 0,
+			next_cid: 0,
 
 			completion_phase: true,
 			entries: unsafe { entries.assume_init() },
@@ -627,11 +716,15 @@ struct QueuePair {
 	/// Completion queue
 	cq: NonNull<CompletionQueueEntry>,
 
-	/// Limits concurrent users of the queues pair
+	/// Limits the number of commands in flight, so that the submission queue never overflows
 	sem: Semaphore<false>,
 	inner: Spin<QueuePairInner, false>,
 }
 
+// Queues are accessed only while holding `inner`'s lock
+unsafe impl Send for QueuePair {}
+unsafe impl Sync for QueuePair {}
+
 impl QueuePair {
 	/// Allocates space for a queue pair and returns the associated instance
 	pub fn new(id: u16) -> AllocResult<Self> {
@@ -671,10 +764,41 @@ impl QueuePair {
 			sq: sq.cast(),
 			cq: cq.cast(),
 
-			sem: Semaphore::new(SQ_LEN),
+			// A full queue is indistinguishable from an empty one, so one entry is left unused
+			sem: Semaphore::new(SQ_LEN - 1),
 			inner: Spin::new(inner),
 		})
 	}
+
+	/// Inserts `cmd` in the submission queue, without ringing the doorbell.
+	///
+	/// `ent` is the data associated with the command until it completes.
+	///
+	/// The caller must hold a permit of `sem` for the command. The function returns the command
+	/// identifier.
+	fn push(
+		&self,
+		inner: &mut QueuePairInner,
+		mut cmd: SubmissionQueueEntry,
+		ent: QueueEntry,
+	) -> u16 {
+		// Commands may complete out of order, so identifiers cannot be the submission slots. A
+		// free identifier exists since there are fewer permits than identifiers
+		let cid = (0..SQ_LEN)
+			.map(|i| (inner.next_cid as usize + i) % SQ_LEN)
+			.find(|cid| matches!(inner.entries[*cid], QueueEntry::Empty))
+			.unwrap();
+		inner.next_cid = ((cid + 1) % SQ_LEN) as u16;
+		inner.entries[cid] = ent;
+		// Add command identifier
+		cmd.cdw0 = (cmd.cdw0 & !0xffff0000) | ((cid as u32) << 16);
+		// Insert in submission queue
+		unsafe {
+			self.sq.add(inner.sq_tail as usize).write_volatile(cmd);
+		}
+		inner.sq_tail = (inner.sq_tail + 1) % (SQ_LEN as u32);
+		cid as u16
+	}
 }
 
 impl Drop for QueuePair {
@@ -694,8 +818,11 @@ struct ControllerInner {
 	/// Doorbell Stride
 	dstrd: usize,
 
+	/// The maximum number of pages a single command may transfer, according to the controller
+	max_transfer: AtomicUsize,
+
 	admin_qp: QueuePair,
-	/// I/O queues list
+	/// I/O queues list. There is one queue pair per CPU core, as long as the controller allows
 	queues: RwLock<Vec<QueuePair>>,
 }
 
@@ -756,7 +883,35 @@ impl ControllerInner {
 		Ok(())
 	}
 
-	fn init_io_queue(&self, id: u16, int: u16) -> EResult<()> {
+	/// Requests `count` I/O queue pairs to the controller.
+	///
+	/// The function returns the number of queue pairs allocated by the controller, which may be
+	/// lower.
+	fn set_queue_count(&self, count: u16) -> EResult<u16> {
+		let n = (count - 1) as u32;
+		let cqe = self.submit_cmd_sync(
+			&self.admin_qp,
+			SubmissionQueueEntry {
+				cdw0: ADMIN_CMD_SET_FEATURES,
+				nsid: 0,
+				cdw12: [0; 2],
+				mptr: [0; 2],
+				dptr: [0; 2],
+				cdw: [FEATURE_NUMBER_OF_QUEUES, n | (n << 16), 0, 0, 0, 0],
+			},
+		);
+		if unlikely(cqe.status() != 0) {
+			println!("nvme: cannot set the number of queues ({})", cqe.status());
+			return Err(errno!(EIO));
+		}
+		// Both values are zero-based
+		let nsqa = cqe.cdw01[0] & 0xffff;
+		let ncqa = cqe.cdw01[0] >> 16;
+		Ok((nsqa.min(ncqa) as u16).saturating_add(1).min(count))
+	}
+
+	/// Creates the I/O queue pair `id`, sending completion interrupts on the MSI-X entry `int`.
+	fn init_io_queue(&self, id: u16, int: u16) -> EResult<QueuePair> {
 		let qp = QueuePair::new(id)?;
 		let dptr = VirtAddr::from(qp.cq).kernel_to_physical().unwrap();
 		let cqe = self.submit_cmd_sync(
@@ -810,58 +965,125 @@ impl ControllerInner {
 			);
 			return Err(errno!(EIO));
 		}
-		self.queues.write().push(qp)?;
-		Ok(())
+		Ok(qp)
+	}
+
+	/// Returns the maximum number of pages a single read or write command may transfer.
+	///
+	/// `blocks` is the number of logical blocks per page.
+	fn max_pages(&self, blocks: u64) -> usize {
+		// The number of logical blocks is a 16-bit field, and a single PRP list is used
+		let nlb_max = (1 << 16) / blocks as usize;
+		self.max_transfer
+			.load(Relaxed)
+			.min(PRP_LIST_LEN + 1)
+			.min(nlb_max)
+	}
+
+	/// Returns the I/O queue pair to be used by the current CPU core.
+	#[inline]
+	fn io_queue<'q>(&self, queues: &'q [QueuePair]) -> &'q QueuePair {
+		// APIC IDs may be sparse, so use the dense index of the core instead
+		&queues[per_cpu().index() % queues.len()]
+	}
+
+	/// Notifies the controller of the new commands in the submission queue of `qp`.
+	#[inline]
+	fn ring_sq(&self, qp: &QueuePair, qp_inner: &QueuePairInner) {
+		unsafe {
+			self.bar.write::<u32>(
+				queue_doorbell_off(qp.id, false, self.dstrd),
+				qp_inner.sq_tail,
+			);
+		}
 	}
 
 	/// Submits a command, returning when completed
 	#[must_use]
-	fn submit_cmd_sync(
-		&self,
-		qp: &QueuePair,
-		mut cmd: SubmissionQueueEntry,
-	) -> CompletionQueueEntry {
+	fn submit_cmd_sync(&self, qp: &QueuePair, cmd: SubmissionQueueEntry) -> CompletionQueueEntry {
 		// Wait for space in the submission queue
 		let _permit = qp.sem.acquire();
 		// Disable interrupts to prevent the completion interrupt from being handled before the
 		// process is put to sleep
 		disable_int(|| {
-			let sq_tail;
+			let cid;
 			{
 				let mut qp_inner = qp.inner.lock();
-				sq_tail = qp_inner.sq_tail;
-				debug_assert!(matches!(
-					qp_inner.entries[sq_tail as usize],
-					QueueEntry::Empty
-				));
-				// Add command identifier
-				cmd.cdw0 = (cmd.cdw0 & !0xffff0000) | ((sq_tail & 0xffff) << 16);
-				// Insert in submission queue
-				unsafe {
-					qp.sq.add(sq_tail as usize).write_volatile(cmd);
-				}
-				qp_inner.entries[sq_tail as usize] = QueueEntry::Submitted(Process::current());
-				// Update queue tail
-				qp_inner.sq_tail = (sq_tail + 1) % (SQ_LEN as u32);
-				unsafe {
-					self.bar.write::<u32>(
-						queue_doorbell_off(qp.id, false, self.dstrd),
-						qp_inner.sq_tail,
-					);
-				}
+				cid = qp.push(
+					&mut qp_inner,
+					cmd,
+					QueueEntry::Submitted(Process::current()),
+				);
+				self.ring_sq(qp, &qp_inner);
 				// Wait for completion
 				process::set_state(State::Sleeping);
 			}
 			schedule();
 			// Retrieve CQE
 			let mut qp_inner = qp.inner.lock();
-			let ent = mem::replace(&mut qp_inner.entries[sq_tail as usize], QueueEntry::Empty);
+			let ent = mem::replace(&mut qp_inner.entries[cid as usize], QueueEntry::Empty);
 			let QueueEntry::Completed(cqe) = ent else {
 				panic!();
 			};
 			cqe
 		})
 	}
+
+	/// Submits commands without waiting for their completion.
+	///
+	/// The doorbell is rung once for the whole batch, unless the submission queue becomes full
+	/// on the way. `completion` is notified of the completion of each command, and is not
+	/// considered done before the whole batch has been submitted.
+	///
+	/// If building a command fails, the previous commands remain submitted and the error is
+	/// returned.
+	fn submit_cmds<I: Iterator<Item = AllocResult<(SubmissionQueueEntry, Option<PrpList>)>>>(
+		&self,
+		qp: &QueuePair,
+		cmds: I,
+		completion: &Arc<IoCompletion>,
+	) -> AllocResult<()> {
+		// Keep the completion pending until the last doorbell, since the first commands may
+		// complete before the following ones are inserted
+		completion.start();
+		// Tells whether commands have been inserted since the last time the doorbell was rung
+		let mut pending = false;
+		for cmd in cmds {
+			let (cmd, prp_list) = match cmd {
+				Ok(cmd) => cmd,
+				Err(e) => {
+					if pending {
+						self.ring_sq(qp, &qp.inner.lock());
+					}
+					completion.end(true);
+					return Err(e);
+				}
+			};
+			let permit = match qp.sem.try_acquire() {
+				Some(permit) => permit,
+				None => {
+					// The queue is full: let the controller process what we already inserted
+					// before waiting
+					if pending {
+						self.ring_sq(qp, &qp.inner.lock());
+					}
+					qp.sem.acquire()
+				}
+			};
+			// The permit is released by the interrupt handler, on completion
+			mem::forget(permit);
+			completion.start();
+			let mut qp_inner = qp.inner.lock();
+			let ent = QueueEntry::Async(completion.clone(), prp_list);
+			qp.push(&mut qp_inner, cmd, ent);
+			pending = true;
+		}
+		if pending {
+			self.ring_sq(qp, &qp.inner.lock());
+		}
+		completion.end(true);
+		Ok(())
+	}
 }
 
 fn handle_int(inner: &ControllerInner, qp: &QueuePair) {
@@ -873,15 +1095,23 @@ fn handle_int(inner: &ControllerInner, qp: &QueuePair) {
 		if (cqe.status & 1 != 0) != qp_inner.completion_phase {
 			break;
 		}
-		// Wake up process
-		let ent = mem::replace(
-			&mut qp_inner.entries[cqe.cid as usize],
-			QueueEntry::Completed(cqe),
-		);
-		let QueueEntry::Submitted(proc) = ent else {
-			unreachable!();
-		};
-		Process::wake_from(&proc, State::Sleeping as _);
+		let cid = cqe.cid as usize;
+		let success = cqe.status() == 0;
+		let ent = mem::replace(&mut qp_inner.entries[cid], QueueEntry::Completed(cqe));
+		match ent {
+			// Wake up process
+			QueueEntry::Submitted(proc) => Process::wake_from(&proc, State::Sleeping as _),
+			QueueEntry::Async(completion, prp_list) => {
+				qp_inner.entries[cid] = QueueEntry::Empty;
+				// The controller is done with the list
+				drop(prp_list);
+				unsafe {
+					qp.sem.release();
+				}
+				completion.end(success);
+			}
+			_ => unreachable!(),
+		}
 		qp_inner.cq_head = (qp_inner.cq_head + 1) % (CQ_LEN as u32);
 		if qp_inner.cq_head == 0 {
 			qp_inner.completion_phase = !qp_inner.completion_phase;
@@ -902,8 +1132,9 @@ fn handle_int(inner: &ControllerInner, qp: &QueuePair) {
 pub struct Controller {
 	inner: Arc<ControllerInner>,
 
-	admin_int: CallbackHandle,
-	io_int: CallbackHandle,
+	admin_int: Arc<Irq>,
+	/// Interrupts of I/O queues, each bound by default to the CPU core using the queue
+	io_int: Vec<Arc<Irq>>,
 }
 
 impl Controller {
@@ -942,35 +1173,33 @@ impl Controller {
 			id: CTRLR_ID.fetch_add(1, Relaxed),
 			bar,
 			dstrd: ((cap >> 32) & 0xf) as usize,
+			max_transfer: AtomicUsize::new(usize::MAX),
 			admin_qp: QueuePair::new(0)?,
 			queues: RwLock::new(Vec::new()),
 		})?;
-		let (admin_int, io_int) = unsafe {
-			let inner_ = inner.clone();
-			let admin_int = int::alloc_callback(move |_, _, _, _| {
-				handle_int(&inner_, &inner_.admin_qp);
-			})?;
-			let inner_ = inner.clone();
-			let io_int = int::alloc_callback(move |_, _, _, _| {
-				let queues = inner_.queues.read();
-				handle_int(&inner_, &queues[0]);
-			})?;
-			(admin_int, io_int)
-		};
 		// Setup MSI
-		let msi_x = dev.enable_msi_x();
-		if let Some(msi_x) = msi_x {
-			msi_x
-				.set(0, core_id() as _, true, false, admin_int.id())
-				.inspect_err(|_| println!("nvme: failed to initialize MSI-x"))?;
-			msi_x
-				.set(1, core_id() as _, true, false, io_int.id())
-				.inspect_err(|_| println!("nvme: failed to initialize MSI-x"))?;
-			println!("nvme: using MSI-X");
-		} else {
+		let Some(msi_x) = dev
+			.enable_msi_x()
+			.filter(|msi_x| msi_x.entries_count() >= 2)
+		else {
 			println!("nvme: no MSI-X, driver does not support MSI");
 			return Err(errno!(EINVAL));
-		}
+		};
+		let admin_int = unsafe {
+			let inner_ = inner.clone();
+			let entry = msi_x.entry(0)?;
+			int::alloc_irq(
+				format!("nvme{}q0", inner.id)?,
+				core_id(),
+				move || handle_int(&inner_, &inner_.admin_qp),
+				move |cpu, vector| {
+					entry.set(cpu as _, true, false, vector);
+					Ok(())
+				},
+			)
+			.inspect_err(|_| println!("nvme: failed to initialize MSI-x"))?
+		};
+		println!("nvme: using MSI-X");
 		// Disable controller
 		unsafe {
 			inner
@@ -1057,6 +1286,13 @@ impl Controller {
 				inner.bar.read::<u32>(REG_CC) | (subsize << 16) | (comsize << 20),
 			);
 		}
+		// Maximum Data Transfer Size, in units of the minimum page size. Zero means no limit
+		if ctrlr_id.mdts != 0 {
+			let max = min_page_size
+				.checked_shl(ctrlr_id.mdts as _)
+				.map_or(usize::MAX, |size| size / PAGE_SIZE);
+			inner.max_transfer.store(max.max(1), Relaxed);
+		}
 		drop(ctrlr_id);
 		// List namespaces. heap-allocated to avoid a stack overflow
 		let mut ns_ids = Box::<MaybeUninit<[u32; 1024]>>::new_uninit()?;
@@ -1080,12 +1316,48 @@ impl Controller {
 		}
 		let dev_path = PathBuf::new_unchecked(format!("/dev/nvme{}", inner.id)?);
 		println!("nvme: detected controller ({dev_path})");
+		// Create an I/O queue pair per CPU core, each with its own interrupt vector bound to the
+		// core. The first MSI-X entry is taken by the admin queue
+		let cpus = iter_online().collect::<CollectResult<Vec<_>>>().0?;
+		let count = cpus
+			.len()
+			.min(msi_x.entries_count() as usize - 1)
+			.min(u16::MAX as usize) as u16;
+		let count = inner.set_queue_count(count)?;
+		let mut queues = Vec::with_capacity(count as usize)?;
+		let mut io_int = Vec::with_capacity(count as usize)?;
+		for (i, cpu) in cpus.into_iter().take(count as usize).enumerate() {
+			let id = i as u16 + 1;
+			let int = unsafe {
+				let inner_ = inner.clone();
+				let entry = msi_x.entry(id)?;
+				int::alloc_irq(
+					format!("nvme{}q{id}", inner.id)?,
+					cpu,
+					move || {
+						let queues = inner_.queues.read();
+						if let Some(qp) = queues.get(i) {
+							handle_int(&inner_, qp);
+						}
+					},
+					move |cpu, vector| {
+						entry.set(cpu as _, true, false, vector);
+						Ok(())
+					},
+				)
+				.inspect_err(|_| println!("nvme: failed to initialize MSI-x"))?
+			};
+			io_int.push(int)?;
+			queues.push(inner.init_io_queue(id, id)?)?;
+		}
+		// No I/O has been submitted yet, so no interrupt handler can be holding the lock
+		*inner.queues.write() = queues;
+		println!("nvme: using {count} I/O queue(s)");
 		let controller = Self {
 			inner,
 			admin_int,
 			io_int,
 		};
-		controller.inner.init_io_queue(1, 1)?;
 		let ns_ids = unsafe { ns_ids.assume_init() };
 		for &i in ns_ids.iter() {
 			if i == 0 {
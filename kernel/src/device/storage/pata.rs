@@ -34,6 +34,7 @@ use crate::{
 	device::{
 		BlkDev, BlockDeviceOps, DeviceID,
 		id::{BLOCK_EXTENDED_MAJOR, BLOCK_EXTENDED_MAJOR_HANDLE},
+		request::{BlkRequest, IoCompletion, IoDir},
 		storage::{SCSI_MAJOR, ide},
 	},
 	memory::cache::RcPage,
@@ -395,6 +396,42 @@ impl PATAInterface {
 			}
 		}
 	}
+
+	/// Reads the page at offset `off` from the disk into `blk`.
+	fn read_blk(&self, dev: &BlkDev, off: u64, blk: &RcPage) -> EResult<()> {
+		let size = PAGE_SIZE as u64 / SECTOR_SIZE;
+		let off = off.checked_mul(size).ok_or_else(|| errno!(EOVERFLOW))?;
+		// If the offset and size are out of bounds of the disk, return an error
+		let end = off.checked_add(size).ok_or_else(|| errno!(EOVERFLOW))?;
+		if unlikely(end > dev.blk_count) {
+			return Err(errno!(EOVERFLOW));
+		}
+		// Avoid data race
+		let _guard = self.lock.lock();
+		// Select disk
+		self.select(false);
+		// Read
+		let buf = unsafe { blk.slice_mut() };
+		let mut i = 0;
+		while i < size {
+			let off = off + i;
+			let count = (size - i).min(u16::MAX as u64) as u16;
+			let (count, _) = self.prepare_io(off, count, false);
+			let start = i as usize;
+			let end = start + count as usize;
+			for j in start..end {
+				self.wait_io()?;
+				for k in 0..256 {
+					let index = j * 256 + k;
+					unsafe {
+						buf[index] = self.channel.ata_bar.read::<u16>(REG_DATA);
+					}
+				}
+			}
+			i += count as u64;
+		}
+		Ok(())
+	}
 }
 
 impl BlockDeviceOps for PATAInterface {
@@ -424,37 +461,7 @@ impl BlockDeviceOps for PATAInterface {
 	fn read_page(&self, dev: &Arc<BlkDev>, off: u64) -> EResult<RcPage> {
 		dev.mapped.get_or_insert_page(off, || {
 			let blk = BlkDev::new_page(dev, off)?;
-			let size = PAGE_SIZE as u64 / SECTOR_SIZE;
-			let off = off.checked_mul(size).ok_or_else(|| errno!(EOVERFLOW))?;
-			// If the offset and size are out of bounds of the disk, return an error
-			let end = off.checked_add(size).ok_or_else(|| errno!(EOVERFLOW))?;
-			if unlikely(end > dev.blk_count) {
-				return Err(errno!(EOVERFLOW));
-			}
-			// Avoid data race
-			let _guard = self.lock.lock();
-			// Select disk
-			self.select(false);
-			// Read
-			let buf = unsafe { blk.slice_mut() };
-			let mut i = 0;
-			while i < size {
-				let off = off + i;
-				let count = (size - i).min(u16::MAX as u64) as u16;
-				let (count, _) = self.prepare_io(off, count, false);
-				let start = i as usize;
-				let end = start + count as usize;
-				for j in start..end {
-					self.wait_io()?;
-					for k in 0..256 {
-						let index = j * 256 + k;
-						unsafe {
-							buf[index] = self.channel.ata_bar.read::<u16>(REG_DATA);
-						}
-					}
-				}
-				i += count as u64;
-			}
+			self.read_blk(dev, off, &blk)?;
 			Ok(blk)
 		})
 	}
@@ -492,4 +499,27 @@ impl BlockDeviceOps for PATAInterface {
 		}
 		Ok(())
 	}
+
+	fn submit(
+		&self,
+		dev: &BlkDev,
+		reqs: &[BlkRequest],
+		completion: &Arc<IoCompletion>,
+	) -> EResult<()> {
+		// PIO transfers cannot be asynchronous. Keep the completion pending until the last
+		// request, so that it is not considered done in the middle of the batch
+		completion.start();
+		for req in reqs {
+			completion.start();
+			let res = (req.off..)
+				.zip(&req.pages)
+				.try_for_each(|(off, page)| match req.dir {
+					IoDir::Read => self.read_blk(dev, off, page),
+					IoDir::Write => self.writeback(dev, off, page),
+				});
+			completion.end(res.is_ok());
+		}
+		completion.end(true);
+		Ok(())
+	}
 }
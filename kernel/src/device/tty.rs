@@ -20,13 +20,14 @@
 //! communicate with it.
 
 use crate::{
-	file::{File, fs::FileOps},
+	file::{File, O_NONBLOCK, fs::FileOps},
 	memory::user::{UserPtr, UserSlice},
 	process::{
 		Process,
 		pid::Pid,
 		signal::{Signal, SignalHandler},
 	},
+	sync::wait_queue::PollTable,
 	syscall::{
 		FromSyscallArg, ioctl,
 		select::{POLLIN, POLLOUT},
@@ -101,6 +102,11 @@ impl FileOps for TTYDeviceHandle {
 		Ok(res)
 	}
 
+	fn poll_wait(&self, _file: &File, _mask: u32, table: &mut PollTable) -> EResult<()> {
+		TTY.poll_wait(table)?;
+		Ok(())
+	}
+
 	fn ioctl(&self, _file: &File, request: ioctl::Request, argp: *const c_void) -> EResult<u32> {
 		match request.get_old_format() {
 			ioctl::TCGETS => {
@@ -147,12 +153,17 @@ impl FileOps for TTYDeviceHandle {
 		}
 	}
 
-	fn read(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+	fn read(&self, file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
 		self.check_sigttin()?;
-		let len = TTY.read(buf)?;
+		let len = TTY.read(buf, file.get_flags() & O_NONBLOCK != 0)?;
 		Ok(len)
 	}
 
+	fn read_nonblock(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		self.check_sigttin()?;
+		TTY.read(buf, true)
+	}
+
 	fn write(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
 		self.check_sigttou()?;
 		// Write
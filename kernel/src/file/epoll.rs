@@ -0,0 +1,471 @@
+/*
+ * Copyright 2026 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! An `epoll` instance watches a set of files for events.
+//!
+//! Each watched file is an *item*, which registers a [`PollTable`] on the wait queues of the
+//! file. When one of them is woken up, the item is inserted in the instance's *ready list*,
+//! without checking which events occurred. Waiting then only polls the items of the ready list,
+//! so that its cost depends on the number of files with pending events rather than on the number
+//! of watched files.
+//!
+//! In level-triggered mode, an item that reported events is inserted back in the ready list, so
+//! that it is polled again on the next wait. In edge-triggered mode ([`EPOLLET`]), it is only
+//! inserted back when the file's wait queues are woken up again.
+
+use crate::{
+	file::{File, fs::FileOps},
+	memory::user::UserSlice,
+	process::{Process, State},
+	sync::{
+		mutex::Mutex,
+		spin::{IntSpin, Spin},
+		wait_queue::{PollTable, WaitQueue, WakeCallback},
+	},
+	syscall::select::{POLLERR, POLLHUP, POLLIN, POLLRDNORM},
+	time::{
+		clock::{Clock, current_time_ns},
+		timer::Timer,
+		unit::Timestamp,
+	},
+};
+use core::{
+	ffi::c_int,
+	fmt,
+	fmt::Formatter,
+	mem,
+	ptr::NonNull,
+	sync::atomic::{
+		AtomicBool, AtomicU32, AtomicU64,
+		Ordering::{Acquire, Relaxed, Release},
+	},
+};
+use utils::{
+	collections::{btreemap::BTreeMap, list::ListNode, vec::Vec},
+	errno,
+	errno::{AllocResult, EResult},
+	list, list_type,
+	ptr::arc::Arc,
+};
+
+/// Event: the file is available for reading.
+pub const EPOLLIN: u32 = 0x1;
+/// Event: there is an exceptional condition on the file.
+pub const EPOLLPRI: u32 = 0x2;
+/// Event: the file is available for writing.
+pub const EPOLLOUT: u32 = 0x4;
+/// Event: error condition. Always reported.
+pub const EPOLLERR: u32 = 0x8;
+/// Event: hang up. Always reported.
+pub const EPOLLHUP: u32 = 0x10;
+/// Event: equivalent to [`EPOLLIN`].
+pub const EPOLLRDNORM: u32 = 0x40;
+/// Event: priority band data can be read.
+pub const EPOLLRDBAND: u32 = 0x80;
+/// Event: equivalent to [`EPOLLOUT`].
+pub const EPOLLWRNORM: u32 = 0x100;
+/// Event: priority data may be written.
+pub const EPOLLWRBAND: u32 = 0x200;
+/// Event: the peer closed its end of the connection.
+pub const EPOLLRDHUP: u32 = 0x2000;
+
+/// Flag: when several instances watch the same file, only one of them is woken up.
+pub const EPOLLEXCLUSIVE: u32 = 1 << 28;
+/// Flag: prevents system suspend while events are pending. Ignored.
+pub const EPOLLWAKEUP: u32 = 1 << 29;
+/// Flag: the item is disabled after reporting events once, until it is modified.
+pub const EPOLLONESHOT: u32 = 1 << 30;
+/// Flag: edge-triggered mode.
+pub const EPOLLET: u32 = 1 << 31;
+
+/// The bits of an item's events that are flags rather than events.
+const EP_FLAGS: u32 = EPOLLEXCLUSIVE | EPOLLWAKEUP | EPOLLONESHOT | EPOLLET;
+/// The bits allowed along with [`EPOLLEXCLUSIVE`].
+const EP_EXCLUSIVE_OK: u32 = EPOLLIN
+	| EPOLLOUT
+	| EPOLLERR
+	| EPOLLHUP
+	| EPOLLRDNORM
+	| EPOLLRDBAND
+	| EPOLLWRNORM
+	| EPOLLWRBAND
+	| EPOLLWAKEUP
+	| EPOLLET
+	| EPOLLEXCLUSIVE;
+
+/// An event, as exchanged with userspace.
+#[repr(C, packed)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct EpollEvent {
+	/// The events mask, with flags
+	pub events: u32,
+	/// User data, returned along with the events
+	pub data: u64,
+}
+
+/// A file watched by an `epoll` instance.
+pub struct Item {
+	/// The file descriptor the file has been added with
+	fd: c_int,
+	/// The watched file
+	///
+	/// The item does not hold a reference to the file, so that watching it does not keep it open:
+	/// the file unregisters its items when dropped, with [`release_file`].
+	file: NonNull<File>,
+	/// The events to watch, with flags. If no event remains, the item is disabled
+	events: AtomicU32,
+	/// User data
+	data: AtomicU64,
+
+	/// The node in the ready list
+	ready_node: ListNode,
+	/// Tells whether the item is in the ready list, or being processed by a wait. Modified only
+	/// while the ready list is locked
+	queued: AtomicBool,
+	/// The hooks registered on the file's wait queues
+	table: Spin<Option<PollTable>>,
+	/// The instance the item belongs to
+	ep: Arc<Instance>,
+}
+
+// The ready list node is accessed only while the ready list is locked
+unsafe impl Send for Item {}
+unsafe impl Sync for Item {}
+
+impl Item {
+	/// Returns the watched file.
+	#[inline]
+	fn file(&self) -> &File {
+		// The item is unregistered before the file is dropped
+		unsafe { self.file.as_ref() }
+	}
+
+	/// Returns the key of the item in the interest list.
+	#[inline]
+	fn key(&self) -> (c_int, usize) {
+		(self.fd, self.file.as_ptr() as usize)
+	}
+
+	/// Polls the file for the item's events, returning the events that occurred.
+	fn poll(&self) -> u32 {
+		let mask = self.events.load(Acquire) & !EP_FLAGS;
+		if mask == 0 {
+			return 0;
+		}
+		// A failure to poll is reported as an error condition
+		let file = self.file();
+		let events = file.ops.poll(file, mask).unwrap_or(POLLERR);
+		events & (mask | POLLERR | POLLHUP)
+	}
+
+	/// Inserts the item in the ready list, if not already in it.
+	///
+	/// The function returns `true` if the item has been inserted.
+	fn queue(this: &Arc<Self>) -> bool {
+		let mut ready = this.ep.ready.lock();
+		if this.queued.swap(true, Relaxed) {
+			return false;
+		}
+		ready.insert_back(this.clone());
+		true
+	}
+
+	/// Registers hooks on the file's wait queues, then queues the item if events are already
+	/// pending.
+	fn arm(this: &Arc<Self>) -> EResult<()> {
+		let events = this.events.load(Acquire);
+		let mut table = PollTable::new(this.clone(), events & EPOLLEXCLUSIVE != 0);
+		let file = this.file();
+		file.ops.poll_wait(file, events & !EP_FLAGS, &mut table)?;
+		*this.table.lock() = Some(table);
+		if this.poll() != 0 && Self::queue(this) {
+			this.ep.wait.wake_next();
+		}
+		Ok(())
+	}
+
+	/// Unregisters the item's hooks and removes it from the ready list.
+	///
+	/// The instance's interest list must be locked, so that no wait is processing the item.
+	fn disarm(this: &Arc<Self>) {
+		// Dropping the table unregisters the hooks, which breaks the reference cycle with them
+		let table = this.table.lock().take();
+		drop(table);
+		let mut ready = this.ep.ready.lock();
+		if this.queued.swap(false, Relaxed) {
+			unsafe {
+				ready.remove(this);
+			}
+		}
+	}
+
+	/// Detaches the item from its file and disarms it.
+	///
+	/// The instance's interest list must be locked, and the item removed from it.
+	fn detach(this: &Arc<Self>) {
+		this.file()
+			.epoll_items
+			.lock()
+			.retain(|i| Arc::as_ptr(i) != Arc::as_ptr(this));
+		Self::disarm(this);
+	}
+}
+
+impl WakeCallback for Item {
+	fn wake(&self) -> bool {
+		// Disabled by `EPOLLONESHOT`
+		if self.events.load(Acquire) & !EP_FLAGS == 0 {
+			return false;
+		}
+		// Items always reside in an `Arc`
+		let this = unsafe { Arc::from_raw(self) };
+		Arc::increment_count(&this);
+		Self::queue(&this);
+		self.ep.wait.wake_next()
+	}
+}
+
+impl fmt::Debug for Item {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.debug_struct("Item")
+			.field("fd", &self.fd)
+			.field("events", &self.events)
+			.finish()
+	}
+}
+
+/// The state of an `epoll` instance, shared with its items.
+struct Instance {
+	/// The interest list, ordered by file descriptor, then by file
+	///
+	/// Waits lock it while processing the ready list, which serializes them with changes to the
+	/// interest list.
+	items: Mutex<BTreeMap<(c_int, usize), Arc<Item>>, false>,
+	/// The items that may have pending events
+	ready: IntSpin<list_type!(Item, ready_node)>,
+	/// The processes waiting for events
+	wait: WaitQueue,
+}
+
+/// An `epoll` instance.
+pub struct EventPoll(Arc<Instance>);
+
+impl EventPoll {
+	/// Creates a new instance, watching no file.
+	pub fn new() -> AllocResult<Self> {
+		Ok(Self(Arc::new(Instance {
+			items: Mutex::new(BTreeMap::new()),
+			ready: IntSpin::new(list!(Item, ready_node)),
+			wait: WaitQueue::new(),
+		})?))
+	}
+
+	/// Starts watching `file`, open with the file descriptor `fd`, for the events in `event`.
+	pub fn add(&self, fd: c_int, file: Arc<File>, event: EpollEvent) -> EResult<()> {
+		let events = event.events;
+		if events & EPOLLEXCLUSIVE != 0 && events & !EP_EXCLUSIVE_OK != 0 {
+			return Err(errno!(EINVAL));
+		}
+		// Nested instances are not supported
+		if file.get_buffer::<EventPoll>().is_some() {
+			return Err(errno!(EINVAL));
+		}
+		let mut items = self.0.items.lock();
+		let key = (fd, Arc::as_ptr(&file) as usize);
+		if items.contains_key(&key) {
+			return Err(errno!(EEXIST));
+		}
+		let item = Arc::new(Item {
+			fd,
+			file: NonNull::from(&*file),
+			events: AtomicU32::new(events),
+			data: AtomicU64::new(event.data),
+
+			ready_node: ListNode::default(),
+			queued: AtomicBool::new(false),
+			table: Spin::new(None),
+			ep: self.0.clone(),
+		})?;
+		file.epoll_items.lock().push(item.clone())?;
+		let res = items
+			.insert(key, item.clone())
+			.map_err(Into::into)
+			.and_then(|_| Item::arm(&item));
+		if let Err(e) = res {
+			items.remove(&key);
+			Item::detach(&item);
+			return Err(e);
+		}
+		Ok(())
+	}
+
+	/// Changes the events watched on `file`, open with the file descriptor `fd`.
+	pub fn modify(&self, fd: c_int, file: &Arc<File>, event: EpollEvent) -> EResult<()> {
+		let items = self.0.items.lock();
+		let item = items
+			.get(&(fd, Arc::as_ptr(file) as usize))
+			.ok_or_else(|| errno!(ENOENT))?;
+		// Exclusive items cannot be modified
+		let events = item.events.load(Acquire);
+		if (event.events | events) & EPOLLEXCLUSIVE != 0 {
+			return Err(errno!(EINVAL));
+		}
+		// The set of wait queues depends on the events
+		Item::disarm(item);
+		item.events.store(event.events, Release);
+		item.data.store(event.data, Relaxed);
+		Item::arm(item)
+	}
+
+	/// Stops watching `file`, open with the file descriptor `fd`.
+	pub fn delete(&self, fd: c_int, file: &Arc<File>) -> EResult<()> {
+		let mut items = self.0.items.lock();
+		let item = items
+			.remove(&(fd, Arc::as_ptr(file) as usize))
+			.ok_or_else(|| errno!(ENOENT))?;
+		Item::detach(&item);
+		Ok(())
+	}
+
+	/// Moves the events of ready items to `events`, returning the number of events written.
+	///
+	/// The interest list must be locked.
+	fn harvest(&self, events: &UserSlice<EpollEvent>) -> EResult<usize> {
+		// Take the ready list, so that items re-inserted during processing are not processed
+		// twice
+		let mut txlist = mem::replace(&mut *self.0.ready.lock(), list!(Item, ready_node));
+		let mut count = 0;
+		let mut res = Ok(());
+		while count < events.len() {
+			let Some(item) = txlist.remove_front() else {
+				break;
+			};
+			{
+				// From now on, a wake up inserts the item in the ready list again
+				let _ready = self.0.ready.lock();
+				item.queued.store(false, Relaxed);
+			}
+			let revents = item.poll();
+			if revents == 0 {
+				continue;
+			}
+			let event = EpollEvent {
+				events: revents,
+				data: item.data.load(Relaxed),
+			};
+			if let Err(e) = events.copy_to_user(count, &[event]) {
+				Item::queue(&item);
+				res = Err(e);
+				break;
+			}
+			count += 1;
+			let flags = item.events.load(Acquire);
+			if flags & EPOLLONESHOT != 0 {
+				item.events.fetch_and(EP_FLAGS, Release);
+			} else if flags & EPOLLET == 0 {
+				Item::queue(&item);
+			}
+		}
+		// Give back the items that have not been processed
+		if !txlist.is_empty() {
+			let mut ready = self.0.ready.lock();
+			while let Some(item) = txlist.remove_back() {
+				ready.insert_front(item);
+			}
+		}
+		res.map(|_| count)
+	}
+
+	/// Waits for events, writing them to `events`.
+	///
+	/// `timeout` is the maximum duration to wait for, in nanoseconds. If `None`, the function
+	/// waits indefinitely.
+	///
+	/// The function returns the number of events written.
+	pub fn wait(
+		&self,
+		events: UserSlice<EpollEvent>,
+		timeout: Option<Timestamp>,
+	) -> EResult<usize> {
+		let deadline = timeout.map(|t| current_time_ns(Clock::Monotonic).saturating_add(t));
+		let expired = || deadline.is_some_and(|d| current_time_ns(Clock::Monotonic) >= d);
+		// Set up a timer to be woken up at the deadline. Dropping the timer at the end of the
+		// function removes it from the timer queue
+		let _timer = match timeout {
+			Some(delay) if delay > 0 => {
+				let proc = Process::current();
+				let mut timer = Timer::new(Clock::Monotonic, move || {
+					Process::wake_from(&proc, State::IntSleeping as u8);
+				})?;
+				timer.set_time(0, delay)?;
+				Some(timer)
+			}
+			_ => None,
+		};
+		loop {
+			let count = {
+				let _items = self.0.items.lock();
+				self.harvest(&events)?
+			};
+			if count > 0 || expired() {
+				return Ok(count);
+			}
+			self.0
+				.wait
+				.wait_until(|| (!self.0.ready.lock().is_empty() || expired()).then_some(()))?;
+		}
+	}
+}
+
+impl FileOps for EventPoll {
+	fn release(&self, _file: &File) {
+		// Break the reference cycles between the instance and its items
+		let mut items = self.0.items.lock();
+		while let Some((_, item)) = items.pop_first() {
+			Item::detach(&item);
+		}
+	}
+
+	fn poll(&self, _file: &File, mask: u32) -> EResult<u32> {
+		let ready = !self.0.ready.lock().is_empty();
+		Ok(if ready { POLLIN | POLLRDNORM } else { 0 } & mask)
+	}
+}
+
+impl fmt::Debug for EventPoll {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.write_str("EventPoll")
+	}
+}
+
+/// Removes `file` from the `epoll` instances watching it.
+///
+/// Since `epoll` items do not hold references to the files they watch, this function must be
+/// called when the last reference to `file` is dropped.
+pub fn release_file(file: &File) {
+	let items = mem::take(&mut *file.epoll_items.lock());
+	for item in items.iter() {
+		// Waits process the item only while the interest list is locked
+		let mut ep_items = item.ep.items.lock();
+		if ep_items.remove(&item.key()).is_some() {
+			Item::disarm(item);
+		}
+	}
+}
+
+/// The list of `epoll` items watching a file.
+pub type FileItems = Spin<Vec<Arc<Item>>>;
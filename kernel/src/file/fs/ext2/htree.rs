@@ -0,0 +1,856 @@
+/*
+ * Copyright 2026 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! Hashed directory index (htree), enabled by the `dir_index` feature.
+//!
+//! In an indexed directory, the first block holds the root of a tree of *index nodes*, mapping
+//! hashes of names to the *leaf blocks* holding the entries with these hashes. Leaf blocks are
+//! regular blocks of directory entries.
+//!
+//! Index nodes are disguised as directory entries, so that the directory remains valid for
+//! implementations ignoring the index:
+//! - the root lives in the slack of the `..` entry
+//! - other nodes are blocks made of a single free entry
+//!
+//! The tree has at most two levels of index nodes. When a leaf block is full, it is split in two
+//! according to the hashes of its entries.
+
+use super::{
+	Ext2Fs, dirent,
+	dirent::Dirent,
+	inode::{Ext2INode, INODE_FLAG_HASH_INDEXED},
+};
+use crate::{file::FileType, memory::cache::RcPage};
+use core::mem::offset_of;
+use utils::{collections::vec::Vec, errno, errno::EResult, vec};
+
+/// Hash version: legacy hash.
+const DX_HASH_LEGACY: u8 = 0;
+/// Hash version: half MD4.
+const DX_HASH_HALF_MD4: u8 = 1;
+/// Hash version: TEA.
+const DX_HASH_TEA: u8 = 2;
+/// The offset between a hash version and its variant using unsigned chars.
+const DX_HASH_UNSIGNED_OFF: u8 = 3;
+
+/// `s_flags`: names are hashed as unsigned chars.
+const FLAG_UNSIGNED_HASH: u32 = 0x2;
+
+/// The seed used when the superblock does not specify one.
+const DEFAULT_SEED: [u32; 4] = [0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476];
+/// The hash reserved to mark the end of the directory.
+const HASH_EOF: u32 = 0x7fffffff << 1;
+
+/// The offset of the root information in the first block.
+const ROOT_INFO_OFF: usize = 24;
+/// The size of the root information.
+const ROOT_INFO_LEN: u8 = 8;
+/// The offset of entries in the root.
+const ROOT_ENTRIES_OFF: usize = ROOT_INFO_OFF + ROOT_INFO_LEN as usize;
+/// The offset of entries in index nodes other than the root.
+const NODE_ENTRIES_OFF: usize = dirent::NAME_OFF;
+/// The size of an index entry.
+const ENTRY_SIZE: usize = 8;
+/// The maximum number of levels of index nodes.
+const MAX_LEVELS: usize = 2;
+
+#[inline]
+fn get_u16(buf: &[u8], off: usize) -> u16 {
+	u16::from_le_bytes([buf[off], buf[off + 1]])
+}
+
+#[inline]
+fn get_u32(buf: &[u8], off: usize) -> u32 {
+	u32::from_le_bytes([buf[off], buf[off + 1], buf[off + 2], buf[off + 3]])
+}
+
+#[inline]
+fn set_u16(buf: &mut [u8], off: usize, val: u16) {
+	buf[off..(off + 2)].copy_from_slice(&val.to_le_bytes());
+}
+
+#[inline]
+fn set_u32(buf: &mut [u8], off: usize, val: u32) {
+	buf[off..(off + 4)].copy_from_slice(&val.to_le_bytes());
+}
+
+/// Returns the size of a record holding a name of `len` bytes.
+#[inline]
+fn rec_size(len: usize) -> usize {
+	(dirent::NAME_OFF + len).next_multiple_of(dirent::ALIGN)
+}
+
+/// Legacy hash function.
+fn legacy_hash(name: &[u8], signed: bool) -> u32 {
+	let mut hash0: u32 = 0x12a3fe2d;
+	let mut hash1: u32 = 0x37abe8f9;
+	for b in name {
+		let c = if signed { *b as i8 as i32 } else { *b as i32 };
+		let mut hash = hash1.wrapping_add(hash0 ^ c.wrapping_mul(7152373) as u32);
+		if hash & 0x80000000 != 0 {
+			hash = hash.wrapping_sub(0x7fffffff);
+		}
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	hash0 << 1
+}
+
+/// Fills `buf` with the beginning of `msg`, padded according to the length of `msg`.
+fn str_to_hash_buf(msg: &[u8], signed: bool, buf: &mut [u32]) {
+	let len = msg.len() as u32;
+	let mut pad = len | (len << 8);
+	pad |= pad << 16;
+	let mut val = pad;
+	let mut out = buf.iter_mut();
+	let n = msg.len().min(out.len() * 4);
+	for (i, b) in msg[..n].iter().enumerate() {
+		let c = if signed { *b as i8 as u32 } else { *b as u32 };
+		val = c.wrapping_add(val << 8);
+		if i % 4 == 3 {
+			if let Some(o) = out.next() {
+				*o = val;
+			}
+			val = pad;
+		}
+	}
+	if let Some(o) = out.next() {
+		*o = val;
+	}
+	for o in out {
+		*o = pad;
+	}
+}
+
+/// Half MD4 transform, mixing `input` into `buf`.
+fn half_md4_transform(buf: &mut [u32; 4], input: &[u32; 8]) {
+	const K2: u32 = 0x5a827999;
+	const K3: u32 = 0x6ed9eba1;
+	let f = |x: u32, y: u32, z: u32| z ^ (x & (y ^ z));
+	let g = |x: u32, y: u32, z: u32| (x & y).wrapping_add((x ^ y) & z);
+	let h = |x: u32, y: u32, z: u32| x ^ y ^ z;
+	let [mut a, mut b, mut c, mut d] = *buf;
+	macro_rules! round {
+		($f:ident, $a:ident, $b:ident, $c:ident, $d:ident, $x:expr, $s:expr) => {
+			$a = $a
+				.wrapping_add($f($b, $c, $d))
+				.wrapping_add($x)
+				.rotate_left($s);
+		};
+	}
+	// Round 1
+	for i in [0, 4] {
+		round!(f, a, b, c, d, input[i], 3);
+		round!(f, d, a, b, c, input[i + 1], 7);
+		round!(f, c, d, a, b, input[i + 2], 11);
+		round!(f, b, c, d, a, input[i + 3], 19);
+	}
+	// Round 2
+	for i in [1, 0] {
+		round!(g, a, b, c, d, input[i].wrapping_add(K2), 3);
+		round!(g, d, a, b, c, input[i + 2].wrapping_add(K2), 5);
+		round!(g, c, d, a, b, input[i + 4].wrapping_add(K2), 9);
+		round!(g, b, c, d, a, input[i + 6].wrapping_add(K2), 13);
+	}
+	// Round 3
+	for i in [3, 1] {
+		round!(h, a, b, c, d, input[i].wrapping_add(K3), 3);
+		round!(h, d, a, b, c, input[i + 4].wrapping_add(K3), 9);
+		round!(h, c, d, a, b, input[i - 1].wrapping_add(K3), 11);
+		round!(h, b, c, d, a, input[i + 3].wrapping_add(K3), 15);
+	}
+	buf[0] = buf[0].wrapping_add(a);
+	buf[1] = buf[1].wrapping_add(b);
+	buf[2] = buf[2].wrapping_add(c);
+	buf[3] = buf[3].wrapping_add(d);
+}
+
+/// TEA transform, mixing `input` into `buf`.
+fn tea_transform(buf: &mut [u32; 4], input: &[u32; 4]) {
+	const DELTA: u32 = 0x9e3779b9;
+	let mut sum: u32 = 0;
+	let [mut b0, mut b1] = [buf[0], buf[1]];
+	let [a, b, c, d] = *input;
+	for _ in 0..16 {
+		sum = sum.wrapping_add(DELTA);
+		b0 = b0.wrapping_add(
+			(b1 << 4).wrapping_add(a) ^ b1.wrapping_add(sum) ^ (b1 >> 5).wrapping_add(b),
+		);
+		b1 = b1.wrapping_add(
+			(b0 << 4).wrapping_add(c) ^ b0.wrapping_add(sum) ^ (b0 >> 5).wrapping_add(d),
+		);
+	}
+	buf[0] = buf[0].wrapping_add(b0);
+	buf[1] = buf[1].wrapping_add(b1);
+}
+
+/// The parameters of the hash function of a directory.
+#[derive(Clone, Copy, Debug)]
+struct HashInfo {
+	/// The hash version, without the unsigned variant
+	version: u8,
+	/// Tells whether chars are signed
+	signed: bool,
+	/// The seed
+	seed: [u32; 4],
+}
+
+impl HashInfo {
+	/// Returns the parameters for the hash version `version` on `fs`.
+	///
+	/// If the version is not supported, the function returns `None`.
+	fn new(fs: &Ext2Fs, version: u8) -> Option<Self> {
+		let (version, signed) = match version {
+			DX_HASH_LEGACY..=DX_HASH_TEA => (version, fs.sp.s_flags & FLAG_UNSIGNED_HASH == 0),
+			v if v - DX_HASH_UNSIGNED_OFF <= DX_HASH_TEA => (v - DX_HASH_UNSIGNED_OFF, false),
+			_ => return None,
+		};
+		let seed = if fs.sp.s_hash_seed.iter().all(|s| *s == 0) {
+			DEFAULT_SEED
+		} else {
+			fs.sp.s_hash_seed
+		};
+		Some(Self {
+			version,
+			signed,
+			seed,
+		})
+	}
+
+	/// Computes the hash of `name`.
+	fn hash(&self, name: &[u8]) -> u32 {
+		let mut buf = self.seed;
+		let hash = match self.version {
+			DX_HASH_HALF_MD4 => {
+				let mut input = [0; 8];
+				for chunk in name.chunks(32) {
+					let off = chunk.as_ptr().addr() - name.as_ptr().addr();
+					str_to_hash_buf(&name[off..], self.signed, &mut input);
+					half_md4_transform(&mut buf, &input);
+				}
+				buf[1]
+			}
+			DX_HASH_TEA => {
+				let mut input = [0; 4];
+				for chunk in name.chunks(16) {
+					let off = chunk.as_ptr().addr() - name.as_ptr().addr();
+					str_to_hash_buf(&name[off..], self.signed, &mut input);
+					tea_transform(&mut buf, &input);
+				}
+				buf[0]
+			}
+			_ => legacy_hash(name, self.signed),
+		};
+		let hash = hash & !1;
+		if hash == HASH_EOF {
+			(0x7fffffff - 1) << 1
+		} else {
+			hash
+		}
+	}
+}
+
+/// Returns the number of entries in the index node whose entries are at `entries` in `buf`.
+#[inline]
+fn node_count(buf: &[u8], entries: usize) -> usize {
+	get_u16(buf, entries + 2) as usize
+}
+
+/// Returns the maximum number of entries in the index node whose entries are at `entries` in
+/// `buf`.
+#[inline]
+fn node_limit(buf: &[u8], entries: usize) -> usize {
+	get_u16(buf, entries) as usize
+}
+
+/// Returns the lowest hash of the `i`th entry of an index node.
+#[inline]
+fn entry_hash(buf: &[u8], entries: usize, i: usize) -> u32 {
+	// The hash of the first entry is not stored since it is always zero
+	if i == 0 {
+		0
+	} else {
+		get_u32(buf, entries + i * ENTRY_SIZE)
+	}
+}
+
+/// Returns the block pointed to by the `i`th entry of an index node.
+#[inline]
+fn entry_block(buf: &[u8], entries: usize, i: usize) -> u32 {
+	get_u32(buf, entries + i * ENTRY_SIZE + 4)
+}
+
+/// Inserts an entry at position `at` in an index node, which must not be full.
+fn node_insert(buf: &mut [u8], entries: usize, at: usize, hash: u32, block: u32) {
+	let count = node_count(buf, entries);
+	let off = entries + at * ENTRY_SIZE;
+	buf.copy_within(off..(entries + count * ENTRY_SIZE), off + ENTRY_SIZE);
+	set_u32(buf, off, hash);
+	set_u32(buf, off + 4, block);
+	set_u16(buf, entries + 2, (count + 1) as u16);
+}
+
+/// Writes the header of an index node other than the root, with `count` entries, in `buf`.
+fn write_node_header(buf: &mut [u8], fs: &Ext2Fs, count: usize) -> EResult<()> {
+	buf.fill(0);
+	Dirent::write_new(buf, &fs.sp, 0, buf.len() as _, None, b"")?;
+	set_u16(
+		buf,
+		NODE_ENTRIES_OFF,
+		((buf.len() - NODE_ENTRIES_OFF) / ENTRY_SIZE) as _,
+	);
+	set_u16(buf, NODE_ENTRIES_OFF + 2, count as _);
+	Ok(())
+}
+
+/// Reads the file block `off` of `inode`.
+fn read_blk(inode: &Ext2INode, fs: &Ext2Fs, off: u32) -> EResult<RcPage> {
+	let blk = inode
+		.translate_blk_off(off, fs)?
+		.ok_or_else(|| errno!(EUCLEAN))?;
+	fs.dev.ops.read_page(&fs.dev, blk.get() as _)
+}
+
+/// Allocates a new block at the end of the directory `inode`.
+///
+/// The function returns the offset of the block in the file, along with the block.
+fn append_blk(inode: &mut Ext2INode, fs: &Ext2Fs) -> EResult<(u32, RcPage)> {
+	let blk_size = fs.sp.get_block_size() as u64;
+	let off = inode.get_size(&fs.sp) / blk_size;
+	let off: u32 = off.try_into().map_err(|_| errno!(EFBIG))?;
+	let blk = inode.alloc_content_blk(off, fs)?;
+	inode.set_size(&fs.sp, (off as u64 + 1) * blk_size, false);
+	let blk = fs.dev.ops.read_page(&fs.dev, blk as _)?;
+	Ok((off, blk))
+}
+
+/// A position in an index node.
+struct Frame {
+	/// The block containing the node
+	blk: RcPage,
+	/// The offset of the node's entries in the block
+	entries: usize,
+	/// The index of the followed entry
+	at: usize,
+}
+
+impl Frame {
+	/// Returns the content of the node's block.
+	#[inline]
+	fn buf(&self) -> &mut [u8] {
+		// Safe since the inode is locked
+		unsafe { self.blk.slice_mut() }
+	}
+
+	/// Tells whether the node is full.
+	#[inline]
+	fn is_full(&self) -> bool {
+		let buf = self.buf();
+		node_count(buf, self.entries) >= node_limit(buf, self.entries)
+	}
+}
+
+/// The path from the root of an index to a leaf block.
+struct Path {
+	/// The parameters of the hash function
+	info: HashInfo,
+	/// The frames for each level of the tree, starting from the root
+	frames: [Option<Frame>; MAX_LEVELS],
+	/// The number of levels below the root
+	levels: usize,
+	/// The offset of the leaf block in the file
+	leaf: u32,
+}
+
+impl Path {
+	/// Returns the frame of the deepest index node.
+	#[inline]
+	fn last(&self) -> &Frame {
+		self.frames[self.levels].as_ref().unwrap()
+	}
+
+	/// Tells whether the leaf block following the current one may hold entries with the hash
+	/// `hash`.
+	fn collision_follows(&self, hash: u32) -> bool {
+		for frame in self.frames[..=self.levels].iter().rev().flatten() {
+			let buf = frame.buf();
+			if frame.at + 1 < node_count(buf, frame.entries) {
+				// The lowest bit of the hash marks entries continuing from the previous block
+				return entry_hash(buf, frame.entries, frame.at + 1) == hash | 1;
+			}
+		}
+		false
+	}
+}
+
+/// Returns the parameters of the hash function of the indexed directory `inode`, along with the
+/// number of levels of the tree and the root block.
+///
+/// If the index uses unsupported parameters, the function returns `None`.
+fn read_root(inode: &Ext2INode, fs: &Ext2Fs) -> EResult<Option<(HashInfo, usize, RcPage)>> {
+	let root = read_blk(inode, fs, 0)?;
+	let buf = root.slice::<u8>();
+	let reserved = get_u32(buf, ROOT_INFO_OFF);
+	let version = buf[ROOT_INFO_OFF + 4];
+	let info_len = buf[ROOT_INFO_OFF + 5];
+	let levels = buf[ROOT_INFO_OFF + 6] as usize;
+	let limit = (buf.len() - ROOT_ENTRIES_OFF) / ENTRY_SIZE;
+	if reserved != 0
+		|| info_len != ROOT_INFO_LEN
+		|| levels >= MAX_LEVELS
+		|| node_limit(buf, ROOT_ENTRIES_OFF) != limit
+	{
+		return Ok(None);
+	}
+	let Some(info) = HashInfo::new(fs, version) else {
+		return Ok(None);
+	};
+	Ok(Some((info, levels, root)))
+}
+
+/// Walks the index of `inode` down to the leaf block for the hash `hash`.
+///
+/// If the index uses unsupported parameters, the function returns `None`.
+fn probe(inode: &Ext2INode, fs: &Ext2Fs, name: &[u8]) -> EResult<Option<(Path, u32)>> {
+	let Some((info, levels, mut blk)) = read_root(inode, fs)? else {
+		return Ok(None);
+	};
+	let hash = info.hash(name);
+	let mut frames = [None, None];
+	let mut entries = ROOT_ENTRIES_OFF;
+	let mut leaf = 0;
+	for (level, frame) in frames[..=levels].iter_mut().enumerate() {
+		let buf = blk.slice::<u8>();
+		let count = node_count(buf, entries);
+		if count == 0 || count > node_limit(buf, entries) {
+			return Err(errno!(EUCLEAN));
+		}
+		// Find the last entry with a hash lower than or equal to `hash`
+		let (mut lo, mut hi) = (1, count);
+		while lo < hi {
+			let mid = lo + (hi - lo) / 2;
+			if entry_hash(buf, entries, mid) <= hash {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		let at = lo - 1;
+		let next = entry_block(buf, entries, at);
+		*frame = Some(Frame {
+			blk,
+			entries,
+			at,
+		});
+		if level == levels {
+			leaf = next;
+			break;
+		}
+		blk = read_blk(inode, fs, next)?;
+		entries = NODE_ENTRIES_OFF;
+	}
+	let path = Path {
+		info,
+		frames,
+		levels,
+		leaf,
+	};
+	Ok(Some((path, hash)))
+}
+
+/// Looks for the entry `name` in the leaf block `buf`.
+///
+/// On success, the function returns the entry's inode and offset in the block.
+fn find_in_block(buf: &mut [u8], name: &[u8], fs: &Ext2Fs) -> EResult<Option<(u32, usize)>> {
+	let mut off = 0;
+	while off < buf.len() {
+		let ent = Dirent::from_slice(&mut buf[off..], &fs.sp)?;
+		if !ent.is_free() && ent.get_name(&fs.sp) == name {
+			return Ok(Some((ent.inode, off)));
+		}
+		off += ent.rec_len as usize;
+	}
+	Ok(None)
+}
+
+/// Inserts an entry in the leaf block `buf`, in the first free space large enough.
+///
+/// If the block does not have enough free space, the function returns `false`.
+fn insert_in_block(
+	buf: &mut [u8],
+	fs: &Ext2Fs,
+	entry_inode: u32,
+	name: &[u8],
+	file_type: FileType,
+) -> EResult<bool> {
+	let needed = rec_size(name.len());
+	let mut off = 0;
+	while off < buf.len() {
+		let ent = Dirent::from_slice(&mut buf[off..], &fs.sp)?;
+		let rec_len = ent.rec_len as usize;
+		let used = if ent.is_free() {
+			0
+		} else {
+			rec_size(ent.name_len(&fs.sp))
+		};
+		if rec_len - used >= needed {
+			// Shrink the existing entry to make room
+			if used > 0 {
+				ent.rec_len = used as _;
+			}
+			Dirent::write_new(
+				&mut buf[(off + used)..],
+				&fs.sp,
+				entry_inode,
+				(rec_len - used) as _,
+				Some(file_type),
+				name,
+			)?;
+			return Ok(true);
+		}
+		off += rec_len;
+	}
+	Ok(false)
+}
+
+/// Fills the leaf block `buf` with the entries of `src` at the given offsets, packed together.
+fn write_leaf(buf: &mut [u8], fs: &Ext2Fs, src: &mut [u8], ents: &[(u32, usize)]) -> EResult<()> {
+	const REC_LEN_OFF: usize = offset_of!(Dirent, rec_len);
+	buf.fill(0);
+	let mut off = 0;
+	let mut last = None;
+	for (_, src_off) in ents {
+		let ent = Dirent::from_slice(&mut src[*src_off..], &fs.sp)?;
+		let len = rec_size(ent.name_len(&fs.sp));
+		buf[off..(off + len)].copy_from_slice(&src[*src_off..(*src_off + len)]);
+		set_u16(buf, off + REC_LEN_OFF, len as _);
+		last = Some(off);
+		off += len;
+	}
+	match last {
+		// The last entry covers the remaining space
+		Some(last) => set_u16(buf, last + REC_LEN_OFF, (buf.len() - last) as _),
+		None => Dirent::write_new(buf, &fs.sp, 0, buf.len() as _, None, b"")?,
+	}
+	Ok(())
+}
+
+/// Moves the upper half of the entries of the leaf block `old`, by hash, to the empty block
+/// `new`.
+///
+/// The function returns the lowest hash of the entries in `new`, with the lowest bit set if
+/// entries with the same hash remain in `old`.
+fn split_leaf(fs: &Ext2Fs, info: &HashInfo, old: &RcPage, new: &RcPage) -> EResult<u32> {
+	// Safe since the inode is locked
+	let old_buf = unsafe { old.slice_mut() };
+	let new_buf = unsafe { new.slice_mut() };
+	let mut src = vec![0u8; old_buf.len()]?;
+	src.copy_from_slice(old_buf);
+	// Collect entries along with their hashes
+	let mut ents = Vec::new();
+	let mut off = 0;
+	while off < src.len() {
+		let ent = Dirent::from_slice(&mut src[off..], &fs.sp)?;
+		if !ent.is_free() {
+			ents.push((info.hash(ent.get_name(&fs.sp)), off))?;
+		}
+		off += ent.rec_len as usize;
+	}
+	if ents.len() < 2 {
+		return Err(errno!(ENOSPC));
+	}
+	ents.sort_unstable_by_key(|(hash, _)| *hash);
+	let split = ents.len() / 2;
+	let hash = ents[split].0;
+	let continued = ents[split - 1].0 == hash;
+	write_leaf(new_buf, fs, &mut src, &ents[split..])?;
+	write_leaf(old_buf, fs, &mut src, &ents[..split])?;
+	old.mark_dirty();
+	new.mark_dirty();
+	Ok(hash | continued as u32)
+}
+
+/// Makes room in the deepest index node of `path`, adding a level to the tree or splitting a node
+/// as necessary.
+///
+/// If the tree cannot grow anymore, the function returns [`errno::ENOSPC`].
+fn grow_index(inode: &mut Ext2INode, fs: &Ext2Fs, path: &Path) -> EResult<()> {
+	let root = path.frames[0].as_ref().unwrap();
+	let root_buf = root.buf();
+	let (off, blk) = append_blk(inode, fs)?;
+	// Safe since the block has just been allocated
+	let buf = unsafe { blk.slice_mut() };
+	if path.levels == 0 {
+		// Move the root's entries to a new node
+		let count = node_count(root_buf, ROOT_ENTRIES_OFF);
+		write_node_header(buf, fs, count)?;
+		let len = count * ENTRY_SIZE - 4;
+		buf[(NODE_ENTRIES_OFF + 4)..(NODE_ENTRIES_OFF + 4 + len)]
+			.copy_from_slice(&root_buf[(ROOT_ENTRIES_OFF + 4)..(ROOT_ENTRIES_OFF + 4 + len)]);
+		set_u16(root_buf, ROOT_ENTRIES_OFF + 2, 1);
+		set_u32(root_buf, ROOT_ENTRIES_OFF + 4, off);
+		root_buf[ROOT_INFO_OFF + 6] = 1;
+	} else {
+		if root.is_full() {
+			return Err(errno!(ENOSPC));
+		}
+		// Split the node in two
+		let node = path.last();
+		let node_buf = node.buf();
+		let count = node_count(node_buf, node.entries);
+		let split = count / 2;
+		let hash = entry_hash(node_buf, node.entries, split);
+		write_node_header(buf, fs, count - split)?;
+		let src = node.entries + split * ENTRY_SIZE + 4;
+		let len = (count - split) * ENTRY_SIZE - 4;
+		buf[(NODE_ENTRIES_OFF + 4)..(NODE_ENTRIES_OFF + 4 + len)]
+			.copy_from_slice(&node_buf[src..(src + len)]);
+		set_u16(node_buf, node.entries + 2, split as _);
+		node.blk.mark_dirty();
+		node_insert(root_buf, ROOT_ENTRIES_OFF, root.at + 1, hash, off);
+	}
+	root.blk.mark_dirty();
+	blk.mark_dirty();
+	Ok(())
+}
+
+/// Looks up the entry `name` in the indexed directory `inode`.
+///
+/// On success, the function returns the same as [`Ext2INode::get_dirent`]. If the index cannot
+/// be used, the function returns `None`, and the directory must be searched linearly.
+pub fn lookup(inode: &Ext2INode, name: &[u8], fs: &Ext2Fs) -> EResult<Option<Option<(u32, u64)>>> {
+	let Some((path, hash)) = probe(inode, fs, name)? else {
+		return Ok(None);
+	};
+	let blk = read_blk(inode, fs, path.leaf)?;
+	// Safe since the inode is locked
+	let buf = unsafe { blk.slice_mut() };
+	if let Some((ino, off)) = find_in_block(buf, name, fs)? {
+		let off = path.leaf as u64 * buf.len() as u64 + off as u64;
+		return Ok(Some(Some((ino, off))));
+	}
+	// Entries with the same hash may continue on the next leaf. This is rare enough to fall
+	// back to a linear search
+	if path.collision_follows(hash) {
+		return Ok(None);
+	}
+	Ok(Some(None))
+}
+
+/// Adds an entry to the indexed directory `inode`.
+///
+/// If the index cannot be used, it is dropped, and the function returns `false`. The entry must
+/// then be added linearly.
+pub fn add(
+	inode: &mut Ext2INode,
+	fs: &Ext2Fs,
+	entry_inode: u32,
+	name: &[u8],
+	file_type: FileType,
+) -> EResult<bool> {
+	let Some((mut path, mut hash)) = probe(inode, fs, name)? else {
+		// The directory remains valid without its index
+		inode.i_flags &= !INODE_FLAG_HASH_INDEXED;
+		return Ok(false);
+	};
+	let mut leaf = read_blk(inode, fs, path.leaf)?;
+	// Safe since the inode is locked
+	if insert_in_block(
+		unsafe { leaf.slice_mut() },
+		fs,
+		entry_inode,
+		name,
+		file_type,
+	)? {
+		leaf.mark_dirty();
+		return Ok(true);
+	}
+	// The leaf is full and must be split. Make room for the new leaf in the index first
+	if path.last().is_full() {
+		grow_index(inode, fs, &path)?;
+		(path, hash) = probe(inode, fs, name)?.ok_or_else(|| errno!(EUCLEAN))?;
+		leaf = read_blk(inode, fs, path.leaf)?;
+	}
+	let (new_off, new) = append_blk(inode, fs)?;
+	let split_hash = split_leaf(fs, &path.info, &leaf, &new)?;
+	let last = path.last();
+	node_insert(last.buf(), last.entries, last.at + 1, split_hash, new_off);
+	last.blk.mark_dirty();
+	// Insert in the block covering the entry's hash
+	let target = if hash >= split_hash & !1 { &new } else { &leaf };
+	// Safe since the inode is locked
+	if !insert_in_block(
+		unsafe { target.slice_mut() },
+		fs,
+		entry_inode,
+		name,
+		file_type,
+	)? {
+		return Err(errno!(ENOSPC));
+	}
+	target.mark_dirty();
+	Ok(true)
+}
+
+/// Converts the directory `inode`, which must be made of a single block, to an indexed directory.
+///
+/// The entries of the first block are moved to a new leaf block, and the first block becomes the
+/// root of the index.
+///
+/// If the first block does not start with the `.` and `..` entries, the directory is not
+/// converted and the function returns `false`.
+pub fn make_indexed(inode: &mut Ext2INode, fs: &Ext2Fs) -> EResult<bool> {
+	let root = read_blk(inode, fs, 0)?;
+	// Safe since the inode is locked
+	let buf = unsafe { root.slice_mut() };
+	// Read `.` and `..`
+	let dot = Dirent::from_slice(buf, &fs.sp)?;
+	if dot.get_name(&fs.sp) != b"." {
+		return Ok(false);
+	}
+	let (dot_inode, dot_len) = (dot.inode, dot.rec_len as usize);
+	let dotdot = Dirent::from_slice(&mut buf[dot_len..], &fs.sp)?;
+	if dotdot.get_name(&fs.sp) != b".." {
+		return Ok(false);
+	}
+	let (dotdot_inode, mut off) = (dotdot.inode, dot_len + dotdot.rec_len as usize);
+	let Some(version) = [fs.sp.s_def_hash_version, DX_HASH_HALF_MD4]
+		.into_iter()
+		.find(|v| HashInfo::new(fs, *v).is_some())
+	else {
+		return Ok(false);
+	};
+	// Move the other entries to a new leaf
+	let mut ents = Vec::new();
+	while off < buf.len() {
+		let ent = Dirent::from_slice(&mut buf[off..], &fs.sp)?;
+		if !ent.is_free() {
+			ents.push((0, off))?;
+		}
+		off += ent.rec_len as usize;
+	}
+	let (leaf_off, leaf) = append_blk(inode, fs)?;
+	// Safe since the block has just been allocated
+	write_leaf(unsafe { leaf.slice_mut() }, fs, buf, &ents)?;
+	leaf.mark_dirty();
+	// Write the root
+	let blk_size = buf.len();
+	buf.fill(0);
+	let dot_len = rec_size(1);
+	Dirent::write_new(
+		buf,
+		&fs.sp,
+		dot_inode,
+		dot_len as _,
+		Some(FileType::Directory),
+		b".",
+	)?;
+	Dirent::write_new(
+		&mut buf[dot_len..],
+		&fs.sp,
+		dotdot_inode,
+		(blk_size - dot_len) as _,
+		Some(FileType::Directory),
+		b"..",
+	)?;
+	buf[ROOT_INFO_OFF + 4] = version;
+	buf[ROOT_INFO_OFF + 5] = ROOT_INFO_LEN;
+	set_u16(
+		buf,
+		ROOT_ENTRIES_OFF,
+		((blk_size - ROOT_ENTRIES_OFF) / ENTRY_SIZE) as _,
+	);
+	set_u16(buf, ROOT_ENTRIES_OFF + 2, 1);
+	set_u32(buf, ROOT_ENTRIES_OFF + 4, leaf_off);
+	root.mark_dirty();
+	inode.i_flags |= INODE_FLAG_HASH_INDEXED;
+	Ok(true)
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+
+	/// A seed other than the default one.
+	const SEED: [u32; 4] = [0x2a40415d, 0x762a4bbc, 0x919d71b9, 0x92c51710];
+	/// A name longer than one block of input of each hash function.
+	const LONG_NAME: &[u8] = &[b'a'; 40];
+	/// A name with non-ASCII chars, whose hash depends on their signedness.
+	const HIGH_NAME: &[u8] = b"\xe9t\xe9";
+
+	/// Checks the hashes of the hash version `version`.
+	///
+	/// `expected` contains the hashes for, in order:
+	/// - an empty name
+	/// - a short name
+	/// - [`LONG_NAME`]
+	/// - [`HIGH_NAME`], with signed chars
+	/// - [`HIGH_NAME`], with unsigned chars
+	/// - the short name, with [`SEED`]
+	///
+	/// Expected values are computed by e2fsprogs' `debugfs dx_hash`.
+	fn check(version: u8, expected: [u32; 6]) {
+		let cases: [(&[u8], bool, [u32; 4]); 6] = [
+			(b"", true, DEFAULT_SEED),
+			(b"hello", true, DEFAULT_SEED),
+			(LONG_NAME, true, DEFAULT_SEED),
+			(HIGH_NAME, true, DEFAULT_SEED),
+			(HIGH_NAME, false, DEFAULT_SEED),
+			(b"hello", true, SEED),
+		];
+		for ((name, signed, seed), expected) in cases.into_iter().zip(expected) {
+			let info = HashInfo {
+				version,
+				signed,
+				seed,
+			};
+			assert_eq!(info.hash(name), expected);
+		}
+	}
+
+	#[test_case]
+	fn htree_hash_legacy() {
+		// The legacy hash does not use the seed
+		check(
+			DX_HASH_LEGACY,
+			[
+				0x2547fc5a, 0x32252546, 0xd7baa792, 0xcbfc35a2, 0xe3870ba0, 0x32252546,
+			],
+		);
+	}
+
+	#[test_case]
+	fn htree_hash_half_md4() {
+		check(
+			DX_HASH_HALF_MD4,
+			[
+				0xefcdab88, 0x1746da32, 0x2eea49e4, 0x54289c74, 0x050ac262, 0xe8cda42e,
+			],
+		);
+	}
+
+	#[test_case]
+	fn htree_hash_tea() {
+		check(
+			DX_HASH_TEA,
+			[
+				0x67452300, 0x6f5bb1a8, 0x8b06be02, 0xf5848156, 0x7c608570, 0x42774e38,
+			],
+		);
+	}
+}
@@ -18,13 +18,16 @@
 
 //! An inode represents a file in the filesystem.
 
-use super::{Ext2Fs, Superblock, bgd::BlockGroupDescriptor, dirent, dirent::Dirent, zero_block};
+use super::{
+	Ext2Fs, Superblock, bgd::BlockGroupDescriptor, dirent, dirent::Dirent, htree, zero_block,
+};
 use crate::{
 	file::{FileType, INode, Mode, Stat, fs::ext2::dirent::DirentIterator, vfs::node::Node},
 	memory::cache::{RcBlockVal, RcPage},
 	sync::mutex::MutexGuard,
 };
 use core::{
+	cmp::min,
 	hint::unlikely,
 	mem,
 	num::NonZeroU32,
@@ -69,7 +72,7 @@ const INODE_FLAG_NODUMP: u32 = 0x00040;
 /// `s_flags`: Last accessed time should not be updated
 const INODE_FLAG_ATIME_NOUPDATE: u32 = 0x00080;
 /// `s_flags`: Hash indexed directory
-const INODE_FLAG_HASH_INDEXED: u32 = 0x10000;
+pub const INODE_FLAG_HASH_INDEXED: u32 = 0x01000;
 /// `s_flags`: AFS directory
 const INODE_FLAG_AFS_DIRECTORY: u32 = 0x20000;
 /// `s_flags`: Journal file data
@@ -82,6 +85,9 @@ const SECTOR_SIZE: u32 = 512;
 /// separate block.
 pub const SYMLINK_INLINE_LIMIT: u64 = 60;
 
+/// The maximum number of blocks allocated at once for a file's content.
+const ALLOC_RUN_MAX: u32 = 2048;
+
 /// The inode of the root directory.
 pub const ROOT_DIRECTORY_INODE: u32 = 2;
 
@@ -97,6 +103,12 @@ impl INodeWrap<'_> {
 	pub fn mark_dirty(&self) {
 		self.inode.mark_dirty()
 	}
+
+	/// Writes the associated page back to disk, if dirty.
+	#[inline]
+	pub fn writeback(&self) -> EResult<()> {
+		self.inode.writeback()
+	}
 }
 
 impl Deref for INodeWrap<'_> {
@@ -383,42 +395,124 @@ impl Ext2INode {
 		Ok(Some(blk_off))
 	}
 
-	/// Allocates a block for the node's content block at the given file block offset `off`.
+	/// Returns the disk block around which a content block at file block offset `off` should be
+	/// allocated, to keep the content contiguous.
 	///
-	/// The content of the allocated block is **not** initialized.
+	/// If there is no preference, the function returns zero.
+	fn blk_goal(&self, off: u32, fs: &Ext2Fs) -> EResult<u32> {
+		if let Some(prev) = off.checked_sub(1) {
+			if let Some(blk) = self.translate_blk_off(prev, fs)? {
+				return Ok(blk.get() + 1);
+			}
+		}
+		Ok(self.i_block[0])
+	}
+
+	/// Maps a block for the node's content block at the given file block offset `off`, allocating
+	/// indirection blocks as needed.
 	///
-	/// If a block is already allocated, the function does nothing.
+	/// If `data` is `Some`, the given disk block is used as the content block. Else, a block is
+	/// allocated near `goal`. New indirection blocks are also allocated near `goal`.
+	///
+	/// If a block is already mapped, it is kept.
 	///
 	/// **Note**: the function assumes the inode is locked.
 	///
-	/// On success, the function returns the allocated disk block offset.
-	pub fn alloc_content_blk(&mut self, off: u32, fs: &Ext2Fs) -> EResult<u32> {
+	/// On success, the function returns the disk block offset of the content block and whether
+	/// `data` has been used.
+	fn map_content_blk(
+		&mut self,
+		off: u32,
+		data: Option<u32>,
+		mut goal: u32,
+		fs: &Ext2Fs,
+	) -> EResult<(u32, bool)> {
 		let mut offsets: [usize; 4] = [0; 4];
 		let depth = indirections_offsets(off, fs.sp.get_entries_per_block_log(), &mut offsets)?;
+		let mut used = false;
+		// Returns the block to insert at the given level
+		let mut new_blk = |last: bool| -> EResult<u32> {
+			if let (true, Some(data)) = (last, data) {
+				used = true;
+				return Ok(data);
+			}
+			let blk = fs.alloc_blocks(goal, 1)?.start;
+			zero_block(fs, blk as _)?;
+			goal = blk + 1;
+			Ok(blk)
+		};
 		// Allocate the first level if needed
 		let blk_off = &mut self.i_block[offsets[0]];
 		if *blk_off == 0 {
-			*blk_off = fs.alloc_block()?;
-			zero_block(fs, *blk_off as _)?;
+			*blk_off = new_blk(depth == 1)?;
 		}
 		// Perform indirections
 		let mut blk_off = *blk_off;
-		for off in &offsets[1..depth] {
+		for (i, off) in offsets[1..depth].iter().enumerate() {
 			let blk = fs.dev.ops.read_page(&fs.dev, blk_off as _)?;
 			let ent = &blk.slice::<AtomicU32>()[*off];
 			// Allocate block if needed (two atomic operations are fine here since the node is
 			// locked)
 			let mut b = ent.load(Relaxed);
 			if b == 0 {
-				let new = fs.alloc_block()?;
-				zero_block(fs, new as _)?;
+				let new = new_blk(i + 2 == depth)?;
 				ent.store(new, Relaxed);
 				blk.mark_dirty();
 				b = new;
 			}
 			blk_off = b;
 		}
-		Ok(blk_off)
+		Ok((blk_off, used))
+	}
+
+	/// Allocates a block for the node's content block at the given file block offset `off`.
+	///
+	/// The allocated block is filled with zeros.
+	///
+	/// If a block is already allocated, the function does nothing.
+	///
+	/// **Note**: the function assumes the inode is locked.
+	///
+	/// On success, the function returns the allocated disk block offset.
+	pub fn alloc_content_blk(&mut self, off: u32, fs: &Ext2Fs) -> EResult<u32> {
+		let goal = self.blk_goal(off, fs)?;
+		Ok(self.map_content_blk(off, None, goal, fs)?.0)
+	}
+
+	/// Allocates blocks for the node's content blocks in the file block offsets range
+	/// `start..end`.
+	///
+	/// Blocks are allocated in contiguous runs when possible, so that the content can be read and
+	/// written with large requests. The allocated blocks are filled with zeros.
+	///
+	/// Blocks that are already allocated are kept.
+	///
+	/// **Note**: the function assumes the inode is locked.
+	pub fn alloc_content_range(&mut self, start: u32, end: u32, fs: &Ext2Fs) -> EResult<()> {
+		let mut off = start;
+		while off < end {
+			let goal = self.blk_goal(off, fs)?;
+			let count = min(end - off, ALLOC_RUN_MAX);
+			let run = fs.alloc_blocks(goal, count)?;
+			for blk in run.clone() {
+				let res = zero_block(fs, blk as _)
+					.and_then(|_| self.map_content_blk(off, Some(blk), run.end, fs));
+				match res {
+					// The offset was already mapped
+					Ok((_, false)) => fs.free_block(blk)?,
+					Ok((_, true)) => {}
+					Err(e) => {
+						// Free the rest of the run
+						for blk in blk..run.end {
+							fs.free_block(blk)?;
+						}
+						return Err(e);
+					}
+				}
+				off += 1;
+			}
+		}
+		Ok(())
 	}
 
 	fn free_content_blk_impl(blk: u32, offsets: &[usize], fs: &Ext2Fs) -> EResult<bool> {
@@ -475,6 +569,40 @@ impl Ext2INode {
 		Ok(())
 	}
 
+	/// Writes back the block of indirections `blk_off` and the blocks of indirections it points
+	/// to, if dirty.
+	///
+	/// `level` is the number of indirections below the block
+	fn indirect_sync_all(blk_off: u32, level: usize, fs: &Ext2Fs) -> EResult<()> {
+		let blk = fs.dev.ops.read_page(&fs.dev, blk_off as _)?;
+		if let Some(next_level) = level.checked_sub(1) {
+			for blk in blk.slice() {
+				let Some(blk) = check_blk_off(*blk, &fs.sp)? else {
+					continue;
+				};
+				Self::indirect_sync_all(blk.get(), next_level, fs)?;
+			}
+		}
+		blk.writeback(None, false)
+	}
+
+	/// Writes back the blocks of indirections of the inode, if dirty.
+	pub fn sync_indirect(&self, fs: &Ext2Fs) -> EResult<()> {
+		// Symbolic links stored inline have no blocks
+		if matches!(self.get_type(), FileType::Link)
+			&& self.get_size(&fs.sp) <= SYMLINK_INLINE_LIMIT
+		{
+			return Ok(());
+		}
+		for (off, blk) in self.i_block.iter().enumerate().skip(DIRECT_BLOCKS_COUNT) {
+			let Some(blk) = check_blk_off(*blk, &fs.sp)? else {
+				continue;
+			};
+			Self::indirect_sync_all(blk.get(), off - DIRECT_BLOCKS_COUNT, fs)?;
+		}
+		Ok(())
+	}
+
 	/// Frees all the content blocks of the inode.
 	pub fn free_content(&mut self, fs: &Ext2Fs) -> EResult<()> {
 		// If the file is a link and its content is stored inline, there is nothing to do
@@ -499,6 +627,12 @@ impl Ext2INode {
 		Ok(())
 	}
 
+	/// Tells whether the directory has a hash index.
+	pub fn is_indexed(&self, fs: &Ext2Fs) -> bool {
+		fs.sp.s_feature_compat & super::OPTIONAL_FEATURE_HASH_INDEX != 0
+			&& self.i_flags & INODE_FLAG_HASH_INDEXED != 0
+	}
+
 	/// Returns the information of a directory entry with the given name `name`.
 	///
 	/// The function returns:
@@ -513,7 +647,11 @@ impl Ext2INode {
 		if self.get_type() != FileType::Directory {
 			return Ok(None);
 		}
-		// TODO If the hash index is enabled, use it
+		if self.is_indexed(fs) {
+			if let Some(res) = htree::lookup(self, name, fs)? {
+				return Ok(res);
+			}
+		}
 		// Linear lookup
 		let mut blk = None;
 		for ent in DirentIterator::new(fs, self, &mut blk, 0)? {
@@ -612,6 +750,9 @@ impl Ext2INode {
 		if unlikely(rec_len as u32 > blk_size) {
 			return Err(errno!(ENAMETOOLONG));
 		}
+		if self.is_indexed(fs) && htree::add(self, fs, entry_inode, name, file_type)? {
+			return Ok(());
+		}
 		if let Some((blk, off, len)) = self.find_suitable_slot(fs, rec_len)? {
 			// Safe since the inode is locked
 			let buf = unsafe { blk.slice_mut() };
@@ -636,6 +777,13 @@ impl Ext2INode {
 				&fs.sp,
 			)?;
 			blk.mark_dirty();
+		} else if !fs.readonly
+			&& fs.sp.s_feature_compat & super::OPTIONAL_FEATURE_HASH_INDEX != 0
+			&& self.get_size(&fs.sp) == blk_size as u64
+			&& htree::make_indexed(self, fs)?
+		{
+			// The directory outgrows its first block: index it
+			htree::add(self, fs, entry_inode, name, file_type)?;
 		} else {
 			// No suitable free entry: Fill a new block
 			let blocks = self.get_blocks(&fs.sp);
@@ -679,8 +827,9 @@ impl Ext2INode {
 		let ent = Dirent::from_slice(&mut slice[inner_off..], &fs.sp)?;
 		ent.inode = inode as _;
 		blk.mark_dirty();
-		// If the block is now empty, free it
-		if inode == 0 && is_block_empty(slice, &fs.sp)? {
+		// If the block is now empty, free it. Blocks of indexed directories are referenced by the
+		// index, so they are kept
+		if inode == 0 && !self.is_indexed(fs) && is_block_empty(slice, &fs.sp)? {
 			// If this is the last block, update the file's size
 			if file_blk_off as u32 + 1 >= self.get_blocks(&fs.sp) {
 				self.set_size(&fs.sp, file_blk_off * blk_size as u64, false);
@@ -48,6 +48,7 @@
 
 mod bgd;
 mod dirent;
+mod htree;
 mod inode;
 
 use crate::{
@@ -57,8 +58,9 @@ use crate::{
 		fs::{
 			FileOps, Filesystem, FilesystemOps, FilesystemType, NodeOps, Statfs, downcast_fs,
 			ext2::{dirent::DirentIterator, inode::ROOT_DIRECTORY_INODE},
-			generic_file_read, generic_file_write,
+			generic_file_read, generic_file_splice_read, generic_file_write,
 		},
+		pipe::PipeBuffer,
 		vfs,
 		vfs::node::Node,
 	},
@@ -71,11 +73,12 @@ use crate::{
 };
 use bgd::BlockGroupDescriptor;
 use core::{
-	cmp::max,
+	cmp::{max, min},
 	hint::unlikely,
+	ops::Range,
 	sync::atomic::{
 		AtomicU8, AtomicU16, AtomicU32, AtomicUsize,
-		Ordering::{Acquire, Relaxed, Release},
+		Ordering::{AcqRel, Acquire, Relaxed, Release},
 	},
 };
 use inode::Ext2INode;
@@ -83,7 +86,7 @@ use macros::AnyRepr;
 use utils::{
 	boxed::Box,
 	bytes,
-	collections::path::PathBuf,
+	collections::{path::PathBuf, vec::Vec},
 	errno,
 	errno::EResult,
 	limits::{NAME_MAX, PAGE_SIZE, SYMLINK_MAX},
@@ -137,12 +140,10 @@ const WRITE_REQUIRED_64_BITS: u32 = 0x2;
 const WRITE_REQUIRED_DIRECTORY_BINARY_TREE: u32 = 0x4;
 
 /// Zeros the page at the given offset on the disk.
+///
+/// The previous content of the block is not read from the disk.
 fn zero_block(fs: &Ext2Fs, off: u64) -> EResult<()> {
-	let blk = fs.dev.ops.read_page(&fs.dev, off)?;
-	for b in blk.slice::<AtomicUsize>() {
-		b.store(0, Relaxed);
-	}
-	blk.mark_dirty();
+	fs.dev.ops.zero_page(&fs.dev, off)?;
 	Ok(())
 }
 
@@ -175,6 +176,169 @@ fn bitmap_alloc_impl(blk: &RcPage) -> Option<u32> {
 	None
 }
 
+/// Finds the first run of `0` bits in the given block, in the range `range`, then returns its
+/// range.
+///
+/// If no bit is found, the function returns `None`.
+fn bitmap_find_run(blk: &RcPage, range: Range<u32>) -> Option<Range<u32>> {
+	let units = blk.slice::<AtomicUsize>();
+	let bits = usize::BITS;
+	// Find the first zero bit, skipping full units
+	let mut i = range.start;
+	while i < range.end {
+		let free = !units[(i / bits) as usize].load(Acquire) >> (i % bits);
+		if free != 0 {
+			i += free.trailing_zeros();
+			break;
+		}
+		i = (i / bits + 1) * bits;
+	}
+	if i >= range.end {
+		return None;
+	}
+	// Find the end of the run
+	let start = i;
+	while i < range.end {
+		let shift = i % bits;
+		let used = units[(i / bits) as usize].load(Acquire) >> shift;
+		let n = min(used.trailing_zeros(), bits - shift);
+		i += n;
+		if n < bits - shift {
+			break;
+		}
+	}
+	Some(start..min(i, range.end))
+}
+
+/// Atomically sets the `0` bits in the given block, in the range `range`, stopping at the first
+/// bit that is already set.
+///
+/// The function returns the number of bits that have been set.
+fn bitmap_claim(blk: &RcPage, range: Range<u32>) -> u32 {
+	let units = blk.slice::<AtomicUsize>();
+	let bits = usize::BITS;
+	let mut i = range.start;
+	while i < range.end {
+		let shift = i % bits;
+		let n = min(range.end - i, bits - shift);
+		let mask = (usize::MAX >> (bits - n)) << shift;
+		// The bits that have been set in the unit
+		let mut claimed = 0;
+		let _ = units[(i / bits) as usize].fetch_update(AcqRel, Acquire, |unit| {
+			// Stop before the first bit that is already set
+			let taken = unit & mask;
+			claimed = match taken {
+				0 => mask,
+				_ => mask & ((1 << taken.trailing_zeros()) - 1),
+			};
+			(claimed != 0).then_some(unit | claimed)
+		});
+		i += claimed.count_ones();
+		if claimed != mask {
+			break;
+		}
+	}
+	let count = i - range.start;
+	if count > 0 {
+		blk.mark_dirty();
+	}
+	count
+}
+
+/// In-memory allocation state of a block group.
+///
+/// It is only a hint: the group's bitmap remains the reference, so a stale state can only make
+/// an allocation slower.
+#[derive(Debug, Default)]
+struct GroupAlloc {
+	/// A run of free blocks, relative to the group. Allocations are served from it first
+	free: Range<u32>,
+	/// The offset in the group at which the next search for free blocks starts
+	hint: u32,
+}
+
+impl GroupAlloc {
+	/// Removes `range` from the cached run of free blocks, if they overlap.
+	fn consume(&mut self, range: &Range<u32>) {
+		if range.contains(&self.free.start) {
+			self.free.start = min(range.end, self.free.end);
+		} else if self.free.contains(&range.start) {
+			self.free.end = range.start;
+		}
+	}
+
+	/// Claims up to `count` contiguous free blocks in the group's bitmap `bitmap`, which has
+	/// `size` entries.
+	///
+	/// If `goal` is `Some`, the group first attempts to allocate blocks starting at this offset.
+	///
+	/// If no free block can be found, the function returns `None`.
+	fn alloc(
+		&mut self,
+		bitmap: &RcPage,
+		size: u32,
+		goal: Option<u32>,
+		count: u32,
+	) -> Option<Range<u32>> {
+		if let Some(goal) = goal.filter(|goal| *goal < size) {
+			let len = bitmap_claim(bitmap, goal..min(goal.saturating_add(count), size));
+			if len > 0 {
+				let range = goal..(goal + len);
+				self.consume(&range);
+				return Some(range);
+			}
+		}
+		// Use the cached run of free blocks
+		if !self.free.is_empty() {
+			let start = self.free.start;
+			let end = min(start.saturating_add(count), self.free.end);
+			let len = bitmap_claim(bitmap, start..end);
+			if len > 0 {
+				self.free.start = start + len;
+				// A part of the run has been allocated somewhere else
+				if start + len < end {
+					self.free = Range::default();
+				}
+				self.hint = start + len;
+				return Some(start..(start + len));
+			}
+			self.free = Range::default();
+		}
+		// Search for a free run, from the hint then from the beginning of the group
+		let hint = min(self.hint, size);
+		for mut range in [hint..size, 0..hint] {
+			while let Some(run) = bitmap_find_run(bitmap, range.clone()) {
+				let end = min(run.start.saturating_add(count), run.end);
+				let len = bitmap_claim(bitmap, run.start..end);
+				if len == 0 {
+					// The block has been allocated concurrently
+					range.start = run.start + 1;
+					continue;
+				}
+				let alloc_end = run.start + len;
+				// Keep the rest of the run for next allocations
+				if alloc_end == end {
+					self.free = alloc_end..run.end;
+				}
+				self.hint = alloc_end;
+				return Some(run.start..alloc_end);
+			}
+		}
+		None
+	}
+
+	/// Accounts for the block at offset `blk` in the group being freed.
+	fn free(&mut self, blk: u32) {
+		if self.free.is_empty() {
+			self.free = blk..(blk + 1);
+		} else if blk == self.free.end {
+			self.free.end += 1;
+		} else if blk + 1 == self.free.start {
+			self.free.start -= 1;
+		}
+	}
+}
+
 /// Node operations.
 #[derive(Debug)]
 struct Ext2NodeOps;
@@ -195,7 +359,7 @@ impl NodeOps for Ext2NodeOps {
 						Box::new(Ext2FileOps)?,
 					);
 					let stat = Ext2INode::get(&node, fs)?.stat(&fs.sp);
-					node.stat = Spin::new(stat);
+					node.init_stat(stat);
 					Ok(Arc::new(node)?)
 				})
 			})
@@ -428,6 +592,40 @@ impl NodeOps for Ext2NodeOps {
 		})
 	}
 
+	fn readahead(&self, node: &Arc<Node>, range: Range<u64>) -> EResult<()> {
+		let fs = downcast_fs::<Ext2Fs>(&*node.fs.ops);
+		// Translate offsets to runs of contiguous blocks that are not in cache
+		let mut runs: Vec<(u64, u64, u64)> = Vec::new();
+		{
+			let inode = Ext2INode::get(node, fs)?;
+			for off in range {
+				if node.mapped.get(off).is_some() {
+					continue;
+				}
+				let file_off: u32 = off.try_into().map_err(|_| errno!(EOVERFLOW))?;
+				let Some(blk_off) = inode.translate_blk_off(file_off, fs)? else {
+					continue;
+				};
+				let blk_off = blk_off.get() as u64;
+				match runs.last_mut() {
+					Some((last_off, last_blk, count))
+						if *last_off + *count == off && *last_blk + *count == blk_off =>
+					{
+						*count += 1
+					}
+					_ => runs.push((off, blk_off, 1))?,
+				}
+			}
+		}
+		for (off, blk_off, count) in runs {
+			let pages = fs.dev.ops.start_read(&fs.dev, blk_off, count)?;
+			for (off, page) in (off..).zip(pages) {
+				node.mapped.insert(off, &page)?;
+			}
+		}
+		Ok(())
+	}
+
 	fn set_stat(&self, node: &Node, stat: &Stat) -> EResult<()> {
 		let fs = downcast_fs::<Ext2Fs>(&*node.fs.ops);
 		let mut inode_ = Ext2INode::get(node, fs)?;
@@ -440,6 +638,13 @@ impl NodeOps for Ext2NodeOps {
 		inode_.mark_dirty();
 		Ok(())
 	}
+
+	fn sync_metadata(&self, node: &Node) -> EResult<()> {
+		let fs = downcast_fs::<Ext2Fs>(&*node.fs.ops);
+		let inode_ = Ext2INode::get(node, fs)?;
+		inode_.sync_indirect(fs)?;
+		inode_.writeback()
+	}
 }
 
 /// Open file operations.
@@ -461,6 +666,25 @@ impl FileOps for Ext2FileOps {
 		generic_file_read(file, off, buf)
 	}
 
+	fn splice_read(
+		&self,
+		file: &File,
+		off: u64,
+		pipe: &PipeBuffer,
+		len: usize,
+		nonblock: bool,
+	) -> EResult<usize> {
+		let node = file.node();
+		let fs = downcast_fs::<Ext2Fs>(&*node.fs.ops);
+		{
+			let inode_ = Ext2INode::get(node, fs)?;
+			if inode_.get_type() != FileType::Regular {
+				return Err(errno!(EINVAL));
+			}
+		}
+		generic_file_splice_read(file, off, pipe, len, nonblock)
+	}
+
 	fn write(&self, file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
 		let node = file.node();
 		let fs = downcast_fs::<Ext2Fs>(&*node.fs.ops);
@@ -489,6 +713,7 @@ impl FileOps for Ext2FileOps {
 		if inode_.get_type() != FileType::Regular {
 			return Err(errno!(EINVAL));
 		}
+		node.content_changed();
 		// The size of a block
 		let blk_size = fs.sp.get_block_size();
 		let old_size = inode_.get_size(&fs.sp);
@@ -505,9 +730,7 @@ impl FileOps for Ext2FileOps {
 			// Expand the file
 			let start = old_size.div_ceil(blk_size as _) as u32;
 			let end = size.div_ceil(blk_size as _) as u32;
-			for off in start..end {
-				inode_.alloc_content_blk(off, fs)?;
-			}
+			inode_.alloc_content_range(start, end, fs)?;
 		}
 		// Update size
 		inode_.set_size(&fs.sp, size, false);
@@ -607,8 +830,16 @@ pub struct Superblock {
 	s_journal_dev: u32,
 	/// The head of orphan inodes list.
 	s_last_orphan: u32,
+	/// The seed for the hash of names in indexed directories.
+	s_hash_seed: [u32; 4],
+	/// The default hash version for indexed directories.
+	s_def_hash_version: u8,
+	/// Unused.
+	_reserved: [u8; 99],
+	/// Miscellaneous flags.
+	s_flags: u32,
 
-	_padding: [u8; 788],
+	_padding: [u8; 668],
 }
 
 impl Superblock {
@@ -667,6 +898,8 @@ struct Ext2Fs {
 	sp: RcBlockVal<Superblock>,
 	/// Tells whether the filesystem is mounted as read-only
 	readonly: bool,
+	/// The allocation state of each block group
+	groups: Vec<Spin<GroupAlloc>>,
 }
 
 impl Ext2Fs {
@@ -767,33 +1000,67 @@ impl Ext2Fs {
 		Ok(())
 	}
 
-	/// Returns the ID of a free block in the filesystem.
-	pub fn alloc_block(&self) -> EResult<u32> {
-		if unlikely(self.sp.s_free_inodes_count.load(Acquire) == 0) {
+	/// Allocates up to `count` contiguous blocks and returns their range.
+	///
+	/// `goal` is the block at which the allocation should preferably start, to keep related
+	/// blocks close to each other. If zero, there is no preference.
+	///
+	/// At least one block is allocated, but the function may return fewer than `count` blocks if
+	/// no large enough run of free blocks is found quickly. If no free block can be found, the
+	/// function returns an error.
+	pub fn alloc_blocks(&self, goal: u32, count: u32) -> EResult<Range<u32>> {
+		if unlikely(self.sp.s_free_blocks_count.load(Acquire) == 0) {
 			return Err(errno!(ENOSPC));
 		}
-		for i in 0..self.sp.get_block_groups_count() {
-			let bgd = BlockGroupDescriptor::get(i as _, self)?;
+		let blocks_per_group = self.sp.s_blocks_per_group;
+		let groups_count = self.sp.get_block_groups_count();
+		let goal = if goal < self.sp.s_blocks_count {
+			goal
+		} else {
+			0
+		};
+		let goal_group = goal / blocks_per_group;
+		// Search from the goal's group, wrapping around
+		for i in 0..groups_count {
+			let group = (goal_group + i) % groups_count;
+			let bgd = BlockGroupDescriptor::get(group, self)?;
 			if bgd.bg_free_blocks_count.load(Acquire) == 0 {
 				continue;
 			}
-			let Some(j) = self.bitmap_alloc(bgd.bg_block_bitmap, self.sp.s_blocks_per_group)?
-			else {
+			// Read the bitmap before locking, since it may require sleeping
+			let bitmap = self
+				.dev
+				.ops
+				.read_page(&self.dev, bgd.bg_block_bitmap as _)?;
+			let group_goal = (goal != 0 && i == 0).then_some(goal % blocks_per_group);
+			let Some(run) = self.groups[group as usize].lock().alloc(
+				&bitmap,
+				blocks_per_group,
+				group_goal,
+				count.max(1),
+			) else {
 				continue;
 			};
-			let blk_index = i * self.sp.s_blocks_per_group + j;
-			if unlikely(blk_index <= 2 || blk_index >= self.sp.s_blocks_count) {
+			let start = group * blocks_per_group + run.start;
+			let end = group * blocks_per_group + run.end;
+			if unlikely(start <= 2 || end > self.sp.s_blocks_count) {
 				return Err(errno!(EUCLEAN));
 			}
-			self.sp.s_free_blocks_count.fetch_sub(1, Release);
-			bgd.bg_free_blocks_count.fetch_sub(1, Release);
+			let len = end - start;
+			self.sp.s_free_blocks_count.fetch_sub(len, Release);
+			bgd.bg_free_blocks_count.fetch_sub(len as _, Release);
 			self.sp.mark_dirty();
 			bgd.mark_dirty();
-			return Ok(blk_index);
+			return Ok(start..end);
 		}
 		Err(errno!(ENOSPC))
 	}
 
+	/// Returns the ID of a free block in the filesystem.
+	pub fn alloc_block(&self) -> EResult<u32> {
+		Ok(self.alloc_blocks(0, 1)?.start)
+	}
+
 	/// Marks the block `blk` available on the filesystem.
 	///
 	/// If `blk` is zero, the function does nothing.
@@ -814,6 +1081,9 @@ impl Ext2Fs {
 			bgd.bg_free_blocks_count.fetch_add(1, Release);
 			self.sp.mark_dirty();
 			bgd.mark_dirty();
+			if let Some(alloc) = self.groups.get(group as usize) {
+				alloc.lock().free(bitfield_index);
+			}
 		}
 		Ok(())
 	}
@@ -857,7 +1127,7 @@ impl FilesystemOps for Ext2Fs {
 				Box::new(Ext2FileOps)?,
 			);
 			let stat = Ext2INode::get(&node, self)?.stat(&self.sp);
-			node.stat = Spin::new(stat);
+			node.init_stat(stat);
 			Ok(Arc::new(node)?)
 		})
 	}
@@ -914,7 +1184,7 @@ impl FilesystemOps for Ext2Fs {
 		// Update stat on `node` and return it
 		let stat = inode.stat(&self.sp);
 		drop(inode);
-		node.stat = Spin::new(stat);
+		node.init_stat(stat);
 		// Insert in cache
 		let node = Arc::new(node)?;
 		fs.node_insert(node.clone())?;
@@ -972,6 +1242,11 @@ impl FilesystemType for Ext2FsType {
 		if unlikely(sp.s_log_block_size != 2) {
 			return Err(errno!(EINVAL));
 		}
+		// Each block group must have a single block of bitmap
+		if unlikely(sp.s_blocks_per_group == 0 || sp.s_blocks_per_group > sp.get_block_size() * 8)
+		{
+			return Err(errno!(EINVAL));
+		}
 		if sp.s_rev_level >= 1 {
 			if unlikely(
 				!sp.s_inode_size.is_power_of_two()
@@ -1010,12 +1285,18 @@ impl FilesystemType for Ext2FsType {
 		sp.s_mtime.store(ts as _, Relaxed);
 		sp.s_mnt_count.fetch_add(1, Relaxed);
 		sp.mark_dirty();
+		let groups_count = sp.get_block_groups_count() as usize;
+		let mut groups = Vec::with_capacity(groups_count)?;
+		for _ in 0..groups_count {
+			groups.push(Spin::new(GroupAlloc::default()))?;
+		}
 		Ok(Filesystem::new(
 			dev.id.get_device_number(),
 			Box::new(Ext2Fs {
 				dev,
 				sp,
 				readonly,
+				groups,
 			})?,
 		)?)
 	}
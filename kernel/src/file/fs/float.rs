@@ -16,8 +16,8 @@
  * Maestro. If not, see <https://www.gnu.org/licenses/>.
  */
 
-//! floatfs is a filesystem for "floating" files. Those are pipes and sockets created by system
-//! calls, without any link to regular filesystems.
+//! floatfs is a filesystem for "floating" files. Those are pipes, sockets and other objects such
+//! as `epoll` instances, created by system calls without any link to regular filesystems.
 
 use crate::{
 	file::{
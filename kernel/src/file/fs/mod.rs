@@ -29,13 +29,14 @@ pub mod tmp;
 use super::{
 	DirContext, File, INode, Mode, Stat,
 	perm::{Gid, Uid},
+	pipe::{PipeBuf, PipeBuffer},
 	vfs,
 };
 use crate::{
 	device::BlkDev,
 	file::vfs::node::Node,
-	memory::{cache::RcPage, user::UserSlice},
-	sync::{mutex::Mutex, spin::Spin},
+	memory::{buddy::ZONE_KERNEL, cache, cache::RcPage, user::UserSlice},
+	sync::{mutex::Mutex, spin::Spin, wait_queue::PollTable},
 	syscall::ioctl,
 	time::unit::Timestamp,
 };
@@ -48,6 +49,7 @@ use core::{
 	fmt::{Debug, Formatter},
 	hash::{Hash, Hasher},
 	hint::unlikely,
+	ops::Range,
 };
 use utils::{
 	boxed::Box,
@@ -233,6 +235,17 @@ pub trait NodeOps: Any + Debug {
 		Err(errno!(EINVAL))
 	}
 
+	/// Starts reading the pages in range `range`, in pages, from `node` into its page cache.
+	///
+	/// The function does not wait for the pages to be read. Pages that are already in cache are
+	/// skipped.
+	///
+	/// The default implementation of this function does nothing.
+	fn readahead(&self, node: &Arc<Node>, range: Range<u64>) -> EResult<()> {
+		let _ = (node, range);
+		Ok(())
+	}
+
 	/// Updates the node's status.
 	///
 	/// The default implementation of this function does nothing.
@@ -240,6 +253,13 @@ pub trait NodeOps: Any + Debug {
 		let _ = (node, stat);
 		Ok(())
 	}
+
+	/// Writes the metadata of `node` that is needed to retrieve its content back to the storage.
+	///
+	/// The default implementation synchronizes the whole filesystem.
+	fn sync_metadata(&self, node: &Node) -> EResult<()> {
+		node.fs.ops.sync_fs()
+	}
 }
 
 /// Open file operations.
@@ -270,6 +290,18 @@ pub trait FileOps: Any + Debug {
 		Err(errno!(EINVAL))
 	}
 
+	/// Registers `table` on the wait queues that are woken up when events in `mask` may occur on
+	/// the file, so that the file can be watched without calling [`Self::poll`] repeatedly.
+	///
+	/// Hooks may be notified spuriously: [`Self::poll`] tells which events actually occurred.
+	///
+	/// The default implementation returns [`errno::EPERM`], meaning the file does not support
+	/// event notification.
+	fn poll_wait(&self, file: &File, mask: u32, table: &mut PollTable) -> EResult<()> {
+		let _ = (file, mask, table);
+		Err(errno!(EPERM))
+	}
+
 	/// Performs an ioctl operation on the device file.
 	///
 	/// Arguments:
@@ -311,6 +343,56 @@ pub trait FileOps: Any + Debug {
 		Err(errno!(EINVAL))
 	}
 
+	/// Reads like [`Self::read`], except that the function returns [`errno::EAGAIN`] instead of
+	/// waiting for data, regardless of the `O_NONBLOCK` flag of `file`.
+	///
+	/// The default implementation calls [`Self::read`], which is correct for files on which
+	/// reading never waits.
+	fn read_nonblock(&self, file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		self.read(file, off, buf)
+	}
+
+	/// Writes like [`Self::write`], except that the function returns [`errno::EAGAIN`] instead
+	/// of waiting for room, regardless of the `O_NONBLOCK` flag of `file`.
+	///
+	/// The default implementation calls [`Self::write`], which is correct for files on which
+	/// writing never waits.
+	fn write_nonblock(&self, file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		self.write(file, off, buf)
+	}
+
+	/// Moves up to `len` bytes of the content of `file`, from offset `off`, to the pipe `pipe`.
+	///
+	/// If `nonblock` is set, the function does not wait for room in the pipe.
+	///
+	/// On success, the function returns the number of bytes moved.
+	///
+	/// The default implementation copies a single page of content with [`Self::read`]. Files
+	/// backed by the page cache should use [`generic_file_splice_read`] instead.
+	fn splice_read(
+		&self,
+		file: &File,
+		mut off: u64,
+		pipe: &PipeBuffer,
+		len: usize,
+		nonblock: bool,
+	) -> EResult<usize> {
+		// Reading more may block on files that are not regular
+		let mut done = false;
+		pipe.splice_in(len, nonblock, |max| {
+			if done {
+				return Ok(None);
+			}
+			done = true;
+			let page = RcPage::new(ZONE_KERNEL, None, 0)?;
+			let len = min(max, PAGE_SIZE);
+			let buf = UserSlice::from_slice_mut(unsafe { &mut page.slice_mut::<u8>()[..len] });
+			let len = self.read(file, off, buf)?;
+			off += len as u64;
+			Ok(Some(PipeBuf::new(page, 0, len)))
+		})
+	}
+
 	/// Changes the size of the file, truncating its content if necessary.
 	///
 	/// If `size` is greater than or equals to the current size of the file, the function does
@@ -335,6 +417,13 @@ pub fn generic_file_read(file: &File, mut off: u64, buf: UserSlice<u8>) -> EResu
 	let buf_len = min(buf.len() as u64, size - off);
 	let start = off / PAGE_SIZE as u64;
 	let end = off.saturating_add(buf_len).div_ceil(PAGE_SIZE as u64);
+	if let Some(range) = file
+		.readahead
+		.on_read(start, end, size.div_ceil(PAGE_SIZE as u64))
+	{
+		// Readahead is only an optimization: errors are reported by the read itself
+		let _ = node.node_ops.readahead(node, range);
+	}
 	let mut buf_off = 0;
 	for page_off in start..end {
 		let page = node.node_ops.read_page(node, page_off)?;
@@ -350,11 +439,45 @@ pub fn generic_file_read(file: &File, mut off: u64, buf: UserSlice<u8>) -> EResu
 	Ok(buf_off)
 }
 
+/// Generic implementation for [`FileOps::splice_read`] on regular files.
+///
+/// The pipe references pages of the page cache instead of copying their content.
+///
+/// **Note**: `file` **must** have an associated [`Node`], otherwise the function panics.
+pub fn generic_file_splice_read(
+	file: &File,
+	mut off: u64,
+	pipe: &PipeBuffer,
+	len: usize,
+	nonblock: bool,
+) -> EResult<usize> {
+	let node = file.node();
+	let size = file.stat().size;
+	let len = min(len as u64, size.saturating_sub(off));
+	let start = off / PAGE_SIZE as u64;
+	let end = off.saturating_add(len).div_ceil(PAGE_SIZE as u64);
+	if let Some(range) = file
+		.readahead
+		.on_read(start, end, size.div_ceil(PAGE_SIZE as u64))
+	{
+		// Readahead is only an optimization: errors are reported by the read itself
+		let _ = node.node_ops.readahead(node, range);
+	}
+	pipe.splice_in(len as usize, nonblock, |max| {
+		let page = node.node_ops.read_page(node, off / PAGE_SIZE as u64)?;
+		let inner_off = off as usize % PAGE_SIZE;
+		let len = min(max, PAGE_SIZE - inner_off);
+		off += len as u64;
+		Ok(Some(PipeBuf::new(page, inner_off, len)))
+	})
+}
+
 /// Generic implementation for [`FileOps::write`] on regular files.
 ///
 /// **Note**: `file` **must** have an associated [`Node`], otherwise the function panics.
 pub fn generic_file_write(file: &File, mut off: u64, buf: UserSlice<u8>) -> EResult<usize> {
 	let node = file.node();
+	node.content_changed();
 	let size = file.stat().size;
 	// Extend the file if necessary
 	let end = off.saturating_add(buf.len() as u64);
@@ -375,6 +498,7 @@ pub fn generic_file_write(file: &File, mut off: u64, buf: UserSlice<u8>) -> ERes
 		buf_off += len;
 		off += len as u64;
 	}
+	cache::balance_dirty_pages();
 	Ok(buf_off)
 }
 
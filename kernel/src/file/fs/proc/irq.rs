@@ -0,0 +1,195 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! The `irq` directory exposes the interrupts registered with [`int::alloc_irq`].
+//!
+//! Each interrupt has a directory named after its number, containing:
+//! - `name`: the name of the interrupt
+//! - `smp_affinity`: the mask of CPU cores the interrupt may be sent to, in hexadecimal. Since an
+//!   interrupt is sent to a single core, writing a mask selects the lowest online core in it
+
+use crate::{
+	file::{
+		DirContext, DirEntry, File, FileType, Stat,
+		fs::{
+			DummyOps, FileOps, NodeOps,
+			kernfs::{EitherOps, StaticDir, StaticEntry, box_file, static_dir_stat},
+		},
+		vfs,
+		vfs::node::Node,
+	},
+	format_content, int,
+	memory::user::UserSlice,
+	process::scheduler::cpu::cpus,
+};
+use core::{fmt, fmt::Formatter, hint::unlikely, sync::atomic::Ordering::Acquire};
+use utils::{boxed::Box, errno, errno::EResult, format, ptr::arc::Arc};
+
+/// The directory containing a directory for each interrupt.
+#[derive(Clone, Debug)]
+pub struct IrqDir;
+
+impl NodeOps for IrqDir {
+	fn lookup_entry<'n>(&self, dir: &Node, ent: &mut vfs::Entry) -> EResult<()> {
+		let irq = core::str::from_utf8(&ent.name)
+			.ok()
+			.and_then(|s| s.parse().ok())
+			.filter(|irq| int::get_irq(*irq).is_some());
+		let Some(irq) = irq else {
+			return Ok(());
+		};
+		ent.node = Some(Arc::new(Node::new(
+			0,
+			dir.fs.clone(),
+			static_dir_stat(),
+			Box::new(StaticDir {
+				entries: &[
+					StaticEntry {
+						name: b"name",
+						stat: |_| Stat {
+							mode: FileType::Regular.to_mode() | 0o444,
+							..Default::default()
+						},
+						init: EitherOps::File(|irq| box_file(Name(irq))),
+					},
+					StaticEntry {
+						name: b"smp_affinity",
+						stat: |_| Stat {
+							mode: FileType::Regular.to_mode() | 0o644,
+							..Default::default()
+						},
+						init: EitherOps::File(|irq| box_file(SmpAffinity(irq))),
+					},
+				],
+				data: irq,
+			})?,
+			Box::new(DummyOps)?,
+		))?);
+		Ok(())
+	}
+
+	fn iter_entries(&self, _dir: &Node, ctx: &mut DirContext) -> EResult<()> {
+		let off: usize = ctx.off.try_into().map_err(|_| errno!(EINVAL))?;
+		for irq in off..int::irq_count() {
+			let name = format!("{irq}")?;
+			let ent = DirEntry {
+				inode: 0,
+				entry_type: Some(FileType::Directory),
+				name: &name,
+			};
+			if !(ctx.write)(&ent)? {
+				break;
+			}
+			ctx.off += 1;
+		}
+		Ok(())
+	}
+}
+
+/// The `name` file of an interrupt.
+#[derive(Debug)]
+struct Name(usize);
+
+impl FileOps for Name {
+	fn read(&self, _file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		let irq = int::get_irq(self.0).ok_or_else(|| errno!(ENOENT))?;
+		format_content!(off, buf, "{}\n", irq.name)
+	}
+}
+
+/// Displays a mask of CPU cores with only the bit of `cpu` set, in comma-separated groups of 32
+/// bits, most significant first.
+struct CpuMaskDisplay {
+	/// The core whose bit is set
+	cpu: u32,
+	/// The number of groups to display
+	groups: u32,
+}
+
+impl fmt::Display for CpuMaskDisplay {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		for group in (0..self.groups).rev() {
+			let bits = if self.cpu / 32 == group {
+				1u32 << (self.cpu % 32)
+			} else {
+				0
+			};
+			write!(f, "{bits:08x}")?;
+			if group > 0 {
+				write!(f, ",")?;
+			}
+		}
+		writeln!(f)
+	}
+}
+
+/// Returns the lowest online CPU core in the hexadecimal mask `mask`.
+///
+/// Commas and whitespaces in `mask` are ignored.
+///
+/// If the mask is invalid or does not contain any online core, the function returns `None`.
+fn parse_cpu_mask(mask: &[u8]) -> Option<u32> {
+	let mut cpu = 0;
+	let mut found = None;
+	// Digits are iterated from the least significant
+	for c in mask.iter().rev() {
+		if *c == b',' || c.is_ascii_whitespace() {
+			continue;
+		}
+		let digit = (*c as char).to_digit(16)?;
+		for bit in 0..4 {
+			let online = cpus()
+				.get((cpu + bit) as usize)
+				.is_some_and(|c| c.online.load(Acquire));
+			if found.is_none() && digit & (1 << bit) != 0 && online {
+				found = Some(cpu + bit);
+			}
+		}
+		cpu += 4;
+	}
+	found
+}
+
+/// The `smp_affinity` file of an interrupt.
+#[derive(Debug)]
+struct SmpAffinity(usize);
+
+impl FileOps for SmpAffinity {
+	fn read(&self, _file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		let irq = int::get_irq(self.0).ok_or_else(|| errno!(ENOENT))?;
+		let mask = CpuMaskDisplay {
+			cpu: irq.cpu(),
+			groups: cpus().len().div_ceil(32).max(1) as u32,
+		};
+		format_content!(off, buf, "{mask}")
+	}
+
+	fn write(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		let irq = int::get_irq(self.0).ok_or_else(|| errno!(ENOENT))?;
+		let mut b = [0u8; 256];
+		let len = buf.copy_from_user(0, &mut b)?;
+		if unlikely(len == b.len()) {
+			return Err(errno!(EINVAL));
+		}
+		let cpu = parse_cpu_mask(&b[..len]).ok_or_else(|| errno!(EINVAL))?;
+		unsafe {
+			irq.set_affinity(cpu)?;
+		}
+		Ok(buf.len())
+	}
+}
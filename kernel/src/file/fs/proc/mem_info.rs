@@ -32,7 +32,6 @@ pub struct MemInfo;
 
 impl FileOps for MemInfo {
 	fn read(&self, _file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
-		let mem_info = memory::stats::MEM_INFO.lock().clone();
-		format_content!(off, buf, "{}", mem_info)
+		format_content!(off, buf, "{}", memory::stats::mem_info())
 	}
 }
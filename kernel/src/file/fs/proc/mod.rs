@@ -19,12 +19,16 @@
 //! The `procfs` is a virtual filesystem which provides information about
 //! processes.
 
+mod irq;
 mod mem_info;
 mod proc_dir;
+mod profile;
 mod self_link;
 mod sys_dir;
+mod trace;
 mod uptime;
 mod version;
+mod vmstat;
 
 use super::{DummyOps, Filesystem, FilesystemOps, FilesystemType, NodeOps};
 use crate::{
@@ -44,17 +48,21 @@ use crate::{
 	},
 	process::{PROCESSES, Process, pid::Pid},
 };
+use irq::IrqDir;
 use mem_info::MemInfo;
 use proc_dir::{
 	cmdline::Cmdline, cwd::Cwd, exe::Exe, mounts::Mounts, stat::StatNode, status::Status,
 };
+use profile::Profile;
 use self_link::SelfNode;
 use sys_dir::OsRelease;
+use trace::Trace;
 use uptime::Uptime;
 use utils::{
 	boxed::Box, collections::path::PathBuf, errno, errno::EResult, format, ptr::arc::Arc,
 };
 use version::Version;
+use vmstat::VmStat;
 
 /// Returns the user ID and group ID of the process with the given PID.
 ///
@@ -91,6 +99,11 @@ impl RootDir {
 	/// processes.
 	const STATIC: StaticDir = StaticDir {
 		entries: &[
+			StaticEntry {
+				name: b"irq",
+				stat: |_| static_dir_stat(),
+				init: EitherOps::Node(|_| box_node(IrqDir)),
+			},
 			StaticEntry {
 				name: b"meminfo",
 				stat: |_| Stat {
@@ -107,6 +120,14 @@ impl RootDir {
 				},
 				init: EitherOps::Node(|_| box_node(StaticLink(b"self/mounts"))),
 			},
+			StaticEntry {
+				name: b"profile",
+				stat: |_| Stat {
+					mode: FileType::Regular.to_mode() | 0o600,
+					..Default::default()
+				},
+				init: EitherOps::File(|_| box_file(Profile)),
+			},
 			StaticEntry {
 				name: b"self",
 				stat: |_| Stat {
@@ -138,6 +159,14 @@ impl RootDir {
 					})
 				}),
 			},
+			StaticEntry {
+				name: b"trace",
+				stat: |_| Stat {
+					mode: FileType::Regular.to_mode() | 0o600,
+					..Default::default()
+				},
+				init: EitherOps::File(|_| box_file(Trace)),
+			},
 			StaticEntry {
 				name: b"uptime",
 				stat: |_| Stat {
@@ -154,6 +183,14 @@ impl RootDir {
 				},
 				init: EitherOps::File(|_| box_file(Version)),
 			},
+			StaticEntry {
+				name: b"vmstat",
+				stat: |_| Stat {
+					mode: FileType::Regular.to_mode() | 0o444,
+					..Default::default()
+				},
+				init: EitherOps::File(|_| box_file(VmStat)),
+			},
 		],
 		data: (),
 	};
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! The `profile` file returns the samples collected by the CPU profiler, as folded stacks.
+//!
+//! See [`crate::profile`] for the format.
+
+use crate::{
+	file::{File, fs::FileOps},
+	format_content,
+	memory::user::UserSlice,
+	profile,
+	profile::FoldedDisplay,
+};
+use utils::{errno, errno::EResult};
+
+/// The `profile` file.
+#[derive(Debug, Default)]
+pub struct Profile;
+
+impl FileOps for Profile {
+	fn read(&self, _file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		// Only collect pending samples at the beginning of the file, so that the content does not
+		// change while it is read in several chunks
+		let samples = profile::samples(off == 0)?;
+		format_content!(off, buf, "{}", FoldedDisplay(&samples))
+	}
+
+	fn write(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		let mut b = [0u8];
+		if buf.copy_from_user(0, &mut b)? == 0 {
+			return Ok(0);
+		}
+		match b[0] {
+			b'0' => profile::set_enabled(false)?,
+			b'1' => profile::set_enabled(true)?,
+			_ => return Err(errno!(EINVAL)),
+		}
+		Ok(buf.len())
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! The `trace` file exports the events recorded by the kernel tracer as a binary stream.
+//!
+//! See [`crate::trace`] for the format.
+
+use crate::{
+	file::{File, O_NONBLOCK, fs::FileOps},
+	memory::user::UserSlice,
+	process::scheduler::cpu::cpus,
+	sync::mutex::Mutex,
+	time::{clock::Clock, sleep_for},
+	trace,
+	trace::Event,
+};
+use core::{hint::unlikely, mem::size_of};
+use utils::{bytes::as_bytes, errno, errno::EResult};
+
+/// The delay between two polls of the rings while waiting for events, in nanoseconds.
+const POLL_DELAY: u64 = 10_000_000;
+
+/// Lock ensuring the rings have a single consumer at a time.
+static READER: Mutex<()> = Mutex::new(());
+
+/// The `trace` file.
+#[derive(Debug, Default)]
+pub struct Trace;
+
+impl Trace {
+	/// Moves as many events as possible from the rings to `buf`.
+	///
+	/// The function returns the number of bytes written.
+	fn drain(buf: &UserSlice<u8>) -> EResult<usize> {
+		let _guard = READER.lock()?;
+		let count = buf.len() / size_of::<Event>();
+		let mut i = 0;
+		// Take events from each core in turn, so that a busy core cannot starve the others
+		'outer: loop {
+			let mut progress = false;
+			for cpu in cpus() {
+				if i >= count {
+					break 'outer;
+				}
+				// Safe since `READER` is locked
+				let Some(event) = (unsafe { trace::consume(cpu) }) else {
+					continue;
+				};
+				buf.copy_to_user(i * size_of::<Event>(), as_bytes(&event))?;
+				i += 1;
+				progress = true;
+			}
+			if !progress {
+				break;
+			}
+		}
+		Ok(i * size_of::<Event>())
+	}
+}
+
+impl FileOps for Trace {
+	fn read(&self, file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		if unlikely(buf.len() < size_of::<Event>()) {
+			return Err(errno!(EINVAL));
+		}
+		// Events are recorded in contexts where waking up a process is not possible, so the
+		// rings are polled instead
+		loop {
+			let len = Self::drain(&buf)?;
+			if len > 0 {
+				break Ok(len);
+			}
+			if file.get_flags() & O_NONBLOCK != 0 {
+				break Err(errno!(EAGAIN));
+			}
+			sleep_for(Clock::Monotonic, POLL_DELAY, &mut 0)?;
+		}
+	}
+
+	fn write(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		let mut b = [0u8];
+		if buf.copy_from_user(0, &mut b)? == 0 {
+			return Ok(0);
+		}
+		match b[0] {
+			b'0' => trace::set_enabled(false)?,
+			b'1' => trace::set_enabled(true)?,
+			_ => return Err(errno!(EINVAL)),
+		}
+		Ok(buf.len())
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! The `vmstat` file returns virtual memory and scheduling statistics, summed from the per-CPU
+//! counters.
+
+use crate::{
+	file::{File, fs::FileOps},
+	format_content,
+	memory::user::UserSlice,
+	process::scheduler::cpu::{counter, counter::Counter},
+};
+use core::{fmt, fmt::Formatter};
+use utils::{errno::EResult, limits::PAGE_SIZE};
+
+/// Displays the content of the file.
+struct VmStatDisplay;
+
+impl fmt::Display for VmStatDisplay {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		let kib = PAGE_SIZE as isize / 1024;
+		writeln!(f, "nr_free_pages {}", counter::sum(Counter::FreePages))?;
+		writeln!(f, "pgpgin {}", counter::sum(Counter::PagesIn) * kib)?;
+		writeln!(f, "pgpgout {}", counter::sum(Counter::PagesOut) * kib)?;
+		writeln!(f, "pgfault {}", counter::sum(Counter::PageFaults))?;
+		writeln!(f, "ctxt {}", counter::sum(Counter::ContextSwitches))
+	}
+}
+
+/// The `vmstat` file.
+#[derive(Debug, Default)]
+pub struct VmStat;
+
+impl FileOps for VmStat {
+	fn read(&self, _file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		format_content!(off, buf, "{}", VmStatDisplay)
+	}
+}
@@ -29,9 +29,11 @@ use crate::{
 		DirContext, DirEntry, File, FileType, Stat,
 		fs::{
 			FileOps, Filesystem, FilesystemOps, FilesystemType, NodeOps, Statfs, downcast_fs,
-			generic_file_read, generic_file_write, kernfs, kernfs::NodeStorage,
+			generic_file_read, generic_file_splice_read, generic_file_write, kernfs,
+			kernfs::NodeStorage,
 		},
 		perm::{ROOT_GID, ROOT_UID},
+		pipe::PipeBuffer,
 		vfs,
 		vfs::node::Node,
 	},
@@ -42,7 +44,7 @@ use core::{any::Any, hint::unlikely};
 use utils::{
 	TryClone, TryToOwned,
 	boxed::Box,
-	collections::{path::PathBuf, vec::Vec},
+	collections::{hashmap::HashMap, path::PathBuf, vec::Vec},
 	errno,
 	errno::{AllocResult, EResult},
 	limits::{NAME_MAX, PAGE_SIZE},
@@ -61,7 +63,10 @@ struct DirInner {
 	// for entries in between each calls
 	entries: Vec<Option<TmpfsDirEntry>>,
 	used_slots: usize,
-	// TODO: add a structure to map entry names to slots in `entries`
+	/// Maps entry names to slots in `entries`
+	index: HashMap<Cow<'static, [u8]>, usize>,
+	/// Holes in `entries`, to be reused by insertions
+	free_slots: Vec<usize>,
 }
 
 impl DirInner {
@@ -69,21 +74,26 @@ impl DirInner {
 	///
 	/// If no such entry exist, the function returns `None`.
 	fn find(&self, name: &[u8]) -> Option<&Arc<Node>> {
-		self.entries
-			.iter()
-			.filter_map(|e| e.as_ref())
-			.find(|e| e.name.as_ref() == name)
-			.map(|e| &e.node)
+		let slot = *self.index.get(name)?;
+		self.entries[slot].as_ref().map(|e| &e.node)
 	}
 
 	/// Inserts a new entry.
 	fn insert(&mut self, ent: TmpfsDirEntry) -> AllocResult<()> {
-		if self.used_slots == self.entries.len() {
-			self.entries.push(Some(ent))?;
-		} else {
-			let slot = self.entries.iter_mut().find(|e| e.is_none()).unwrap();
-			*slot = Some(ent);
-		}
+		// Reserve beforehand so that no allocation can fail once the entry is inserted
+		self.index.reserve(1)?;
+		let name = ent.name.try_clone()?;
+		let slot = match self.free_slots.pop() {
+			Some(slot) => {
+				self.entries[slot] = Some(ent);
+				slot
+			}
+			None => {
+				self.entries.push(Some(ent))?;
+				self.entries.len() - 1
+			}
+		};
+		self.index.insert(name, slot)?;
 		self.used_slots += 1;
 		Ok(())
 	}
@@ -92,34 +102,36 @@ impl DirInner {
 	///
 	/// If no such entry exist, the function does nothing.
 	fn set_inode(&mut self, name: &[u8], node: Arc<Node>) {
-		let ent = self
-			.entries
-			.iter_mut()
-			.filter_map(|e| e.as_mut())
-			.find(|e| e.name.as_ref() == name);
-		if let Some(ent) = ent {
+		let Some(&slot) = self.index.get(name) else {
+			return;
+		};
+		if let Some(ent) = &mut self.entries[slot] {
 			ent.node = node;
 		}
 	}
 
 	/// Removes the entry with name `name`, if any.
 	fn remove(&mut self, name: &[u8]) {
-		let slots_count = self.entries.len();
-		let slot = self
-			.entries
-			.iter_mut()
-			.enumerate()
-			.find(|(_, e)| matches!(e, Some(e) if e.name.as_ref() == name));
-		let Some((index, slot)) = slot else {
+		let Some(slot) = self.index.remove(name) else {
 			return;
 		};
-		if index == slots_count - 1 {
-			self.entries.truncate(index);
+		if slot == self.entries.len() - 1 {
+			self.entries.truncate(slot);
 		} else {
-			*slot = None;
+			self.entries[slot] = None;
+			// If this fails, the hole is simply not reused
+			let _ = self.free_slots.push(slot);
 		}
 		self.used_slots -= 1;
 	}
+
+	/// Removes all entries.
+	fn clear(&mut self) {
+		self.entries.clear();
+		self.used_slots = 0;
+		self.index.clear();
+		self.free_slots.clear();
+	}
 }
 
 // TODO use rwlock
@@ -233,15 +245,14 @@ impl NodeOps for NodeContent {
 			let mut inner = inner.lock();
 			let not_empty = inner.used_slots > 2
 				|| inner
-					.entries
+					.index
 					.iter()
-					.filter_map(|e| e.as_ref())
-					.any(|e| !matches!(e.name.as_ref(), b"." | b".."));
+					.any(|(name, _)| !matches!(name.as_ref(), b"." | b".."));
 			if not_empty {
 				return Err(errno!(ENOTEMPTY));
 			}
 			// Remove `.` and `..` to break cycles
-			inner.entries.clear();
+			inner.clear();
 			// Decrement references count
 			node.stat.lock().nlink -= 1;
 			parent.stat.lock().nlink -= 1;
@@ -329,6 +340,17 @@ impl FileOps for TmpFSFile {
 		generic_file_read(file, off, buf)
 	}
 
+	fn splice_read(
+		&self,
+		file: &File,
+		off: u64,
+		pipe: &PipeBuffer,
+		len: usize,
+		nonblock: bool,
+	) -> EResult<usize> {
+		generic_file_splice_read(file, off, pipe, len, nonblock)
+	}
+
 	fn write(&self, file: &File, off: u64, buf: UserSlice<u8>) -> EResult<usize> {
 		let node = file.node();
 		let fs = downcast_fs::<TmpFS>(&*node.fs.ops);
@@ -346,6 +368,7 @@ impl FileOps for TmpFSFile {
 		};
 		// Validation
 		let size: usize = size.try_into().map_err(|_| errno!(EOVERFLOW))?;
+		node.content_changed();
 		let new_pages_count = size.div_ceil(PAGE_SIZE);
 		let mut pages = pages.lock();
 		// Allocate or free pages
@@ -24,12 +24,14 @@
 //! The root filesystem is passed to the kernel as an argument on boot.
 //! Other filesystems are mounted into subdirectories.
 
+pub mod epoll;
 pub mod fd;
 pub mod fs;
 pub mod lock;
 pub mod perm;
 pub mod pipe;
 pub mod socket;
+pub mod uring;
 pub mod util;
 pub mod vfs;
 
@@ -43,7 +45,7 @@ use crate::{
 		socket::Socket,
 		vfs::node::Node,
 	},
-	memory::user::UserSlice,
+	memory::{readahead::Readahead, user::UserSlice},
 	net::{SocketDesc, SocketDomain, SocketType},
 	println,
 	sync::{atomic::AtomicU64, mutex::Mutex, once::OnceInit, spin::Spin},
@@ -352,6 +354,10 @@ pub struct File {
 
 	/// `flock` mode currently held by this open file description.
 	pub flock_mode: Mutex<FlockMode, false>,
+	/// Readahead state
+	pub readahead: Readahead,
+	/// The `epoll` instances watching the file
+	pub epoll_items: epoll::FileItems,
 }
 
 impl File {
@@ -399,6 +405,8 @@ impl File {
 			off: Default::default(),
 
 			flock_mode: Default::default(),
+			readahead: Default::default(),
+			epoll_items: Default::default(),
 		};
 		file.ops.acquire(&file);
 		Ok(Arc::new(file)?)
@@ -415,6 +423,8 @@ impl File {
 			off: Default::default(),
 
 			flock_mode: Default::default(),
+			readahead: Default::default(),
+			epoll_items: Default::default(),
 		};
 		file.ops.acquire(&file);
 		Ok(Arc::new(file)?)
@@ -544,7 +554,16 @@ impl File {
 			node.flock.release(mode);
 		}
 		self.ops.release(&self);
-		vfs::Entry::release(self.vfs_entry)
+		let entry = self.vfs_entry.clone();
+		drop(self);
+		vfs::Entry::release(entry)
+	}
+}
+
+impl Drop for File {
+	fn drop(&mut self) {
+		// `epoll` items do not hold references to the files they watch
+		epoll::release_file(self);
 	}
 }
 
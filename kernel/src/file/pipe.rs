@@ -18,42 +18,226 @@
 
 //! A pipe is an object that links two file descriptors together. One reading
 //! and another writing, with a buffer in between.
+//!
+//! The content of a pipe is a queue of [`PipeBuf`]s, each referencing a range of a page. Data
+//! written from userspace is copied to pages owned by the pipe, while `splice` and `tee` move
+//! references to pages between files and pipes, without copying their content. Pages of the page
+//! cache can this way be sent from a file to another.
+//!
+//! The capacity of a pipe is a number of buffers, which can be changed with `F_SETPIPE_SZ`.
 
 use crate::{
 	file::{File, O_NONBLOCK, fs::FileOps},
 	memory::{
-		ring_buffer::RingBuffer,
+		buddy::ZONE_KERNEL,
+		cache::RcPage,
 		user::{UserPtr, UserSlice},
 	},
 	process::{Process, signal::Signal},
-	sync::{spin::Spin, wait_queue::WaitQueue},
-	syscall::{FromSyscallArg, ioctl},
+	sync::{
+		spin::Spin,
+		wait_queue::{PollTable, WaitQueue},
+	},
+	syscall::{
+		FromSyscallArg, ioctl,
+		select::{POLLERR, POLLHUP, POLLIN, POLLOUT, POLLRDNORM, POLLWRNORM},
+	},
 };
 use core::{
+	cmp::min,
 	ffi::{c_int, c_void},
 	hint::unlikely,
-	num::NonZeroUsize,
 };
 use utils::{
+	collections::vec::Vec,
 	errno,
 	errno::{AllocResult, EResult},
+	limits::PAGE_SIZE,
 };
 
-/// The capacity of a pipe in bytes.
-const CAPACITY: usize = 65536;
+/// The default number of buffers of a pipe.
+const DEFAULT_SLOTS: usize = 16;
+/// The maximum capacity of a pipe an unprivileged process can set, in bytes.
+pub const PIPE_MAX_SIZE: usize = 1024 * 1024;
 
 // TODO guarantee atomicity on transfer <= PIPE_BUF
 
+/// A reference to a range of a page, in a pipe.
+#[derive(Clone, Debug)]
+pub struct PipeBuf {
+	/// The page
+	page: RcPage,
+	/// The offset of the range in the page
+	off: usize,
+	/// The length of the range
+	len: usize,
+	/// Tells whether written data can be appended to the range. This is the case only when the
+	/// rest of the page is not used by anyone else
+	merge: bool,
+}
+
+impl PipeBuf {
+	/// Creates a buffer referencing the range `off..(off + len)` of `page`.
+	///
+	/// The page may be shared with others (such as the page cache), so data written to the pipe is
+	/// never appended to it.
+	pub fn new(page: RcPage, off: usize, len: usize) -> Self {
+		debug_assert!(off + len <= PAGE_SIZE);
+		Self {
+			page,
+			off,
+			len,
+			merge: false,
+		}
+	}
+
+	/// Returns the length of the buffer in bytes.
+	#[inline]
+	pub fn len(&self) -> usize {
+		self.len
+	}
+
+	/// Tells whether the buffer is empty.
+	#[inline]
+	pub fn is_empty(&self) -> bool {
+		self.len == 0
+	}
+
+	/// Returns the page the buffer references.
+	#[inline]
+	pub fn page(&self) -> &RcPage {
+		&self.page
+	}
+
+	/// Returns the offset of the buffer in the page.
+	#[inline]
+	pub fn off(&self) -> usize {
+		self.off
+	}
+
+	/// Returns the content of the buffer.
+	#[inline]
+	pub fn as_slice(&self) -> &[u8] {
+		&self.page.slice()[self.off..(self.off + self.len)]
+	}
+
+	/// Returns a pointer to the byte at offset `off` in the page.
+	#[inline]
+	fn page_ptr(&self, off: usize) -> *mut u8 {
+		unsafe { self.page.virt_addr().as_ptr::<u8>().add(off) }
+	}
+}
+
 #[derive(Debug)]
 struct PipeInner {
-	/// The pipe's buffer.
-	buffer: RingBuffer,
+	/// The buffers, from the oldest to the newest.
+	bufs: Vec<PipeBuf>,
+	/// The maximum number of buffers.
+	slots: usize,
+	/// The total number of bytes in the buffers.
+	len: usize,
 	/// The number of readers on the pipe.
 	readers: usize,
 	/// The number of writers on the pipe.
 	writers: usize,
 }
 
+impl PipeInner {
+	/// Tells whether no buffer can be added to the pipe.
+	#[inline]
+	fn is_full(&self) -> bool {
+		self.bufs.len() >= self.slots
+	}
+
+	/// Reads data from the pipe to `buf`.
+	///
+	/// The function returns the number of bytes read.
+	fn read(&mut self, buf: UserSlice<u8>) -> EResult<usize> {
+		let mut off = 0;
+		while off < buf.len() {
+			let Some(first) = self.bufs.first_mut() else {
+				break;
+			};
+			let res = unsafe { buf.copy_to_user_raw(off, first.page_ptr(first.off), first.len) };
+			let len = match res {
+				Ok(len) => len,
+				Err(e) if off == 0 => return Err(e),
+				Err(_) => break,
+			};
+			first.off += len;
+			first.len -= len;
+			self.len -= len;
+			off += len;
+			if first.len == 0 {
+				self.bufs.remove(0);
+			}
+		}
+		Ok(off)
+	}
+
+	/// Writes data from `buf` to the pipe.
+	///
+	/// Data is appended to the last buffer if possible, then to new pages.
+	///
+	/// The function returns the number of bytes written.
+	fn write(&mut self, buf: UserSlice<u8>) -> EResult<usize> {
+		let mut off = 0;
+		while off < buf.len() {
+			let mergeable = self
+				.bufs
+				.last()
+				.is_some_and(|b| b.merge && b.off + b.len < PAGE_SIZE);
+			if !mergeable {
+				if self.is_full() {
+					break;
+				}
+				let page = RcPage::new(ZONE_KERNEL, None, 0)?;
+				self.bufs.push(PipeBuf {
+					page,
+					off: 0,
+					len: 0,
+					merge: true,
+				})?;
+			}
+			let last = self.bufs.last_mut().unwrap();
+			let end = last.off + last.len;
+			let res = unsafe { buf.copy_from_user_raw(off, last.page_ptr(end), PAGE_SIZE - end) };
+			match res {
+				Ok(len) => {
+					last.len += len;
+					self.len += len;
+					off += len;
+				}
+				Err(e) => {
+					if last.len == 0 {
+						self.bufs.pop();
+					}
+					if off == 0 {
+						return Err(e);
+					}
+					break;
+				}
+			}
+		}
+		Ok(off)
+	}
+
+	/// Takes up to `max` bytes from the first buffer of the pipe.
+	fn take(&mut self, max: usize) -> Option<PipeBuf> {
+		let first = self.bufs.first_mut()?;
+		let buf = if first.len <= max {
+			self.bufs.remove(0)
+		} else {
+			let buf = PipeBuf::new(first.page.clone(), first.off, max);
+			first.off += max;
+			first.len -= max;
+			buf
+		};
+		self.len -= buf.len;
+		Some(buf)
+	}
+}
+
 /// Representing a FIFO buffer.
 #[derive(Debug)]
 pub struct PipeBuffer {
@@ -70,7 +254,9 @@ impl PipeBuffer {
 	pub fn new() -> AllocResult<Self> {
 		Ok(Self {
 			inner: Spin::new(PipeInner {
-				buffer: RingBuffer::new(NonZeroUsize::new(CAPACITY).unwrap())?,
+				bufs: Vec::new(),
+				slots: DEFAULT_SLOTS,
+				len: 0,
 				readers: 0,
 				writers: 0,
 			}),
@@ -79,9 +265,316 @@ impl PipeBuffer {
 		})
 	}
 
+	/// Creates a pipe that is not attached to any file, to transfer data between two files
+	/// without copying it.
+	///
+	/// The pipe has one reader and one writer.
+	pub fn direct() -> AllocResult<Self> {
+		let pipe = Self::new()?;
+		{
+			let mut inner = pipe.inner.lock();
+			inner.readers = 1;
+			inner.writers = 1;
+		}
+		Ok(pipe)
+	}
+
 	/// Returns the capacity of the pipe in bytes.
 	pub fn get_capacity(&self) -> usize {
-		CAPACITY
+		self.inner.lock().slots * PAGE_SIZE
+	}
+
+	/// Sets the capacity of the pipe to at least `size` bytes.
+	///
+	/// The capacity is rounded up to a power of two number of pages.
+	///
+	/// If the pipe currently holds more buffers than the new capacity allows, the function returns
+	/// [`errno::EBUSY`].
+	///
+	/// On success, the function returns the new capacity in bytes.
+	pub fn set_capacity(&self, size: usize) -> EResult<usize> {
+		let slots = size
+			.div_ceil(PAGE_SIZE)
+			.max(1)
+			.checked_next_power_of_two()
+			.filter(|s| s.checked_mul(PAGE_SIZE).is_some())
+			.ok_or_else(|| errno!(EINVAL))?;
+		let mut inner = self.inner.lock();
+		if inner.bufs.len() > slots {
+			return Err(errno!(EBUSY));
+		}
+		inner.slots = slots;
+		// There may be room for writers now
+		self.wr_queue.wake_all();
+		Ok(slots * PAGE_SIZE)
+	}
+
+	/// Waits until a buffer can be added to the pipe.
+	///
+	/// If the pipe has no reader, the current process is sent a `SIGPIPE` and the function returns
+	/// [`errno::EPIPE`].
+	fn wait_space(&self, nonblock: bool) -> EResult<()> {
+		self.wr_queue.wait_until(|| {
+			let inner = self.inner.lock();
+			if inner.readers == 0 {
+				Process::kill(&Process::current(), Signal::SIGPIPE);
+				return Some(Err(errno!(EPIPE)));
+			}
+			if !inner.is_full() {
+				Some(Ok(()))
+			} else if nonblock {
+				Some(Err(errno!(EAGAIN)))
+			} else {
+				None
+			}
+		})?
+	}
+
+	/// Waits until the pipe is not empty, then calls `f` on it.
+	///
+	/// If the pipe is empty and has no writer, the function returns `None`.
+	fn wait_data<T, F: FnMut(&mut PipeInner) -> T>(
+		&self,
+		nonblock: bool,
+		mut f: F,
+	) -> EResult<Option<T>> {
+		self.rd_queue.wait_until(|| {
+			let mut inner = self.inner.lock();
+			if inner.bufs.is_empty() {
+				return if inner.writers == 0 {
+					Some(Ok(None))
+				} else if nonblock {
+					Some(Err(errno!(EAGAIN)))
+				} else {
+					None
+				};
+			}
+			let res = f(&mut inner);
+			self.wr_queue.wake_next();
+			Some(Ok(Some(res)))
+		})?
+	}
+
+	/// Adds `buf` at the end of the pipe, waiting for room if necessary.
+	fn push(&self, buf: PipeBuf) -> EResult<()> {
+		let mut buf = Some(buf);
+		self.wr_queue.wait_until(|| {
+			let mut inner = self.inner.lock();
+			if inner.readers == 0 {
+				Process::kill(&Process::current(), Signal::SIGPIPE);
+				return Some(Err(errno!(EPIPE)));
+			}
+			if inner.is_full() {
+				return None;
+			}
+			let buf = buf.take().unwrap();
+			let len = buf.len;
+			if let Err(e) = inner.bufs.push(buf) {
+				return Some(Err(e.into()));
+			}
+			inner.len += len;
+			self.rd_queue.wake_next();
+			Some(Ok(()))
+		})?
+	}
+
+	/// Puts `buf` back at the beginning of the pipe.
+	fn unread(&self, buf: PipeBuf) -> EResult<()> {
+		let mut inner = self.inner.lock();
+		let len = buf.len;
+		inner.bufs.insert(0, buf)?;
+		inner.len += len;
+		self.rd_queue.wake_next();
+		Ok(())
+	}
+
+	/// Reads data from the pipe to `buf`.
+	///
+	/// If `nonblock` is set, the function does not wait for data.
+	pub fn read_user(&self, buf: UserSlice<u8>, nonblock: bool) -> EResult<usize> {
+		if unlikely(buf.is_empty()) {
+			return Ok(0);
+		}
+		let len = self.wait_data(nonblock, |inner| inner.read(buf))?;
+		len.transpose().map(|len| len.unwrap_or(0))
+	}
+
+	/// Writes data from `buf` to the pipe.
+	///
+	/// If `nonblock` is set, the function does not wait for room.
+	pub fn write_user(&self, buf: UserSlice<u8>, nonblock: bool) -> EResult<usize> {
+		if unlikely(buf.is_empty()) {
+			return Ok(0);
+		}
+		self.wr_queue.wait_until(|| {
+			let mut inner = self.inner.lock();
+			if inner.readers == 0 {
+				Process::kill(&Process::current(), Signal::SIGPIPE);
+				return Some(Err(errno!(EPIPE)));
+			}
+			let len = match inner.write(buf) {
+				Ok(l) => l,
+				Err(e) => return Some(Err(e)),
+			};
+			if len > 0 {
+				self.rd_queue.wake_next();
+				return Some(Ok(len));
+			}
+			// No space left to write
+			if nonblock {
+				Some(Err(errno!(EAGAIN)))
+			} else {
+				None
+			}
+		})?
+	}
+
+	/// Adds buffers produced by `next` to the pipe, until `len` bytes have been added.
+	///
+	/// `next` is called with the maximum length of the next buffer, and returns `None` if there is
+	/// no more data. Since the pipe is not locked during the call, `next` is allowed to sleep.
+	///
+	/// If the pipe is full, the function waits for room, unless `nonblock` is set or data has
+	/// already been added.
+	///
+	/// The function returns the number of bytes added.
+	pub fn splice_in<F: FnMut(usize) -> EResult<Option<PipeBuf>>>(
+		&self,
+		len: usize,
+		nonblock: bool,
+		mut next: F,
+	) -> EResult<usize> {
+		let mut total = 0;
+		while total < len {
+			// Wait for room before taking data from the source, so that it is not lost
+			let res = self
+				.wait_space(nonblock || total > 0)
+				.and_then(|_| next(len - total));
+			let buf = match res {
+				Ok(Some(buf)) if !buf.is_empty() => buf,
+				Ok(_) => break,
+				Err(e) if total == 0 => return Err(e),
+				Err(_) => break,
+			};
+			let buf_len = buf.len;
+			match self.push(buf) {
+				Ok(()) => total += buf_len,
+				Err(e) if total == 0 => return Err(e),
+				Err(_) => break,
+			}
+		}
+		Ok(total)
+	}
+
+	/// Takes up to `len` bytes from the pipe and gives them to `sink`, buffer by buffer.
+	///
+	/// `sink` is called without the pipe being locked, with a buffer and whether it must not
+	/// block. It returns the number of bytes it consumed, and the rest of the buffer is put back
+	/// at the beginning of the pipe.
+	///
+	/// If the pipe is empty, the function waits for data, unless `nonblock` is set or data has
+	/// already been consumed.
+	///
+	/// The function returns the number of bytes consumed.
+	pub fn splice_out<F: FnMut(&PipeBuf, bool) -> EResult<usize>>(
+		&self,
+		len: usize,
+		nonblock: bool,
+		mut sink: F,
+	) -> EResult<usize> {
+		let mut total = 0;
+		while total < len {
+			let nonblock = nonblock || total > 0;
+			let res = self.wait_data(nonblock, |inner| inner.take(len - total));
+			let mut buf = match res {
+				Ok(Some(Some(buf))) => buf,
+				Ok(_) => break,
+				Err(e) if total == 0 => return Err(e),
+				Err(_) => break,
+			};
+			let res = sink(&buf, nonblock);
+			let consumed = *res.as_ref().unwrap_or(&0);
+			let partial = consumed < buf.len;
+			if partial {
+				buf.off += consumed;
+				buf.len -= consumed;
+				self.unread(buf)?;
+			}
+			match res {
+				Ok(n) => total += n,
+				Err(e) if total == 0 => return Err(e),
+				Err(_) => break,
+			}
+			if partial {
+				break;
+			}
+		}
+		Ok(total)
+	}
+
+	/// Moves up to `len` bytes from the pipe to the pipe `out`, without copying them.
+	///
+	/// The function returns the number of bytes moved.
+	pub fn splice_to(&self, out: &Self, len: usize, nonblock: bool) -> EResult<usize> {
+		self.splice_out(len, nonblock, |buf, nonblock| {
+			out.wait_space(nonblock)?;
+			out.push(buf.clone())?;
+			Ok(buf.len)
+		})
+	}
+
+	/// Duplicates up to `len` bytes from the beginning of the pipe to the pipe `out`, without
+	/// consuming them.
+	///
+	/// Pages are shared by both pipes.
+	///
+	/// The function returns the number of bytes duplicated.
+	pub fn tee(&self, out: &Self, len: usize, nonblock: bool) -> EResult<usize> {
+		loop {
+			out.wait_space(nonblock)?;
+			let room = {
+				let inner = out.inner.lock();
+				inner.slots.saturating_sub(inner.bufs.len())
+			};
+			let bufs = self.wait_data(nonblock, |inner| {
+				let mut bufs = Vec::new();
+				let mut total = 0;
+				for buf in inner.bufs.iter_mut().take(room) {
+					if total >= len {
+						break;
+					}
+					// Both pipes now reference the page
+					buf.merge = false;
+					let l = min(buf.len, len - total);
+					bufs.push(PipeBuf::new(buf.page.clone(), buf.off, l))?;
+					total += l;
+				}
+				AllocResult::Ok(bufs)
+			})?;
+			let Some(bufs) = bufs.transpose()? else {
+				return Ok(0);
+			};
+			let mut inner = out.inner.lock();
+			if inner.readers == 0 {
+				Process::kill(&Process::current(), Signal::SIGPIPE);
+				return Err(errno!(EPIPE));
+			}
+			let mut total = 0;
+			for buf in bufs {
+				if inner.is_full() {
+					break;
+				}
+				let len = buf.len;
+				inner.bufs.push(buf)?;
+				inner.len += len;
+				total += len;
+			}
+			// If another writer took the room, try again
+			if total > 0 {
+				out.rd_queue.wake_next();
+				return Ok(total);
+			}
+		}
 	}
 }
 
@@ -110,14 +603,48 @@ impl FileOps for PipeBuffer {
 		}
 	}
 
-	fn poll(&self, _file: &File, _mask: u32) -> EResult<u32> {
-		todo!()
+	fn poll(&self, file: &File, mask: u32) -> EResult<u32> {
+		let inner = self.inner.lock();
+		let mut events = 0;
+		if file.can_read() {
+			if inner.len > 0 {
+				events |= POLLIN | POLLRDNORM;
+			}
+			if inner.writers == 0 {
+				events |= POLLHUP;
+			}
+		}
+		if file.can_write() {
+			if inner.readers == 0 {
+				events |= POLLERR;
+			} else if !inner.is_full() {
+				events |= POLLOUT | POLLWRNORM;
+			}
+		}
+		// Errors and hang ups are always reported
+		Ok(events & (mask | POLLERR | POLLHUP))
+	}
+
+	fn poll_wait(&self, file: &File, _mask: u32, table: &mut PollTable) -> EResult<()> {
+		// The queues live as long as the pipe, which the file keeps alive. Both queues are woken
+		// up when the other end is closed
+		if file.can_read() {
+			unsafe {
+				table.add(&self.rd_queue)?;
+			}
+		}
+		if file.can_write() {
+			unsafe {
+				table.add(&self.wr_queue)?;
+			}
+		}
+		Ok(())
 	}
 
 	fn ioctl(&self, _file: &File, request: ioctl::Request, argp: *const c_void) -> EResult<u32> {
 		match request.get_old_format() {
 			ioctl::FIONREAD => {
-				let len = self.inner.lock().buffer.get_data_len() as c_int;
+				let len = self.inner.lock().len as c_int;
 				let count_ptr = UserPtr::from_ptr(argp as usize);
 				count_ptr.copy_to_user(&len)?;
 			}
@@ -127,57 +654,18 @@ impl FileOps for PipeBuffer {
 	}
 
 	fn read(&self, file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
-		if unlikely(buf.is_empty()) {
-			return Ok(0);
-		}
-		let len = self.rd_queue.wait_until(|| {
-			let mut inner = self.inner.lock();
-			let len = match inner.buffer.read(buf) {
-				Ok(l) => l,
-				Err(e) => return Some(Err(e)),
-			};
-			if len > 0 {
-				self.wr_queue.wake_next();
-				return Some(Ok(len));
-			}
-			// Nothing to read
-			if inner.writers == 0 {
-				return Some(Ok(0));
-			}
-			if file.get_flags() & O_NONBLOCK != 0 {
-				Some(Err(errno!(EAGAIN)))
-			} else {
-				None
-			}
-		})??;
-		Ok(len)
+		self.read_user(buf, file.get_flags() & O_NONBLOCK != 0)
 	}
 
 	fn write(&self, file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
-		if unlikely(buf.is_empty()) {
-			return Ok(0);
-		}
-		let len = self.wr_queue.wait_until(|| {
-			let mut inner = self.inner.lock();
-			if inner.readers == 0 {
-				Process::kill(&Process::current(), Signal::SIGPIPE);
-				return Some(Err(errno!(EPIPE)));
-			}
-			let len = match inner.buffer.write(buf) {
-				Ok(l) => l,
-				Err(e) => return Some(Err(e)),
-			};
-			if len > 0 {
-				self.rd_queue.wake_next();
-				return Some(Ok(len));
-			}
-			// No space left to write
-			if file.get_flags() & O_NONBLOCK != 0 {
-				Some(Err(errno!(EAGAIN)))
-			} else {
-				None
-			}
-		})??;
-		Ok(len)
+		self.write_user(buf, file.get_flags() & O_NONBLOCK != 0)
+	}
+
+	fn read_nonblock(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		self.read_user(buf, true)
+	}
+
+	fn write_nonblock(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		self.write_user(buf, true)
 	}
 }
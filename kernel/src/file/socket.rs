@@ -19,16 +19,30 @@
 //! This file implements sockets.
 
 use crate::{
-	file::{File, fs::FileOps},
-	memory::{ring_buffer::RingBuffer, user::UserSlice},
-	net::{SocketDesc, osi},
-	sync::{spin::Spin, wait_queue::WaitQueue},
-	syscall::ioctl,
+	file::{File, O_NONBLOCK, fs::FileOps},
+	memory::{cache::RcPage, user::UserSlice},
+	net::{
+		SocketDesc,
+		buf::{HEAD_SIZE, HEADROOM, PacketBuf},
+		osi,
+	},
+	sync::{
+		spin::Spin,
+		wait_queue::{PollTable, WaitQueue},
+	},
+	syscall::{
+		ioctl,
+		select::{POLLERR, POLLHUP, POLLIN, POLLOUT, POLLRDNORM, POLLWRNORM},
+	},
 };
 use core::{
+	cmp::min,
 	ffi::{c_int, c_void},
-	num::NonZeroUsize,
-	sync::{atomic, atomic::AtomicUsize},
+	hint::unlikely,
+	sync::{
+		atomic,
+		atomic::{AtomicBool, AtomicUsize},
+	},
 };
 use utils::{
 	collections::vec::Vec,
@@ -42,6 +56,52 @@ const BUFFER_SIZE: usize = 65536;
 /// Socket option level: Socket
 const SOL_SOCKET: c_int = 1;
 
+/// Received packets waiting to be read.
+#[derive(Debug, Default)]
+struct RxQueue {
+	/// The packets, from the oldest to the newest
+	pkts: Vec<PacketBuf>,
+	/// The offset of the first unread byte in the first packet
+	off: usize,
+	/// The total number of unread bytes
+	len: usize,
+}
+
+impl RxQueue {
+	/// Reads data from the queue to `buf`.
+	///
+	/// If `stream` is set, data is read across packets. Otherwise, a single packet is read and
+	/// what does not fit in `buf` is discarded.
+	///
+	/// The function returns the number of bytes read.
+	fn read(&mut self, buf: UserSlice<u8>, stream: bool) -> EResult<usize> {
+		let mut chunk = [0u8; 128];
+		let mut total = 0;
+		while let Some(pkt) = self.pkts.first() {
+			// Copy from the packet to userspace, through a buffer on the stack
+			while total < buf.len() && self.off < pkt.len() {
+				let len = min(chunk.len(), buf.len() - total);
+				let len = pkt.copy_to(self.off, &mut chunk[..len]);
+				buf.copy_to_user(total, &chunk[..len])?;
+				self.off += len;
+				self.len -= len;
+				total += len;
+			}
+			if stream && self.off < pkt.len() {
+				break;
+			}
+			// Discard what remains of the packet
+			self.len -= pkt.len() - self.off;
+			self.pkts.remove(0);
+			self.off = 0;
+			if !stream || total >= buf.len() {
+				break;
+			}
+		}
+		Ok(total)
+	}
+}
+
 /// A UNIX socket.
 #[derive(Debug)]
 pub struct Socket {
@@ -56,10 +116,10 @@ pub struct Socket {
 	/// The address the socket is bound to.
 	sockname: Spin<Vec<u8>>,
 
-	/// The buffer containing received data. If `None`, reception has been shutdown.
-	rx_buff: Spin<Option<RingBuffer>>,
-	/// The buffer containing data to be transmitted. If `None`, transmission has been shutdown.
-	tx_buff: Spin<Option<RingBuffer>>,
+	/// The queue of received packets. If `None`, reception has been shutdown.
+	rx: Spin<Option<RxQueue>>,
+	/// Tells whether transmission has been shutdown.
+	tx_shutdown: AtomicBool,
 
 	/// Receive wait queue.
 	rx_queue: WaitQueue,
@@ -77,12 +137,8 @@ impl Socket {
 
 			sockname: Default::default(),
 
-			rx_buff: Spin::new(Some(RingBuffer::new(
-				NonZeroUsize::new(BUFFER_SIZE).unwrap(),
-			)?)),
-			tx_buff: Spin::new(Some(RingBuffer::new(
-				NonZeroUsize::new(BUFFER_SIZE).unwrap(),
-			)?)),
+			rx: Spin::new(Some(RxQueue::default())),
+			tx_shutdown: AtomicBool::new(false),
 
 			rx_queue: WaitQueue::new(),
 			tx_queue: WaitQueue::new(),
@@ -148,14 +204,80 @@ impl Socket {
 		Ok(())
 	}
 
+	/// Queues the packet `pkt`, received by the transport layer, for reading.
+	///
+	/// `pkt` contains only the payload. If the receive queue is full, or if reception has been
+	/// shutdown, the packet is dropped.
+	pub fn deliver(&self, pkt: PacketBuf) {
+		let mut rx = self.rx.lock();
+		let Some(rx) = rx.as_mut() else {
+			return;
+		};
+		let len = pkt.len();
+		if rx.len + len > BUFFER_SIZE || rx.pkts.push(pkt).is_err() {
+			return;
+		}
+		rx.len += len;
+		self.rx_queue.wake_next();
+	}
+
+	/// Reads a received packet to `buf`.
+	///
+	/// If `nonblock` is set, the function does not wait for a packet.
+	pub fn read_user(&self, buf: UserSlice<u8>, nonblock: bool) -> EResult<usize> {
+		if unlikely(buf.is_empty()) {
+			return Ok(0);
+		}
+		let stream = self.desc.type_.is_stream();
+		self.rx_queue.wait_until(|| {
+			let mut rx = self.rx.lock();
+			let Some(rx) = rx.as_mut() else {
+				// Reception has been shutdown
+				return Some(Ok(0));
+			};
+			if !rx.pkts.is_empty() {
+				return Some(rx.read(buf, stream));
+			}
+			if nonblock {
+				Some(Err(errno!(EAGAIN)))
+			} else {
+				None
+			}
+		})?
+	}
+
+	/// Transmits the range `off..(off + len)` of `page`, referencing the page instead of copying
+	/// it.
+	///
+	/// This is used by `sendfile` to transmit pages of the page cache.
+	///
+	/// The function returns the number of bytes transmitted.
+	pub fn send_page(&self, page: &RcPage, off: usize, len: usize) -> EResult<usize> {
+		let stack = self.stack_for_transmit()?;
+		let mut pkt = PacketBuf::new(HEADROOM)?;
+		pkt.attach(page.clone(), off, len)?;
+		stack.transmit(pkt)?;
+		Ok(len)
+	}
+
+	/// Returns the network stack to transmit data with.
+	fn stack_for_transmit(&self) -> EResult<&osi::Stack> {
+		if unlikely(self.tx_shutdown.load(atomic::Ordering::Acquire)) {
+			return Err(errno!(EPIPE));
+		}
+		// A destination address is required
+		self.stack.as_ref().ok_or_else(|| errno!(EDESTADDRREQ))
+	}
+
 	/// Shuts down the reception side of the socket.
 	pub fn shutdown_reception(&self) {
-		*self.rx_buff.lock() = None;
+		*self.rx.lock() = None;
+		self.rx_queue.wake_all();
 	}
 
 	/// Shuts down the transmit side of the socket.
 	pub fn shutdown_transmit(&self) {
-		*self.tx_buff.lock() = None;
+		self.tx_shutdown.store(true, atomic::Ordering::Release);
 	}
 }
 
@@ -171,26 +293,63 @@ impl FileOps for Socket {
 		}
 	}
 
-	fn poll(&self, _file: &File, _mask: u32) -> EResult<u32> {
-		todo!()
+	fn poll(&self, _file: &File, mask: u32) -> EResult<u32> {
+		let mut events = match self.rx.lock().as_ref() {
+			Some(rx) if rx.len > 0 => POLLIN | POLLRDNORM,
+			Some(_) => 0,
+			None => POLLIN | POLLRDNORM | POLLHUP,
+		};
+		if self.tx_shutdown.load(atomic::Ordering::Acquire) {
+			events |= POLLERR;
+		} else if self.stack.is_some() {
+			events |= POLLOUT | POLLWRNORM;
+		}
+		// Errors and hang ups are always reported
+		Ok(events & (mask | POLLERR | POLLHUP))
+	}
+
+	fn poll_wait(&self, _file: &File, _mask: u32, table: &mut PollTable) -> EResult<()> {
+		// The queue lives as long as the socket, which the file keeps alive
+		unsafe {
+			table.add(&self.rx_queue)?;
+		}
+		Ok(())
 	}
 
 	fn ioctl(&self, _file: &File, _request: ioctl::Request, _argp: *const c_void) -> EResult<u32> {
 		todo!()
 	}
 
-	fn read(&self, _file: &File, _off: u64, _buf: UserSlice<u8>) -> EResult<usize> {
-		if !self.desc.type_.is_stream() {
-			// TODO error
-		}
-		todo!()
+	fn read(&self, file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		self.read_user(buf, file.get_flags() & O_NONBLOCK != 0)
 	}
 
-	fn write(&self, _file: &File, _off: u64, _buf: UserSlice<u8>) -> EResult<usize> {
-		// A destination address is required
-		let Some(_stack) = self.stack.as_ref() else {
-			return Err(errno!(EDESTADDRREQ));
-		};
-		todo!()
+	fn read_nonblock(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		self.read_user(buf, true)
+	}
+
+	fn write(&self, _file: &File, _off: u64, buf: UserSlice<u8>) -> EResult<usize> {
+		let stack = self.stack_for_transmit()?;
+		let max = HEAD_SIZE - HEADROOM;
+		if unlikely(!self.desc.type_.is_stream() && buf.len() > max) {
+			return Err(errno!(EMSGSIZE));
+		}
+		// Userspace data is copied once, to the packets' heads
+		let mut off = 0;
+		while off < buf.len() {
+			let len = min(buf.len() - off, max);
+			let mut pkt = PacketBuf::new(HEADROOM)?;
+			let copied = buf.copy_from_user(off, pkt.put(len)?)?;
+			pkt.trim(copied);
+			match stack.transmit(pkt) {
+				Ok(()) => off += copied,
+				Err(e) if off == 0 => return Err(e),
+				Err(_) => break,
+			}
+			if copied < len {
+				break;
+			}
+		}
+		Ok(off)
 	}
 }
@@ -0,0 +1,947 @@
+/*
+ * Copyright 2026 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! An `io_uring` instance allows a process to submit I/O operations in batches and to retrieve
+//! their results asynchronously, through rings shared with the kernel:
+//! - the *submission queue* (SQ), in which the process writes entries (SQEs) describing
+//!   operations, consumed by the kernel on `io_uring_enter`
+//! - the *completion queue* (CQ), in which the kernel writes the results of operations (CQEs),
+//!   consumed by the process
+//!
+//! Unlike Linux, the rings are mapped in the process's memory space when the instance is
+//! created, instead of with `mmap` on the instance's file descriptor. Their addresses are
+//! returned in the `user_addr` fields of [`SqringOffsets`] and [`CqringOffsets`].
+//!
+//! `IORING_OP_NOP` is completed at submission. Other operations are executed by the kernel's I/O
+//! workers, which switch to the memory space of the submitting process to access its buffers.
+//! Workers never wait for devices or files to be ready:
+//! - reads and writes on regular files and block devices first start reading the pages they access
+//!   into the page cache. The request is queued to a worker from the completion of these reads, so
+//!   the number of I/Os in flight is not limited by the number of workers
+//! - operations on files that may not be ready (pipes, sockets, terminals, ...) are first armed on
+//!   the file's wait queues. They are executed without waiting, and armed again if the file is not
+//!   ready anymore by the time they run. On files that do not support event notification, such an
+//!   operation fails with `EAGAIN` instead
+
+use crate::{
+	device::request::IoCompletion,
+	file::{File, FileType, fs::FileOps},
+	memory::{VirtAddr, cache::RcPage, user::UserSlice},
+	process::{
+		Process,
+		mem_space::{MAP_ANONYMOUS, MAP_SHARED, MemSpace, PROT_READ, PROT_WRITE},
+		signal::Signal,
+	},
+	sync::{
+		mutex::Mutex,
+		spin::{IntSpin, Spin},
+		wait_queue::{PollTable, WaitQueue, WakeCallback},
+	},
+	syscall::select::{POLLERR, POLLHUP, POLLIN, POLLOUT, POLLRDNORM},
+};
+use core::{
+	cmp::min,
+	ffi::c_int,
+	fmt,
+	fmt::Formatter,
+	mem::size_of,
+	num::NonZeroUsize,
+	ptr,
+	sync::atomic::{
+		AtomicBool, AtomicU32, AtomicUsize,
+		Ordering::{AcqRel, Acquire, Relaxed, Release},
+	},
+};
+use utils::{
+	collections::{list::ListNode, vec::Vec},
+	errno,
+	errno::{AllocResult, CollectResult, EResult},
+	limits::PAGE_SIZE,
+	list, list_type,
+	ptr::arc::Arc,
+};
+
+/// The maximum number of entries in the submission queue.
+pub const MAX_ENTRIES: u32 = 4096;
+/// The maximum number of I/O workers.
+pub const MAX_WORKERS: usize = 4;
+
+/// Setup flag: the size of the completion queue is given by [`Params::cq_entries`].
+pub const IORING_SETUP_CQSIZE: u32 = 1 << 3;
+/// Setup flag: queue sizes that are too large are clamped instead of failing.
+pub const IORING_SETUP_CLAMP: u32 = 1 << 4;
+/// Feature: the submission and completion rings share the same memory.
+pub const IORING_FEAT_SINGLE_MMAP: u32 = 1 << 0;
+/// `io_uring_enter` flag: wait for completions.
+pub const IORING_ENTER_GETEVENTS: u32 = 1 << 0;
+
+/// Operation: do nothing.
+const IORING_OP_NOP: u8 = 0;
+/// Operation: equivalent to `fsync`.
+const IORING_OP_FSYNC: u8 = 3;
+/// Operation: wait for events on a file, like `poll` on a single file.
+const IORING_OP_POLL_ADD: u8 = 6;
+/// Operation: equivalent to `accept4`.
+const IORING_OP_ACCEPT: u8 = 13;
+/// Operation: equivalent to `pread`, or `read` if the offset is `-1`.
+const IORING_OP_READ: u8 = 22;
+/// Operation: equivalent to `pwrite`, or `write` if the offset is `-1`.
+const IORING_OP_WRITE: u8 = 23;
+
+/// `fsync` flag: equivalent to `fdatasync`.
+const IORING_FSYNC_DATASYNC: u32 = 1 << 0;
+
+// Layout of the rings' memory. The heads of the two rings are on separate cache lines, since
+// they are written by different sides
+
+/// Offset of the head of the submission queue, written by the kernel.
+const SQ_HEAD: usize = 0;
+/// Offset of the tail of the submission queue, written by userspace.
+const SQ_TAIL: usize = 4;
+/// Offset of the mask of the submission queue.
+const SQ_MASK: usize = 8;
+/// Offset of the number of entries of the submission queue.
+const SQ_ENTRIES: usize = 12;
+/// Offset of the flags of the submission queue.
+const SQ_FLAGS: usize = 16;
+/// Offset of the number of invalid entries that have been dropped from the submission queue.
+const SQ_DROPPED: usize = 20;
+/// Offset of the head of the completion queue, written by userspace.
+const CQ_HEAD: usize = 64;
+/// Offset of the tail of the completion queue, written by the kernel.
+const CQ_TAIL: usize = 68;
+/// Offset of the mask of the completion queue.
+const CQ_MASK: usize = 72;
+/// Offset of the number of entries of the completion queue.
+const CQ_ENTRIES: usize = 76;
+/// Offset of the number of completions that have been dropped because the queue was full.
+const CQ_OVERFLOW: usize = 80;
+/// Offset of the flags of the completion queue.
+const CQ_FLAGS: usize = 84;
+/// Offset of the array of indexes of submitted entries.
+const SQ_ARRAY: usize = 128;
+
+/// A submission queue entry.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Sqe {
+	/// The operation
+	pub opcode: u8,
+	/// Entry flags
+	pub flags: u8,
+	/// The priority of the request
+	pub ioprio: u16,
+	/// The file descriptor to operate on
+	pub fd: i32,
+	/// The offset in the file
+	pub off: u64,
+	/// The address of the buffer
+	pub addr: u64,
+	/// The length of the buffer
+	pub len: u32,
+	/// Operation-specific flags
+	pub op_flags: u32,
+	/// User data, returned along with the completion
+	pub user_data: u64,
+	/// The index of a registered buffer
+	pub buf_index: u16,
+	/// The credentials to use
+	pub personality: u16,
+	/// Operation-specific file descriptor
+	pub splice_fd_in: i32,
+	/// Operation-specific address
+	pub addr3: u64,
+	/// Padding
+	pub __pad2: u64,
+}
+
+/// A completion queue entry.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Cqe {
+	/// User data of the submission
+	pub user_data: u64,
+	/// The result of the operation, or a negative errno
+	pub res: i32,
+	/// Flags
+	pub flags: u32,
+}
+
+/// Offsets of the fields of the submission queue.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct SqringOffsets {
+	/// The offset of the head index
+	pub head: u32,
+	/// The offset of the tail index
+	pub tail: u32,
+	/// The offset of the mask applied to indexes
+	pub ring_mask: u32,
+	/// The offset of the number of entries
+	pub ring_entries: u32,
+	/// The offset of the flags
+	pub flags: u32,
+	/// The offset of the counter of dropped entries
+	pub dropped: u32,
+	/// The offset of the array of entry indexes
+	pub array: u32,
+	/// Reserved
+	pub resv1: u32,
+	/// The address of the submission queue entries
+	pub user_addr: u64,
+}
+
+/// Offsets of the fields of the completion queue.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct CqringOffsets {
+	/// The offset of the head index
+	pub head: u32,
+	/// The offset of the tail index
+	pub tail: u32,
+	/// The offset of the mask applied to indexes
+	pub ring_mask: u32,
+	/// The offset of the number of entries
+	pub ring_entries: u32,
+	/// The offset of the counter of overflowed completions
+	pub overflow: u32,
+	/// The offset of the completion queue entries
+	pub cqes: u32,
+	/// The offset of the flags
+	pub flags: u32,
+	/// Reserved
+	pub resv1: u32,
+	/// The address of the rings
+	pub user_addr: u64,
+}
+
+/// Parameters of an instance, exchanged with userspace on `io_uring_setup`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct Params {
+	/// The number of submission queue entries
+	pub sq_entries: u32,
+	/// The number of completion queue entries
+	pub cq_entries: u32,
+	/// Setup flags
+	pub flags: u32,
+	/// The CPU of the submission thread (unsupported)
+	pub sq_thread_cpu: u32,
+	/// The idle time of the submission thread (unsupported)
+	pub sq_thread_idle: u32,
+	/// The features supported by the kernel
+	pub features: u32,
+	/// The instance to share workers with (unsupported)
+	pub wq_fd: u32,
+	/// Reserved
+	pub resv: [u32; 3],
+	/// Offsets of the submission queue
+	pub sq_off: SqringOffsets,
+	/// Offsets of the completion queue
+	pub cq_off: CqringOffsets,
+}
+
+/// Memory shared with userspace, made of pages that are not necessarily contiguous.
+struct Region(Vec<RcPage>);
+
+impl Region {
+	/// Allocates a zeroed region of at least `size` bytes.
+	fn new(size: usize) -> AllocResult<Self> {
+		let count = size.div_ceil(PAGE_SIZE);
+		let mut pages = Vec::with_capacity(count)?;
+		for _ in 0..count {
+			pages.push(RcPage::new_zeroed()?)?;
+		}
+		Ok(Self(pages))
+	}
+
+	/// Returns a pointer to the object of type `T` at offset `off`.
+	///
+	/// The object must not cross a page boundary.
+	fn ptr<T>(&self, off: usize) -> *mut T {
+		debug_assert!(off % PAGE_SIZE + size_of::<T>() <= PAGE_SIZE);
+		(self.0[off / PAGE_SIZE].virt_addr() + off % PAGE_SIZE).as_ptr()
+	}
+
+	/// Returns the field at offset `off`.
+	fn field(&self, off: usize) -> &AtomicU32 {
+		unsafe { &*self.ptr(off) }
+	}
+}
+
+/// Requests waiting to be executed by an I/O worker.
+static QUEUE: IntSpin<list_type!(Request, node)> = IntSpin::new(list!(Request, node));
+/// The queue on which idle I/O workers wait.
+static WORKERS: WaitQueue = WaitQueue::new();
+
+/// The state of an instance, shared with its requests.
+struct Ring {
+	/// The memory of the rings
+	rings: Region,
+	/// The memory of the submission queue entries
+	sqes: Region,
+	/// The mask of the submission queue
+	sq_mask: u32,
+	/// The mask of the completion queue
+	cq_mask: u32,
+	/// The offset of the completion queue entries in the rings' memory
+	cqes_off: usize,
+
+	/// Serializes submissions
+	sq_lock: Mutex<(), false>,
+	/// Serializes completions
+	cq_lock: Spin<()>,
+	/// The processes waiting for completions
+	cq_wait: WaitQueue,
+
+	/// Requests waiting for their file to be ready
+	armed: Spin<Vec<Arc<Request>>>,
+	/// Tells whether the instance has been closed
+	closed: AtomicBool,
+}
+
+impl Ring {
+	/// Returns the number of completions that have not been consumed by userspace.
+	fn pending(&self) -> u32 {
+		let tail = self.rings.field(CQ_TAIL).load(Relaxed);
+		let head = self.rings.field(CQ_HEAD).load(Acquire);
+		tail.wrapping_sub(head)
+	}
+
+	/// Posts the completion of the request with user data `user_data`, with the result `res`.
+	///
+	/// If the completion queue is full, the completion is dropped and accounted for in the
+	/// overflow counter.
+	fn complete(&self, user_data: u64, res: EResult<usize>) {
+		let res = match res {
+			Ok(val) => min(val, i32::MAX as usize) as i32,
+			Err(e) => -e.as_int(),
+		};
+		{
+			let _guard = self.cq_lock.lock();
+			let tail = self.rings.field(CQ_TAIL).load(Relaxed);
+			let head = self.rings.field(CQ_HEAD).load(Acquire);
+			if tail.wrapping_sub(head) > self.cq_mask {
+				self.rings.field(CQ_OVERFLOW).fetch_add(1, Relaxed);
+			} else {
+				let off = self.cqes_off + (tail & self.cq_mask) as usize * size_of::<Cqe>();
+				let cqe = Cqe {
+					user_data,
+					res,
+					flags: 0,
+				};
+				unsafe {
+					self.rings.ptr::<Cqe>(off).write_volatile(cqe);
+				}
+				self.rings
+					.field(CQ_TAIL)
+					.store(tail.wrapping_add(1), Release);
+			}
+		}
+		self.cq_wait.wake_all();
+	}
+
+	/// Submits up to `count` entries of the submission queue, returning the number of entries
+	/// consumed.
+	fn submit(this: &Arc<Self>, count: u32) -> EResult<u32> {
+		let _guard = this.sq_lock.lock();
+		let mem_space = Process::current().mem_space().clone();
+		let head_field = this.rings.field(SQ_HEAD);
+		let mut head = head_field.load(Relaxed);
+		let tail = this.rings.field(SQ_TAIL).load(Acquire);
+		let mut submitted = 0;
+		let mut queued = 0;
+		while submitted < count && head != tail {
+			let off = SQ_ARRAY + (head & this.sq_mask) as usize * size_of::<u32>();
+			let index = unsafe { this.rings.ptr::<u32>(off).read_volatile() };
+			head = head.wrapping_add(1);
+			if index > this.sq_mask {
+				this.rings.field(SQ_DROPPED).fetch_add(1, Relaxed);
+				continue;
+			}
+			let off = index as usize * size_of::<Sqe>();
+			let sqe = unsafe { this.sqes.ptr::<Sqe>(off).read_volatile() };
+			submitted += 1;
+			match Request::submit(this, &mem_space, sqe) {
+				Ok(true) => queued += 1,
+				Ok(false) => {}
+				Err(e) => this.complete(sqe.user_data, Err(e)),
+			}
+		}
+		head_field.store(head, Release);
+		// Wake up workers once for the whole batch
+		if queued > 0 {
+			WORKERS.wake_n(queued);
+		}
+		Ok(submitted)
+	}
+}
+
+/// An operation submitted to an instance.
+struct Request {
+	/// The node in the workers' queue
+	node: ListNode,
+	/// Tells whether the request is in the workers' queue. Modified only while the queue is
+	/// locked
+	queued: AtomicBool,
+
+	/// The instance the request has been submitted to
+	ring: Arc<Ring>,
+	/// The process which submitted the request
+	submitter: Arc<Process>,
+	/// The memory space of the process which submitted the request
+	mem_space: Arc<MemSpace>,
+	/// The file to operate on
+	file: Arc<File>,
+	/// The submission entry
+	sqe: Sqe,
+
+	/// The events to wait for on the file before executing the operation. If zero, the
+	/// operation is executed right away
+	mask: u32,
+	/// If set, the operation must not wait for the file to be ready
+	nonblock: bool,
+	/// The hooks registered on the file's wait queues, while waiting for events
+	table: Spin<Option<PollTable>>,
+	/// Tells whether the request has been executed or cancelled
+	done: AtomicBool,
+	/// The number of page cache reads the request waits for before being queued
+	io_pending: AtomicUsize,
+}
+
+impl Request {
+	/// Prepares the request for `sqe`, submitted to `ring` by a process with the memory space
+	/// `mem_space`.
+	///
+	/// The function returns `true` if the request has been queued to a worker.
+	fn submit(ring: &Arc<Ring>, mem_space: &Arc<MemSpace>, sqe: Sqe) -> EResult<bool> {
+		// Entry flags (linked requests, registered files, ...) are not supported
+		if sqe.flags != 0 {
+			return Err(errno!(EINVAL));
+		}
+		let mask = match sqe.opcode {
+			IORING_OP_NOP => {
+				ring.complete(sqe.user_data, Ok(0));
+				return Ok(false);
+			}
+			IORING_OP_FSYNC => 0,
+			IORING_OP_POLL_ADD => sqe.op_flags | POLLERR | POLLHUP,
+			IORING_OP_READ => POLLIN,
+			IORING_OP_WRITE => POLLOUT,
+			// Sockets do not support accepting connections yet
+			IORING_OP_ACCEPT => return Err(errno!(EOPNOTSUPP)),
+			_ => return Err(errno!(EINVAL)),
+		};
+		let proc = Process::current();
+		let file = proc
+			.file_descriptors()
+			.lock()
+			.get_fd(sqe.fd)?
+			.get_file()
+			.clone();
+		// Regular files and block devices are always ready
+		let mask = match file.stat().get_type() {
+			Some(FileType::Regular | FileType::Directory | FileType::BlockDevice)
+				if sqe.opcode != IORING_OP_POLL_ADD =>
+			{
+				0
+			}
+			_ => mask,
+		};
+		// Files that may not be ready must not make the worker wait
+		let nonblock = mask != 0;
+		let new = |mask| {
+			Arc::new(Self {
+				node: ListNode::default(),
+				queued: AtomicBool::new(false),
+
+				ring: ring.clone(),
+				submitter: proc.clone(),
+				mem_space: mem_space.clone(),
+				file: file.clone(),
+				sqe,
+
+				mask,
+				nonblock,
+				table: Spin::new(None),
+				done: AtomicBool::new(false),
+				io_pending: AtomicUsize::new(0),
+			})
+		};
+		let mut req = new(mask)?;
+		if mask != 0 {
+			match Self::arm(&req) {
+				Ok(()) => return Ok(false),
+				// The file does not support event notification, execute right away
+				Err(e) if e.as_int() == errno::EPERM && sqe.opcode != IORING_OP_POLL_ADD => {
+					req = new(0)?;
+				}
+				Err(e) => return Err(e),
+			}
+		}
+		if matches!(sqe.opcode, IORING_OP_READ | IORING_OP_WRITE) {
+			return Ok(Self::start_io(&req));
+		}
+		Ok(Self::queue(&req))
+	}
+
+	/// Starts reading the pages the operation accesses into the page cache, so that executing it
+	/// does not wait for the device. The request is queued once all the reads are over, possibly
+	/// from an interrupt handler.
+	///
+	/// The function returns `true` if the request has been queued to a worker.
+	fn start_io(this: &Arc<Self>) -> bool {
+		let sqe = &this.sqe;
+		let file = &this.file;
+		let off = match sqe.off {
+			u64::MAX => file.get_offset(),
+			off => off,
+		};
+		let len = min(sqe.len as usize, i32::MAX as usize) as u64;
+		let start = off / PAGE_SIZE as u64;
+		let end = off.saturating_add(len).div_ceil(PAGE_SIZE as u64);
+		// Reading ahead is only an optimization: errors are reported by the operation itself
+		let pages = (|| -> EResult<Vec<RcPage>> {
+			let stat = file.stat();
+			match stat.get_type() {
+				Some(FileType::Regular) => {
+					let node = file.node();
+					let end = min(end, stat.size.div_ceil(PAGE_SIZE as u64));
+					if start >= end {
+						return Ok(Vec::new());
+					}
+					node.node_ops.readahead(node, start..end)?;
+					Ok((start..end)
+						.filter_map(|off| node.mapped.get(off))
+						.collect::<CollectResult<Vec<_>>>()
+						.0?)
+				}
+				Some(FileType::BlockDevice) if start < end => {
+					let dev = file.as_block_device().ok_or_else(|| errno!(ENODEV))?;
+					dev.ops.start_read(&dev, start, end - start)
+				}
+				_ => Ok(Vec::new()),
+			}
+		})()
+		.unwrap_or_default();
+		// Hold a reference on the counter so that the request is not queued before all callbacks
+		// are registered
+		this.io_pending.store(1, Relaxed);
+		let mut last: Option<Arc<IoCompletion>> = None;
+		for page in pages {
+			let Some(read) = page.pending_read() else {
+				continue;
+			};
+			// Consecutive pages are usually filled by the same read
+			if last
+				.as_ref()
+				.is_some_and(|last| Arc::as_ptr(last) == Arc::as_ptr(&read))
+			{
+				continue;
+			}
+			this.io_pending.fetch_add(1, Relaxed);
+			let req = this.clone();
+			let registered = Arc::new(move || {
+				if Self::end_io(&req) {
+					WORKERS.wake_next();
+				}
+			})
+			.and_then(|callback| read.on_done(callback));
+			match registered {
+				Ok(true) => {}
+				// The read is already over
+				Ok(false) => {
+					this.io_pending.fetch_sub(1, Relaxed);
+				}
+				// Reads that are not waited for are waited for by the worker
+				Err(_) => {
+					this.io_pending.fetch_sub(1, Relaxed);
+					break;
+				}
+			}
+			last = Some(read);
+		}
+		Self::end_io(this)
+	}
+
+	/// Accounts for the end of a read started by [`Self::start_io`]. After the last one, the
+	/// request is queued.
+	///
+	/// The function returns `true` if the request has been queued to a worker.
+	fn end_io(this: &Arc<Self>) -> bool {
+		this.io_pending.fetch_sub(1, AcqRel) == 1 && Self::queue(this)
+	}
+
+	/// Registers hooks on the file's wait queues, then queues the request if events are
+	/// already pending.
+	///
+	/// On failure, the request is cancelled.
+	fn arm(this: &Arc<Self>) -> EResult<()> {
+		this.ring.armed.lock().push(this.clone())?;
+		// If the instance has been closed, nothing would cancel the request anymore. Closing sets
+		// the flag before taking the list of armed requests
+		if this.ring.closed.load(Acquire) {
+			this.done.store(true, Release);
+			Self::disarm(this);
+			return Err(errno!(ECANCELED));
+		}
+		let res = {
+			// Keep the table locked so that the request cannot be disarmed before registration
+			// is over
+			let mut table = this.table.lock();
+			let table = table.insert(PollTable::new(this.clone(), false));
+			this.file.ops.poll_wait(&this.file, this.mask, table)
+		};
+		if let Err(e) = res {
+			// Hooks may have been notified already
+			this.done.store(true, Release);
+			Self::disarm(this);
+			return Err(e);
+		}
+		if this.poll() != 0 && Self::queue(this) {
+			WORKERS.wake_next();
+		}
+		Ok(())
+	}
+
+	/// Unregisters the request's hooks.
+	fn disarm(this: &Arc<Self>) {
+		// Dropping the table unregisters the hooks, which breaks the reference cycle with them
+		let table = this.table.lock().take();
+		drop(table);
+		this.ring
+			.armed
+			.lock()
+			.retain(|r| Arc::as_ptr(r) != Arc::as_ptr(this));
+	}
+
+	/// Polls the file for the request's events, returning the events that occurred.
+	fn poll(&self) -> u32 {
+		// A failure to poll is reported as an error condition
+		let events = self.file.ops.poll(&self.file, self.mask).unwrap_or(POLLERR);
+		events & self.mask
+	}
+
+	/// Inserts the request in the workers' queue, if not already in it.
+	///
+	/// The function returns `true` if the request has been inserted.
+	fn queue(this: &Arc<Self>) -> bool {
+		let mut queue = QUEUE.lock();
+		if this.queued.swap(true, Relaxed) {
+			return false;
+		}
+		queue.insert_back(this.clone());
+		true
+	}
+
+	/// Removes the first request from the workers' queue, if `f` returns `true` for it.
+	fn dequeue<F: FnOnce(&Self) -> bool>(f: F) -> Option<Arc<Self>> {
+		let mut queue = QUEUE.lock();
+		if !f(&*queue.front()?) {
+			return None;
+		}
+		let req = queue.remove_front()?;
+		req.queued.store(false, Relaxed);
+		Some(req)
+	}
+
+	/// Executes the operation, returning its result.
+	///
+	/// `events` is the set of events that occurred on the file, if the request waited for any.
+	///
+	/// The memory space of the submitting process must be bound.
+	fn execute(&self, events: u32) -> EResult<usize> {
+		let sqe = &self.sqe;
+		let file = &self.file;
+		match sqe.opcode {
+			IORING_OP_READ | IORING_OP_WRITE => {
+				let len = min(sqe.len as usize, i32::MAX as usize);
+				let buf =
+					UserSlice::from_user(ptr::with_exposed_provenance_mut(sqe.addr as _), len)?;
+				if len == 0 {
+					return Ok(0);
+				}
+				// An offset of `-1` means the file's current offset is used, or its end when
+				// writing with `O_APPEND`
+				let off = match sqe.off {
+					u64::MAX if sqe.opcode == IORING_OP_WRITE => file.get_offset(),
+					u64::MAX => file.off.load(Acquire),
+					off => off,
+				};
+				let len = match (sqe.opcode, self.nonblock) {
+					(IORING_OP_READ, false) => file.ops.read(file, off, buf)?,
+					(IORING_OP_READ, true) => file.ops.read_nonblock(file, off, buf)?,
+					(_, false) => file.ops.write(file, off, buf)?,
+					(_, true) => file.ops.write_nonblock(file, off, buf)?,
+				};
+				if sqe.off == u64::MAX {
+					file.off.store(off.saturating_add(len as u64), Release);
+				}
+				Ok(len)
+			}
+			IORING_OP_FSYNC => {
+				let node = file.node();
+				node.sync_data()?;
+				if sqe.op_flags & IORING_FSYNC_DATASYNC == 0 {
+					node.sync_metadata()?;
+				}
+				Ok(0)
+			}
+			IORING_OP_POLL_ADD => Ok(events as _),
+			_ => unreachable!(),
+		}
+	}
+
+	/// Runs the request on the current worker.
+	///
+	/// The memory space of the submitting process must be bound.
+	fn run(this: &Arc<Self>) {
+		let events = if this.mask != 0 {
+			let events = this.poll();
+			// Spurious wake up: wait for the next one
+			if events == 0 {
+				return;
+			}
+			events
+		} else {
+			0
+		};
+		if this.done.swap(true, Acquire) {
+			return;
+		}
+		if this.mask != 0 {
+			Self::disarm(this);
+		}
+		// Signals raised by the operation (such as `SIGPIPE` on a pipe without reader) target the
+		// current process, which is the worker. Redirect them to the submitter
+		let worker = Process::current();
+		worker.signal.lock().clear_pending();
+		let res = this.execute(events);
+		let pending = {
+			let mut signal = worker.signal.lock();
+			let pending = signal.pending();
+			signal.clear_pending();
+			pending
+		};
+		for (sig, _) in pending.iter().enumerate().filter(|(_, b)| *b) {
+			if let Ok(sig) = Signal::try_from(sig as c_int) {
+				Process::kill(&this.submitter, sig);
+			}
+		}
+		// The file is not ready anymore (for example, another reader drained it since it has been
+		// polled): wait for the next event
+		let res = match res {
+			Err(e) if this.mask != 0 && e.as_int() == errno::EAGAIN => {
+				this.done.store(false, Release);
+				match Self::arm(this) {
+					Ok(()) => return,
+					Err(e) => Err(e),
+				}
+			}
+			res => res,
+		};
+		this.ring.complete(this.sqe.user_data, res);
+	}
+}
+
+// The workers' queue node is accessed only while the queue is locked
+unsafe impl Send for Request {}
+unsafe impl Sync for Request {}
+
+impl WakeCallback for Request {
+	fn wake(&self) -> bool {
+		if self.done.load(Relaxed) {
+			return false;
+		}
+		// Requests always reside in an `Arc`
+		let this = unsafe { Arc::from_raw(self) };
+		Arc::increment_count(&this);
+		Self::queue(&this) && WORKERS.wake_next()
+	}
+}
+
+impl fmt::Debug for Request {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.debug_struct("Request")
+			.field("sqe", &self.sqe)
+			.field("mask", &self.mask)
+			.finish()
+	}
+}
+
+/// An `io_uring` instance.
+pub struct IoUring(Arc<Ring>);
+
+impl IoUring {
+	/// Creates an instance with `sq_entries` submission entries and `cq_entries` completion
+	/// entries.
+	///
+	/// Both sizes must be powers of two.
+	pub fn new(sq_entries: u32, cq_entries: u32) -> AllocResult<Self> {
+		debug_assert!(sq_entries.is_power_of_two() && cq_entries.is_power_of_two());
+		let cqes_off = (SQ_ARRAY + sq_entries as usize * size_of::<u32>()).next_multiple_of(64);
+		let rings = Region::new(cqes_off + cq_entries as usize * size_of::<Cqe>())?;
+		let sqes = Region::new(sq_entries as usize * size_of::<Sqe>())?;
+		rings.field(SQ_MASK).store(sq_entries - 1, Relaxed);
+		rings.field(SQ_ENTRIES).store(sq_entries, Relaxed);
+		rings.field(CQ_MASK).store(cq_entries - 1, Relaxed);
+		rings.field(CQ_ENTRIES).store(cq_entries, Relaxed);
+		Ok(Self(Arc::new(Ring {
+			rings,
+			sqes,
+			sq_mask: sq_entries - 1,
+			cq_mask: cq_entries - 1,
+			cqes_off,
+
+			sq_lock: Mutex::new(()),
+			cq_lock: Spin::new(()),
+			cq_wait: WaitQueue::new(),
+
+			armed: Spin::new(Vec::new()),
+			closed: AtomicBool::new(false),
+		})?))
+	}
+
+	/// Maps the rings in `mem_space`, filling the offsets in `params`.
+	pub fn map(&self, mem_space: &MemSpace, params: &mut Params) -> EResult<()> {
+		let ring = &self.0;
+		let prot = PROT_READ | PROT_WRITE;
+		let flags = MAP_SHARED | MAP_ANONYMOUS;
+		let rings_addr = mem_space.map_special(prot, flags, &ring.rings.0)?;
+		let sqes_addr = match mem_space.map_special(prot, flags, &ring.sqes.0) {
+			Ok(addr) => addr,
+			Err(e) => {
+				let pages = NonZeroUsize::new(ring.rings.0.len()).unwrap();
+				mem_space.unmap(rings_addr, pages)?;
+				return Err(e.into());
+			}
+		};
+		params.sq_entries = ring.sq_mask + 1;
+		params.cq_entries = ring.cq_mask + 1;
+		params.features = IORING_FEAT_SINGLE_MMAP;
+		params.sq_off = SqringOffsets {
+			head: SQ_HEAD as _,
+			tail: SQ_TAIL as _,
+			ring_mask: SQ_MASK as _,
+			ring_entries: SQ_ENTRIES as _,
+			flags: SQ_FLAGS as _,
+			dropped: SQ_DROPPED as _,
+			array: SQ_ARRAY as _,
+			resv1: 0,
+			user_addr: sqes_addr.0 as _,
+		};
+		params.cq_off = CqringOffsets {
+			head: CQ_HEAD as _,
+			tail: CQ_TAIL as _,
+			ring_mask: CQ_MASK as _,
+			ring_entries: CQ_ENTRIES as _,
+			overflow: CQ_OVERFLOW as _,
+			cqes: ring.cqes_off as _,
+			flags: CQ_FLAGS as _,
+			resv1: 0,
+			user_addr: rings_addr.0 as _,
+		};
+		Ok(())
+	}
+
+	/// Unmaps the rings mapped in `mem_space` by [`Self::map`], using the values it filled in
+	/// `params`.
+	pub fn unmap(mem_space: &MemSpace, params: &Params) -> EResult<()> {
+		let rings_len =
+			params.cq_off.cqes as usize + params.cq_entries as usize * size_of::<Cqe>();
+		let sqes_len = params.sq_entries as usize * size_of::<Sqe>();
+		for (addr, len) in [
+			(params.cq_off.user_addr, rings_len),
+			(params.sq_off.user_addr, sqes_len),
+		] {
+			let pages = NonZeroUsize::new(len.div_ceil(PAGE_SIZE)).unwrap();
+			mem_space.unmap(VirtAddr(addr as _), pages)?;
+		}
+		Ok(())
+	}
+
+	/// Submits up to `count` entries of the submission queue, returning the number of entries
+	/// consumed.
+	pub fn submit(&self, count: u32) -> EResult<u32> {
+		Ring::submit(&self.0, count)
+	}
+
+	/// Waits until at least `count` completions are available in the completion queue.
+	pub fn wait(&self, count: u32) -> EResult<()> {
+		let ring = &self.0;
+		let count = min(count, ring.cq_mask + 1);
+		ring.cq_wait
+			.wait_until(|| (ring.pending() >= count).then_some(()))
+	}
+}
+
+impl FileOps for IoUring {
+	fn release(&self, _file: &File) {
+		let ring = &self.0;
+		ring.closed.store(true, Release);
+		// Cancel requests waiting for their file, to break the reference cycles with their hooks
+		let armed = core::mem::take(&mut *ring.armed.lock());
+		for req in armed {
+			if !req.done.swap(true, Acquire) {
+				req.table.lock().take();
+			}
+		}
+	}
+
+	fn poll(&self, _file: &File, mask: u32) -> EResult<u32> {
+		let ready = self.0.pending() > 0;
+		Ok(if ready { POLLIN | POLLRDNORM } else { 0 } & mask)
+	}
+
+	fn poll_wait(&self, _file: &File, _mask: u32, table: &mut PollTable) -> EResult<()> {
+		// The queue lives as long as the instance, which the file keeps alive
+		unsafe { table.add(&self.0.cq_wait) }?;
+		Ok(())
+	}
+}
+
+impl fmt::Debug for IoUring {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.write_str("IoUring")
+	}
+}
+
+/// The entry point of the kernel tasks executing `io_uring` requests.
+pub(crate) fn worker_task() -> ! {
+	loop {
+		let Ok(req) = WORKERS.wait_until(|| Request::dequeue(|_| true)) else {
+			// Kernel threads do not handle signals: discard them, so that waiting is not
+			// interrupted again
+			Process::current().signal.lock().clear_pending();
+			continue;
+		};
+		// Keep the memory space bound while consecutive requests come from the same process
+		let mem_space = req.mem_space.clone();
+		MemSpace::switch(&mem_space, |mem_space| {
+			let mut req = Some(req);
+			while let Some(cur) = req {
+				if !cur.ring.closed.load(Acquire) {
+					Request::run(&cur);
+				}
+				req = Request::dequeue(|next| {
+					Arc::as_ptr(&next.mem_space) == Arc::as_ptr(mem_space)
+				});
+			}
+		});
+	}
+}
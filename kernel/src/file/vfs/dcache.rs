@@ -0,0 +1,284 @@
+/*
+ * Copyright 2026 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! The directory entries cache (dcache).
+//!
+//! Cached entries are inserted in a global hash table, indexed by their parent and name. Lookups
+//! do not take any lock: they traverse the chains of the table inside an RCU read-side critical
+//! section, without taking references on the entries they go through. Modifications of a chain
+//! are serialized by the bucket's spinlock, and the cache's reference to a removed entry is
+//! released only after a grace period.
+//!
+//! Reclaimable entries are also inserted in an LRU, split in shards, an entry being inserted on
+//! the shard of the CPU that cached it. Lookups do not promote entries: they only mark them as
+//! referenced, which gives them a second chance when the cache shrinks.
+
+use super::Entry;
+use crate::{
+	arch::core_id,
+	println,
+	sync::{
+		rcu,
+		rcu::{RcuHead, ReadGuard},
+		spin::Spin,
+	},
+};
+use core::{
+	hash::Hasher,
+	mem::{ManuallyDrop, offset_of},
+	ptr,
+	ptr::NonNull,
+	sync::atomic::{
+		AtomicPtr,
+		Ordering::{Acquire, Relaxed, Release},
+	},
+};
+use utils::{collections::hashmap::hash::FxHasher, list, list_type, ptr::arc::Arc};
+
+/// The number of buckets of the hash table, as a power of two.
+const HASH_BITS: u32 = 12;
+/// The number of LRU shards.
+const LRU_SHARDS: usize = 8;
+
+/// A bucket of the hash table.
+struct Bucket {
+	/// The first entry of the chain
+	head: AtomicPtr<Entry>,
+	/// The lock serializing modifications of the chain
+	lock: Spin<()>,
+}
+
+/// The hash table of cached entries.
+static TABLE: [Bucket; 1 << HASH_BITS] = [const {
+	Bucket {
+		head: AtomicPtr::new(ptr::null_mut()),
+		lock: Spin::new(()),
+	}
+}; 1 << HASH_BITS];
+
+/// The LRU shards of reclaimable entries.
+static LRU: [Spin<list_type!(Entry, lru)>; LRU_SHARDS] =
+	[const { Spin::new(list!(Entry, lru)) }; LRU_SHARDS];
+
+/// Returns the bucket of the child `name` of `parent`.
+fn bucket(parent: &Entry, name: &[u8]) -> &'static Bucket {
+	let mut hasher = FxHasher::default();
+	hasher.write_usize(ptr::from_ref(parent).addr());
+	hasher.write(name);
+	&TABLE[hasher.finish() as usize & ((1 << HASH_BITS) - 1)]
+}
+
+/// Tells whether `ent` is the child `name` of `parent`.
+#[inline]
+fn is_child(ent: &Entry, parent: &Entry, name: &[u8]) -> bool {
+	ent.parent
+		.as_ref()
+		.is_some_and(|p| ptr::eq(Arc::as_ptr(p), parent))
+		&& *ent.name == *name
+}
+
+/// Returns a new reference to `ent`.
+///
+/// # Safety
+///
+/// `ent` must be owned by an [`Arc`] whose count cannot reach zero during the call.
+#[inline]
+unsafe fn new_ref(ent: &Entry) -> Arc<Entry> {
+	let arc = ManuallyDrop::new(unsafe { Arc::from_raw(ent) });
+	Arc::clone(&arc)
+}
+
+/// Returns a new reference to `ent`, which has been found inside the read-side critical
+/// section of `guard`.
+#[inline]
+pub fn get_ref(_guard: &ReadGuard, ent: &Entry) -> Arc<Entry> {
+	// The cache's reference is released only after a grace period, so the count cannot reach zero
+	unsafe { new_ref(ent) }
+}
+
+/// Looks up the child `name` of `parent` in the cache, inside the read-side critical section of
+/// `guard`.
+///
+/// The returned entry remains valid until `guard` is dropped. A reference to it can be taken with
+/// [`get_ref`].
+pub fn lookup_rcu<'g>(_guard: &'g ReadGuard, parent: &Entry, name: &[u8]) -> Option<&'g Entry> {
+	let mut cur = bucket(parent, name).head.load(Acquire);
+	while let Some(ent) = unsafe { cur.as_ref() } {
+		if is_child(ent, parent, name) {
+			ent.referenced.store(true, Relaxed);
+			return Some(ent);
+		}
+		cur = ent.hash_next.load(Acquire);
+	}
+	None
+}
+
+/// Looks up the child `name` of `parent` in the cache.
+pub fn lookup(parent: &Entry, name: &[u8]) -> Option<Arc<Entry>> {
+	let guard = rcu::read_lock();
+	lookup_rcu(&guard, parent, name).map(|ent| get_ref(&guard, ent))
+}
+
+/// Returns the link pointing to the child `name` of `parent` in `bucket`, along with the child.
+///
+/// The bucket must be locked.
+fn find_locked<'b>(
+	bucket: &'b Bucket,
+	parent: &Entry,
+	name: &[u8],
+) -> Option<(&'b AtomicPtr<Entry>, &'b Entry)> {
+	let mut link = &bucket.head;
+	loop {
+		let ent = unsafe { link.load(Relaxed).as_ref()? };
+		if is_child(ent, parent, name) {
+			return Some((link, ent));
+		}
+		link = &ent.hash_next;
+	}
+}
+
+/// Removes `ent` from the LRU, then releases the cache's reference to it after a grace period.
+///
+/// `ent` must have been removed from the hash table, while its bucket is locked.
+fn evict(ent: &Entry) {
+	let arc = unsafe { new_ref(ent) };
+	unsafe {
+		LRU[ent.shard.load(Relaxed) as usize].lock().remove(&arc);
+	}
+	drop(arc);
+	unsafe {
+		rcu::call(&ent.rcu, release_rcu);
+	}
+}
+
+/// Releases the cache's reference to the entry in which `head` is embedded.
+unsafe fn release_rcu(head: NonNull<RcuHead>) {
+	let ent = unsafe {
+		let ptr = head.byte_sub(offset_of!(Entry, rcu)).cast::<Entry>();
+		Arc::from_raw(ptr.as_ptr())
+	};
+	// Nobody is left to report the error to
+	if let Err(errno) = Entry::release(ent) {
+		println!("Failed to release evicted entry: {errno}");
+	}
+}
+
+/// Implementation of [`insert`] and [`replace`].
+fn insert_impl(entry: Arc<Entry>, replace: bool, reclaimable: bool) -> Arc<Entry> {
+	let Some(parent) = &entry.parent else {
+		// The root of the VFS is not cached
+		return entry;
+	};
+	let bucket = bucket(parent, &entry.name);
+	let _lock = bucket.lock.lock();
+	let old = find_locked(bucket, parent, &entry.name);
+	let old = match old {
+		Some((_, old)) if !replace => return unsafe { new_ref(old) },
+		Some((link, old)) => {
+			link.store(old.hash_next.load(Relaxed), Release);
+			Some(old)
+		}
+		None => None,
+	};
+	if reclaimable {
+		let shard = core_id() as usize % LRU_SHARDS;
+		entry.shard.store(shard as _, Relaxed);
+		LRU[shard].lock().insert_front(entry.clone());
+	}
+	// The table holds a reference to the entry
+	entry.hash_next.store(bucket.head.load(Relaxed), Relaxed);
+	let ptr = Arc::into_raw(entry.clone());
+	bucket.head.store(ptr.cast_mut(), Release);
+	if let Some(old) = old {
+		evict(old);
+	}
+	entry
+}
+
+/// Inserts `entry` in the cache as a child of its parent.
+///
+/// If the parent already has a cached child with the same name, `entry` is not inserted and the
+/// function returns the cached child instead.
+pub fn insert(entry: Arc<Entry>) -> Arc<Entry> {
+	insert_impl(entry, false, true)
+}
+
+/// Inserts `entry` in the cache as a child of its parent, replacing the cached child with the
+/// same name, if any.
+///
+/// If `reclaimable` is `false`, the entry is never removed from the cache when it shrinks.
+pub fn replace(entry: Arc<Entry>, reclaimable: bool) {
+	insert_impl(entry, true, reclaimable);
+}
+
+/// Removes the child `name` of `parent` from the cache.
+///
+/// If `only` is set, the child is removed only if it is this entry.
+///
+/// The function returns `true` if an entry has been removed.
+fn remove_impl(parent: &Entry, name: &[u8], only: Option<&Entry>) -> bool {
+	let bucket = bucket(parent, name);
+	let _lock = bucket.lock.lock();
+	let Some((link, ent)) = find_locked(bucket, parent, name) else {
+		return false;
+	};
+	if only.is_some_and(|only| !ptr::eq(only, ent)) {
+		return false;
+	}
+	link.store(ent.hash_next.load(Relaxed), Release);
+	evict(ent);
+	true
+}
+
+/// Removes the child `name` of `parent` from the cache.
+pub fn remove(parent: &Entry, name: &[u8]) {
+	remove_impl(parent, name, None);
+}
+
+/// Attempts to shrink the cache, evicting an entry that is not in use.
+///
+/// If the cache cannot shrink, the function returns `false`.
+pub fn shrink() -> bool {
+	let start = core_id() as usize;
+	for i in 0..LRU_SHARDS {
+		let candidate = {
+			let mut lru = LRU[(start + i) % LRU_SHARDS].lock();
+			lru.iter().rev().find_map(|cursor| {
+				let ent = cursor.arc();
+				// Give a second chance to entries that have been looked up since the last scan
+				if ent.referenced.swap(false, Relaxed) {
+					return None;
+				}
+				// The reference we hold, plus the one held by the LRU, plus the one held by the
+				// table. Entries with cached children are referenced by them
+				(Arc::strong_count(&ent) <= 3).then_some(ent)
+			})
+		};
+		let Some(ent) = candidate else {
+			continue;
+		};
+		// Entries in the LRU always have a parent
+		let Some(parent) = &ent.parent else {
+			continue;
+		};
+		if remove_impl(parent, &ent.name, Some(&ent)) {
+			return true;
+		}
+	}
+	false
+}
@@ -30,6 +30,7 @@
 /// - `gid`
 ///
 /// `uid` and `gid` are set according to `ap`
+pub mod dcache;
 pub mod mountpoint;
 pub mod node;
 
@@ -43,17 +44,15 @@ use crate::{
 		perm::{can_search_directory, can_set_file_permissions, can_write_directory},
 	},
 	process::Process,
-	sync::{mutex::Mutex, once::OnceInit, spin::Spin},
+	sync::{once::OnceInit, rcu, rcu::RcuHead},
 };
 use core::{
-	borrow::Borrow,
-	hash::{Hash, Hasher},
 	hint::unlikely,
+	sync::atomic::{AtomicBool, AtomicPtr, AtomicU8},
 };
 use node::Node;
 use utils::{
 	collections::{
-		hashset::HashSet,
 		list::ListNode,
 		path::{Component, Path, PathBuf},
 		string::String,
@@ -62,36 +61,9 @@ use utils::{
 	errno,
 	errno::{AllocResult, EResult},
 	limits::{LINK_MAX, PATH_MAX, SYMLOOP_MAX},
-	list, list_type,
 	ptr::arc::Arc,
 };
 
-/// A child of a VFS entry.
-///
-/// The [`Hash`] and [`PartialEq`] traits are forwarded to the entry's name.
-#[derive(Debug)]
-struct EntryChild(Arc<Entry>);
-
-impl Borrow<[u8]> for EntryChild {
-	fn borrow(&self) -> &[u8] {
-		&self.0.name
-	}
-}
-
-impl Eq for EntryChild {}
-
-impl PartialEq for EntryChild {
-	fn eq(&self, other: &Self) -> bool {
-		self.0.name.eq(&other.0.name)
-	}
-}
-
-impl Hash for EntryChild {
-	fn hash<H: Hasher>(&self, state: &mut H) {
-		self.0.name.hash(state)
-	}
-}
-
 /// A VFS entry, representing a directory entry cached in memory.
 ///
 /// An entry can be negative. That is, represent a non-existent file.
@@ -103,17 +75,21 @@ pub struct Entry {
 	///
 	/// If `None`, the current entry is the root of the VFS.
 	pub parent: Option<Arc<Entry>>,
-	/// The list of cached file entries.
-	///
-	/// This is not an exhaustive list of the file's entries. Only those that are loaded.
-	children: Mutex<HashSet<EntryChild>, false>,
 	/// The node associated with the entry.
 	///
 	/// If `None`, the entry is negative.
 	pub node: Option<Arc<Node>>,
 
+	/// The next entry in the cache's hash chain
+	hash_next: AtomicPtr<Entry>,
 	/// Node for the LRU
 	lru: ListNode,
+	/// The LRU shard the entry is inserted in
+	shard: AtomicU8,
+	/// Tells whether the entry has been looked up since the cache last tried to reclaim it
+	referenced: AtomicBool,
+	/// Header to release the cache's reference to the entry after a grace period
+	rcu: RcuHead,
 }
 
 impl Entry {
@@ -122,10 +98,13 @@ impl Entry {
 		Self {
 			name,
 			parent,
-			children: Default::default(),
 			node,
 
+			hash_next: Default::default(),
 			lru: Default::default(),
+			shard: Default::default(),
+			referenced: Default::default(),
+			rcu: Default::default(),
 		}
 	}
 
@@ -181,38 +160,21 @@ impl Entry {
 		Ok(PathBuf::new_unchecked(String::from(buf)))
 	}
 
-	/// Makes `self` a child of its parent, if any. The entry is also inserted in the LRU.
+	/// Makes `self` a child of its parent, if any, inserting it in the cache. If the parent
+	/// already has a cached child with the same name, it is replaced.
 	///
 	/// The function returns `self` wrapped into an [`Arc`].
 	pub fn link_parent(self) -> AllocResult<Arc<Self>> {
 		let entry = Arc::new(self)?;
-		if let Some(parent) = &entry.parent {
-			parent.children.lock().insert(EntryChild(entry.clone()))?;
-		}
-		LRU.lock().insert_front(entry.clone());
+		dcache::replace(entry.clone(), true);
 		Ok(entry)
 	}
 
 	/// Releases the entry, removing the underlying node if no link remain and this was the last
 	/// use of it.
+	///
+	/// Cached entries are released only once removed from the cache.
 	pub fn release(this: Arc<Self>) -> EResult<()> {
-		// Lock now to avoid a race condition
-		let mut lru = LRU.lock();
-		/*
-		 * If this is **not** the last reference to the entry, we cannot remove it.
-		 *
-		 * The reference that we hold here + the one held by the LRU = 2
-		 *
-		 * We cannot release an entry with at least one cached child. Fortunately, a child
-		 * entry refers to its parent, so the condition below is sufficient.
-		 */
-		if Arc::strong_count(&this) > 2 {
-			return Ok(());
-		}
-		unsafe {
-			lru.remove(&this);
-		}
-		drop(lru);
 		// If other references remain, we cannot go further
 		let Some(entry) = Arc::into_inner(this) else {
 			return Ok(());
@@ -225,38 +187,11 @@ impl Entry {
 	}
 }
 
-/// Directory entries LRU.
-static LRU: Spin<list_type!(Entry, lru)> = Spin::new(list!(Entry, lru));
-
 /// Attempts to shrink the directory entries cache.
 ///
 /// If the cache cannot shrink, the function returns `false`.
 pub fn shrink_entries() -> bool {
-	let mut lru = LRU.lock();
-	for cursor in lru.iter().rev() {
-		let entry = cursor.arc();
-		// The following is the same as the implementation of `Entry::release`. We don't call
-		// directly to reuse the lock on `LRU`
-		let Some(parent) = entry.parent.clone() else {
-			continue;
-		};
-		let mut parent_children = parent.children.lock();
-		if Arc::strong_count(&entry) > 3 {
-			continue;
-		}
-		parent_children.remove(&*entry.name);
-		cursor.remove();
-		let Some(entry) = Arc::into_inner(entry) else {
-			continue;
-		};
-		drop(parent_children);
-		if let Some(node) = entry.node {
-			// TODO log I/O errors?
-			let _ = Node::release(node);
-		}
-		return true;
-	}
-	false
+	dcache::shrink()
 }
 
 /// The root entry of the VFS
@@ -323,15 +258,8 @@ pub enum Resolved<'s> {
 /// If the entry does not exist in cache or on the filesystem, the function returns a negative
 /// entry.
 fn resolve_entry(lookup_dir: &Arc<Entry>, name: &[u8]) -> EResult<Arc<Entry>> {
-	let mut children = lookup_dir.children.lock();
 	// Try to get from cache first
-	if let Some(ent) = children.get(name) {
-		let ent = ent.0.clone();
-		drop(children);
-		// Promote the entry in the LRU
-		unsafe {
-			LRU.lock().lru_promote(&ent);
-		}
+	if let Some(ent) = dcache::lookup(lookup_dir, name) {
 		return Ok(ent);
 	}
 	// Not in cache. Try to get from the filesystem
@@ -340,12 +268,10 @@ fn resolve_entry(lookup_dir: &Arc<Entry>, name: &[u8]) -> EResult<Arc<Entry>> {
 	lookup_dir_node
 		.node_ops
 		.lookup_entry(lookup_dir_node, &mut entry)?;
-	let entry = Arc::new(entry)?;
+	let mut entry = Arc::new(entry)?;
 	if lookup_dir_node.fs.ops.cache_entries() {
-		// Insert in cache. Do not use `link_parent` to keep `children` locked
-		children.insert(EntryChild(entry.clone()))?;
-		drop(children);
-		LRU.lock().insert_front(entry.clone());
+		// If another task cached the entry in the meantime, use it instead
+		entry = dcache::insert(entry);
 	}
 	Ok(entry)
 }
@@ -481,6 +407,94 @@ fn resolve_path_impl<'p>(
 	}
 }
 
+/// Resolves `path` with `settings`, using only the entries present in the cache, without taking
+/// any lock or reference on intermediate entries.
+///
+/// If the resolution requires an entry that is not in the cache, or to follow a symbolic link,
+/// the function returns `None` and the resolution must be done with [`resolve_path_impl`].
+fn resolve_path_rcu<'p>(
+	path: &'p Path,
+	settings: &ResolutionSettings,
+) -> Option<EResult<Resolved<'p>>> {
+	let guard = rcu::read_lock();
+	// Get start lookup directory
+	let mut lookup_dir: &Entry = match (path.is_absolute(), &settings.cwd) {
+		(false, Some(start)) => start,
+		_ => &settings.root,
+	};
+	let mut components = path.components();
+	let Some(final_component) = components.next_back() else {
+		return Some(Ok(Resolved::Found(dcache::get_ref(&guard, lookup_dir))));
+	};
+	// Iterate on intermediate components
+	for comp in components {
+		// Check lookup permission
+		if !can_search_directory(&lookup_dir.node().perm_stat()) {
+			return Some(Err(errno!(EACCES)));
+		}
+		// Get the name of the next entry
+		let name = match comp {
+			Component::ParentDir => {
+				if let Some(parent) = &lookup_dir.parent {
+					lookup_dir = parent;
+				}
+				continue;
+			}
+			Component::Normal(name) => name,
+			// Ignore
+			_ => continue,
+		};
+		// Get entry
+		let entry = dcache::lookup_rcu(&guard, lookup_dir, name)?;
+		if entry.is_negative() {
+			return Some(Err(errno!(ENOENT)));
+		}
+		match FileType::from_mode(entry.node().perm_stat().mode) {
+			Some(FileType::Directory) => lookup_dir = entry,
+			// Symbolic links are resolved on the slow path
+			Some(FileType::Link) => return None,
+			Some(_) => return Some(Err(errno!(ENOTDIR))),
+			None => return Some(Err(errno!(EUCLEAN))),
+		}
+	}
+	// Final component lookup
+	let name = match final_component {
+		Component::RootDir | Component::CurDir => {
+			return Some(Ok(Resolved::Found(dcache::get_ref(&guard, lookup_dir))));
+		}
+		Component::ParentDir => {
+			if let Some(parent) = &lookup_dir.parent {
+				lookup_dir = parent;
+			}
+			return Some(Ok(Resolved::Found(dcache::get_ref(&guard, lookup_dir))));
+		}
+		Component::Normal(name) => name,
+	};
+	// Check lookup permission
+	if !can_search_directory(&lookup_dir.node().perm_stat()) {
+		return Some(Err(errno!(EACCES)));
+	}
+	// Get entry
+	let entry = dcache::lookup_rcu(&guard, lookup_dir, name)?;
+	if entry.is_negative() {
+		// The file does not exist
+		return Some(if settings.create {
+			Ok(Resolved::Creatable {
+				parent: dcache::get_ref(&guard, lookup_dir),
+				name,
+			})
+		} else {
+			Err(errno!(ENOENT))
+		});
+	}
+	if settings.follow_link
+		&& FileType::from_mode(entry.node().perm_stat().mode) == Some(FileType::Link)
+	{
+		return None;
+	}
+	Some(Ok(Resolved::Found(dcache::get_ref(&guard, entry))))
+}
+
 /// Resolves the given `path` with the given `settings`.
 ///
 /// The following conditions can cause errors:
@@ -498,6 +512,9 @@ pub fn resolve_path<'p>(path: &'p Path, settings: &ResolutionSettings) -> EResul
 	if settings.cwd.is_none() && path.is_empty() {
 		return Err(errno!(ENOENT));
 	}
+	if let Some(res) = resolve_path_rcu(path, settings) {
+		return res;
+	}
 	resolve_path_impl(path, settings, 0)
 }
 
@@ -539,6 +556,7 @@ pub fn set_stat(node: &Node, set: &StatSet) -> EResult<()> {
 	if let Some(gid) = set.gid {
 		stat.gid = gid;
 	}
+	node.update_perm(&stat);
 	if let Some(ctime) = set.ctime {
 		stat.ctime = ctime;
 	}
@@ -670,15 +688,11 @@ pub fn unlink(entry: Arc<Entry>) -> EResult<()> {
 	if mountpoint::from_entry(&entry).is_some() {
 		return Err(errno!(EBUSY));
 	}
-	// Lock now to avoid race conditions
-	let mut children = parent.children.lock();
 	// Remove link from filesystem
 	let dir_node = parent.node();
 	dir_node.node_ops.unlink(dir_node, &entry)?;
 	// Remove link from cache
-	children.remove(entry.name.as_bytes());
-	// Drop to avoid deadlock
-	drop(children);
+	dcache::remove(parent, entry.name.as_bytes());
 	// Remove the underlying node if this was the last reference to it
 	Entry::release(entry)?;
 	Ok(())
@@ -781,7 +795,7 @@ pub fn rename(old: Arc<Entry>, new_parent: Arc<Entry>, new_name: &[u8]) -> EResu
 	// Perform rename
 	old.node().node_ops.rename(&old, &new_parent, new_name)?;
 	// Invalidate cache
-	old_parent.children.lock().remove(&*old.name);
-	new_parent.children.lock().remove(new_name);
+	dcache::remove(old_parent, &old.name);
+	dcache::remove(&new_parent, new_name);
 	Ok(())
 }
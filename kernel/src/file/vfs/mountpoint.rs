@@ -24,7 +24,7 @@ use crate::{
 		FileType, fs,
 		fs::{Filesystem, FilesystemType},
 		vfs,
-		vfs::EntryChild,
+		vfs::dcache,
 	},
 	sync::spin::Spin,
 };
@@ -255,11 +255,9 @@ pub fn create(
 	// If the next insertion fails, this will be undone by the implementation of `Drop`
 	mps.insert(Arc::as_ptr(&root_entry), mountpoint)?;
 	// Replace `target` with the mountpoint's root in the tree
-	if let Some(target_parent) = &parent {
-		target_parent
-			.children
-			.lock()
-			.insert(EntryChild(root_entry.clone()))?;
+	// The root is never reclaimed from the cache, so that the mountpoint remains reachable
+	if parent.is_some() {
+		dcache::replace(root_entry.clone(), false);
 	}
 	Ok(root_entry)
 }
@@ -279,7 +277,7 @@ pub fn remove(target: Arc<vfs::Entry>) -> EResult<()> {
 		// Cannot unmount root filesystem
 		return Err(errno!(EINVAL));
 	};
-	parent.children.lock().remove(target.name.as_bytes());
+	dcache::remove(parent, target.name.as_bytes());
 	// TODO release node and children
 	MOUNT_POINTS.lock().remove(&Arc::as_ptr(&target));
 	Ok(())
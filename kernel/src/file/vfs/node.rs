@@ -25,9 +25,16 @@ use crate::{
 		lock::Flock,
 	},
 	memory::{cache::MappedNode, user::UserSlice},
+	process::exec::elf::ElfImage,
 	sync::{mutex::Mutex, spin::Spin},
 };
-use core::ptr;
+use core::{
+	ptr,
+	sync::atomic::{
+		AtomicU64,
+		Ordering::{Acquire, Release},
+	},
+};
 use utils::{
 	boxed::Box,
 	collections::{list::ListNode, path::PathBuf, string::String, vec::Vec},
@@ -36,6 +43,12 @@ use utils::{
 	ptr::arc::Arc,
 };
 
+/// Packs the mode, UID and GID of `stat` into a single value.
+#[inline]
+fn pack_perm(stat: &Stat) -> u64 {
+	stat.mode as u64 | (stat.uid as u64) << 32 | (stat.gid as u64) << 48
+}
+
 /// A filesystem node, cached by the VFS.
 #[derive(Debug)]
 pub struct Node {
@@ -49,6 +62,10 @@ pub struct Node {
 	/// From the user of this structure's point of view, this is a read-only cache. It is updated
 	/// only by the VFS
 	pub stat: Spin<Stat>,
+	/// Copy of the mode, UID and GID of `stat`, readable without locking
+	///
+	/// Must be updated with [`Self::update_perm`] each time one of these fields is modified.
+	perm: AtomicU64,
 
 	/// Handle for node operations
 	pub node_ops: Box<dyn NodeOps>,
@@ -59,6 +76,8 @@ pub struct Node {
 	pub lock: Mutex<(), false>,
 	/// The node as mapped
 	pub mapped: MappedNode,
+	/// The parsed program image, if the node has been executed
+	pub exec_image: Spin<Option<Arc<ElfImage>>>,
 
 	/// BSD flavour advisory lock state
 	pub flock: Flock,
@@ -87,6 +106,7 @@ impl Node {
 			inode,
 			fs,
 
+			perm: AtomicU64::new(pack_perm(&stat)),
 			stat: Spin::new(stat),
 
 			node_ops,
@@ -94,6 +114,7 @@ impl Node {
 
 			lock: Default::default(),
 			mapped: Default::default(),
+			exec_image: Default::default(),
 
 			flock: Default::default(),
 
@@ -107,6 +128,33 @@ impl Node {
 		self.stat.lock().clone()
 	}
 
+	/// Sets the status of the node before it gets shared.
+	pub fn init_stat(&mut self, stat: Stat) {
+		*self.perm.get_mut() = pack_perm(&stat);
+		self.stat = Spin::new(stat);
+	}
+
+	/// Updates the lockless copy of the mode, UID and GID from `stat`.
+	///
+	/// The caller must hold the lock on `self.stat` and pass its content.
+	#[inline]
+	pub fn update_perm(&self, stat: &Stat) {
+		self.perm.store(pack_perm(stat), Release);
+	}
+
+	/// Returns a status containing only the mode, UID and GID of the node, without locking.
+	///
+	/// This is enough for permission checks and file type lookups.
+	pub fn perm_stat(&self) -> Stat {
+		let perm = self.perm.load(Acquire);
+		Stat {
+			mode: perm as _,
+			uid: (perm >> 32) as _,
+			gid: (perm >> 48) as _,
+			..Default::default()
+		}
+	}
+
 	/// Returns the type of the file.
 	#[inline]
 	pub fn get_type(&self) -> Option<FileType> {
@@ -137,12 +185,27 @@ impl Node {
 		PathBuf::try_from(String::from(buf))
 	}
 
+	/// Drops information derived from the node's content, which is about to be modified.
+	///
+	/// The modification time cannot be relied on for this, since it has a resolution of one
+	/// second.
+	#[inline]
+	pub fn content_changed(&self) {
+		self.exec_image.lock().take();
+	}
+
 	/// Synchronizes the node's cached content to disk.
 	#[inline]
 	pub fn sync_data(&self) -> EResult<()> {
 		self.mapped.sync()
 	}
 
+	/// Synchronizes the node's metadata to disk.
+	#[inline]
+	pub fn sync_metadata(&self) -> EResult<()> {
+		self.node_ops.sync_metadata(self)
+	}
+
 	/// Releases the node, removing it from the disk if this is the last reference to it.
 	pub fn release(this: Arc<Self>) -> EResult<()> {
 		// If other references are left (aside from the one in the filesystem's cache), do nothing
@@ -28,11 +28,26 @@ use crate::{
 	},
 	memory::user::UserSlice,
 	power::{halt, halting},
-	process::scheduler::{alter_flow, cpu::per_cpu, defer, preempt_check_resched},
+	process::scheduler::{
+		alter_flow,
+		cpu::{cpus, per_cpu},
+		defer, preempt_check_resched,
+	},
 	rand,
+	sync::{mutex::Mutex, spin::IntSpin},
+};
+use core::{
+	alloc::AllocError, array, cell::UnsafeCell, hint::unlikely, mem,
+	sync::atomic::Ordering::Acquire,
+};
+use utils::{
+	boxed::Box,
+	bytes::as_bytes,
+	collections::{string::String, vec::Vec},
+	errno,
+	errno::{AllocResult, EResult},
+	ptr::arc::Arc,
 };
-use core::{alloc::AllocError, array, cell::UnsafeCell, hint::unlikely};
-use utils::{boxed::Box, bytes::as_bytes, errno::AllocResult};
 
 type CallbackInner = dyn FnMut(u32, u32, &mut IntFrame, u8);
 /// A callback to handle an interruption
@@ -152,6 +167,178 @@ pub unsafe fn alloc_callback<F: 'static + FnMut(u32, u32, &mut IntFrame, u8)>(
 	})
 }
 
+/// Like [`alloc_callback`], except the callback is registered on the CPU core `cpu` instead of
+/// the current one.
+///
+/// This is useful for devices able to send interrupts to a given core, such as with MSI-X.
+///
+/// If no ID is available on `cpu`, the function returns [`AllocError`].
+///
+/// # Safety
+///
+/// This function must not be called inside an interrupt handler.
+pub unsafe fn alloc_callback_on<F: 'static + Send + FnMut(u32, u32, &mut IntFrame, u8)>(
+	cpu: u32,
+	callback: F,
+) -> AllocResult<CallbackHandle> {
+	// Allocate on the current core, since the deferred call runs in interrupt context
+	let callback = Box::new(callback)?;
+	let slot = Arc::new(IntSpin::new((Some(callback), None)))?;
+	let s = slot.clone();
+	defer::synchronous(cpu, move || {
+		let mut s = s.lock();
+		let Some(callback) = s.0.take() else {
+			return;
+		};
+		let callback: Callback = callback;
+		let res = per_cpu().int_callbacks.0[HARDWARE_INT_COUNT..]
+			.iter()
+			.enumerate()
+			.find(|(_, cell)| unsafe { (*cell.get()).is_none() })
+			.map(|(id, cell)| {
+				unsafe {
+					*cell.get() = Some(callback);
+				}
+				CallbackHandle {
+					cpu: core_id(),
+					id: (HARDWARE_INT_COUNT + id) as _,
+				}
+			});
+		s.1 = Some(res);
+	});
+	slot.lock().1.take().flatten().ok_or(AllocError)
+}
+
+/// A device interrupt, whose vector can be moved from a CPU core to another.
+///
+/// Device interrupts are listed in `/proc/irq`, which allows to change the core they are sent to.
+pub struct Irq {
+	/// The interrupt's name
+	pub name: String,
+	/// The interrupt's handler
+	handler: Arc<dyn Fn() + Send + Sync>,
+	/// Reprograms the device to send the interrupt on the vector `vector` of the core `cpu`,
+	/// with arguments `(cpu, vector)`
+	route: Box<dyn Fn(u32, u32) -> EResult<()> + Send + Sync>,
+	/// The callback bound to the interrupt's current vector
+	callback: Mutex<CallbackHandle, false>,
+}
+
+impl Irq {
+	/// Returns the core the interrupt is sent to.
+	pub fn cpu(&self) -> u32 {
+		self.callback.lock().cpu
+	}
+
+	/// Sends the interrupt to the core `cpu` from now on.
+	///
+	/// If the core is not online, the function returns [`errno::EINVAL`].
+	///
+	/// # Safety
+	///
+	/// This function must not be called inside an interrupt handler.
+	pub unsafe fn set_affinity(&self, cpu: u32) -> EResult<()> {
+		let online = cpus()
+			.get(cpu as usize)
+			.is_some_and(|c| c.online.load(Acquire));
+		if unlikely(!online) {
+			return Err(errno!(EINVAL));
+		}
+		let mut callback = self.callback.lock();
+		if callback.cpu == cpu {
+			return Ok(());
+		}
+		let handler = self.handler.clone();
+		let new = unsafe { alloc_callback_on(cpu, move |_, _, _, _| handler())? };
+		if let Err(e) = (self.route)(cpu, new.id) {
+			unsafe {
+				new.unregister();
+			}
+			return Err(e);
+		}
+		let old = mem::replace(&mut *callback, new);
+		let old_cpu = old.cpu;
+		unsafe {
+			old.unregister();
+		}
+		// Messages sent by the device before being reprogrammed may have reached the
+		// previous core and been dropped. Handle anything left behind
+		let handler = self.handler.clone();
+		defer::synchronous(old_cpu, move || handler());
+		Ok(())
+	}
+}
+
+/// The list of device interrupts. The number of each interrupt is its index in the list.
+static IRQS: Mutex<Vec<Arc<Irq>>, false> = Mutex::new(Vec::new());
+
+/// Allocates a device interrupt, initially sent to the core `cpu`.
+///
+/// Arguments:
+/// - `name` is the name of the interrupt, such as the device and queue it belongs to
+/// - `cpu` is the core to send the interrupt to
+/// - `handler` handles the interrupt. It must tolerate being called spuriously, and on two cores
+///   at once while the interrupt is moved to another core
+/// - `route` reprograms the device to send the interrupt on the vector `vector` of the core `cpu`,
+///   with arguments `(cpu, vector)`. For MSI-X, this is done with
+///   [`crate::device::bus::pci::MsiXEntry::set`]
+///
+/// Allocating a vector per device queue and binding it to the core submitting to the queue allows
+/// to complete I/O on that core, keeping caches warm and avoiding cross-core wakeups.
+///
+/// # Safety
+///
+/// This function must not be called inside an interrupt handler.
+pub unsafe fn alloc_irq<
+	H: 'static + Fn() + Send + Sync,
+	R: 'static + Fn(u32, u32) -> EResult<()> + Send + Sync,
+>(
+	name: String,
+	cpu: u32,
+	handler: H,
+	route: R,
+) -> EResult<Arc<Irq>> {
+	let handler: Arc<dyn Fn() + Send + Sync> = Arc::new(handler)?;
+	let route: Box<dyn Fn(u32, u32) -> EResult<()> + Send + Sync> = Box::new(route)?;
+	let h = handler.clone();
+	let callback = unsafe { alloc_callback_on(cpu, move |_, _, _, _| h())? };
+	let id = callback.id;
+	let res = (|| {
+		let irq = Arc::new(Irq {
+			name,
+			handler,
+			route,
+			callback: Mutex::new(callback),
+		})?;
+		let mut irqs = IRQS.lock();
+		irqs.reserve(1)?;
+		(irq.route)(cpu, id)?;
+		// Cannot fail since memory has been reserved
+		irqs.push(irq.clone())?;
+		Ok(irq)
+	})();
+	if res.is_err() {
+		unsafe {
+			CallbackHandle {
+				cpu,
+				id,
+			}
+			.unregister();
+		}
+	}
+	res
+}
+
+/// Returns the device interrupt with number `num`, if any.
+pub fn get_irq(num: usize) -> Option<Arc<Irq>> {
+	IRQS.lock().get(num).cloned()
+}
+
+/// Returns the number of device interrupts.
+pub fn irq_count() -> usize {
+	IRQS.lock().len()
+}
+
 /// Called whenever an interruption is triggered.
 ///
 /// `frame` is the stack frame of the interruption, with general purpose registers saved.
@@ -55,6 +55,7 @@
 
 pub mod acpi;
 pub mod arch;
+pub mod bench;
 mod boot;
 pub mod cmdline;
 #[macro_use]
@@ -64,6 +65,7 @@ pub mod device;
 pub mod elf;
 pub mod file;
 pub mod int;
+pub mod libc;
 pub mod logger;
 pub mod memory;
 pub mod module;
@@ -75,11 +77,13 @@ pub mod power;
 #[macro_use]
 pub mod print;
 pub mod process;
+pub mod profile;
 pub mod rand;
 pub mod selftest;
 pub mod sync;
 pub mod syscall;
 pub mod time;
+pub mod trace;
 #[cfg(config_tty_enabled)]
 pub mod tty;
 
@@ -87,7 +91,7 @@ use crate::{
 	arch::x86::{idt::IntFrame, smp},
 	file::{
 		fs::{float, initramfs},
-		vfs,
+		uring, vfs,
 	},
 	memory::{cache, vmem},
 	process::{
@@ -96,9 +100,9 @@ use crate::{
 		scheduler,
 		scheduler::{cpu::CPU, switch, switch::idle_task},
 	},
-	sync::spin::Spin,
+	sync::{rcu, spin::Spin},
 };
-use core::{ffi::c_void, sync::atomic::Ordering::Release};
+use core::{cmp::min, ffi::c_void, sync::atomic::Ordering::Release};
 pub use utils;
 use utils::{
 	collections::{path::Path, string::String, vec::Vec},
@@ -146,6 +150,8 @@ fn kernel_main_inner(magic: u32, multiboot_ptr: *const c_void) {
 
 	// Architecture-specific initialization, stage 1
 	arch::init1(true);
+	// Select the implementations of C functions
+	libc::init();
 
 	println!("Setup memory management");
 	memory::memmap::init(boot_info);
@@ -214,6 +220,16 @@ fn kernel_main_inner(magic: u32, multiboot_ptr: *const c_void) {
 			.expect("rebalance task launch failed");
 	}
 	Process::new_kthread(None, cache::flush_task, true).expect("cache flush task launch failed");
+	Process::new_kthread(None, rcu::rcu_task, true).expect("RCU task launch failed");
+	Process::new_kthread(None, net::napi::poll_task, true)
+		.expect("network poll task launch failed");
+	for _ in 0..min(CPU.len(), uring::MAX_WORKERS) {
+		Process::new_kthread(None, uring::worker_task, true)
+			.expect("io_uring worker launch failed");
+	}
+	if args_parser.is_bench() {
+		Process::new_kthread(None, bench::bench_task, true).expect("benchmark task launch failed");
+	}
 
 	unsafe {
 		switch::init_ctx(&init_frame);
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBC_H
+# define LIBC_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+// Feature flags, in sync with the `libc` module
+
+# define LIBC_SSE2	(1 << 0)
+# define LIBC_ERMS	(1 << 1)
+# define LIBC_FSRM	(1 << 2)
+
+// Below this size, the setup cost of vectorized variants is not worth it
+# define SIMD_THRESHOLD	32
+
+// Helpers for word-at-a-time algorithms
+# define ONES ((size_t) -1 / 0xff)
+# define HIGHS (ONES * 0x80)
+# define HAS_ZERO(w) (((w) - ONES) & (~(w) & HIGHS))
+
+// Word type allowing unaligned accesses
+typedef size_t __attribute__((__may_alias__, __aligned__(1))) uword;
+
+// Set of features usable by the functions, selected at boot
+extern uint32_t __libc_features;
+
+int __memcmp_sse2(const void *vl, const void *vr, size_t n);
+size_t __strlen_sse2(const char *s);
+void *__memchr_sse2(const void *s, int c, size_t n);
+
+#endif
@@ -0,0 +1,27 @@
+// Code based on musl. License: https://git.musl-libc.org/cgit/musl/tree/COPYRIGHT
+
+#include "libc.h"
+
+void *memchr(const void *src, int c, size_t n)
+{
+	const unsigned char *s = src;
+
+	c = (unsigned char) c;
+	if (n >= SIMD_THRESHOLD && (__libc_features & LIBC_SSE2))
+		return __memchr_sse2(src, c, n);
+	// Align
+	for (; ((uintptr_t) s % sizeof(size_t)) && n && *s != c; s++, n--)
+		;
+	if (n && *s != c) {
+		// Check word-by-word
+		const size_t k = ONES * c;
+		const size_t *w = (const size_t *) s;
+		for (; n >= sizeof(size_t) && !HAS_ZERO(*w ^ k); w++, n -= sizeof(size_t))
+			;
+		s = (const unsigned char *) w;
+	}
+	// Find the byte
+	for (; n && *s != c; s++, n--)
+		;
+	return n ? (void *) s : NULL;
+}
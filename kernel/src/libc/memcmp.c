@@ -1,10 +1,19 @@
-// Code taken from musl. License: https://git.musl-libc.org/cgit/musl/tree/COPYRIGHT
+// Code based on musl. License: https://git.musl-libc.org/cgit/musl/tree/COPYRIGHT
 
-#include <stddef.h>
+#include "libc.h"
 
 int memcmp(const void *vl, const void *vr, size_t n)
 {
-    const unsigned char *l = vl, *r = vr;
-    for (; n && *l == *r; n--, l++, r++);
-    return n ? *l - *r : 0;
+	const unsigned char *l = vl, *r = vr;
+
+	if (n >= SIMD_THRESHOLD && (__libc_features & LIBC_SSE2))
+		return __memcmp_sse2(vl, vr, n);
+	// Skip identical words
+	for (; n >= sizeof(size_t) && *(const uword *) l == *(const uword *) r;
+		n -= sizeof(size_t), l += sizeof(size_t), r += sizeof(size_t))
+		;
+	// Find the differing byte
+	for (; n && *l == *r; n--, l++, r++)
+		;
+	return n ? *l - *r : 0;
 }
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! The kernel provides its own implementation of the string and memory functions of the C
+//! library (`memcpy`, `memcmp`, `strlen`, ...), which are required by the compiler and used
+//! through the codebase.
+//!
+//! Those functions are implemented in C and assembly, next to this module and in the
+//! architecture-specific sources. Some of them have vectorized variants, which are selected at
+//! boot by [`init`], according to the features supported by the CPU.
+//!
+//! Vectorized variants save and restore the SIMD registers they use, since the kernel does not
+//! save the userspace FPU state on entry.
+
+use core::{
+	ffi::{c_int, c_void},
+	sync::atomic::{AtomicU32, Ordering::Relaxed},
+};
+
+/// Feature flag: SSE2 variants can be used.
+///
+/// This value must remain in sync with `libc.h` and the assembly sources.
+pub const FEATURE_SSE2: u32 = 1 << 0;
+/// Feature flag: `rep movsb` and `rep stosb` are fast for large buffers.
+///
+/// This value must remain in sync with `libc.h` and the assembly sources.
+pub const FEATURE_ERMS: u32 = 1 << 1;
+/// Feature flag: `rep movsb` is fast even for small buffers.
+///
+/// This value must remain in sync with `libc.h` and the assembly sources.
+pub const FEATURE_FSRM: u32 = 1 << 2;
+
+/// The set of features the C functions are allowed to use.
+///
+/// Before [`init`] is called, only generic implementations are used.
+#[unsafe(export_name = "__libc_features")]
+static FEATURES: AtomicU32 = AtomicU32::new(0);
+
+unsafe extern "C" {
+	fn memchr(s: *const c_void, c: c_int, n: usize) -> *const c_void;
+	fn strnlen(s: *const u8, maxlen: usize) -> usize;
+}
+
+/// Selects the implementations of the C functions according to the features supported by the
+/// current CPU.
+///
+/// This function must be called only once, on the bootstrap processor.
+pub(crate) fn init() {
+	let mut features = 0;
+	#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+	{
+		use crate::arch::x86::cpuid::{has_erms, has_fsrm, has_sse2};
+		if has_sse2() {
+			features |= FEATURE_SSE2;
+		}
+		if has_erms() {
+			features |= FEATURE_ERMS;
+			if has_fsrm() {
+				features |= FEATURE_FSRM;
+			}
+		}
+	}
+	FEATURES.store(features, Relaxed);
+}
+
+/// Returns the set of features used by the C functions.
+#[inline]
+pub fn features() -> u32 {
+	FEATURES.load(Relaxed)
+}
+
+/// Returns the offset of the first occurrence of `c` in `s`.
+///
+/// If not found, the function returns `None`.
+#[inline]
+pub fn find_byte(s: &[u8], c: u8) -> Option<usize> {
+	let ptr = unsafe { memchr(s.as_ptr() as _, c as _, s.len()) };
+	(!ptr.is_null()).then(|| ptr.addr() - s.as_ptr().addr())
+}
+
+/// Returns the length of the nul-terminated string at the beginning of `s`.
+///
+/// If `s` does not contain a nul byte, the function returns the length of `s`.
+#[inline]
+pub fn str_len(s: &[u8]) -> usize {
+	unsafe { strnlen(s.as_ptr(), s.len()) }
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+	use core::ffi::c_char;
+
+	unsafe extern "C" {
+		fn memcmp(s1: *const c_void, s2: *const c_void, n: usize) -> c_int;
+		fn strlen(s: *const c_char) -> usize;
+	}
+
+	/// Buffer sizes to test, covering small buffers and both tails of vectorized loops.
+	const SIZES: &[usize] = &[
+		0, 1, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 255, 1000,
+	];
+
+	#[test_case]
+	fn libc_memcmp() {
+		let mut a = [0u8; 1024];
+		let mut b = [0u8; 1024];
+		for (i, (a, b)) in a.iter_mut().zip(b.iter_mut()).enumerate() {
+			*a = i as u8;
+			*b = i as u8;
+		}
+		for align in 0..16 {
+			for &n in SIZES {
+				let ret = unsafe { memcmp(a[align..].as_ptr() as _, b.as_ptr() as _, n) };
+				assert_eq!(ret == 0, align == 0 || n == 0);
+				let ret = unsafe { memcmp(a.as_ptr() as _, b.as_ptr() as _, n) };
+				assert_eq!(ret, 0);
+				// Introduce a difference on each position of interest
+				for diff in [0, n / 2, n.saturating_sub(1)] {
+					if diff >= n {
+						continue;
+					}
+					let prev = b[diff];
+					b[diff] = a[diff].wrapping_add(1);
+					let ret = unsafe { memcmp(a.as_ptr() as _, b.as_ptr() as _, n) };
+					assert_eq!(ret, a[diff] as c_int - b[diff] as c_int);
+					b[diff] = prev;
+				}
+			}
+		}
+	}
+
+	#[test_case]
+	fn libc_strlen() {
+		let mut buf = [b'a'; 1024];
+		for align in 0..16 {
+			for &n in SIZES {
+				buf[align + n] = 0;
+				let len = unsafe { strlen(buf[align..].as_ptr() as _) };
+				assert_eq!(len, n);
+				assert_eq!(str_len(&buf[align..]), n);
+				assert_eq!(str_len(&buf[align..(align + n)]), n);
+				buf[align + n] = b'a';
+			}
+		}
+	}
+
+	#[test_case]
+	fn libc_memchr() {
+		let mut buf = [0u8; 1024];
+		for align in 0..16 {
+			for &n in SIZES {
+				let s = &mut buf[align..(align + n)];
+				assert_eq!(find_byte(s, 1), None);
+				for pos in [0, n / 2, n.saturating_sub(1)] {
+					if pos >= n {
+						continue;
+					}
+					s[pos] = 1;
+					assert_eq!(find_byte(s, 1), Some(pos));
+					s[pos] = 0;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,11 @@
+// Code based on musl. License: https://git.musl-libc.org/cgit/musl/tree/COPYRIGHT
+
+#include "libc.h"
+
+void *memchr(const void *src, int c, size_t n);
+
+size_t strnlen(const char *s, size_t n)
+{
+	const char *p = memchr(s, 0, n);
+	return p ? (size_t) (p - s) : n;
+}
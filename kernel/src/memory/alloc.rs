@@ -78,9 +78,9 @@ pub(crate) fn init() {
 
 	// TODO MMIO zone
 
-	*buddy::ZONES.lock() = [
+	buddy::init([
 		user_zone,
 		unsafe { core::mem::zeroed() }, // TODO MMIO
 		kernel_zone,
-	];
+	]);
 }
@@ -23,9 +23,15 @@
 //!
 //! The order of a frame is the `n` in the expression `pow(2, n)` that represents the
 //! size of a frame in pages.
+//!
+//! To avoid contention on the zones' lock, each CPU keeps a cache of free frames of small
+//! orders (see [`CpuFrames`]). The cache is refilled from, and drained to, the zones in batches.
 
-use super::{PhysAddr, VirtAddr, oom, stats};
-use crate::sync::{atomic::AtomicU64, spin::IntSpin};
+use super::{PhysAddr, VirtAddr, oom};
+use crate::{
+	process::scheduler::cpu::{counter, counter::Counter, cpus, try_per_cpu},
+	sync::{atomic::AtomicU64, once::OnceInit, spin::IntSpin},
+};
 use core::{
 	alloc::AllocError,
 	hint::unlikely,
@@ -34,7 +40,7 @@ use core::{
 	ptr,
 	ptr::{NonNull, null_mut},
 	slice,
-	sync::atomic::{AtomicBool, Ordering::Relaxed},
+	sync::atomic::{AtomicBool, AtomicUsize, Ordering::Relaxed},
 };
 use utils::{errno::AllocResult, limits::PAGE_SIZE, math};
 
@@ -67,6 +73,12 @@ pub const BUDDY_RETRY: Flags = 0b100;
 /// The size of the metadata for one frame.
 pub const FRAME_METADATA_SIZE: usize = size_of::<Frame>();
 
+/// The number of orders for which frames are cached per-CPU, starting from zero.
+const PCP_ORDERS: usize = 4;
+/// The maximum number of order-0 frames in a per-CPU list. For higher orders, the maximum is
+/// halved at each order.
+const PCP_HIGH: usize = 64;
+
 /// An allocatable zone of memory, initialized at boot.
 pub(crate) struct Zone {
 	/// A pointer to the beginning of the metadata of the zone
@@ -168,6 +180,79 @@ impl Zone {
 	fn frames(&self) -> &'static mut [Frame] {
 		unsafe { slice::from_raw_parts_mut(self.metadata_begin, self.pages_count as usize) }
 	}
+
+	/// Allocates a frame of order `order` in the zone.
+	///
+	/// Statistics in [`Counter::FreePages`] are left to the caller.
+	///
+	/// If no frame is available, the function returns `None`.
+	fn alloc_frame(&mut self, order: FrameOrder) -> Option<PhysAddr> {
+		let frame = unsafe { self.get_available_frame(order)?.as_mut() };
+		frame.split(self, order);
+		let frame = frame.frame();
+		frame.mark_used();
+		let addr = frame.addr(self);
+		debug_assert!(addr >= self.begin && addr < self.begin + self.get_size());
+		self.allocated_pages += math::pow2(order as usize);
+		Some(addr)
+	}
+
+	/// Frees the frame of order `order` at `addr`, which must be in the zone.
+	///
+	/// Statistics in [`Counter::FreePages`] are left to the caller.
+	fn free_frame(&mut self, addr: PhysAddr, order: FrameOrder) {
+		let frames = self.frames();
+		let frame_id = self.get_frame_id_from_addr(addr);
+		debug_assert!(frame_id < self.pages_count);
+		let frame = &mut frames[frame_id as usize];
+		debug_assert!(frame.is_allocated());
+		let free_frame = frame.mark_free(order);
+		free_frame.coalesce(self);
+		self.allocated_pages -= math::pow2(order as usize);
+	}
+}
+
+/// The location of a zone, which does not change after initialization.
+///
+/// This allows to find the zone of a frame without locking.
+#[derive(Clone, Copy)]
+struct ZoneLayout {
+	/// A pointer to the beginning of the metadata of the zone
+	metadata_begin: *mut Frame,
+	/// A pointer to the beginning of the allocatable memory of the zone
+	begin: PhysAddr,
+	/// The size of the zone in pages
+	pages_count: FrameID,
+}
+
+// The layout is immutable
+unsafe impl Send for ZoneLayout {}
+unsafe impl Sync for ZoneLayout {}
+
+/// The layout of each zone.
+static LAYOUTS: OnceInit<[ZoneLayout; ZONES_COUNT]> = unsafe { OnceInit::new() };
+
+/// Returns the index of the zone containing `addr`, along with the frame's index in the zone.
+fn locate(addr: PhysAddr) -> Option<(usize, &'static ZoneLayout, FrameID)> {
+	LAYOUTS.iter().enumerate().find_map(|(i, layout)| {
+		let id = addr.0.checked_sub(layout.begin.0)? / PAGE_SIZE;
+		(id < layout.pages_count as usize).then_some((i, layout, id as FrameID))
+	})
+}
+
+/// Initializes the allocator with the given zones.
+///
+/// This function must be called only once, at boot.
+pub(crate) fn init(zones: [Zone; ZONES_COUNT]) {
+	let layouts = zones.each_ref().map(|z| ZoneLayout {
+		metadata_begin: z.metadata_begin,
+		begin: z.begin,
+		pages_count: z.pages_count,
+	});
+	unsafe {
+		OnceInit::init(&LAYOUTS, layouts);
+	}
+	*ZONES.lock() = zones;
 }
 
 /// Returns the ID of `frame` in the associated zone `zone`.
@@ -305,7 +390,8 @@ impl FreeFrame {
 /// Metadata of an allocated physical page of memory.
 #[derive(Default)]
 pub struct Page {
-	/// If part of a mapped file, this is the offset in the file
+	/// If part of a mapped file, this is the offset in the file. If part of a slab whose header
+	/// is located outside of the page, this is the address of the header
 	pub off: AtomicU64,
 
 	/// Tells whether the page has been written to
@@ -394,14 +480,128 @@ pub fn get_order(pages: NonZeroUsize) -> FrameOrder {
 	}
 }
 
-/// Returns a mutable reference to the zone that contains the given physical address `phys_addr`.
+/// A list of free frames of the same zone and order, cached by a CPU.
+struct FrameList {
+	/// The number of frames in the list
+	len: usize,
+	/// The frames
+	frames: [PhysAddr; PCP_HIGH],
+}
+
+/// Per-CPU cache of free frames, for each zone and small order.
 ///
-/// `zones` is the list of zones.
-fn get_zone_for_addr(zones: &mut [Zone; ZONES_COUNT], phys_addr: PhysAddr) -> Option<&mut Zone> {
-	zones.iter_mut().find(|z| {
-		let end = z.begin + z.get_size();
-		(z.begin..end).contains(&phys_addr)
-	})
+/// Frames in the cache are considered allocated by their zone.
+///
+/// When a list is empty, it is refilled with a batch of frames from the zone. When it reaches its
+/// high watermark, a batch of frames is given back to the zone.
+pub struct CpuFrames {
+	/// Lists of frames, per zone then order
+	lists: [[IntSpin<FrameList>; PCP_ORDERS]; ZONES_COUNT],
+	/// The number of pages in the cache
+	cached: AtomicUsize,
+}
+
+impl CpuFrames {
+	/// Creates a new instance, with empty lists.
+	pub const fn new() -> Self {
+		Self {
+			lists: [const {
+				[const {
+					IntSpin::new(FrameList {
+						len: 0,
+						frames: [PhysAddr(0); PCP_HIGH],
+					})
+				}; PCP_ORDERS]
+			}; ZONES_COUNT],
+			cached: AtomicUsize::new(0),
+		}
+	}
+
+	/// Returns the maximum number of frames of order `order` in a list.
+	#[inline]
+	fn high(order: FrameOrder) -> usize {
+		PCP_HIGH >> order
+	}
+
+	/// Returns the number of frames of order `order` moved at once between a list and its zone.
+	#[inline]
+	fn batch(order: FrameOrder) -> usize {
+		(Self::high(order) / 4).max(1)
+	}
+
+	/// Takes a frame of order `order` from the list of zone `zone`, refilling it if empty.
+	///
+	/// If no frame is available in the zone, the function returns `None`.
+	fn alloc(&self, zone: usize, order: FrameOrder) -> Option<PhysAddr> {
+		let mut list = self.lists[zone][order as usize].lock();
+		if list.len == 0 {
+			let mut zones = ZONES.lock();
+			while list.len < Self::batch(order) {
+				let Some(addr) = zones[zone].alloc_frame(order) else {
+					break;
+				};
+				let len = list.len;
+				list.frames[len] = addr;
+				list.len += 1;
+			}
+			drop(zones);
+			let pages = list.len << order;
+			counter::add(Counter::FreePages, -(pages as isize));
+			self.cached.fetch_add(pages, Relaxed);
+		}
+		list.len = list.len.checked_sub(1)?;
+		self.cached.fetch_sub(1 << order, Relaxed);
+		Some(list.frames[list.len])
+	}
+
+	/// Puts the frame of order `order` at `addr` in the list of zone `zone`, draining the list if
+	/// full.
+	fn free(&self, zone: usize, addr: PhysAddr, order: FrameOrder) {
+		let mut list = self.lists[zone][order as usize].lock();
+		if list.len >= Self::high(order) {
+			let count = Self::batch(order);
+			{
+				let mut zones = ZONES.lock();
+				for _ in 0..count {
+					list.len -= 1;
+					zones[zone].free_frame(list.frames[list.len], order);
+				}
+			}
+			let pages = count << order;
+			counter::add(Counter::FreePages, pages as _);
+			self.cached.fetch_sub(pages, Relaxed);
+		}
+		let len = list.len;
+		list.frames[len] = addr;
+		list.len += 1;
+		self.cached.fetch_add(1 << order, Relaxed);
+	}
+
+	/// Gives all the cached frames back to the zones.
+	///
+	/// The function returns the number of pages that have been freed.
+	fn drain(&self) -> usize {
+		let mut total = 0;
+		for (zone, lists) in self.lists.iter().enumerate() {
+			for (order, list) in lists.iter().enumerate() {
+				let mut list = list.lock();
+				if list.len == 0 {
+					continue;
+				}
+				{
+					let mut zones = ZONES.lock();
+					for addr in &list.frames[..list.len] {
+						zones[zone].free_frame(*addr, order as _);
+					}
+				}
+				total += list.len << order;
+				list.len = 0;
+			}
+		}
+		counter::add(Counter::FreePages, total as _);
+		self.cached.fetch_sub(total, Relaxed);
+		total
+	}
 }
 
 /// Allocates a frame of memory using the buddy allocator.
@@ -417,40 +617,61 @@ pub fn alloc(order: FrameOrder, flags: Flags) -> AllocResult<PhysAddr> {
 	if unlikely(order > MAX_ORDER) {
 		return Err(AllocError);
 	}
-	// Select a zone and frame to allocate on
 	let begin_zone = (flags & ZONE_TYPE_MASK) as usize;
+	// Fast path: take from the CPU's cache
+	let cached = try_per_cpu()
+		.filter(|_| (order as usize) < PCP_ORDERS)
+		.and_then(|cpu| cpu.buddy_cache.alloc(begin_zone, order));
+	let addr = match cached {
+		Some(addr) => {
+			// Reset the metadata, which has been left from the previous use
+			get_page(addr).init(0);
+			addr
+		}
+		None => alloc_slow(order, flags, begin_zone)?,
+	};
+	crate::trace::event(crate::trace::Kind::FrameAlloc, addr.0 as _, order as _);
+	#[cfg(feature = "memtrace")]
+	super::trace::sample(
+		"buddy",
+		super::trace::SampleOp::Alloc,
+		addr.0,
+		math::pow2(order as usize),
+	);
+	Ok(addr)
+}
+
+/// Allocates a frame from the zones directly.
+///
+/// Arguments are the same as [`alloc`]. `begin_zone` is the first zone to try.
+fn alloc_slow(order: FrameOrder, flags: Flags, begin_zone: usize) -> AllocResult<PhysAddr> {
+	// Select a zone and frame to allocate on
 	let mut guard = None;
-	let (mut frame, zone) = loop {
+	let addr = loop {
 		let zones = guard.get_or_insert(ZONES.lock());
 		let res = zones[begin_zone..]
 			.iter_mut()
-			.find_map(|z| Some((z.get_available_frame(order)?, z)));
+			.find_map(|z| z.alloc_frame(order));
 		// If a frame has been found, use it
 		if let Some(res) = res {
 			break res;
 		}
+		// Retry with the frames cached by CPUs, if any
+		guard = None;
+		let drained: usize = cpus().iter().map(|cpu| cpu.buddy_cache.drain()).sum();
+		if drained > 0 {
+			continue;
+		}
 		// If allowed, reclaim memory and retry the allocation
 		if flags & BUDDY_RETRY != 0 {
-			// Avoid deadlock
-			guard = None;
 			oom::reclaim();
 		} else {
 			return Err(AllocError);
 		}
 	};
-	let frame = unsafe { frame.as_mut() };
-	// Do the actual allocation
-	frame.split(zone, order);
-	let frame = frame.frame();
-	frame.mark_used();
-	let addr = frame.addr(zone);
-	debug_assert!(addr >= zone.begin && addr < zone.begin + zone.get_size());
+	drop(guard);
 	// Statistics
-	let pages_count = math::pow2(order as usize);
-	zone.allocated_pages += pages_count;
-	stats::MEM_INFO.lock().mem_free -= pages_count * 4;
-	#[cfg(feature = "memtrace")]
-	super::trace::sample("buddy", super::trace::SampleOp::Alloc, addr.0, pages_count);
+	counter::add(Counter::FreePages, -(math::pow2(order as usize) as isize));
 	Ok(addr)
 }
 
@@ -469,18 +690,34 @@ pub fn alloc_kernel(order: FrameOrder, flags: Flags) -> AllocResult<NonNull<u8>>
 /// Returns a reference to the metadata of the page at `addr`.
 pub fn get_page(addr: PhysAddr) -> &'static Page {
 	debug_assert!(addr.is_aligned_to(PAGE_SIZE));
-	let mut zones = ZONES.lock();
-	let zone = get_zone_for_addr(&mut zones, addr).unwrap();
-	let frames = zone.frames();
-	let frame_id = zone.get_frame_id_from_addr(addr);
-	debug_assert!(frame_id < zone.pages_count);
-	let frame = &frames[frame_id as usize];
+	let (_, layout, frame_id) = locate(addr).unwrap();
+	let frame = unsafe { &*layout.metadata_begin.add(frame_id as usize) };
 	match frame {
 		Frame::Allocated(p) => p,
 		Frame::Free(_) => panic!("retrieving metadata of an unallocated frame"),
 	}
 }
 
+/// Splits the allocated frame of order `order` at `addr` into frames of order `0`.
+///
+/// Each page of the frame can then be freed separately, with order `0`. The buddy allocator
+/// coalesces them back once they are all free.
+///
+/// # Safety
+///
+/// The frame must have been allocated with [`alloc()`] with the same order, and must not have been
+/// freed.
+pub unsafe fn split(addr: PhysAddr, order: FrameOrder) {
+	debug_assert!(addr.is_aligned_to(PAGE_SIZE));
+	let (_, layout, frame_id) = locate(addr).unwrap();
+	// The frames of the block are reserved to the caller, so no lock is needed. Only the first
+	// one is marked as used
+	for i in 1..math::pow2(order as usize) {
+		let frame = &mut *layout.metadata_begin.add(frame_id as usize + i);
+		frame.mark_used();
+	}
+}
+
 /// Frees the given memory frame that was allocated using the buddy allocator.
 ///
 /// Arguments:
@@ -497,23 +734,23 @@ pub fn get_page(addr: PhysAddr) -> &'static Page {
 pub unsafe fn free(addr: PhysAddr, order: FrameOrder) {
 	debug_assert!(addr.is_aligned_to(PAGE_SIZE));
 	debug_assert!(order <= MAX_ORDER);
-	// Get zone
-	let mut zones = ZONES.lock();
-	let zone = get_zone_for_addr(&mut zones, addr).unwrap();
-	let frames = zone.frames();
-	// Perform free
-	let frame_id = zone.get_frame_id_from_addr(addr);
-	debug_assert!(frame_id < zone.pages_count);
-	let frame = &mut frames[frame_id as usize];
-	debug_assert!(frame.is_allocated());
-	let free_frame = frame.mark_free(order);
-	free_frame.coalesce(zone);
-	// Statistics
-	let pages_count = math::pow2(order as usize);
-	zone.allocated_pages -= pages_count;
-	stats::MEM_INFO.lock().mem_free += pages_count * 4;
+	let (zone, ..) = locate(addr).unwrap();
+	match try_per_cpu().filter(|_| (order as usize) < PCP_ORDERS) {
+		// Fast path: put in the CPU's cache
+		Some(cpu) => cpu.buddy_cache.free(zone, addr, order),
+		None => {
+			ZONES.lock()[zone].free_frame(addr, order);
+			counter::add(Counter::FreePages, math::pow2(order as usize) as _);
+		}
+	}
+	crate::trace::event(crate::trace::Kind::FrameFree, addr.0 as _, order as _);
 	#[cfg(feature = "memtrace")]
-	super::trace::sample("buddy", super::trace::SampleOp::Free, addr.0, pages_count);
+	super::trace::sample(
+		"buddy",
+		super::trace::SampleOp::Free,
+		addr.0,
+		math::pow2(order as usize),
+	);
 }
 
 /// Frees the given memory frame.
@@ -531,9 +768,15 @@ pub unsafe fn free_kernel(ptr: *mut u8, order: FrameOrder) {
 }
 
 /// Returns the total number of pages allocated by the buddy allocator.
+///
+/// Pages in per-CPU caches are not counted.
 pub fn allocated_pages_count() -> usize {
-	let zones = ZONES.lock();
-	zones.iter().map(|z| z.allocated_pages).sum()
+	let allocated: usize = ZONES.lock().iter().map(|z| z.allocated_pages).sum();
+	let cached: usize = cpus()
+		.iter()
+		.map(|cpu| cpu.buddy_cache.cached.load(Relaxed))
+		.sum();
+	allocated - cached
 }
 
 #[cfg(test)]
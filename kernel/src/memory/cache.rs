@@ -19,21 +19,40 @@
 //! The page cache allows to avoid unnecessary disk I/O by using all the available memory on the
 //! system to cache the content of the disk.
 //!
-//! A cached page can have the following states:
-//! - **Active**: the page is currently mapped. It cannot be reclaimed, unless the processes
-//!   mapping it are killed, turning the page inactive
-//! - **Inactive**: the page is not mapped (just in cache for a potential future use). It can be
-//!   reclaimed at anytime
+//! Cached pages are kept on LRU lists, to select the pages to reclaim when memory runs low. To
+//! avoid contention, the lists are split into shards. A page is assigned to the shard of the CPU
+//! that allocated it.
+//!
+//! Each shard has two lists:
+//! - **Active**: pages that have been accessed several times recently
+//! - **Inactive**: pages that are candidates for reclaim
+//!
+//! Accessing a page only sets its *referenced* bit, without locking. Referenced pages are
+//! promoted to the active list when found by the reclaim scan, or on their second access. When
+//! the inactive list becomes smaller than the active list, pages are moved from the tail of the
+//! active list to the inactive list, unless they have been referenced since.
+//!
+//! Pages that have been written to are also kept on a global *dirty list*, in the order they
+//! have been dirtied. The writeback task only walks the dirty pages that have expired, and
+//! writers are throttled when too much memory is dirty (see [`balance_dirty_pages`]).
+//!
+//! A page may be inserted in the cache while it is still being read from the device (see
+//! [`crate::memory::readahead`]). Looking the page up in the cache then waits for the read to
+//! complete.
 
 use crate::{
-	device::BlkDev,
+	arch::core_id,
+	device::{
+		BlkDev, request,
+		request::{BlkRequest, IoCompletion, IoDir},
+	},
 	memory::{
 		PhysAddr, VirtAddr, buddy,
 		buddy::{Flags, Page, ZONE_KERNEL},
-		stats::MEM_INFO,
+		stats::MEM_TOTAL,
 	},
 	println,
-	sync::{mutex::Mutex, spin::IntSpin},
+	sync::spin::IntSpin,
 	time::{
 		clock::{Clock, current_time_ms},
 		sleep_for,
@@ -44,17 +63,18 @@ use core::{
 	fmt,
 	fmt::Formatter,
 	marker::PhantomData,
+	mem,
 	ops::Deref,
-	slice,
+	ptr, slice,
 	sync::atomic::{
-		AtomicUsize,
-		Ordering::{Acquire, Release},
+		AtomicBool, AtomicU8, AtomicU64, AtomicUsize,
+		Ordering::{Acquire, Relaxed, Release},
 	},
 };
 use utils::{
 	bytes::AnyRepr,
-	collections::{btreemap::BTreeMap, list::ListNode},
-	errno::{AllocResult, EResult},
+	collections::{btreemap::BTreeMap, list::ListNode, vec::Vec},
+	errno::{AllocResult, CollectResult, EResult},
 	limits::PAGE_SIZE,
 	list, list_type,
 	ptr::arc::Arc,
@@ -62,6 +82,27 @@ use utils::{
 
 /// The timeout, in milliseconds, after which a dirty page may be written back to disk.
 const WRITEBACK_TIMEOUT: u64 = build_cfg!(config_memory_writeback_timeout);
+/// The maximum number of pages submitted at once to a device on writeback.
+const WRITEBACK_BATCH: usize = 256;
+
+/// The number of LRU shards.
+const LRU_SHARDS: usize = 16;
+/// The maximum number of pages reclaimed by a single call to [`shrink`].
+const RECLAIM_BATCH: usize = 32;
+/// The maximum number of pages examined on a list of a shard, per reclaim pass.
+const SCAN_BATCH: usize = 128;
+
+/// The percentage of memory that may be dirty before writers are throttled.
+const DIRTY_RATIO: usize = 20;
+/// The percentage of memory under which throttled writers stop writing pages back.
+const DIRTY_BACKGROUND_RATIO: usize = 10;
+
+/// LRU state: the page is not on any list.
+const LRU_NONE: u8 = 0;
+/// LRU state: the page is on the active list of its shard.
+const LRU_ACTIVE: u8 = 1;
+/// LRU state: the page is on the inactive list of its shard.
+const LRU_INACTIVE: u8 = 2;
 
 #[derive(Debug)]
 struct RcPageInner {
@@ -75,12 +116,31 @@ struct RcPageInner {
 
 	/// The number of places where the page is mapped.
 	map_count: AtomicUsize,
+	/// The read filling the page, if still pending or failed
+	read: IntSpin<Option<Arc<IoCompletion>>>,
+
+	/// The index of the LRU shard of the page
+	shard: u8,
+	/// The LRU list the page is on. Modified only while the shard is locked
+	lru_state: AtomicU8,
+	/// Tells whether the page has been accessed since the last reclaim scan
+	referenced: AtomicBool,
 	/// The node for the cache LRU
 	lru: ListNode,
+
+	/// The timestamp at which the page has been inserted in the dirty list, in milliseconds
+	dirtied_at: AtomicU64,
+	/// The node for the dirty list
+	dirty_node: ListNode,
 }
 
 impl Drop for RcPageInner {
 	fn drop(&mut self) {
+		// The device may still be writing to the page
+		let read = self.read.lock().take();
+		if let Some(read) = read {
+			let _ = read.wait();
+		}
 		unsafe {
 			buddy::free(self.addr, 0);
 		}
@@ -104,6 +164,24 @@ impl RcPage {
 	/// - `dev_off` is the offset of the page on the device
 	pub fn new(flags: Flags, dev: Option<Arc<BlkDev>>, dev_off: u64) -> AllocResult<Self> {
 		let addr = buddy::alloc(0, flags)?;
+		unsafe { Self::from_phys(addr, dev, dev_off) }
+	}
+
+	/// Creates a page from the already allocated frame of order `0` at `addr`.
+	///
+	/// The returned page takes ownership of the frame. On failure, the frame is freed.
+	///
+	/// Other arguments are the same as for [`Self::new`].
+	///
+	/// # Safety
+	///
+	/// The frame must have been allocated with the buddy allocator, with order `0` or split with
+	/// [`buddy::split`], and must not be owned by anything else.
+	pub unsafe fn from_phys(
+		addr: PhysAddr,
+		dev: Option<Arc<BlkDev>>,
+		dev_off: u64,
+	) -> AllocResult<Self> {
 		let p = Self(Arc::new(RcPageInner {
 			addr,
 
@@ -111,9 +189,17 @@ impl RcPage {
 			dev_off,
 
 			map_count: Default::default(),
+			read: IntSpin::new(None),
+
+			shard: (core_id() as usize % LRU_SHARDS) as _,
+			lru_state: AtomicU8::new(LRU_NONE),
+			referenced: AtomicBool::new(false),
 			lru: Default::default(),
+
+			dirtied_at: AtomicU64::new(0),
+			dirty_node: Default::default(),
 		})?);
-		LRU.lock().insert_front(p.0.clone());
+		p.lru_shard().lock().insert(p.0.clone(), LRU_INACTIVE);
 		Ok(p)
 	}
 
@@ -181,9 +267,62 @@ impl RcPage {
 		self.get_page().init(off);
 	}
 
+	/// Sets `read` as the pending read filling the page.
+	///
+	/// Until it completes, lookups in the cache wait for it.
+	pub fn set_read_pending(&self, read: Arc<IoCompletion>) {
+		*self.0.read.lock() = Some(read);
+	}
+
+	/// Tells whether the page is still being read from the device.
+	pub fn is_reading(&self) -> bool {
+		self.0
+			.read
+			.lock()
+			.as_ref()
+			.is_some_and(|read| !read.is_done())
+	}
+
+	/// Returns the pending read filling the page, if it is not over yet.
+	pub fn pending_read(&self) -> Option<Arc<IoCompletion>> {
+		self.0
+			.read
+			.lock()
+			.as_ref()
+			.filter(|read| !read.is_done())
+			.cloned()
+	}
+
+	/// Waits for the pending read filling the page, if any.
+	///
+	/// If the read failed, the content of the page is invalid and the function returns
+	/// [`utils::errno::EIO`].
+	pub fn wait_uptodate(&self) -> EResult<()> {
+		let read = self.0.read.lock().clone();
+		let Some(read) = read else {
+			return Ok(());
+		};
+		read.wait()?;
+		// The read succeeded, no need to keep track of it anymore
+		*self.0.read.lock() = None;
+		Ok(())
+	}
+
 	/// Marks the page as dirty.
+	///
+	/// If the page lives on a device, it is inserted in the dirty list to be written back later.
 	pub fn mark_dirty(&self) {
-		self.get_page().dirty.store(true, Release);
+		if self.get_page().dirty.swap(true, Release) || self.0.dev.is_none() {
+			return;
+		}
+		let mut dirty = DIRTY.lock();
+		if !self.0.dirty_node.is_linked() {
+			self.0
+				.dirtied_at
+				.store(current_time_ms(Clock::Boottime), Relaxed);
+			dirty.insert_back(self.0.clone());
+			DIRTY_COUNT.fetch_add(1, Relaxed);
+		}
 	}
 
 	/// Writes dirty pages back to disk, if their timestamp has expired.
@@ -196,25 +335,44 @@ impl RcPage {
 		let Some(dev) = &self.0.dev else {
 			return Ok(());
 		};
+		if !self.claim_writeback(ts, check_ts) {
+			return Ok(());
+		}
+		// Write page
+		dev.ops.writeback(dev, self.dev_offset(), self)?;
+		// Update write timestamp
+		if let Some(ts) = ts {
+			self.get_page().last_write.store(ts, Release);
+		}
+		Ok(())
+	}
+
+	/// Tells whether the page has to be written back, clearing its dirty flag if so.
+	///
+	/// Arguments are the same as for [`Self::writeback`].
+	fn claim_writeback(&self, ts: Option<UTimestamp>, check_ts: bool) -> bool {
 		let page = self.get_page();
 		// If not old enough, stop
 		if let Some(ts) = ts {
 			let last_write = page.last_write.load(Acquire);
 			if check_ts && ts < last_write + WRITEBACK_TIMEOUT {
-				return Ok(());
+				return false;
 			}
 		}
+		// Clear the flag and unlink under the same lock, so that a concurrent `mark_dirty` either
+		// happens before and is written back, or after and inserts the page again
+		let mut dirty = DIRTY.lock();
 		// If not dirty, stop
 		if !page.dirty.swap(false, Acquire) {
-			return Ok(());
+			return false;
 		}
-		// Write page
-		dev.ops.writeback(dev, self.dev_offset(), self)?;
-		// Update write timestamp
-		if let Some(ts) = ts {
-			page.last_write.store(ts, Release);
+		if self.0.dirty_node.is_linked() {
+			unsafe {
+				dirty.remove(&self.0);
+			}
+			DIRTY_COUNT.fetch_sub(1, Relaxed);
 		}
-		Ok(())
+		true
 	}
 
 	/// Returns a reference to the map counter.
@@ -228,16 +386,38 @@ impl RcPage {
 	pub fn is_shared(&self) -> bool {
 		self.0.map_count.load(Acquire) > 1
 	}
+
+	/// Returns the LRU shard of the page.
+	#[inline]
+	fn lru_shard(&self) -> &'static IntSpin<LruShard> {
+		&LRU[self.0.shard as usize]
+	}
+
+	/// Marks the page as accessed.
+	///
+	/// If the page was already referenced and is inactive, it is moved to the active list.
+	pub fn mark_accessed(&self) {
+		if !self.0.referenced.swap(true, Relaxed) {
+			return;
+		}
+		if self.0.lru_state.load(Relaxed) != LRU_INACTIVE {
+			return;
+		}
+		let mut shard = self.lru_shard().lock();
+		// The state may have changed before locking
+		if self.0.lru_state.load(Relaxed) == LRU_INACTIVE {
+			shard.remove(&self.0);
+			shard.insert(self.0.clone(), LRU_ACTIVE);
+		}
+	}
 }
 
 impl Drop for RcPage {
 	fn drop(&mut self) {
-		if Arc::strong_count(&self.0) > 2 {
+		if Arc::strong_count(&self.0) > 2 || self.0.lru_state.load(Relaxed) == LRU_NONE {
 			return;
 		}
-		unsafe {
-			LRU.lock().remove(&self.0);
-		}
+		self.lru_shard().lock().remove(&self.0);
 	}
 }
 
@@ -279,6 +459,12 @@ impl<T: AnyRepr> RcBlockVal<T> {
 	pub fn mark_dirty(&self) {
 		self.page.mark_dirty();
 	}
+
+	/// Writes the page storing the inner value back to disk, if dirty.
+	#[inline]
+	pub fn writeback(&self) -> EResult<()> {
+		self.page.writeback(None, false)
+	}
 }
 
 impl<T: AnyRepr> Deref for RcBlockVal<T> {
@@ -309,6 +495,8 @@ impl MappedNode {
 	/// Returns the page at the offset `off`.
 	///
 	/// If not present, the function returns `None`.
+	///
+	/// The function does not wait for the page to be read from the device.
 	pub fn get(&self, off: u64) -> Option<RcPage> {
 		self.cache.lock().get(&off).cloned()
 	}
@@ -320,32 +508,71 @@ impl MappedNode {
 		off: u64,
 		init: Init,
 	) -> EResult<RcPage> {
-		let pages = self.cache.lock();
-		if let Some(page) = pages.get(&off) {
+		let page = self.cache.lock().get(&off).cloned();
+		// Getting the page from disk might require sleeping. Do not hold a spinlock while sleeping
+		if let Some(page) = page {
 			// Cache hit
-			return Ok(page.clone());
+			match page.wait_uptodate() {
+				Ok(()) => {
+					page.mark_accessed();
+					return Ok(page);
+				}
+				// The page could not be read: remove it and retry
+				Err(_) => self.remove(off, &page),
+			}
 		}
-		// Getting the page from disk might require sleeping. Do not hold a spinlock while sleeping
-		drop(pages);
 		// Cache miss: read and insert
 		let page = init()?;
 		page.init(off);
 		self.cache.lock().insert(off, page.clone())?;
-		unsafe {
-			LRU.lock().lru_promote(&page.0);
-		}
+		page.mark_accessed();
 		Ok(page)
 	}
 
+	/// Inserts `page` at offset `off`, unless a page is already present.
+	///
+	/// The function returns `true` if the page has been inserted.
+	pub fn insert(&self, off: u64, page: &RcPage) -> AllocResult<bool> {
+		{
+			let mut cache = self.cache.lock();
+			if cache.get(&off).is_some() {
+				return Ok(false);
+			}
+			page.init(off);
+			cache.insert(off, page.clone())?;
+		}
+		Ok(true)
+	}
+
+	/// Removes the page at offset `off`, if it is `page`.
+	fn remove(&self, off: u64, page: &RcPage) {
+		let mut cache = self.cache.lock();
+		if cache
+			.get(&off)
+			.is_some_and(|p| Arc::as_ptr(&p.0) == Arc::as_ptr(&page.0))
+		{
+			cache.remove(&off);
+		}
+	}
+
 	/// Synchronizes all pages in the cache back to disk.
 	pub fn sync(&self) -> EResult<()> {
 		let ts = current_time_ms(Clock::Boottime);
+		// Do not hold a spinlock while sleeping on I/O
+		let pages = self
+			.cache
+			.lock()
+			.iter()
+			.map(|(_, page)| page.clone())
+			.collect::<CollectResult<Vec<_>>>()
+			.0?;
 		// Sync all pages
-		let pages = self.cache.lock();
-		for (_, page) in pages.iter() {
-			page.writeback(Some(ts), false)?;
-		}
-		Ok(())
+		let mut batch = WritebackBatch::new(Some(ts));
+		let res = pages.iter().try_for_each(|page| batch.push(page, false));
+		// Pending requests must be flushed even on failure, since their pages are not marked
+		// dirty anymore
+		let flush = batch.flush();
+		res.and(flush)
 	}
 
 	/// Removes, without flushing, all the pages after the offset `off` (included).
@@ -354,22 +581,351 @@ impl MappedNode {
 	}
 }
 
-/// Global cache for all pages
-static LRU: Mutex<list_type!(RcPageInner, lru), false> = Mutex::new(list!(RcPageInner, lru));
+/// Pages to be written back, submitted to their device in batches to keep several requests in
+/// flight.
+///
+/// Pages that are contiguous on the device are merged into a single request.
+///
+/// The batch must be flushed with [`Self::flush`] when done.
+struct WritebackBatch {
+	/// The timestamp at which pages are written
+	ts: Option<UTimestamp>,
+	/// The device the pending requests are targeting
+	dev: Option<Arc<BlkDev>>,
+	/// Pending requests
+	reqs: Vec<BlkRequest>,
+	/// The number of pages in pending requests
+	pages_count: usize,
+}
 
-fn flush_task_inner(cur_ts: Timestamp) {
-	// Iterate on all pages
-	let mut lru = LRU.lock();
-	for cursor in lru.iter().rev() {
-		let page = RcPage(cursor.arc());
-		if let Err(errno) = page.writeback(Some(cur_ts), true) {
-			// Failure, try the next page
+impl WritebackBatch {
+	/// Creates a new instance.
+	///
+	/// `ts` is the timestamp at which pages are written. See [`RcPage::writeback`].
+	fn new(ts: Option<UTimestamp>) -> Self {
+		Self {
+			ts,
+			dev: None,
+			reqs: Vec::new(),
+			pages_count: 0,
+		}
+	}
+
+	/// Adds `page` to the batch if it has to be written back.
+	///
+	/// `check_ts` has the same meaning as for [`RcPage::writeback`].
+	///
+	/// If `page` directly follows the last pending request on the device, it is merged into it.
+	///
+	/// If the batch is full or if `page` lives on another device, pending requests are flushed
+	/// first.
+	fn push(&mut self, page: &RcPage, check_ts: bool) -> EResult<()> {
+		if page.0.dev.is_none() || !page.claim_writeback(self.ts, check_ts) {
+			return Ok(());
+		}
+		self.push_claimed(page)
+	}
+
+	/// Adds `page` to the batch. The page must have been claimed for writeback beforehand.
+	///
+	/// On failure, the page is marked dirty again.
+	fn push_claimed(&mut self, page: &RcPage) -> EResult<()> {
+		let Some(dev) = &page.0.dev else {
+			return Ok(());
+		};
+		let same_dev = self
+			.dev
+			.as_ref()
+			.is_some_and(|d| Arc::as_ptr(d) == Arc::as_ptr(dev));
+		if !same_dev || self.pages_count >= WRITEBACK_BATCH {
+			if let Err(e) = self.flush() {
+				page.mark_dirty();
+				return Err(e);
+			}
+			self.dev = Some(dev.clone());
+		}
+		let res = match self.reqs.last_mut() {
+			Some(last) if last.end() == Some(page.dev_offset()) => last.pages.push(page.clone()),
+			_ => BlkRequest::single(IoDir::Write, page.dev_offset(), page.clone())
+				.and_then(|req| self.reqs.push(req)),
+		};
+		if let Err(e) = res {
+			page.mark_dirty();
+			return Err(e.into());
+		}
+		self.pages_count += 1;
+		Ok(())
+	}
+
+	/// Submits pending requests and waits for their completion.
+	///
+	/// On failure, pages are marked dirty again so that they are retried later.
+	fn flush(&mut self) -> EResult<()> {
+		let Some(dev) = &self.dev else {
+			return Ok(());
+		};
+		if self.reqs.is_empty() {
+			return Ok(());
+		}
+		let res = IoCompletion::new()
+			.map_err(Into::into)
+			.and_then(|completion| {
+				request::account_io(IoDir::Write, self.pages_count);
+				let res = dev.ops.submit(dev, &self.reqs, &completion);
+				// Requests that have been submitted must be waited for in any case
+				let wait = completion.wait();
+				res.and(wait)
+			});
+		for page in self.reqs.iter().flat_map(|req| req.pages.iter()) {
+			match (&res, self.ts) {
+				(Ok(_), Some(ts)) => page.get_page().last_write.store(ts, Release),
+				(Ok(_), None) => {}
+				(Err(_), _) => page.mark_dirty(),
+			}
+		}
+		self.reqs.clear();
+		self.pages_count = 0;
+		res
+	}
+}
+
+/// A list of cached pages.
+type LruList = list_type!(RcPageInner, lru);
+
+/// A shard of the page cache LRU.
+struct LruShard {
+	/// Pages that have been accessed several times recently
+	active: LruList,
+	/// Pages that are candidates for reclaim
+	inactive: LruList,
+	/// The number of pages in `active`
+	active_count: usize,
+	/// The number of pages in `inactive`
+	inactive_count: usize,
+}
+
+impl LruShard {
+	/// Creates a new, empty shard.
+	const fn new() -> Self {
+		Self {
+			active: list!(RcPageInner, lru),
+			inactive: list!(RcPageInner, lru),
+			active_count: 0,
+			inactive_count: 0,
+		}
+	}
+
+	/// Inserts `page` at the front of the list `state`.
+	fn insert(&mut self, page: Arc<RcPageInner>, state: u8) {
+		page.lru_state.store(state, Relaxed);
+		match state {
+			LRU_ACTIVE => {
+				self.active.insert_front(page);
+				self.active_count += 1;
+			}
+			_ => {
+				self.inactive.insert_front(page);
+				self.inactive_count += 1;
+			}
+		}
+	}
+
+	/// Removes `page` from the list it is on, if any.
+	fn remove(&mut self, page: &Arc<RcPageInner>) {
+		match page.lru_state.swap(LRU_NONE, Relaxed) {
+			LRU_ACTIVE => {
+				unsafe {
+					self.active.remove(page);
+				}
+				self.active_count -= 1;
+			}
+			LRU_INACTIVE => {
+				unsafe {
+					self.inactive.remove(page);
+				}
+				self.inactive_count -= 1;
+			}
+			_ => {}
+		}
+	}
+
+	/// Moves pages from the tail of the active list to the inactive list, until the inactive list
+	/// is at least as large as the active list.
+	///
+	/// Pages that have been referenced since the last scan are given another round on the active
+	/// list.
+	fn age(&mut self) {
+		for _ in 0..SCAN_BATCH {
+			if self.inactive_count >= self.active_count {
+				break;
+			}
+			let Some(page) = self.active.remove_back() else {
+				break;
+			};
+			self.active_count -= 1;
+			let state = if page.referenced.swap(false, Relaxed) {
+				LRU_ACTIVE
+			} else {
+				LRU_INACTIVE
+			};
+			self.insert(page, state);
+		}
+	}
+
+	/// Takes up to `max` reclaim candidates from the tail of the inactive list, and moves them to
+	/// `isolated`.
+	///
+	/// The function returns the number of isolated pages.
+	fn isolate(&mut self, isolated: &mut LruList, max: usize) -> usize {
+		self.age();
+		let mut count = 0;
+		for _ in 0..SCAN_BATCH {
+			if count >= max {
+				break;
+			}
+			let Some(page) = self.inactive.remove_back() else {
+				break;
+			};
+			self.inactive_count -= 1;
+			// Referenced or mapped pages are in use
+			let referenced = page.referenced.swap(false, Relaxed);
+			if referenced || page.map_count.load(Relaxed) > 0 {
+				self.insert(page, LRU_ACTIVE);
+				continue;
+			}
+			page.lru_state.store(LRU_NONE, Relaxed);
+			isolated.insert_back(page);
+			count += 1;
+		}
+		count
+	}
+}
+
+/// Global cache for all pages, split into shards
+static LRU: [IntSpin<LruShard>; LRU_SHARDS] =
+	[const { IntSpin::new(LruShard::new()) }; LRU_SHARDS];
+
+/// Returns the number of pages on the active and inactive lists, respectively.
+pub fn lru_stats() -> (usize, usize) {
+	LRU.iter().fold((0, 0), |(active, inactive), shard| {
+		let shard = shard.lock();
+		(active + shard.active_count, inactive + shard.inactive_count)
+	})
+}
+
+/// Pages that have been written to since their last writeback, in the order they have been
+/// dirtied
+static DIRTY: IntSpin<list_type!(RcPageInner, dirty_node)> =
+	IntSpin::new(list!(RcPageInner, dirty_node));
+/// The number of pages in [`DIRTY`]
+static DIRTY_COUNT: AtomicUsize = AtomicUsize::new(0);
+
+/// Returns the number of dirty pages.
+#[inline]
+pub fn dirty_count() -> usize {
+	DIRTY_COUNT.load(Relaxed)
+}
+
+/// Takes up to [`WRITEBACK_BATCH`] pages from the front of the dirty list, claiming them for
+/// writeback.
+///
+/// If `expire` is specified, only pages dirtied for at least [`WRITEBACK_TIMEOUT`] milliseconds
+/// at that timestamp are taken.
+///
+/// The returned pages are sorted by device and offset, so that adjacent pages can be merged.
+fn take_dirty(expire: Option<Timestamp>) -> AllocResult<Vec<RcPage>> {
+	let mut pages = Vec::with_capacity(WRITEBACK_BATCH)?;
+	{
+		let mut dirty = DIRTY.lock();
+		while pages.len() < WRITEBACK_BATCH {
+			let Some(front) = dirty.front() else {
+				break;
+			};
+			// Pages are in dirtying order: stop at the first one that has not expired
+			let dirtied_at = front.dirtied_at.load(Relaxed);
+			if expire.is_some_and(|ts| ts < dirtied_at + WRITEBACK_TIMEOUT) {
+				break;
+			}
+			dirty.remove_front();
+			DIRTY_COUNT.fetch_sub(1, Relaxed);
+			let page = RcPage(front);
+			// The page may have been written back by another path in the meantime
+			if page.get_page().dirty.swap(false, Acquire) {
+				// Cannot fail since the capacity is sufficient
+				pages.push(page)?;
+			}
+		}
+	}
+	pages.sort_unstable_by_key(|page| {
+		let dev = page.0.dev.as_ref().map(Arc::as_ptr).unwrap_or(ptr::null());
+		(dev as *const () as usize, page.dev_offset())
+	});
+	Ok(pages)
+}
+
+/// Writes back `pages`, which have been claimed for writeback, with the timestamp `ts`.
+fn write_pages(pages: &[RcPage], ts: UTimestamp) -> EResult<()> {
+	let mut batch = WritebackBatch::new(Some(ts));
+	let mut pushed = 0;
+	let res = pages.iter().try_for_each(|page| {
+		pushed += 1;
+		batch.push_claimed(page)
+	});
+	// On failure, the batch has marked dirty again the pages it failed on. Pages that have not
+	// been pushed have to be marked dirty again too
+	if res.is_err() {
+		pages[pushed..].iter().for_each(RcPage::mark_dirty);
+	}
+	let flush = batch.flush();
+	res.and(flush)
+}
+
+/// Writes back dirty pages in batches, until `cond` returns `false`.
+///
+/// `expire` has the same meaning as for [`take_dirty`].
+fn writeback_dirty<F: FnMut() -> bool>(expire: Option<Timestamp>, mut cond: F) {
+	let ts = current_time_ms(Clock::Boottime);
+	while cond() {
+		let pages = match take_dirty(expire) {
+			Ok(pages) => pages,
+			Err(errno) => {
+				println!("Disk writeback failure: {errno}");
+				break;
+			}
+		};
+		if pages.is_empty() {
+			break;
+		}
+		if let Err(errno) = write_pages(&pages, ts) {
+			// Failed pages are back on the dirty list: do not retry them right away
 			println!("Disk writeback I/O failure: {errno}");
-			continue;
+			break;
 		}
 	}
 }
 
+/// Throttles the current process if too much memory is dirty, by making it write back dirty
+/// pages until the amount of dirty memory gets low enough.
+///
+/// This function is meant to be called after writing to cached pages.
+pub fn balance_dirty_pages() {
+	// Fast path
+	let count = dirty_count();
+	if count < WRITEBACK_BATCH {
+		return;
+	}
+	let total = MEM_TOTAL.load(Relaxed) / 4;
+	if count <= total * DIRTY_RATIO / 100 {
+		return;
+	}
+	let background = total * DIRTY_BACKGROUND_RATIO / 100;
+	writeback_dirty(None, || dirty_count() > background);
+}
+
+fn flush_task_inner(cur_ts: Timestamp) {
+	writeback_dirty(Some(cur_ts), || true);
+}
+
 /// The entry point of the kernel task flushing cached memory back to disk.
 pub(crate) fn flush_task() -> ! {
 	loop {
@@ -381,44 +937,93 @@ pub(crate) fn flush_task() -> ! {
 	}
 }
 
-/// Attempts to shrink the page cache.
+/// Attempts to reclaim the isolated page `page`.
+///
+/// If the page is still in use, the function returns `false`.
+fn reclaim_page(page: &RcPage) -> bool {
+	// The reference held by `page`, plus the device's cache if any
+	let count = 1 + page.0.dev.is_some() as usize;
+	// Dirty pages are left to writeback, which also holds a reference to them
+	if Arc::strong_count(&page.0) > count
+		|| page.is_reading()
+		|| page.get_page().dirty.load(Acquire)
+	{
+		return false;
+	}
+	let Some(dev) = &page.0.dev else {
+		return true;
+	};
+	// We lock the cache to avoid having someone else activating the page while we are removing
+	// it
+	let mut cache = dev.mapped.cache.lock();
+	let unused = Arc::strong_count(&page.0) <= count && !page.get_page().dirty.load(Acquire);
+	let cached = cache
+		.get(&page.0.dev_off)
+		.is_some_and(|p| Arc::as_ptr(&p.0) == Arc::as_ptr(&page.0));
+	if unused && cached {
+		cache.remove(&page.0.dev_off);
+	}
+	unused
+}
+
+/// Reclaims up to `max` pages from `shard`.
+///
+/// The function returns the number of reclaimed pages.
+fn shrink_shard(shard: &IntSpin<LruShard>, max: usize) -> usize {
+	let mut isolated = list!(RcPageInner, lru);
+	if shard.lock().isolate(&mut isolated, max) == 0 {
+		return 0;
+	}
+	// Do not hold the shard's lock while writing pages back
+	let mut putback = list!(RcPageInner, lru);
+	let mut reclaimed = 0;
+	while let Some(page) = isolated.remove_front() {
+		let page = RcPage(page);
+		if reclaim_page(&page) {
+			// Dropping the last reference frees the page
+			reclaimed += 1;
+		} else {
+			putback.insert_back(page.0.clone());
+		}
+	}
+	if !putback.is_empty() {
+		let mut shard = shard.lock();
+		while let Some(page) = putback.remove_front() {
+			shard.insert(page, LRU_INACTIVE);
+		}
+	}
+	reclaimed
+}
+
+/// Reclaims up to [`RECLAIM_BATCH`] pages, scanning shards starting from the current CPU's.
+///
+/// The function returns the number of reclaimed pages.
+fn shrink_shards() -> usize {
+	let start = core_id() as usize;
+	let mut reclaimed = 0;
+	for i in 0..LRU_SHARDS {
+		let shard = &LRU[(start + i) % LRU_SHARDS];
+		reclaimed += shrink_shard(shard, RECLAIM_BATCH - reclaimed);
+		if reclaimed >= RECLAIM_BATCH {
+			break;
+		}
+	}
+	reclaimed
+}
+
+/// Attempts to shrink the page cache, reclaiming a batch of pages.
+///
+/// If only dirty pages remain, a batch of them is written back, then reclaimed.
 ///
 /// If the cache cannot shrink, the function returns `false`.
 pub fn shrink() -> bool {
-	// Search for and remove an inactive page
-	let mut lru = LRU.lock();
-	let mut iter = lru.iter().rev();
-	loop {
-		let Some(cursor) = iter.next() else {
-			// No more pages remaining
-			return false;
-		};
-		// Get as an Arc to access the reference counter
-		let page = RcPage(cursor.arc());
-		{
-			// We lock the cache first to avoid having someone else activating the page while
-			// we are removing it
-			let mut cache = page.0.dev.as_ref().map(|dev| dev.mapped.cache.lock());
-			// If the page is used somewhere else, skip to the next
-			let count = 2 + cache.is_some() as usize;
-			if Arc::strong_count(&page.0) > count {
-				continue;
-			}
-			if let Err(errno) = page.writeback(None, false) {
-				// Failure, try the next page
-				println!("Disk writeback I/O failure: {errno}");
-				continue;
-			}
-			// Remove the page from its node
-			if let Some(cache) = &mut cache {
-				cache.remove(&page.0.dev_off);
-			}
-		}
-		// Remove the page from the LRU
-		cursor.remove();
-		break;
+	if shrink_shards() > 0 {
+		return true;
+	}
+	if dirty_count() == 0 {
+		return false;
 	}
-	// Update statistics
-	MEM_INFO.lock().inactive -= 4;
-	true
+	let mut once = true;
+	writeback_dirty(None, || mem::take(&mut once));
+	shrink_shards() > 0
 }
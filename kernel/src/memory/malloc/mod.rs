@@ -17,14 +17,20 @@
  */
 
 //! Implementation of the global memory allocator for kernelspace operations.
+//!
+//! Small allocations are served by the slab allocator (see [`slab`]), which keeps per-CPU caches.
+//! Larger allocations are served by the chunk allocator, protected by a global spinlock.
 
 mod block;
 mod chunk;
+mod slab;
 
 use crate::{
 	memory,
 	memory::{buddy, malloc::ptr::NonNull},
 	sync::spin::IntSpin,
+	trace,
+	trace::Kind,
 };
 use block::Block;
 use chunk::Chunk;
@@ -36,6 +42,7 @@ use core::{
 	ptr,
 	ptr::drop_in_place,
 };
+pub use slab::CpuCache;
 use utils::{errno::AllocResult, limits::PAGE_SIZE};
 
 /// The allocator's spinlock.
@@ -148,11 +155,22 @@ pub unsafe fn __alloc(layout: Layout) -> AllocResult<NonNull<[u8]>> {
 	let Some(size) = NonZeroUsize::new(layout.size()) else {
 		return Ok(NonNull::slice_from_raw_parts(layout.dangling(), 0));
 	};
-	let ptr = if layout.align() <= chunk::ALIGNMENT {
-		alloc(size)?
-	} else {
+	let ptr = if layout.align() > chunk::ALIGNMENT {
 		buddy::alloc_kernel(buddy_order_for(layout), 0)?
+	} else if let Some(class) = slab::class_for(size.get()) {
+		let ptr = slab::alloc(class)?;
+		#[cfg(feature = "memtrace")]
+		super::trace::sample(
+			"malloc",
+			super::trace::SampleOp::Alloc,
+			ptr.as_ptr() as usize,
+			size.get(),
+		);
+		ptr
+	} else {
+		alloc(size)?
 	};
+	trace::event(Kind::Malloc, ptr.as_ptr() as usize as _, size.get() as _);
 	Ok(NonNull::slice_from_raw_parts(ptr, size.get()))
 }
 
@@ -170,11 +188,20 @@ pub unsafe fn __realloc(
 	};
 	let old_buddy = old_layout.align() > chunk::ALIGNMENT;
 	let new_buddy = new_layout.align() > chunk::ALIGNMENT;
-	let new_ptr = if !old_buddy && !new_buddy {
+	let old_class = (!old_buddy)
+		.then(|| slab::class_for(old_layout.size()))
+		.flatten();
+	let new_class = (!new_buddy)
+		.then(|| slab::class_for(new_size.get()))
+		.flatten();
+	let new_ptr = if old_class.is_some() && old_class == new_class {
+		// The object is large enough
+		ptr
+	} else if !old_buddy && !new_buddy && old_class.is_none() && new_class.is_none() {
 		// Both allocations live in the chunk allocator: try in-place resize
 		realloc(ptr, new_size)?
 	} else {
-		// At least one side requires the buddy allocator
+		// The allocations live in different allocators
 		let new_ptr = __alloc(new_layout)?;
 		let new_ptr = new_ptr.cast::<u8>();
 		let copy_len = old_layout.size().min(new_size.get());
@@ -192,10 +219,15 @@ pub unsafe fn __dealloc(ptr: NonNull<u8>, layout: Layout) {
 	if unlikely(layout.size() == 0) {
 		return;
 	}
-	if layout.align() <= chunk::ALIGNMENT {
-		free(ptr);
-	} else {
+	trace::event(Kind::Free, ptr.as_ptr() as usize as _, layout.size() as _);
+	if layout.align() > chunk::ALIGNMENT {
 		buddy::free_kernel(ptr.as_ptr(), buddy_order_for(layout));
+	} else if let Some(class) = slab::class_for(layout.size()) {
+		slab::free(ptr, class);
+		#[cfg(feature = "memtrace")]
+		super::trace::sample("malloc", super::trace::SampleOp::Free, ptr.as_ptr() as _, 0);
+	} else {
+		free(ptr);
 	}
 }
 
@@ -291,6 +323,46 @@ mod test {
 		assert_eq!(usage, buddy::allocated_pages_count());
 	}
 
+	#[test_case]
+	fn slab_alloc_free() {
+		unsafe {
+			for size in [1, 16, 17, 100, 512, 1000, 1024] {
+				let layout = Layout::from_size_align(size, 8).unwrap();
+				let mut ptrs: [NonNull<u8>; 256] = [NonNull::dangling(); 256];
+				for (i, p) in ptrs.iter_mut().enumerate() {
+					let ptr = __alloc(layout).unwrap().cast::<u8>();
+					assert!(ptr.as_ptr().is_aligned_to(chunk::ALIGNMENT));
+					slice::from_raw_parts_mut(ptr.as_ptr(), size).fill(i as u8);
+					*p = ptr;
+				}
+				for (i, p) in ptrs.iter().enumerate() {
+					let s = slice::from_raw_parts(p.as_ptr(), size);
+					assert!(s.iter().all(|b| *b == i as u8));
+				}
+				for p in ptrs {
+					__dealloc(p, layout);
+				}
+			}
+		}
+	}
+
+	#[test_case]
+	fn slab_realloc() {
+		unsafe {
+			let layout = Layout::from_size_align(1, 1).unwrap();
+			let mut ptr = __alloc(layout).unwrap().cast::<u8>();
+			*ptr.as_ptr() = 42;
+			let mut old_layout = layout;
+			for size in [8, 16, 17, 1024, 1025, PAGE_SIZE * 2, 12] {
+				let new_layout = Layout::from_size_align(size, 1).unwrap();
+				ptr = __realloc(ptr, old_layout, new_layout).unwrap().cast::<u8>();
+				assert_eq!(*ptr.as_ptr(), 42);
+				old_layout = new_layout;
+			}
+			__dealloc(ptr, old_layout);
+		}
+	}
+
 	// TODO Check the integrity of the data after reallocation
 	#[test_case]
 	fn realloc0() {
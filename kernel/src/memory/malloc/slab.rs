@@ -0,0 +1,380 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! Slab allocator for small objects.
+//!
+//! Small allocations are rounded up to a *size class*, and served from *slabs*: pages split into
+//! objects of the same size. For small classes, the slab's header is located at the beginning of
+//! the page, so that the slab of an object can be found by aligning its address down. For large
+//! classes, where it would take the place of an object, the header is allocated separately and
+//! found through the page's metadata.
+//!
+//! Each CPU keeps a *magazine* of free objects for each size class, so that most allocations and
+//! frees only touch memory local to the CPU. When a magazine is empty, it is refilled from the
+//! partial slabs of the class's *depot*, which is shared between CPUs. When a magazine is full,
+//! half of it is given back to the depot.
+
+use crate::{
+	memory::{VirtAddr, buddy},
+	process::scheduler::cpu::try_per_cpu,
+	sync::spin::IntSpin,
+};
+use core::{alloc::AllocError, mem::size_of, ptr, ptr::NonNull, sync::atomic::Ordering::Relaxed};
+use utils::{errno::AllocResult, limits::PAGE_SIZE};
+
+/// The number of size classes.
+pub const CLASSES_COUNT: usize = 7;
+/// The size of objects for each size class, in bytes.
+const CLASS_SIZES: [usize; CLASSES_COUNT] = [16, 32, 64, 128, 256, 512, 1024];
+/// The maximum number of objects in a magazine.
+const MAGAZINE_SIZE: usize = 32;
+/// The maximum number of empty slabs a depot keeps instead of freeing them.
+const EMPTY_MAX: usize = 1;
+/// The size of the smallest class whose slab headers are located outside of the slab's page.
+const OFF_SLAB_MIN: usize = 512;
+/// The size class off-page slab headers are allocated from.
+const HEADER_CLASS: usize = {
+	let mut class = 0;
+	while CLASS_SIZES[class] < size_of::<Slab>() {
+		class += 1;
+	}
+	// Headers of the header class must be in-page
+	assert!(CLASS_SIZES[class] < OFF_SLAB_MIN);
+	class
+};
+
+/// Returns the index of the size class for allocations of `size` bytes.
+///
+/// If the size is too large for the slab allocator, the function returns `None`.
+#[inline]
+pub fn class_for(size: usize) -> Option<usize> {
+	if size > CLASS_SIZES[CLASSES_COUNT - 1] {
+		return None;
+	}
+	let log = size
+		.max(CLASS_SIZES[0])
+		.next_power_of_two()
+		.trailing_zeros();
+	Some((log - CLASS_SIZES[0].trailing_zeros()) as usize)
+}
+
+/// Returns the size of objects in the class `class`, in bytes.
+#[inline]
+pub fn class_size(class: usize) -> usize {
+	CLASS_SIZES[class]
+}
+
+/// A free object, linked to the next free object of the same slab.
+struct FreeObj {
+	/// The next free object
+	next: *mut FreeObj,
+}
+
+/// Header of a slab, located at the beginning of its page or allocated from [`HEADER_CLASS`].
+#[repr(C)]
+struct Slab {
+	/// The previous slab in the depot's list of partial slabs
+	prev: *mut Slab,
+	/// The next slab in the depot's list of partial slabs
+	next: *mut Slab,
+	/// The first free object of the slab
+	free: *mut FreeObj,
+	/// The number of objects that are not free in the slab, including those in magazines
+	inuse: usize,
+}
+
+/// Returns the metadata of the slab page at `page`.
+#[inline]
+fn page_meta(page: *mut u8) -> &'static buddy::Page {
+	buddy::get_page(VirtAddr::from(page).kernel_to_physical().unwrap())
+}
+
+/// Shared pool of slabs for a size class.
+struct Depot {
+	/// The size class index
+	class: usize,
+	/// The list of slabs that have at least one free object
+	partial: *mut Slab,
+	/// The number of slabs in `partial` that are entirely free
+	empty: usize,
+}
+
+// Slabs are accessed only while the depot is locked
+unsafe impl Send for Depot {}
+
+impl Depot {
+	/// Tells whether the headers of the depot's slabs are located outside of their pages.
+	#[inline]
+	fn off_slab(&self) -> bool {
+		class_size(self.class) >= OFF_SLAB_MIN
+	}
+
+	/// Returns the offset of the first object in a slab's page.
+	#[inline]
+	fn first_obj_off(&self) -> usize {
+		if self.off_slab() {
+			0
+		} else {
+			size_of::<Slab>().next_multiple_of(class_size(self.class))
+		}
+	}
+
+	/// Returns the slab containing the object at `ptr`, along with the slab's page.
+	#[inline]
+	fn slab_of(&self, ptr: *mut u8) -> (*mut Slab, *mut u8) {
+		let page = ptr.map_addr(|addr| addr & !(PAGE_SIZE - 1));
+		if !self.off_slab() {
+			return (page.cast(), page);
+		}
+		let slab = page_meta(page).off.load(Relaxed) as usize;
+		(ptr::with_exposed_provenance_mut(slab), page)
+	}
+
+	/// Inserts `slab` at the beginning of the list of partial slabs.
+	unsafe fn link(&mut self, slab: *mut Slab) {
+		(*slab).prev = ptr::null_mut();
+		(*slab).next = self.partial;
+		if let Some(next) = (*slab).next.as_mut() {
+			next.prev = slab;
+		}
+		self.partial = slab;
+	}
+
+	/// Removes `slab` from the list of partial slabs.
+	unsafe fn unlink(&mut self, slab: *mut Slab) {
+		match (*slab).prev.as_mut() {
+			Some(prev) => prev.next = (*slab).next,
+			None => self.partial = (*slab).next,
+		}
+		if let Some(next) = (*slab).next.as_mut() {
+			next.prev = (*slab).prev;
+		}
+		(*slab).prev = ptr::null_mut();
+		(*slab).next = ptr::null_mut();
+	}
+
+	/// Allocates a new slab and inserts it in the list of partial slabs.
+	unsafe fn grow(&mut self) -> AllocResult<()> {
+		let page = buddy::alloc_kernel(0, 0)?.as_ptr();
+		let slab = if self.off_slab() {
+			let res = DEPOTS[HEADER_CLASS].lock().take();
+			let slab = match res {
+				Ok(slab) => slab,
+				Err(e) => {
+					buddy::free_kernel(page, 0);
+					return Err(e);
+				}
+			};
+			// Keep track of the header for frees
+			page_meta(page)
+				.off
+				.store(slab.expose_provenance() as _, Relaxed);
+			slab.cast::<Slab>()
+		} else {
+			page.cast::<Slab>()
+		};
+		let size = class_size(self.class);
+		// Link all objects, in address order
+		let mut free = ptr::null_mut();
+		let mut off = PAGE_SIZE - size;
+		let first = self.first_obj_off();
+		loop {
+			let obj = page.byte_add(off).cast::<FreeObj>();
+			(*obj).next = free;
+			free = obj;
+			if off == first {
+				break;
+			}
+			off -= size;
+		}
+		slab.write(Slab {
+			prev: ptr::null_mut(),
+			next: ptr::null_mut(),
+			free,
+			inuse: 0,
+		});
+		self.link(slab);
+		self.empty += 1;
+		Ok(())
+	}
+
+	/// Takes an object from the partial slabs.
+	unsafe fn take(&mut self) -> AllocResult<*mut u8> {
+		if self.partial.is_null() {
+			self.grow()?;
+		}
+		let slab = self.partial;
+		let obj = (*slab).free;
+		(*slab).free = (*obj).next;
+		if (*slab).inuse == 0 {
+			self.empty -= 1;
+		}
+		(*slab).inuse += 1;
+		// If the slab is full, remove it from the list
+		if (*slab).free.is_null() {
+			self.unlink(slab);
+		}
+		Ok(obj.cast())
+	}
+
+	/// Gives the object at `ptr` back to its slab.
+	unsafe fn put(&mut self, ptr: *mut u8) {
+		let (slab, page) = self.slab_of(ptr);
+		let obj = ptr.cast::<FreeObj>();
+		let was_full = (*slab).free.is_null();
+		(*obj).next = (*slab).free;
+		(*slab).free = obj;
+		(*slab).inuse -= 1;
+		if was_full {
+			self.link(slab);
+		}
+		if (*slab).inuse == 0 {
+			if self.empty < EMPTY_MAX {
+				self.empty += 1;
+			} else {
+				self.unlink(slab);
+				buddy::free_kernel(page, 0);
+				if self.off_slab() {
+					DEPOTS[HEADER_CLASS].lock().put(slab.cast());
+				}
+			}
+		}
+	}
+}
+
+/// Depots for each size class.
+static DEPOTS: [IntSpin<Depot>; CLASSES_COUNT] = {
+	let mut depots = [const {
+		IntSpin::new(Depot {
+			class: 0,
+			partial: ptr::null_mut(),
+			empty: 0,
+		})
+	}; CLASSES_COUNT];
+	let mut i = 0;
+	while i < CLASSES_COUNT {
+		depots[i] = IntSpin::new(Depot {
+			class: i,
+			partial: ptr::null_mut(),
+			empty: 0,
+		});
+		i += 1;
+	}
+	depots
+};
+
+/// A stack of free objects of the same size class, local to a CPU.
+struct Magazine {
+	/// The number of objects in the magazine
+	len: usize,
+	/// The objects
+	objs: [*mut u8; MAGAZINE_SIZE],
+}
+
+// The magazine is accessed only while locked
+unsafe impl Send for Magazine {}
+
+impl Magazine {
+	/// Moves up to `count` objects from the depot of class `class` to the magazine.
+	unsafe fn refill(&mut self, class: usize, count: usize) -> AllocResult<()> {
+		let mut depot = DEPOTS[class].lock();
+		while self.len < count {
+			match depot.take() {
+				Ok(obj) => {
+					self.objs[self.len] = obj;
+					self.len += 1;
+				}
+				// Fail only if nothing could be taken
+				Err(e) if self.len == 0 => return Err(e),
+				Err(_) => break,
+			}
+		}
+		Ok(())
+	}
+
+	/// Gives objects back to the depot of class `class`, until `count` objects remain.
+	unsafe fn drain(&mut self, class: usize, count: usize) {
+		let mut depot = DEPOTS[class].lock();
+		while self.len > count {
+			self.len -= 1;
+			depot.put(self.objs[self.len]);
+		}
+	}
+}
+
+/// Per-CPU cache of free objects, with a magazine for each size class.
+///
+/// Magazines are locked to remain consistent if the current process migrates to another CPU while
+/// using it, but the lock is almost never contended.
+pub struct CpuCache([IntSpin<Magazine>; CLASSES_COUNT]);
+
+impl CpuCache {
+	/// Creates a new instance, with empty magazines.
+	pub const fn new() -> Self {
+		Self(
+			[const {
+				IntSpin::new(Magazine {
+					len: 0,
+					objs: [ptr::null_mut(); MAGAZINE_SIZE],
+				})
+			}; CLASSES_COUNT],
+		)
+	}
+}
+
+/// Allocates an object of the size class `class`.
+///
+/// # Safety
+///
+/// `class` must be a valid size class.
+pub unsafe fn alloc(class: usize) -> AllocResult<NonNull<u8>> {
+	let ptr = match try_per_cpu() {
+		Some(cpu) => {
+			let mut mag = cpu.malloc_cache.0[class].lock();
+			if mag.len == 0 {
+				mag.refill(class, MAGAZINE_SIZE / 2)?;
+			}
+			mag.len -= 1;
+			mag.objs[mag.len]
+		}
+		// The per-CPU structure is not yet available
+		None => DEPOTS[class].lock().take()?,
+	};
+	NonNull::new(ptr).ok_or(AllocError)
+}
+
+/// Frees the object at `ptr`, of the size class `class`.
+///
+/// # Safety
+///
+/// `ptr` must have been allocated with [`alloc`] with the same size class, and must not be used
+/// after this function is called.
+pub unsafe fn free(ptr: NonNull<u8>, class: usize) {
+	match try_per_cpu() {
+		Some(cpu) => {
+			let mut mag = cpu.malloc_cache.0[class].lock();
+			if mag.len == MAGAZINE_SIZE {
+				mag.drain(class, MAGAZINE_SIZE / 2);
+			}
+			let len = mag.len;
+			mag.objs[len] = ptr.as_ptr();
+			mag.len += 1;
+		}
+		None => DEPOTS[class].lock().put(ptr.as_ptr()),
+	}
+}
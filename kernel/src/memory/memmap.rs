@@ -23,8 +23,14 @@
 //! This data is meant to be used by the memory allocators.
 
 use super::{PhysAddr, VirtAddr, stats};
-use crate::{elf::kernel::sections, multiboot, multiboot::BootInfo, sync::once::OnceInit};
-use core::{cmp::min, iter, ptr};
+use crate::{
+	elf::kernel::sections,
+	multiboot,
+	multiboot::BootInfo,
+	process::scheduler::cpu::{counter, counter::Counter},
+	sync::once::OnceInit,
+};
+use core::{cmp::min, iter, ptr, sync::atomic::Ordering::Relaxed};
 use utils::limits::PAGE_SIZE;
 
 /// Physical memory map information.
@@ -111,7 +117,6 @@ pub(crate) fn init(boot_info: &BootInfo) {
 		OnceInit::init(&PHYS_MAP, phys_map);
 	}
 	// Update memory stats
-	let mut stats = stats::MEM_INFO.lock();
-	stats.mem_total = phys_main_pages * 4;
-	stats.mem_free = phys_main_pages * 4;
+	stats::MEM_TOTAL.store(phys_main_pages * 4, Relaxed);
+	counter::add(Counter::FreePages, phys_main_pages as _);
 }
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! Sequential readahead.
+//!
+//! When a file is read sequentially, pages that are likely to be read next are fetched from the
+//! device ahead of time, so that the process does not have to wait for them.
+//!
+//! Each open file description keeps track of the access pattern with a [`Readahead`]. When
+//! sequential access is detected, a window of pages past the current read is prefetched. The
+//! window grows each time it is consumed, up to a maximum.
+//!
+//! Prefetched pages are inserted in the page cache right away, while the device has not yet
+//! filled them. Looking them up waits for the read to complete.
+
+use crate::sync::spin::Spin;
+use core::{cmp::min, ops::Range};
+
+/// The minimum size of the readahead window, in pages.
+pub const RA_MIN: u64 = 8;
+/// The maximum size of the readahead window, in pages.
+pub const RA_MAX: u64 = 64;
+
+/// An access pattern hint given by userspace, with `posix_fadvise` or `madvise`.
+#[derive(Clone, Copy, Debug, Default, Eq, PartialEq)]
+pub enum Advice {
+	/// No particular pattern: readahead is triggered by sequential reads
+	#[default]
+	Normal,
+	/// Random accesses: no readahead
+	Random,
+	/// Sequential accesses: readahead is always performed, with a larger window
+	Sequential,
+}
+
+/// The state of the readahead for a file.
+#[derive(Debug, Default)]
+struct State {
+	/// The access pattern hint
+	advice: Advice,
+	/// The end of the previous read, in pages
+	prev_end: u64,
+	/// The size of the current window, in pages. If zero, there is no current window
+	size: u64,
+	/// The end of the current window, in pages
+	ra_end: u64,
+}
+
+/// Readahead state for an open file description.
+#[derive(Debug, Default)]
+pub struct Readahead(Spin<State>);
+
+impl Readahead {
+	/// Returns the access pattern hint.
+	pub fn advice(&self) -> Advice {
+		self.0.lock().advice
+	}
+
+	/// Sets the access pattern hint.
+	pub fn set_advice(&self, advice: Advice) {
+		let mut state = self.0.lock();
+		state.advice = advice;
+		state.size = 0;
+	}
+
+	/// Accounts for a read of the pages in range `start..end` of a file, which has `file_pages`
+	/// pages.
+	///
+	/// If pages have to be prefetched, the function returns their range. The range may include
+	/// pages of the current read, so that they are submitted along with the prefetched ones.
+	pub fn on_read(&self, start: u64, end: u64, file_pages: u64) -> Option<Range<u64>> {
+		let mut state = self.0.lock();
+		let sequential = match state.advice {
+			Advice::Normal => start == state.prev_end || start + 1 == state.prev_end,
+			Advice::Random => false,
+			Advice::Sequential => true,
+		};
+		state.prev_end = end;
+		if !sequential {
+			state.size = 0;
+			return None;
+		}
+		let max = match state.advice {
+			Advice::Sequential => RA_MAX * 2,
+			_ => RA_MAX,
+		};
+		if state.size == 0 || start >= state.ra_end {
+			// New window
+			state.size = (2 * (end - start)).clamp(RA_MIN, max);
+			state.ra_end = start;
+		} else if state.ra_end.saturating_sub(end) > state.size / 2 {
+			// Enough of the current window remains
+			return None;
+		} else {
+			// The window is being consumed: grow it
+			state.size = min(state.size * 2, max);
+		}
+		let ra_start = state.ra_end.max(start);
+		let ra_end = min(ra_start.saturating_add(state.size), file_pages);
+		state.ra_end = ra_end;
+		(ra_start < ra_end).then_some(ra_start..ra_end)
+	}
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+
+	#[test_case]
+	fn readahead_sequential() {
+		let ra = Readahead::default();
+		assert_eq!(ra.on_read(0, 1, 1000), Some(0..RA_MIN));
+		// Inside the window
+		assert_eq!(ra.on_read(1, 2, 1000), None);
+		assert_eq!(ra.on_read(2, 3, 1000), None);
+		// Half of the window is consumed
+		assert_eq!(ra.on_read(3, 4, 1000), Some(RA_MIN..(RA_MIN * 3)));
+		assert_eq!(ra.on_read(4, 5, 1000), None);
+		// Capped by the file's size
+		let ra = Readahead::default();
+		assert_eq!(ra.on_read(0, 1, 3), Some(0..3));
+	}
+
+	#[test_case]
+	fn readahead_random() {
+		let ra = Readahead::default();
+		assert_eq!(ra.on_read(10, 11, 1000), None);
+		assert_eq!(ra.on_read(50, 51, 1000), None);
+		ra.set_advice(Advice::Random);
+		assert_eq!(ra.on_read(0, 1, 1000), None);
+		assert_eq!(ra.on_read(1, 2, 1000), None);
+		ra.set_advice(Advice::Sequential);
+		assert_eq!(ra.on_read(500, 501, 1000), Some(500..(500 + RA_MIN)));
+	}
+}
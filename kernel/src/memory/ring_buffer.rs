@@ -22,7 +22,16 @@ use crate::memory::{
 	malloc::{__alloc, __dealloc},
 	user::UserSlice,
 };
-use core::{alloc::Layout, cmp::min, num::NonZeroUsize, ptr::NonNull};
+use core::{
+	alloc::Layout,
+	cmp::min,
+	num::NonZeroUsize,
+	ptr::NonNull,
+	sync::atomic::{
+		AtomicUsize,
+		Ordering::{Acquire, Relaxed, Release},
+	},
+};
 use utils::errno::{AllocResult, EResult};
 
 /// Ring buffer of `u8`.
@@ -161,6 +170,113 @@ impl Drop for RingBuffer {
 	}
 }
 
+/// Lock-free ring buffer of fixed-size records, with a single producer and a single consumer.
+///
+/// The producer and the consumer may run concurrently without taking any lock. When the ring is
+/// full, new records are rejected rather than overwriting the oldest ones.
+pub struct SpscRing<T: Copy> {
+	/// The linear, allocated buffer
+	buf: NonNull<T>,
+	/// The number of records the buffer can hold. This is a power of two
+	capacity: usize,
+
+	/// The total number of records ever written
+	head: AtomicUsize,
+	/// The total number of records ever read
+	tail: AtomicUsize,
+}
+
+impl<T: Copy> SpscRing<T> {
+	/// Creates a new instance.
+	///
+	/// `capacity` is the number of records the buffer can hold, rounded up to a power of two.
+	pub fn new(capacity: NonZeroUsize) -> AllocResult<Self> {
+		let capacity = capacity.get().next_power_of_two();
+		let layout = Layout::array::<T>(capacity).unwrap();
+		let buf = unsafe { __alloc(layout)? };
+		Ok(Self {
+			buf: buf.cast(),
+			capacity,
+
+			head: AtomicUsize::new(0),
+			tail: AtomicUsize::new(0),
+		})
+	}
+
+	/// Returns the number of records the buffer can hold.
+	#[inline(always)]
+	pub fn capacity(&self) -> usize {
+		self.capacity
+	}
+
+	/// Returns the number of records in the buffer.
+	#[inline]
+	pub fn len(&self) -> usize {
+		self.head
+			.load(Acquire)
+			.wrapping_sub(self.tail.load(Acquire))
+	}
+
+	/// Tells whether the buffer is empty.
+	#[inline]
+	pub fn is_empty(&self) -> bool {
+		self.len() == 0
+	}
+
+	/// Appends `val` to the buffer.
+	///
+	/// If the buffer is full, the function returns `false`.
+	///
+	/// # Safety
+	///
+	/// Only one producer may call this function at a time.
+	pub unsafe fn push(&self, val: T) -> bool {
+		let head = self.head.load(Relaxed);
+		let tail = self.tail.load(Acquire);
+		if head.wrapping_sub(tail) >= self.capacity {
+			return false;
+		}
+		unsafe {
+			self.buf.add(head & (self.capacity - 1)).write(val);
+		}
+		// Publish the record to the consumer
+		self.head.store(head.wrapping_add(1), Release);
+		true
+	}
+
+	/// Removes the oldest record from the buffer and returns it.
+	///
+	/// If the buffer is empty, the function returns `None`.
+	///
+	/// # Safety
+	///
+	/// Only one consumer may call this function at a time.
+	pub unsafe fn pop(&self) -> Option<T> {
+		let tail = self.tail.load(Relaxed);
+		let head = self.head.load(Acquire);
+		if tail == head {
+			return None;
+		}
+		let val = unsafe { self.buf.add(tail & (self.capacity - 1)).read() };
+		// Give the slot back to the producer
+		self.tail.store(tail.wrapping_add(1), Release);
+		Some(val)
+	}
+}
+
+impl<T: Copy> Drop for SpscRing<T> {
+	fn drop(&mut self) {
+		let layout = Layout::array::<T>(self.capacity).unwrap();
+		unsafe {
+			__dealloc(self.buf.cast(), layout);
+		}
+	}
+}
+
+unsafe impl<T: Copy + Send> Send for SpscRing<T> {}
+
+unsafe impl<T: Copy + Send> Sync for SpscRing<T> {}
+
 #[cfg(test)]
 mod test {
 	use super::*;
@@ -199,4 +315,24 @@ mod test {
 	}
 
 	// TODO peek
+
+	#[test_case]
+	fn spsc_ring() {
+		let ring = SpscRing::<u32>::new(NonZeroUsize::new(3).unwrap()).unwrap();
+		assert_eq!(ring.capacity(), 4);
+		unsafe {
+			assert_eq!(ring.pop(), None);
+			for i in 0..4 {
+				assert!(ring.push(i));
+			}
+			assert!(!ring.push(4));
+			assert_eq!(ring.len(), 4);
+			assert_eq!(ring.pop(), Some(0));
+			assert!(ring.push(4));
+			for i in 1..5 {
+				assert_eq!(ring.pop(), Some(i));
+			}
+			assert!(ring.is_empty());
+		}
+	}
 }
@@ -18,10 +18,14 @@
 
 //! Statistics about memory usage.
 
-use crate::sync::spin::Spin;
+use crate::{
+	memory::cache,
+	process::scheduler::cpu::{counter, counter::Counter},
+};
 use core::{
 	fmt,
 	fmt::{Display, Formatter},
+	sync::atomic::{AtomicUsize, Ordering::Relaxed},
 };
 
 /// Stores memory usage information. Each field is in KiB.
@@ -33,9 +37,9 @@ pub struct MemInfo {
 	pub mem_free: usize,
 	/// The total amount of free + reclaimable memory.
 	pub mem_available: usize,
-	/// The total amount of active (mapped) memory.
+	/// The total amount of memory on the active list of the page cache.
 	pub active: usize,
-	/// The total amount of inactive (not mapped but cached) memory.
+	/// The total amount of memory on the inactive list of the page cache.
 	pub inactive: usize,
 }
 
@@ -53,11 +57,20 @@ Inactive: {} kB",
 	}
 }
 
-/// Memory usage statistics.
-pub static MEM_INFO: Spin<MemInfo> = Spin::new(MemInfo {
-	mem_total: 0,
-	mem_free: 0,
-	mem_available: 0,
-	active: 0,
-	inactive: 0,
-});
+/// The total amount of memory on the system, in KiB.
+pub static MEM_TOTAL: AtomicUsize = AtomicUsize::new(0);
+
+/// Returns the current memory usage statistics.
+///
+/// Counters are summed over all CPU cores, so this function is not meant to be used on hot paths.
+pub fn mem_info() -> MemInfo {
+	let free_pages = counter::sum(Counter::FreePages).max(0) as usize;
+	let (active, inactive) = cache::lru_stats();
+	MemInfo {
+		mem_total: MEM_TOTAL.load(Relaxed),
+		mem_free: free_pages * 4,
+		mem_available: 0,
+		active: active * 4,
+		inactive: inactive * 4,
+	}
+}
@@ -40,8 +40,12 @@ unsafe extern "C" {
 	pub fn raw_copy(dst: *mut u8, src: *const u8, n: usize) -> bool;
 	/// Zero a range of memory, with page fault handling. On success, the function returns `true`.
 	pub fn raw_zero(dst: *mut u8, n: usize) -> bool;
+	/// Atomic compare-and-exchange on a 32-bit word, with page fault handling. The value of the
+	/// word before the operation is written to `cur`. On success, the function returns `true`.
+	pub fn raw_cmpxchg(ptr: *mut u32, old: u32, new: u32, cur: *mut u32) -> bool;
 
-	/// Function called back when a page fault occurs while using [`raw_copy`] or [`raw_zero`].
+	/// Function called back when a page fault occurs while using [`raw_copy`], [`raw_zero`] or
+	/// [`raw_cmpxchg`].
 	pub fn raw_fault();
 }
 
@@ -140,6 +144,30 @@ impl<T: Sized + fmt::Debug> UserPtr<T> {
 	}
 }
 
+impl UserPtr<u32> {
+	/// Atomically replaces the value with `new` if it is equal to `old`.
+	///
+	/// The function returns the value before the operation. The value has been replaced if it is
+	/// equal to `old`.
+	///
+	/// If the pointer is null or the value is not accessible, the function returns an error.
+	pub fn compare_exchange(&self, old: u32, new: u32) -> EResult<u32> {
+		let Some(ptr) = self.0 else {
+			return Err(errno!(EFAULT));
+		};
+		if unlikely(!bound_check(ptr.as_ptr() as _, size_of::<u32>())) {
+			return Err(errno!(EFAULT));
+		}
+		let mut cur = 0;
+		let res = unsafe { vmem::smap_disable(|| raw_cmpxchg(ptr.as_ptr(), old, new, &mut cur)) };
+		if likely(res) {
+			Ok(cur)
+		} else {
+			Err(errno!(EFAULT))
+		}
+	}
+}
+
 impl<T: fmt::Debug> fmt::Debug for UserPtr<T> {
 	fn fmt(&self, fmt: &mut fmt::Formatter<'_>) -> fmt::Result {
 		let ptr = self.as_ptr();
@@ -24,7 +24,7 @@ use crate::{
 	arch::{
 		x86,
 		x86::{
-			paging::{FLAG_GLOBAL, FLAG_USER, FLAG_WRITE},
+			paging::{FLAG_GLOBAL, FLAG_USER, FLAG_WRITE, StaleTable},
 			smp,
 		},
 	},
@@ -35,13 +35,16 @@ use crate::{
 	process::scheduler::defer,
 	sync::{once::OnceInit, spin::IntSpin},
 };
-use core::{ptr::NonNull, sync::atomic::Ordering::Release};
+use core::{mem, ptr::NonNull, sync::atomic::Ordering::Release};
 use utils::limits::PAGE_SIZE;
 
 // TODO should be configurable
 /// The number of invalidated pages in range above which the whole virtual memory is flushed, to
 /// save time
 const TLB_FLUSH_THRESHOLD: usize = 32;
+/// The maximum number of distinct ranges in a [`TlbBatch`], above which the whole virtual memory
+/// is flushed.
+const TLB_BATCH_RANGES: usize = 8;
 
 /// A virtual memory context, with interior mutability.
 ///
@@ -97,10 +100,33 @@ impl VMem {
 	/// - `flags` is the set of flags to use for the mapping, which are architecture-dependent
 	/// - `page_size_order` the page order at which `FLAG_PAGE_SIZE` should be used (if possible)
 	///
+	/// If the mapping replaces a table, the table is freed right away. If the context may be in
+	/// use, [`Self::map_huge`] must be used instead.
+	///
 	/// **Note**: this function does *not* invalidate the cache. This is the caller's
 	/// responsibility
 	#[inline]
 	pub fn map(&self, physaddr: PhysAddr, virtaddr: VirtAddr, flags: usize, page_size_order: u8) {
+		if let Some(stale) = self.map_huge(physaddr, virtaddr, flags, page_size_order) {
+			unsafe {
+				stale.free();
+			}
+		}
+	}
+
+	/// Like [`Self::map`], except that a table replaced by the mapping is returned instead of
+	/// being freed.
+	///
+	/// The table must be freed only after the cache has been invalidated on every CPU that may
+	/// have used the context, including those in lazy TLB mode, since their paging-structure
+	/// caches may still point to it.
+	pub fn map_huge(
+		&self,
+		physaddr: PhysAddr,
+		virtaddr: VirtAddr,
+		flags: usize,
+		page_size_order: u8,
+	) -> Option<StaleTable> {
 		// Sanitize
 		let physaddr = PhysAddr(physaddr.0 & !(PAGE_SIZE - 1));
 		let virtaddr = VirtAddr(virtaddr.0 & !(PAGE_SIZE - 1));
@@ -113,7 +139,8 @@ impl VMem {
 				virtaddr,
 				flags,
 				page_size_order,
-			);
+			)
+			.1
 		}
 	}
 
@@ -159,6 +186,33 @@ impl VMem {
 		}
 	}
 
+	/// Copies the mappings of the range of `pages` pages starting at `virtaddr` to `dst`, for
+	/// process forking.
+	///
+	/// If `write_protect` is set, the copied pages are made read-only in both contexts, so that
+	/// the next write triggers a Copy-On-Write.
+	///
+	/// The range must be in userspace.
+	///
+	/// **Note**: this function does *not* invalidate the cache. This is the caller's
+	/// responsibility
+	pub fn fork_range(&self, dst: &VMem, virtaddr: VirtAddr, pages: usize, write_protect: bool) {
+		// Sanitize
+		let virtaddr = VirtAddr(virtaddr.0 & !(PAGE_SIZE - 1));
+		let _guard = self.spin.lock();
+		let _dst_guard = dst.spin.lock();
+		#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+		unsafe {
+			x86::paging::fork_range(
+				self.table.as_ref(),
+				dst.table.as_ref(),
+				virtaddr,
+				pages,
+				write_protect,
+			);
+		}
+	}
+
 	/// Polls the dirty flags on the range of `pages` pages starting at `addr`, clearing them
 	/// atomically, and setting them to the associated [`buddy::Page`] structure.
 	pub fn poll_dirty(&self, addr: VirtAddr, pages: usize) {
@@ -248,6 +302,81 @@ pub fn shootdown_range(addr: VirtAddr, count: usize, cpus: impl Iterator<Item =
 	});
 }
 
+/// A batch of invalidations of userspace pages, to be performed on several CPUs with a single
+/// round of IPIs.
+///
+/// When the batch grows past [`TLB_FLUSH_THRESHOLD`] pages or [`TLB_BATCH_RANGES`] ranges, the
+/// whole TLB is flushed instead. Since kernel pages are global, they are not flushed that way and
+/// must not be added to a batch.
+#[derive(Clone, Debug, Default)]
+pub struct TlbBatch {
+	/// The ranges to invalidate, as a start address and a number of pages
+	ranges: [(VirtAddr, usize); TLB_BATCH_RANGES],
+	/// The number of ranges in `ranges`
+	len: usize,
+	/// The total number of pages to invalidate
+	pages: usize,
+}
+
+impl TlbBatch {
+	/// Tells whether the batch is empty.
+	#[inline]
+	pub fn is_empty(&self) -> bool {
+		self.pages == 0
+	}
+
+	/// Tells whether the whole TLB has to be flushed.
+	#[inline]
+	fn is_full(&self) -> bool {
+		self.len > TLB_BATCH_RANGES || self.pages > TLB_FLUSH_THRESHOLD
+	}
+
+	/// Adds the range of `count` pages starting at `addr` to the batch.
+	pub fn add(&mut self, addr: VirtAddr, count: usize) {
+		debug_assert!(addr.kernel_to_physical().is_none());
+		if count == 0 {
+			return;
+		}
+		self.pages = self.pages.saturating_add(count);
+		if self.is_full() {
+			return;
+		}
+		// Merge with the previous range if adjacent
+		if let Some((prev, prev_count)) = self.ranges[..self.len].last_mut()
+			&& *prev + *prev_count * PAGE_SIZE == addr
+		{
+			*prev_count += count;
+			return;
+		}
+		if let Some(range) = self.ranges.get_mut(self.len) {
+			*range = (addr, count);
+		}
+		self.len += 1;
+	}
+
+	/// Performs the invalidations on the current CPU.
+	fn invalidate(&self) {
+		if self.is_full() {
+			flush();
+			return;
+		}
+		for (addr, count) in &self.ranges[..self.len] {
+			invalidate_range(*addr, *count);
+		}
+	}
+
+	/// Performs the invalidations on all CPUs in `cpus`, then clears the batch.
+	///
+	/// If the batch is empty, the function does nothing.
+	pub fn shootdown(&mut self, cpus: impl Iterator<Item = u32>) {
+		if self.is_empty() {
+			return;
+		}
+		let batch = mem::take(self);
+		defer::synchronous_multiple(cpus, move || batch.invalidate());
+	}
+}
+
 /// Executes the closure while allowing the kernel to write on read-only pages.
 ///
 /// # Safety
@@ -420,4 +549,67 @@ mod test {
 			assert_eq!(vmem.translate(VirtAddr(i)), None);
 		}
 	}
+
+	#[test_case]
+	fn vmem_unmap_huge() {
+		let vmem = unsafe { VMem::new() };
+		let huge = PAGE_SIZE << x86::paging::PAGE_SIZE_ORDER_1;
+		vmem.map_range(PhysAddr(huge), VirtAddr(huge), 2 * huge / PAGE_SIZE + 1, 0);
+		// Unmap a page in the middle of a huge page
+		let hole = huge + 3 * PAGE_SIZE;
+		vmem.unmap(VirtAddr(hole));
+		for i in (0..(4 * huge)).step_by(PAGE_SIZE) {
+			let res = vmem.translate(VirtAddr(i));
+			if (huge..(3 * huge + PAGE_SIZE)).contains(&i) && i != hole {
+				assert_eq!(res, Some(PhysAddr(i)));
+			} else {
+				assert_eq!(res, None);
+			}
+		}
+	}
+
+	#[test_case]
+	fn vmem_fork_range() {
+		let src = unsafe { VMem::new() };
+		let dst = unsafe { VMem::new() };
+		let huge = PAGE_SIZE << x86::paging::PAGE_SIZE_ORDER_1;
+		src.map_range(PhysAddr(huge), VirtAddr(huge), huge / PAGE_SIZE + 2, 0);
+		src.map(PhysAddr(0x100000), VirtAddr(0x100000), 0, 0);
+		// Copy the huge page and one page after it
+		src.fork_range(&dst, VirtAddr(huge), huge / PAGE_SIZE + 1, true);
+		for i in (0..(4 * huge)).step_by(PAGE_SIZE) {
+			let res = dst.translate(VirtAddr(i));
+			if (huge..(2 * huge + PAGE_SIZE)).contains(&i) {
+				assert_eq!(res, Some(PhysAddr(i)));
+			} else {
+				assert_eq!(res, None);
+			}
+			// The source is left untouched
+			if (huge..(2 * huge + 2 * PAGE_SIZE)).contains(&i) {
+				assert_eq!(src.translate(VirtAddr(i)), Some(PhysAddr(i)));
+			}
+		}
+	}
+
+	#[test_case]
+	fn vmem_tlb_batch() {
+		let mut batch = TlbBatch::default();
+		assert!(batch.is_empty());
+		// Adjacent ranges are merged
+		batch.add(VirtAddr(0x100000), 2);
+		batch.add(VirtAddr(0x102000), 3);
+		batch.add(VirtAddr(0x200000), 1);
+		assert_eq!(batch.len, 2);
+		assert_eq!(batch.ranges[0], (VirtAddr(0x100000), 5));
+		assert!(!batch.is_full());
+		// Too many ranges
+		for i in 0..TLB_BATCH_RANGES {
+			batch.add(VirtAddr(0x300000 + i * 2 * PAGE_SIZE), 1);
+		}
+		assert!(batch.is_full());
+		// Too many pages
+		let mut batch = TlbBatch::default();
+		batch.add(VirtAddr(0x100000), TLB_FLUSH_THRESHOLD + 1);
+		assert!(batch.is_full());
+	}
 }
@@ -16,53 +16,554 @@
  * Maestro. If not, see <https://www.gnu.org/licenses/>.
  */
 
-//! Buffer list, to avoid allocations in network code.
+//! Packet buffers, carrying packets through the network stack without copying them.
+//!
+//! A [`PacketBuf`] is made of a *head*, a page holding the linear part of the packet, followed by
+//! *fragments*, each referencing a range of another page (such as a page of the page cache, for
+//! `sendfile`).
+//!
+//! Room is left at the beginning of the head (the *headroom*), so that each layer can push its
+//! header in front of the packet on transmission, and pull it on reception, without moving data.
+//!
+//! The head is reference-counted, so that a packet can be shared without being copied. It is
+//! copied only when a layer modifies a shared head. Free heads are kept in a pool, to avoid going
+//! through the buddy allocator for each packet.
 
-use core::ptr::NonNull;
+use crate::{
+	memory::{buddy, cache::RcPage},
+	sync::spin::IntSpin,
+};
+use core::{
+	cmp::min,
+	fmt,
+	fmt::Formatter,
+	mem::size_of,
+	ptr,
+	ptr::NonNull,
+	slice,
+	sync::atomic::{
+		AtomicUsize,
+		Ordering::{Acquire, Relaxed, Release},
+		fence,
+	},
+};
+use utils::{
+	errno,
+	errno::{AllocResult, EResult},
+	limits::PAGE_SIZE,
+};
 
-/// A linked-list of buffers representing a packet being built.
-pub struct BufList<'b> {
-	/// The buffer.
-	pub data: &'b [u8],
+/// The default size of the headroom of new buffers, in bytes.
+///
+/// This is enough for the headers of all layers of the stack.
+pub const HEADROOM: usize = 128;
+/// The maximum number of fragments of a buffer.
+pub const MAX_FRAGS: usize = 8;
+/// The maximum number of free heads kept in the pool.
+const POOL_MAX: usize = 64;
 
-	/// The next buffer in the list.
-	next: Option<NonNull<BufList<'b>>>,
-	/// The length of following buffers combined.
-	next_len: usize,
+/// Header located at the beginning of a head's page.
+#[repr(C)]
+struct Head {
+	/// The number of buffers using the head
+	ref_count: AtomicUsize,
+	/// The next free head in the pool
+	next: *mut Head,
 }
 
-impl<'b> From<&'b [u8]> for BufList<'b> {
-	fn from(b: &'b [u8]) -> Self {
-		Self {
-			data: b,
+/// The offset of the first byte of data in a head's page.
+const DATA_START: usize = size_of::<Head>();
+/// The maximum size of the linear part of a packet, in bytes.
+pub const HEAD_SIZE: usize = PAGE_SIZE - DATA_START;
+
+/// Pool of free heads.
+struct Pool {
+	/// The first free head
+	first: *mut Head,
+	/// The number of heads in the pool
+	len: usize,
+}
+
+// Heads in the pool are accessed only while it is locked
+unsafe impl Send for Pool {}
 
-			next: None,
-			next_len: 0,
+/// The pool of free heads.
+static POOL: IntSpin<Pool> = IntSpin::new(Pool {
+	first: ptr::null_mut(),
+	len: 0,
+});
+
+/// Allocates a head, with a reference count of `1`.
+fn alloc_head() -> AllocResult<NonNull<Head>> {
+	let head = {
+		let mut pool = POOL.lock();
+		let head = pool.first;
+		if !head.is_null() {
+			pool.first = unsafe { (*head).next };
+			pool.len -= 1;
 		}
+		head
+	};
+	let head = match NonNull::new(head) {
+		Some(head) => head,
+		None => buddy::alloc_kernel(0, 0)?.cast(),
+	};
+	unsafe {
+		head.write(Head {
+			ref_count: AtomicUsize::new(1),
+			next: ptr::null_mut(),
+		});
+	}
+	Ok(head)
+}
+
+/// Drops a reference to `head`. If it was the last one, the head is given back to the pool, or
+/// freed if the pool is full.
+///
+/// # Safety
+///
+/// The caller must own a reference to the head, and must not use it anymore.
+unsafe fn release_head(head: NonNull<Head>) {
+	if head.as_ref().ref_count.fetch_sub(1, Release) != 1 {
+		return;
+	}
+	fence(Acquire);
+	let mut pool = POOL.lock();
+	if pool.len < POOL_MAX {
+		(*head.as_ptr()).next = pool.first;
+		pool.first = head.as_ptr();
+		pool.len += 1;
+	} else {
+		drop(pool);
+		buddy::free_kernel(head.as_ptr().cast(), 0);
 	}
 }
 
-impl<'b> BufList<'b> {
-	/// Returns the length of the buffer, plus following buffers.
-	#[allow(clippy::len_without_is_empty)]
+/// The state of the transport checksum of a packet.
+#[derive(Clone, Copy, Debug, Default, Eq, PartialEq)]
+pub enum Checksum {
+	/// On transmission, the checksum is already computed. On reception, it has not been verified.
+	#[default]
+	None,
+	/// On transmission, the checksum is to be computed by the device.
+	///
+	/// The checksum covers the data from offset `start` to the end of the packet, and is stored
+	/// at offset `start + off`. Offsets are relative to the beginning of the packet's data.
+	Partial {
+		/// The offset at which computation starts
+		start: u16,
+		/// The offset of the checksum field, relative to `start`
+		off: u16,
+	},
+	/// On reception, the device has verified the checksum.
+	Unnecessary,
+}
+
+/// A fragment of a packet, referencing a range of a page.
+#[derive(Clone, Debug)]
+pub struct Frag {
+	/// The page
+	page: RcPage,
+	/// The offset of the range in the page
+	off: u16,
+	/// The length of the range
+	len: u16,
+}
+
+impl Frag {
+	/// Returns the page the fragment references.
+	#[inline]
+	pub fn page(&self) -> &RcPage {
+		&self.page
+	}
+
+	/// Returns the offset of the fragment in the page.
+	#[inline]
+	pub fn off(&self) -> usize {
+		self.off as _
+	}
+
+	/// Returns the length of the fragment in bytes.
+	#[inline]
 	pub fn len(&self) -> usize {
-		self.data.len() + self.next_len
+		self.len as _
+	}
+
+	/// Tells whether the fragment is empty.
+	#[inline]
+	pub fn is_empty(&self) -> bool {
+		self.len == 0
+	}
+
+	/// Returns the content of the fragment.
+	#[inline]
+	pub fn as_slice(&self) -> &[u8] {
+		&self.page.slice()[self.off()..(self.off() + self.len())]
+	}
+}
+
+/// An owned packet buffer.
+///
+/// Cloning a buffer does not copy its content.
+pub struct PacketBuf {
+	/// The head of the packet
+	head: NonNull<Head>,
+	/// The offset of the beginning of the data in the head's page
+	data: u16,
+	/// The offset of the end of the data in the head's page
+	tail: u16,
+	/// The fragments following the data of the head
+	frags: [Option<Frag>; MAX_FRAGS],
+	/// The number of fragments
+	frags_count: u8,
+	/// The total length of the fragments, in bytes
+	frags_len: usize,
+	/// The state of the transport checksum. Offsets of [`Checksum::Partial`] are relative to the
+	/// head's page, so that they remain valid when headers are pushed or pulled
+	csum: Checksum,
+}
+
+// The head is modified only when it is not shared
+unsafe impl Send for PacketBuf {}
+unsafe impl Sync for PacketBuf {}
+
+impl PacketBuf {
+	/// Allocates an empty buffer, with `headroom` bytes reserved in front of the data.
+	pub fn new(headroom: usize) -> AllocResult<Self> {
+		let head = alloc_head()?;
+		let off = (DATA_START + min(headroom, HEAD_SIZE)) as u16;
+		Ok(Self {
+			head,
+			data: off,
+			tail: off,
+			frags: [const { None }; MAX_FRAGS],
+			frags_count: 0,
+			frags_len: 0,
+			csum: Checksum::None,
+		})
+	}
+
+	/// Returns a pointer to the byte at offset `off` in the head's page.
+	#[inline]
+	fn head_ptr(&self, off: usize) -> *mut u8 {
+		unsafe { self.head.as_ptr().cast::<u8>().add(off) }
+	}
+
+	/// Returns the total length of the packet, in bytes.
+	#[inline]
+	pub fn len(&self) -> usize {
+		self.head_len() + self.frags_len
+	}
+
+	/// Tells whether the packet is empty.
+	#[inline]
+	pub fn is_empty(&self) -> bool {
+		self.len() == 0
+	}
+
+	/// Returns the length of the linear part of the packet, in bytes.
+	#[inline]
+	pub fn head_len(&self) -> usize {
+		(self.tail - self.data) as _
+	}
+
+	/// Returns the number of bytes available in front of the data.
+	#[inline]
+	pub fn headroom(&self) -> usize {
+		self.data as usize - DATA_START
+	}
+
+	/// Returns the number of bytes available after the linear part of the packet.
+	#[inline]
+	pub fn tailroom(&self) -> usize {
+		PAGE_SIZE - self.tail as usize
+	}
+
+	/// Returns the linear part of the packet.
+	#[inline]
+	pub fn data(&self) -> &[u8] {
+		unsafe { slice::from_raw_parts(self.head_ptr(self.data as _), self.head_len()) }
+	}
+
+	/// Returns the fragments of the packet.
+	#[inline]
+	pub fn frags(&self) -> impl Iterator<Item = &Frag> {
+		self.frags[..self.frags_count as usize].iter().flatten()
+	}
+
+	/// Returns an iterator over the segments of the packet: the linear part, then the fragments.
+	///
+	/// Empty segments are skipped.
+	pub fn segments(&self) -> impl Iterator<Item = &[u8]> {
+		[self.data()]
+			.into_iter()
+			.chain(self.frags().map(Frag::as_slice))
+			.filter(|s| !s.is_empty())
+	}
+
+	/// Makes the head exclusive to the buffer, copying it if it is shared.
+	fn unshare(&mut self) -> AllocResult<()> {
+		if unsafe { self.head.as_ref() }.ref_count.load(Acquire) == 1 {
+			return Ok(());
+		}
+		let head = alloc_head()?;
+		unsafe {
+			let start = self.data as usize;
+			ptr::copy_nonoverlapping(
+				self.head_ptr(start),
+				head.as_ptr().cast::<u8>().add(start),
+				self.head_len(),
+			);
+			release_head(self.head);
+		}
+		self.head = head;
+		Ok(())
+	}
+
+	/// Returns a mutable reference to the linear part of the packet.
+	///
+	/// If the head is shared, it is copied first.
+	pub fn data_mut(&mut self) -> AllocResult<&mut [u8]> {
+		self.unshare()?;
+		let ptr = self.head_ptr(self.data as _);
+		Ok(unsafe { slice::from_raw_parts_mut(ptr, self.head_len()) })
+	}
+
+	/// Extends the data by `len` bytes at the front, to write a header.
+	///
+	/// The function returns the added bytes, which are uninitialized.
+	///
+	/// If the headroom is too small, the function returns [`errno::ENOBUFS`].
+	pub fn push(&mut self, len: usize) -> EResult<&mut [u8]> {
+		if len > self.headroom() {
+			return Err(errno!(ENOBUFS));
+		}
+		self.unshare()?;
+		self.data -= len as u16;
+		let ptr = self.head_ptr(self.data as _);
+		Ok(unsafe { slice::from_raw_parts_mut(ptr, len) })
+	}
+
+	/// Removes `len` bytes from the front of the data, to consume a header.
+	///
+	/// The function returns the removed bytes. If the linear part of the packet is smaller than
+	/// `len`, the function returns `None` and the packet is left untouched.
+	pub fn pull(&mut self, len: usize) -> Option<&[u8]> {
+		if len > self.head_len() {
+			return None;
+		}
+		let ptr = self.head_ptr(self.data as _);
+		self.data += len as u16;
+		Some(unsafe { slice::from_raw_parts(ptr, len) })
+	}
+
+	/// Extends the linear part of the packet by `len` bytes at the end.
+	///
+	/// The function returns the added bytes, which are uninitialized.
+	///
+	/// If the tailroom is too small, or if fragments are attached, the function returns
+	/// [`errno::ENOBUFS`].
+	pub fn put(&mut self, len: usize) -> EResult<&mut [u8]> {
+		if len > self.tailroom() || self.frags_count > 0 {
+			return Err(errno!(ENOBUFS));
+		}
+		self.unshare()?;
+		let ptr = self.head_ptr(self.tail as _);
+		self.tail += len as u16;
+		Ok(unsafe { slice::from_raw_parts_mut(ptr, len) })
+	}
+
+	/// Shrinks the packet to `len` bytes, dropping data at the end.
+	///
+	/// If the packet is already smaller, the function does nothing.
+	pub fn trim(&mut self, len: usize) {
+		if len >= self.len() {
+			return;
+		}
+		let head_len = self.head_len();
+		if len <= head_len {
+			self.tail -= (head_len - len) as u16;
+			for f in &mut self.frags[..self.frags_count as usize] {
+				*f = None;
+			}
+			self.frags_count = 0;
+			self.frags_len = 0;
+			return;
+		}
+		// Find the fragment containing the end
+		let mut end = head_len;
+		for i in 0..self.frags_count as usize {
+			let frag = self.frags[i].as_mut().unwrap();
+			if end + frag.len() >= len {
+				frag.len = (len - end) as u16;
+				for f in &mut self.frags[(i + 1)..self.frags_count as usize] {
+					*f = None;
+				}
+				self.frags_count = (i + 1) as u8;
+				break;
+			}
+			end += frag.len();
+		}
+		self.frags_len = len - head_len;
+	}
+
+	/// Attaches the range `off..(off + len)` of `page` at the end of the packet, without copying
+	/// it.
+	///
+	/// If the range follows the last fragment in the same page, they are merged.
+	///
+	/// If no more fragments can be attached, the function returns [`errno::ENOBUFS`].
+	pub fn attach(&mut self, page: RcPage, off: usize, len: usize) -> EResult<()> {
+		debug_assert!(off + len <= PAGE_SIZE);
+		if let Some(Some(last)) = self.frags[..self.frags_count as usize].last_mut() {
+			let contiguous = last.off() + last.len() == off;
+			if contiguous && last.page.phys_addr() == page.phys_addr() {
+				last.len += len as u16;
+				self.frags_len += len;
+				return Ok(());
+			}
+		}
+		let Some(slot) = self.frags.get_mut(self.frags_count as usize) else {
+			return Err(errno!(ENOBUFS));
+		};
+		*slot = Some(Frag {
+			page,
+			off: off as _,
+			len: len as _,
+		});
+		self.frags_count += 1;
+		self.frags_len += len;
+		Ok(())
 	}
 
-	/// Pushes another buffer at the front of the current list.
+	/// Copies data from offset `off` in the packet to `buf`.
 	///
-	/// The function returns the new head of the list (which is the given `front`).
-	pub fn push_front<'o>(&mut self, mut front: BufList<'o>) -> BufList<'o>
-	where
-		'b: 'o,
-	{
-		front.next = NonNull::new(self);
-		front.next_len = self.data.len() + self.next_len;
-		front
-	}
-
-	/// Returns the next buffer.
-	pub fn next(&self) -> Option<&BufList<'b>> {
-		unsafe { self.next.map(|n| n.as_ref()) }
+	/// The function returns the number of bytes copied.
+	pub fn copy_to(&self, mut off: usize, buf: &mut [u8]) -> usize {
+		let mut copied = 0;
+		for seg in self.segments() {
+			if off >= seg.len() {
+				off -= seg.len();
+				continue;
+			}
+			let len = min(seg.len() - off, buf.len() - copied);
+			buf[copied..(copied + len)].copy_from_slice(&seg[off..(off + len)]);
+			copied += len;
+			off = 0;
+			if copied >= buf.len() {
+				break;
+			}
+		}
+		copied
+	}
+
+	/// Returns the state of the transport checksum.
+	pub fn csum(&self) -> Checksum {
+		match self.csum {
+			Checksum::Partial {
+				start,
+				off,
+			} => Checksum::Partial {
+				start: start.saturating_sub(self.data),
+				off,
+			},
+			csum => csum,
+		}
+	}
+
+	/// Sets the state of the transport checksum.
+	pub fn set_csum(&mut self, csum: Checksum) {
+		self.csum = match csum {
+			Checksum::Partial {
+				start,
+				off,
+			} => Checksum::Partial {
+				start: start + self.data,
+				off,
+			},
+			csum => csum,
+		};
+	}
+}
+
+impl Clone for PacketBuf {
+	fn clone(&self) -> Self {
+		unsafe { self.head.as_ref() }
+			.ref_count
+			.fetch_add(1, Relaxed);
+		Self {
+			head: self.head,
+			data: self.data,
+			tail: self.tail,
+			frags: self.frags.clone(),
+			frags_count: self.frags_count,
+			frags_len: self.frags_len,
+			csum: self.csum,
+		}
+	}
+}
+
+impl Drop for PacketBuf {
+	fn drop(&mut self) {
+		unsafe {
+			release_head(self.head);
+		}
+	}
+}
+
+impl fmt::Debug for PacketBuf {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.debug_struct("PacketBuf")
+			.field("len", &self.len())
+			.field("frags", &self.frags_count)
+			.field("csum", &self.csum())
+			.finish()
+	}
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+
+	#[test_case]
+	fn packet_push_pull() {
+		let mut pkt = PacketBuf::new(HEADROOM).unwrap();
+		pkt.put(4).unwrap().copy_from_slice(b"data");
+		pkt.push(3).unwrap().copy_from_slice(b"hdr");
+		assert_eq!(pkt.headroom(), HEADROOM - 3);
+		assert_eq!(pkt.data(), b"hdrdata");
+		assert_eq!(pkt.pull(3).unwrap(), b"hdr");
+		assert_eq!(pkt.data(), b"data");
+		assert!(pkt.pull(5).is_none());
+		assert!(pkt.push(HEADROOM + 1).is_err());
+	}
+
+	#[test_case]
+	fn packet_clone_unshare() {
+		let mut pkt = PacketBuf::new(HEADROOM).unwrap();
+		pkt.put(4).unwrap().copy_from_slice(b"data");
+		let clone = pkt.clone();
+		pkt.data_mut().unwrap()[0] = b'D';
+		assert_eq!(pkt.data(), b"Data");
+		assert_eq!(clone.data(), b"data");
+	}
+
+	#[test_case]
+	fn packet_frags() {
+		let page = RcPage::new_zeroed().unwrap();
+		let mut pkt = PacketBuf::new(HEADROOM).unwrap();
+		pkt.put(2).unwrap().copy_from_slice(b"ab");
+		pkt.attach(page.clone(), 0, 16).unwrap();
+		pkt.attach(page, 16, 16).unwrap();
+		assert_eq!(pkt.frags().count(), 1);
+		assert_eq!(pkt.len(), 34);
+		let mut buf = [0xff; 4];
+		assert_eq!(pkt.copy_to(1, &mut buf), 4);
+		assert_eq!(buf, [b'b', 0, 0, 0]);
+		pkt.trim(10);
+		assert_eq!(pkt.len(), 10);
+		pkt.trim(1);
+		assert_eq!(pkt.frags().count(), 0);
+		assert_eq!(pkt.data(), b"a");
 	}
 }
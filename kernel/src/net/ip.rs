@@ -18,10 +18,15 @@
 
 //! This module implements the IP protocol.
 
-use super::{buf::BufList, osi::Layer};
+use super::{Address, SocketDomain, buf::PacketBuf, osi, osi::Layer};
 use core::mem::size_of;
 use macros::AnyRepr;
-use utils::{boxed::Box, bytes::as_bytes, crypto::checksum::rfc1071, errno::EResult};
+use utils::{
+	boxed::Box,
+	bytes::{as_bytes, from_bytes},
+	crypto::checksum::rfc1071,
+	errno::EResult,
+};
 
 /// The default TTL value.
 const DEFAULT_TTL: u8 = 128;
@@ -110,20 +115,20 @@ pub struct IPv4Layer {
 }
 
 impl Layer for IPv4Layer {
-	fn transmit<'c, F>(&self, mut buff: BufList<'c>, next: F) -> EResult<()>
-	where
-		F: Fn(BufList<'c>) -> EResult<()>,
-	{
+	fn transmit(
+		&self,
+		mut pkt: PacketBuf,
+		next: &dyn Fn(PacketBuf) -> EResult<()>,
+	) -> EResult<()> {
 		let hdr_len = size_of::<IPv4Header>() as u16; // TODO add options support?
 
 		let dscp = 0; // TODO
 		let ecn = 0; // TODO
 
-		// TODO check endianness
 		let mut hdr = IPv4Header {
-			version_ihl: 4 | (((hdr_len / 4) as u8) << 4),
+			version_ihl: (4 << 4) | (hdr_len / 4) as u8,
 			type_of_service: (dscp << 2) | ecn,
-			total_length: hdr_len + buff.len() as u16,
+			total_length: (hdr_len + pkt.len() as u16).to_be(),
 
 			identification: 0,        // TODO
 			flags_fragment_offset: 0, // TODO
@@ -137,12 +142,54 @@ impl Layer for IPv4Layer {
 			dst_addr: self.dst_addr,
 		};
 		hdr.compute_checksum();
-		let hdr_buff = as_bytes(&hdr);
-		buff.push_front(hdr_buff.into());
-		next(buff)
+		pkt.push(hdr_len as _)?.copy_from_slice(as_bytes(&hdr));
+		next(pkt)
 	}
 }
 
+/// Returns the destination address of the packet `pkt`, which begins with an IP header.
+///
+/// If the header is invalid, the function returns `None`.
+pub fn dst_addr(pkt: &PacketBuf) -> Option<Address> {
+	let hdr: &IPv4Header = from_bytes(pkt.data())?;
+	match hdr.version_ihl >> 4 {
+		4 => Some(Address::IPv4(hdr.dst_addr)),
+		// TODO IPv6
+		_ => None,
+	}
+}
+
+/// Handles the packet `pkt`, received with an IPv4 header.
+///
+/// If the packet is valid, it is passed to the transport layer. Otherwise, it is dropped.
+pub fn receive(mut pkt: PacketBuf) {
+	let Some(hdr) = from_bytes::<IPv4Header>(pkt.data()) else {
+		return;
+	};
+	let hdr_len = (hdr.version_ihl & 0xf) as usize * 4;
+	let total_length = u16::from_be(hdr.total_length) as usize;
+	let fragmented = u16::from_be(hdr.flags_fragment_offset) & !((FLAG_DF as u16) << 13) != 0;
+	let protocol = hdr.protocol;
+	if hdr_len < size_of::<IPv4Header>() || hdr_len > pkt.head_len() {
+		return;
+	}
+	if total_length < hdr_len || total_length > pkt.len() {
+		return;
+	}
+	// The header checksum is never offloaded
+	if rfc1071(&pkt.data()[..hdr_len]) != 0 {
+		return;
+	}
+	// TODO reassemble fragments
+	if fragmented {
+		return;
+	}
+	// Remove the link layer's padding, then the header
+	pkt.trim(total_length);
+	pkt.pull(hdr_len);
+	osi::deliver(SocketDomain::AfInet, protocol, pkt);
+}
+
 /// Builds an IPv4 layer with the given `sockaddr`.
 pub fn inet_build(_sockaddr: &[u8]) -> EResult<Box<dyn Layer>> {
 	// TODO
@@ -22,6 +22,7 @@ pub mod buf;
 pub mod icmp;
 pub mod ip;
 pub mod lo;
+pub mod napi;
 pub mod osi;
 pub mod sockaddr;
 pub mod tcp;
@@ -31,7 +32,7 @@ use crate::{
 	net::sockaddr::{SockAddrIn, SockAddrIn6},
 	sync::spin::Spin,
 };
-use buf::BufList;
+use buf::PacketBuf;
 use core::{cmp::Ordering, mem::size_of};
 use utils::{
 	collections::{hashmap::HashMap, string::String, vec::Vec},
@@ -104,15 +105,26 @@ pub trait Interface {
 	/// Returns the list of addresses bound to the interface.
 	fn get_addresses(&self) -> &[BindAddress];
 
-	/// Reads data from the network interface and writes it into `buff`.
+	/// Transmits the packet `pkt` on the interface.
 	///
-	/// The function returns the number of bytes read.
-	fn read(&mut self, buff: &mut [u8]) -> EResult<u64>;
+	/// `pkt` begins with the header of the network layer. The interface pushes its own link layer
+	/// header, if any.
+	///
+	/// Received packets are not read from the interface: instead, the interface passes them to
+	/// [`receive`] as they arrive.
+	fn transmit(&mut self, pkt: PacketBuf) -> EResult<()>;
 
-	/// Reads data from `buff` and writes it into the network interface.
+	/// Processes up to `budget` received packets, and reclaims transmitted packets.
+	///
+	/// This is called by the poll task after the interface scheduled a poll with
+	/// [`napi::schedule`].
 	///
-	/// The function returns the number of bytes written.
-	fn write(&mut self, buff: &BufList<'_>) -> EResult<u64>;
+	/// The function returns the number of received packets processed. If it is lower than
+	/// `budget`, the interface has no more work, and it must enable its interrupts back before
+	/// returning.
+	fn poll(&mut self, _budget: usize) -> usize {
+		0
+	}
 }
 
 /// An entry in the routing table.
@@ -224,6 +236,27 @@ pub fn get_iface_for(addr: Address) -> Option<Arc<Spin<dyn Interface>>> {
 	get_iface(&route.iface)
 }
 
+/// Passes the packet `pkt`, received on a network interface, to the network layer.
+///
+/// `pkt` must begin with the header of the network layer. Packets of unsupported protocols are
+/// dropped.
+pub fn receive(pkt: PacketBuf) {
+	match pkt.data().first().map(|b| b >> 4) {
+		Some(4) => ip::receive(pkt),
+		// TODO IPv6
+		_ => {}
+	}
+}
+
+/// Transmits the packet `pkt` on the network interface routing to its destination.
+///
+/// `pkt` must begin with the header of the network layer.
+pub fn transmit(pkt: PacketBuf) -> EResult<()> {
+	let dst = ip::dst_addr(&pkt).ok_or_else(|| errno!(EINVAL))?;
+	let iface = get_iface_for(dst).ok_or_else(|| errno!(ENETUNREACH))?;
+	iface.lock().transmit(pkt)
+}
+
 /// Enumeration of socket domains.
 #[derive(Clone, Copy, Debug, Eq, Hash, PartialEq)]
 pub enum SocketDomain {
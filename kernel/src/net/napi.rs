@@ -0,0 +1,108 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! NAPI-style polling of network interfaces.
+//!
+//! Taking an interrupt for each received packet starves the rest of the system under load.
+//! Instead, the interrupt handler of a device masks the device's interrupts and schedules a *poll*
+//! with [`schedule`]. The poll task then calls [`Interface::poll`], which processes received
+//! packets and transmit completions in batches of at most [`BUDGET`] packets. Once the device runs
+//! out of work, it enables its interrupts back.
+//!
+//! Polls run in a kernel thread rather than in a deferred call, since they need to take locks
+//! (which deferred calls must not do) and so that the scheduler shares the CPU between them and
+//! other processes.
+
+use super::Interface;
+use crate::sync::{
+	spin::{IntSpin, Spin},
+	wait_queue::WaitQueue,
+};
+use core::sync::atomic::{
+	AtomicBool,
+	Ordering::{Acquire, Release},
+};
+use utils::{collections::list::ListNode, list, list_type, ptr::arc::Arc};
+
+/// The maximum number of packets an interface processes in a single poll.
+pub const BUDGET: usize = 64;
+
+/// Polling state of a network interface.
+#[derive(Default)]
+pub struct Napi {
+	/// The node in the list of scheduled polls
+	node: ListNode,
+	/// Tells whether the poll is scheduled
+	scheduled: AtomicBool,
+	/// The polled interface
+	iface: Spin<Option<Arc<Spin<dyn Interface>>>>,
+}
+
+impl Napi {
+	/// Sets the interface to poll.
+	///
+	/// Since the interface usually keeps a reference to its polling state, the interface must be
+	/// detached with [`Self::detach`] before being dropped.
+	pub fn attach(&self, iface: Arc<Spin<dyn Interface>>) {
+		*self.iface.lock() = Some(iface);
+	}
+
+	/// Stops polling the interface.
+	pub fn detach(&self) {
+		*self.iface.lock() = None;
+	}
+}
+
+/// The scheduled polls.
+static SCHEDULED: IntSpin<list_type!(Napi, node)> = IntSpin::new(list!(Napi, node));
+/// The queue on which the poll task waits.
+static POLL_QUEUE: WaitQueue = WaitQueue::new();
+
+/// Schedules a poll of the interface attached to `napi`, if not already scheduled.
+///
+/// This function can be called from an interrupt handler, which must have masked the interrupts
+/// of the device beforehand.
+pub fn schedule(napi: &Arc<Napi>) {
+	if napi.scheduled.swap(true, Acquire) {
+		return;
+	}
+	SCHEDULED.lock().insert_back(napi.clone());
+	POLL_QUEUE.wake_next();
+}
+
+/// The entry point of the kernel task polling network interfaces.
+pub(crate) fn poll_task() -> ! {
+	loop {
+		let Ok(napi) = POLL_QUEUE.wait_until(|| SCHEDULED.lock().remove_front()) else {
+			continue;
+		};
+		// Clear the flag first, so that the interrupt enabled back at the end of the poll may
+		// schedule another one
+		napi.scheduled.store(false, Release);
+		let iface = napi.iface.lock().clone();
+		let Some(iface) = iface else {
+			continue;
+		};
+		let count = iface.lock().poll(BUDGET);
+		// If the budget has been exhausted, there is more work. Let other interfaces be polled
+		// first
+		if count >= BUDGET {
+			schedule(&napi);
+		}
+	}
+}
@@ -18,7 +18,7 @@
 
 //! The Open Systems Interconnection (OSI) model defines the architecure of a network stack.
 
-use super::{SocketDesc, SocketDomain, SocketType, buf::BufList, ip};
+use super::{SocketDesc, SocketDomain, SocketType, buf::PacketBuf, ip};
 use crate::sync::spin::Spin;
 use core::fmt::Debug;
 use utils::{boxed::Box, collections::hashmap::HashMap, errno, errno::EResult};
@@ -27,22 +27,22 @@ use utils::{boxed::Box, collections::hashmap::HashMap, errno, errno::EResult};
 ///
 /// A layer stack acts as a pipeline, passing data from one layer to the other.
 pub trait Layer: Debug {
-	// TODO receive
-
-	/// Transmits data in the given buffer.
+	/// Transmits the packet `pkt`.
 	///
 	/// Arguments:
-	/// - `buff` is the list of buffer which composes the packet being built.
-	/// - `next` is the function called to pass the buffers list to the next layer.
-	fn transmit<'c, F>(&self, buff: BufList<'c>, next: F) -> EResult<()>
-	where
-		Self: Sized,
-		F: Fn(BufList<'c>) -> EResult<()>;
+	/// - `pkt` is the packet being built. The layer pushes its header in front of it.
+	/// - `next` is the function called to pass the packet to the next layer.
+	fn transmit(&self, pkt: PacketBuf, next: &dyn Fn(PacketBuf) -> EResult<()>) -> EResult<()>;
 }
 
 /// Function used to build a layer from a given sockaddr structure.
 pub type LayerBuilder = fn(&[u8]) -> EResult<Box<dyn Layer>>;
 
+/// Function receiving packets for an OSI layer 4 (transport) protocol.
+///
+/// The packet begins with the header of the layer.
+pub type Receiver = fn(PacketBuf);
+
 /// Collection of OSI layers 3 (network)
 static DOMAINS: Spin<HashMap<u32, LayerBuilder>> = Spin::new(HashMap::new());
 /// Collection of OSI layers 4 (transport)
@@ -53,6 +53,9 @@ static PROTOCOLS: Spin<HashMap<u32, LayerBuilder>> = Spin::new(HashMap::new());
 /// If this collection doesn't contain a pair, it is considered invalid.
 static DEFAULT_PROTOCOLS: Spin<HashMap<(u32, SocketType), u32>> = Spin::new(HashMap::new());
 
+/// Collection of receive functions of OSI layers 4 (transport), by domain and protocol ID.
+static RECEIVERS: Spin<HashMap<(u32, u8), Receiver>> = Spin::new(HashMap::new());
+
 /// A stack of layers for a socket.
 #[derive(Debug)]
 pub struct Stack {
@@ -100,6 +103,24 @@ impl Stack {
 			protocol,
 		})
 	}
+
+	/// Transmits the packet `pkt`, containing the payload, through the layers of the stack.
+	pub fn transmit(&self, pkt: PacketBuf) -> EResult<()> {
+		self.protocol
+			.transmit(pkt, &|pkt| self.domain.transmit(pkt, &super::transmit))
+	}
+}
+
+/// Passes the packet `pkt`, received by the network layer of `domain`, to the transport protocol
+/// `protocol`.
+///
+/// `pkt` begins with the header of the transport layer. If the protocol is not supported, the
+/// packet is dropped.
+pub fn deliver(domain: SocketDomain, protocol: u8, pkt: PacketBuf) {
+	let receiver = RECEIVERS.lock().get(&(domain.get_id(), protocol)).cloned();
+	if let Some(receiver) = receiver {
+		receiver(pkt);
+	}
 }
 
 /// Registers default domains/types/protocols.
@@ -133,10 +154,15 @@ pub(crate) fn init() -> EResult<()> {
 		// TODO netlink
 		// TODO packet
 	])?;
+	let receivers = HashMap::try_from([
+		// TODO tcp
+		// TODO udp
+	])?;
 
 	*DOMAINS.lock() = domains;
 	*PROTOCOLS.lock() = protocols;
 	*DEFAULT_PROTOCOLS.lock() = default_protocols;
+	*RECEIVERS.lock() = receivers;
 
 	Ok(())
 }
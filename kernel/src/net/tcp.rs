@@ -19,7 +19,7 @@
 //! The Transmission Control Protocol (TCP) is a protocol transmitting sequenced, reliable,
 //! two-way, connection-based byte streams.
 
-use super::{buf::BufList, osi::Layer};
+use super::{buf::PacketBuf, osi::Layer};
 use crate::file::socket::Socket;
 use utils::errno::EResult;
 
@@ -57,10 +57,7 @@ pub struct TCPHdr {
 pub struct TCPLayer {}
 
 impl Layer for TCPLayer {
-	fn transmit<'c, F>(&self, _buff: BufList<'c>, _next: F) -> EResult<()>
-	where
-		F: Fn(BufList<'c>) -> EResult<()>,
-	{
+	fn transmit(&self, _pkt: PacketBuf, _next: &dyn Fn(PacketBuf) -> EResult<()>) -> EResult<()> {
 		todo!()
 	}
 }
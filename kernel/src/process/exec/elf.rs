@@ -30,7 +30,9 @@ use crate::{
 		perm::{AccessProfile, can_execute_file},
 		vfs,
 	},
-	memory::{COMPAT_PROCESS_END, PROCESS_END, VirtAddr, user::UserSlice, vmem},
+	memory::{
+		COMPAT_PROCESS_END, PROCESS_END, VirtAddr, readahead::RA_MAX, user::UserSlice, vmem,
+	},
 	process::{
 		USER_STACK_SIZE,
 		exec::{ProgramImage, vdso::MappedVDSO},
@@ -39,8 +41,17 @@ use crate::{
 			MAP_ANONYMOUS, MAP_FIXED, MAP_PRIVATE, MemSpace, PROT_EXEC, PROT_READ, PROT_WRITE,
 		},
 	},
+	time::unit::Timestamp,
+};
+use core::{
+	cmp::{max, min},
+	fmt,
+	fmt::Formatter,
+	hint::unlikely,
+	num::NonZeroUsize,
+	ops::Add,
+	ptr,
 };
-use core::{cmp::max, hint::unlikely, num::NonZeroUsize, ops::Add, ptr};
 use utils::{
 	collections::{path::Path, string::String, vec::Vec},
 	errno,
@@ -104,6 +115,86 @@ const AT_SYSINFO: i32 = 32;
 /// A pointer to the beginning of the vDSO ELF image.
 const AT_SYSINFO_EHDR: i32 = 33;
 
+/// The maximum number of pages resident in the page cache that are mapped directly for each
+/// segment, to spare page faults at the beginning of the program's execution.
+const PREFAULT_MAX: usize = 16;
+
+/// A parsed ELF program, cached on its node so that executing it again does not require reading
+/// and checking its headers again.
+///
+/// The image is parsed again if the file has been modified in the meantime.
+pub struct ElfImage {
+	/// The file's modification timestamp at the time the image was parsed
+	mtime: Timestamp,
+	/// The file's size at the time the image was parsed
+	size: u64,
+
+	/// The program's headers
+	parser: ELFParser<'static>,
+	/// The offset of the end of the loaded image
+	load_size: usize,
+	/// The offset of the program headers in the loaded image, if loaded
+	phdr: Option<usize>,
+	/// Tells whether the stack is executable
+	exec_stack: bool,
+}
+
+impl ElfImage {
+	/// Returns the image of the program in `file`, parsing it if it is not cached or outdated.
+	pub fn get(file: &File) -> EResult<Arc<Self>> {
+		let node = file.node();
+		let stat = node.stat();
+		let cached = node.exec_image.lock().clone();
+		if let Some(image) = cached.filter(|i| i.mtime == stat.mtime && i.size == stat.size) {
+			return Ok(image);
+		}
+		let parser = ELFParser::from_file(file)?;
+		let ehdr = parser.hdr();
+		let mut phdr = None;
+		let mut exec_stack = true;
+		for seg in parser.segments() {
+			match seg.p_type {
+				PT_LOAD => {
+					if unlikely(seg.p_memsz < seg.p_filesz) {
+						return Err(errno!(ENOEXEC));
+					}
+					if unlikely(seg.p_align as usize != PAGE_SIZE) {
+						return Err(errno!(ENOEXEC));
+					}
+					// If the segment contains the phdr, keep its offset
+					if (seg.p_offset..seg.p_offset + seg.p_filesz).contains(&ehdr.e_phoff) {
+						phdr = Some((ehdr.e_phoff - seg.p_offset + seg.p_vaddr) as usize);
+					}
+				}
+				PT_GNU_STACK => exec_stack = seg.p_flags & PF_X != 0,
+				_ => {}
+			}
+		}
+		let load_size = parser.get_load_size();
+		let image = Arc::new(Self {
+			mtime: stat.mtime,
+			size: stat.size,
+
+			parser,
+			load_size,
+			phdr,
+			exec_stack,
+		})?;
+		*node.exec_image.lock() = Some(image.clone());
+		Ok(image)
+	}
+}
+
+impl fmt::Debug for ElfImage {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.debug_struct("ElfImage")
+			.field("mtime", &self.mtime)
+			.field("size", &self.size)
+			.field("load_size", &self.load_size)
+			.finish_non_exhaustive()
+	}
+}
+
 /// Information returned after loading an ELF program used to finish
 /// initialization.
 #[derive(Debug)]
@@ -248,18 +339,15 @@ fn build_auxiliary<'s>(
 ///
 /// If loaded, the function return the pointer to the end of the segment in
 /// virtual memory.
+///
+/// The segment is mapped privately from the page cache, so that its pages are shared with other
+/// instances of the program until written.
 fn map_segment(
 	file: Arc<File>,
 	mem_space: &MemSpace,
 	load_base: VirtAddr,
 	seg: &ProgramHeader,
 ) -> EResult<VirtAddr> {
-	if unlikely(seg.p_memsz < seg.p_filesz) {
-		return Err(errno!(ENOEXEC));
-	}
-	if unlikely(seg.p_align as usize != PAGE_SIZE) {
-		return Err(errno!(ENOEXEC));
-	}
 	// Map segment
 	let page_start = seg.p_vaddr as usize & !(PAGE_SIZE - 1);
 	let page_off = seg.p_vaddr as usize & (PAGE_SIZE - 1);
@@ -276,6 +364,11 @@ fn map_segment(
 		} else {
 			mmap_prot
 		};
+		// Start reading the beginning of the segment, which is going to be accessed soon
+		let file_start = (seg.p_offset - page_off as u64) / PAGE_SIZE as u64;
+		let file_end = file_start + min(pages.get() as u64, RA_MAX);
+		let node = file.node();
+		let _ = node.node_ops.readahead(node, file_start..file_end);
 		mem_space.map(
 			addr,
 			pages,
@@ -284,6 +377,7 @@ fn map_segment(
 			Some(file),
 			seg.p_offset - page_off as u64,
 		)?;
+		mem_space.prefault(addr, min(pages.get(), PREFAULT_MAX))?;
 		if zero_len > 0 {
 			// Zero the end of the last page
 			let slice = UserSlice::from_user(zero_begin.as_ptr::<u8>(), zero_len)?;
@@ -309,38 +403,27 @@ fn map_segment(
 	Ok(addr + pages * PAGE_SIZE)
 }
 
-/// Loads the ELF file parsed by `elf` into the memory space `mem_space`.
+/// Loads the ELF image `image` into the memory space `mem_space`.
 ///
 /// Arguments:
 /// - `file` is the file containing the ELF image
-/// - `elf` is the ELF image
+/// - `image` is the ELF image
 /// - `mem_space` is the memory space
 /// - `load_base` is the base address at which the ELF is loaded
 fn load_elf(
 	file: &Arc<File>,
-	elf: &ELFParser,
+	image: &ElfImage,
 	mem_space: &Arc<MemSpace>,
 	load_base: VirtAddr,
 ) -> EResult<ELFLoadInfo> {
-	let ehdr = elf.hdr();
+	let ehdr = image.parser.hdr();
 	let mut load_end = load_base;
-	let mut phdr_addr = VirtAddr(0);
-	let mut exec_stack = true;
 	MemSpace::switch(mem_space, |mem_space| -> EResult<()> {
 		// Map segments
-		for seg in elf.segments() {
-			match seg.p_type {
-				PT_LOAD => {
-					let seg_end = map_segment(file.clone(), mem_space, load_base, seg)?;
-					load_end = max(seg_end, load_end);
-					// If the segment contains the phdr, keep its address
-					if (seg.p_offset..seg.p_offset + seg.p_filesz).contains(&ehdr.e_phoff) {
-						phdr_addr =
-							load_base + (ehdr.e_phoff - seg.p_offset + seg.p_vaddr) as usize;
-					}
-				}
-				PT_GNU_STACK => exec_stack = seg.p_flags & PF_X != 0,
-				_ => {}
+		for seg in image.parser.segments() {
+			if seg.p_type == PT_LOAD {
+				let seg_end = map_segment(file.clone(), mem_space, load_base, seg)?;
+				load_end = max(seg_end, load_end);
 			}
 		}
 		Ok(())
@@ -348,12 +431,12 @@ fn load_elf(
 	Ok(ELFLoadInfo {
 		load_end,
 
-		phdr: phdr_addr,
+		phdr: image.phdr.map(|off| load_base + off).unwrap_or(VirtAddr(0)),
 		phentsize: ehdr.e_phentsize as _,
 		phnum: ehdr.e_phnum as _,
 
-		entry_point: load_base + elf.hdr().e_entry as usize,
-		exec_stack,
+		entry_point: load_base + ehdr.e_entry as usize,
+		exec_stack: image.exec_stack,
 	})
 }
 
@@ -503,22 +586,22 @@ pub fn exec(ent: Arc<vfs::Entry>, argv: Vec<String>, envp: Vec<String>) -> EResu
 	}
 	// Read and parse file
 	let file = File::open(ent.clone(), O_RDONLY)?;
-	let parser = ELFParser::from_file(&file)?;
-	if unlikely(!matches!(parser.hdr().e_type, ET_EXEC | ET_DYN)) {
+	let image = ElfImage::get(&file)?;
+	if unlikely(!matches!(image.parser.hdr().e_type, ET_EXEC | ET_DYN)) {
 		return Err(errno!(ENOEXEC));
 	}
 	// Determine load base
 	let mut load_base = VirtAddr(0);
-	if parser.hdr().e_type == ET_DYN {
+	if image.parser.hdr().e_type == ET_DYN {
 		// TODO ASLR
 		load_base = VirtAddr(PAGE_SIZE);
 	}
 	// Initialize memory space
-	let load_end = load_base + parser.get_load_size();
-	let compat = parser.class() == Class::Bit32;
+	let load_end = load_base + image.load_size;
+	let compat = image.parser.class() == Class::Bit32;
 	let mut mem_space = MemSpace::new(ent, load_end, compat)?;
 	// Load program
-	let load_info = load_elf(&file, &parser, &mem_space, load_base)?;
+	let load_info = load_elf(&file, &image, &mem_space, load_base)?;
 	let mut entry_point = load_info.entry_point;
 	// Compute the user stack address
 	let user_stack_addr = if !compat {
@@ -528,7 +611,7 @@ pub fn exec(ent: Arc<vfs::Entry>, argv: Vec<String>, envp: Vec<String>) -> EResu
 	};
 	// If using an interpreter, load it
 	let mut interp_load_base = VirtAddr(0);
-	if let Some(interp) = parser.get_interpreter_path() {
+	if let Some(interp) = image.parser.get_interpreter_path() {
 		let interp = Path::new(interp)?;
 		let interp_ent = vfs::get_file_from_path(interp, true)?;
 		// Check the file can be executed by the user
@@ -541,15 +624,15 @@ pub fn exec(ent: Arc<vfs::Entry>, argv: Vec<String>, envp: Vec<String>) -> EResu
 		}
 		// Read and parse file
 		let file = File::open(interp_ent, O_RDONLY)?;
-		let parser = ELFParser::from_file(&file)?;
+		let interp_image = ElfImage::get(&file)?;
 		// Cannot load the interpreter at the beginning since it might be used by the program
 		// itself
-		if unlikely(parser.hdr().e_type != ET_DYN) {
+		if unlikely(interp_image.parser.hdr().e_type != ET_DYN) {
 			return Err(errno!(ENOEXEC));
 		}
 		// Subtract one page to leave a space in between the stack and the interpreter
-		interp_load_base = user_stack_addr - PAGE_SIZE - parser.get_load_size(); // TODO ASLR
-		let load_info = load_elf(&file, &parser, &mem_space, interp_load_base)?;
+		interp_load_base = user_stack_addr - PAGE_SIZE - interp_image.load_size; // TODO ASLR
+		let load_info = load_elf(&file, &interp_image, &mem_space, interp_load_base)?;
 		entry_point = load_info.entry_point;
 	}
 	// Allocate the userspace stack. We add one page to account for the copy buffer
@@ -18,14 +18,18 @@
 
 //! The vDSO (virtual dynamic shared object) is a small shared library that the kernel
 //! automatically maps into the memory space of all userspace programs.
+//!
+//! The vvar page (see [`vvar`]) is mapped right before the vDSO's image, which accesses it at a
+//! fixed offset.
 
 use crate::{
 	elf::parser::ELFParser,
 	memory::{VirtAddr, buddy::ZONE_KERNEL, cache::RcPage},
 	process::mem_space::{MAP_ANONYMOUS, MAP_PRIVATE, MemSpace, PROT_EXEC, PROT_READ, Page},
 	sync::once::OnceInit,
+	time::vvar,
 };
-use core::{cmp::min, num::NonZeroUsize, ops::Add, ptr::NonNull};
+use core::{cmp::min, iter, num::NonZeroUsize, ops::Add, ptr::NonNull};
 use utils::{
 	collections::vec::Vec,
 	errno::{AllocResult, CollectResult, EResult},
@@ -35,7 +39,8 @@ use utils::{
 
 /// Information on the vDSO ELF image.
 struct Vdso {
-	/// The list of pages on which the image is loaded.
+	/// The list of pages to map: the vvar page, followed by the pages on which the image is
+	/// loaded.
 	pages: Vec<RcPage>,
 	/// The offset of the vDSO's entry.
 	entry_off: Option<NonZeroUsize>,
@@ -60,19 +65,20 @@ fn load_image(elf: &[u8]) -> EResult<Vdso> {
 	let parser = ELFParser::from_slice(elf)?;
 	// Load image into pages
 	let pages_count = elf.len().div_ceil(PAGE_SIZE);
-	let pages = (0..pages_count)
-		.map(|i| {
-			let off = i * PAGE_SIZE;
-			let len = min(PAGE_SIZE, elf.len() - off);
-			// Alloc page
-			let page = RcPage::new(ZONE_KERNEL, None, 0)?;
-			let virtaddr = unsafe { &mut *page.virt_addr().as_ptr::<Page>() };
-			// Copy data
-			let src = &elf[off..(off + len)];
-			virtaddr[..src.len()].copy_from_slice(src);
-			virtaddr[src.len()..].fill(0);
-			Ok(page)
-		})
+	let image = (0..pages_count).map(|i| {
+		let off = i * PAGE_SIZE;
+		let len = min(PAGE_SIZE, elf.len() - off);
+		// Alloc page
+		let page = RcPage::new(ZONE_KERNEL, None, 0)?;
+		let virtaddr = unsafe { &mut *page.virt_addr().as_ptr::<Page>() };
+		// Copy data
+		let src = &elf[off..(off + len)];
+		virtaddr[..src.len()].copy_from_slice(src);
+		virtaddr[src.len()..].fill(0);
+		Ok(page)
+	});
+	let pages = iter::once(Ok(vvar::page().clone()))
+		.chain(image)
 		.collect::<AllocResult<CollectResult<_>>>()?
 		.0?;
 	Ok(Vdso {
@@ -97,6 +103,8 @@ pub fn map(mem_space: &MemSpace, compat: bool) -> EResult<MappedVDSO> {
 		MAP_PRIVATE | MAP_ANONYMOUS,
 		&vdso.pages,
 	)?;
+	// Skip the vvar page
+	let begin = begin + PAGE_SIZE;
 	Ok(MappedVDSO {
 		begin,
 		entry: vdso
@@ -23,21 +23,25 @@
 
 use super::gap::MemGap;
 use crate::{
-	arch::x86::paging,
+	arch::x86::{paging, paging::StaleTable},
 	file::File,
 	memory::{
-		PhysAddr, VirtAddr,
-		buddy::ZONE_USER,
+		PhysAddr, VirtAddr, buddy,
+		buddy::{FrameOrder, ZONE_USER},
 		cache::RcPage,
-		vmem::{VMem, invalidate_page, shootdown_page, write_ro},
+		vmem::{VMem, invalidate_page, shootdown_page, shootdown_range, write_ro},
 	},
-	process::mem_space::{
-		COPY_BUFFER, MAP_ANONYMOUS, MAP_PRIVATE, MAP_SHARED, MemSpace, PROT_EXEC, PROT_WRITE, Page,
+	process::{
+		mem_space::{
+			COPY_BUFFER, MAP_ANONYMOUS, MAP_PRIVATE, MAP_SHARED, MemSpace, PROT_EXEC, PROT_WRITE,
+			Page,
+		},
+		scheduler::cpu::iter_online,
 	},
 	sync::spin::Spin,
 	time::clock::{Clock, current_time_ms},
 };
-use core::{num::NonZeroUsize, ops::Deref, sync::atomic::Ordering::Release};
+use core::{cmp::min, num::NonZeroUsize, ops::Deref, sync::atomic::Ordering::Release};
 use utils::{
 	TryClone,
 	collections::vec::Vec,
@@ -60,15 +64,50 @@ fn zeroed_page() -> PhysAddr {
 		.unwrap()
 }
 
+/// The order of huge pages, used to map large anonymous regions with a single entry.
+const HUGE_PAGE_ORDER: FrameOrder = paging::PAGE_SIZE_ORDER_1;
+/// The number of pages in a huge page.
+const HUGE_PAGE_PAGES: usize = 1 << HUGE_PAGE_ORDER;
+
+/// The policy for the use of transparent huge pages on a mapping, set with `madvise`.
+#[derive(Clone, Copy, Debug, Default, Eq, PartialEq)]
+pub enum HugePolicy {
+	/// Huge pages are used for aligned regions of anonymous mappings, on write
+	#[default]
+	Normal,
+	/// Same as [`Self::Normal`], but also on read, instead of mapping the zeroed page
+	/// (`MADV_HUGEPAGE`)
+	Always,
+	/// Huge pages are never used (`MADV_NOHUGEPAGE`)
+	Never,
+}
+
 /// A wrapper for a mapped frame, allowing to update the map counter.
 #[derive(Debug)]
-pub(super) struct MappedPage(RcPage);
+pub(super) struct MappedPage {
+	/// The mapped frame
+	frame: RcPage,
+	/// Tells whether the frame is borrowed from the page cache of the mapped file. If so, a
+	/// private mapping must copy it before writing to it
+	borrowed: bool,
+}
 
 impl MappedPage {
 	/// Creates a new instance.
 	pub fn new(frame: RcPage) -> Self {
 		frame.map_counter().fetch_add(1, Release);
-		Self(frame)
+		Self {
+			frame,
+			borrowed: false,
+		}
+	}
+
+	/// Creates a new instance for the page cache frame `frame`, mapped in read-only by a private
+	/// mapping until it gets written.
+	pub fn borrowed(frame: RcPage) -> Self {
+		let mut page = Self::new(frame);
+		page.borrowed = true;
+		page
 	}
 }
 
@@ -76,19 +115,21 @@ impl Deref for MappedPage {
 	type Target = RcPage;
 
 	fn deref(&self) -> &Self::Target {
-		&self.0
+		&self.frame
 	}
 }
 
 impl Clone for MappedPage {
 	fn clone(&self) -> Self {
-		Self::new(self.0.clone())
+		let mut page = Self::new(self.frame.clone());
+		page.borrowed = self.borrowed;
+		page
 	}
 }
 
 impl Drop for MappedPage {
 	fn drop(&mut self) {
-		self.0.map_counter().fetch_sub(1, Release);
+		self.frame.map_counter().fetch_sub(1, Release);
 	}
 }
 
@@ -152,6 +193,48 @@ fn init_page(vmem: &VMem, prot: u8, src: Option<&RcPage>, dst: VirtAddr) -> Allo
 	Ok(new_page)
 }
 
+/// Returns the page at offset `off` of `file`, in pages, reading it from the disk if necessary.
+///
+/// `end` is the offset of the end of the mapping in the file, in pages. Pages past it are not
+/// prefetched.
+pub(super) fn read_file_page(file: &File, off: u64, end: u64) -> EResult<RcPage> {
+	let node = file.node();
+	let file_pages = file.stat().size.div_ceil(PAGE_SIZE as u64);
+	if let Some(range) = file.readahead.on_read(off, off + 1, file_pages) {
+		let range = range.start..min(range.end, end);
+		let _ = node.node_ops.readahead(node, range);
+	}
+	node.node_ops.read_page(node, off)
+}
+
+/// Invalidates the TLB for the page at `addr`, after its entry has been updated in `mem_space`.
+///
+/// `present` tells whether the entry was present before the update. If not, no CPU may have
+/// cached it, so other CPUs are not interrupted.
+fn invalidate(mem_space: &MemSpace, addr: VirtAddr, present: bool) {
+	if present {
+		shootdown_page(addr, mem_space.bound_cpus());
+	} else {
+		invalidate_page(addr);
+	}
+}
+
+/// Invalidates the TLB for the huge page at `addr`, after it has been mapped in `mem_space`.
+///
+/// `stale` is the table the huge page entry replaced, if any. Since CPUs in lazy TLB mode do not
+/// receive the memory space's shootdowns but may still walk the table through their
+/// paging-structure caches, all CPUs are interrupted in that case. The table is freed afterward.
+fn shootdown_huge(mem_space: &MemSpace, addr: VirtAddr, stale: Option<StaleTable>) {
+	let Some(stale) = stale else {
+		shootdown_range(addr, HUGE_PAGE_PAGES, mem_space.bound_cpus());
+		return;
+	};
+	shootdown_range(addr, HUGE_PAGE_PAGES, iter_online());
+	unsafe {
+		stale.free();
+	}
+}
+
 /// A mapping in a memory space.
 #[derive(Debug)]
 pub struct MemMapping {
@@ -168,6 +251,8 @@ pub struct MemMapping {
 	pub file: Option<Arc<File>>,
 	/// The offset in the mapped file. If no file is mapped, this field is not relevant
 	pub off: u64,
+	/// The policy for the use of huge pages
+	pub huge: HugePolicy,
 
 	// TODO use a sparse array?
 	/// Pages mapped in memory
@@ -204,11 +289,114 @@ impl MemMapping {
 
 			file,
 			off,
+			huge: HugePolicy::default(),
 
 			pages: Spin::new(pages),
 		})
 	}
 
+	/// Attempts to map the huge page containing the page at offset `offset` of the mapping, onto
+	/// `mem_space`.
+	///
+	/// A huge page is used if the aligned region around the page lies entirely inside the mapping,
+	/// and either:
+	/// - no page of the region is present, in which case a huge page is allocated
+	/// - all pages of the region are present, physically contiguous, aligned, and do not require
+	///   Copy-On-Write, in which case they are mapped again with a single entry (for example after
+	///   the region has been unmapped by `mprotect`)
+	///
+	/// `write` tells whether the page has to be mapped for writing.
+	///
+	/// If no huge page could be mapped, the function returns `false`, and the caller must map a
+	/// normal page instead.
+	fn map_huge(
+		&self,
+		mem_space: &MemSpace,
+		pages: &mut [Option<MappedPage>],
+		offset: usize,
+		write: bool,
+	) -> AllocResult<bool> {
+		if self.file.is_some() || self.huge == HugePolicy::Never {
+			return Ok(false);
+		}
+		// Check the region is inside the mapping
+		let huge_size = HUGE_PAGE_PAGES * PAGE_SIZE;
+		let virtaddr = VirtAddr((self.addr + offset * PAGE_SIZE).0 & !(huge_size - 1));
+		if virtaddr < self.addr {
+			return Ok(false);
+		}
+		let begin = (virtaddr.0 - self.addr.0) / PAGE_SIZE;
+		let Some(region) = pages.get_mut(begin..(begin + HUGE_PAGE_PAGES)) else {
+			return Ok(false);
+		};
+		let flags = vmem_flags(self.prot, false) | paging::FLAG_PAGE_SIZE;
+		if let Some(first) = &region[0] {
+			// Reuse present pages
+			let phys_addr = first.phys_addr();
+			if !phys_addr.is_aligned_to(huge_size) {
+				return Ok(false);
+			}
+			let contiguous = region.iter().enumerate().all(|(i, page)| {
+				page.as_ref().is_some_and(|page| {
+					page.phys_addr() == phys_addr + i * PAGE_SIZE
+						&& (self.flags & MAP_SHARED != 0 || !page.is_shared())
+				})
+			});
+			if !contiguous {
+				return Ok(false);
+			}
+			let stale = mem_space
+				.vmem
+				.map_huge(phys_addr, virtaddr, flags, HUGE_PAGE_ORDER);
+			shootdown_huge(mem_space, virtaddr, stale);
+			return Ok(true);
+		}
+		// Allocate a huge page
+		if !write && self.huge != HugePolicy::Always {
+			return Ok(false);
+		}
+		if region.iter().any(Option::is_some) {
+			return Ok(false);
+		}
+		let mut new_pages = Vec::with_capacity(HUGE_PAGE_PAGES)?;
+		// Do not insist on failure, since normal pages can be used instead
+		let Ok(phys_addr) = buddy::alloc(HUGE_PAGE_ORDER, ZONE_USER) else {
+			return Ok(false);
+		};
+		unsafe {
+			buddy::split(phys_addr, HUGE_PAGE_ORDER);
+		}
+		let mut res = Ok(());
+		for i in 0..HUGE_PAGE_PAGES {
+			let addr = phys_addr + i * PAGE_SIZE;
+			if res.is_err() {
+				// Free the remaining frames
+				unsafe {
+					buddy::free(addr, 0);
+				}
+				continue;
+			}
+			res =
+				unsafe { RcPage::from_phys(addr, None, 0) }.and_then(|page| new_pages.push(page));
+		}
+		res?;
+		let stale = mem_space
+			.vmem
+			.map_huge(phys_addr, virtaddr, flags, HUGE_PAGE_ORDER);
+		// Invalidate before writing, since the zeroed page may be cached for the region
+		shootdown_huge(mem_space, virtaddr, stale);
+		unsafe {
+			// Required if the mapping is not writable
+			write_ro(|| {
+				virtaddr.as_ptr::<u8>().write_bytes(0, huge_size);
+			});
+		}
+		for (dst, page) in region.iter_mut().zip(new_pages) {
+			*dst = Some(MappedPage::new(page));
+		}
+		Ok(true)
+	}
+
 	/// Maps the page at the offset `offset` of the mapping, onto `mem_space`.
 	///
 	/// `write` tells whether the page has to be mapped for writing.
@@ -222,14 +410,58 @@ impl MemMapping {
 	///
 	/// Upon allocation failure, or failure to read a page from the disk, the function returns an
 	/// error.
+	#[inline]
 	pub(super) fn map(&self, mem_space: &MemSpace, offset: usize, write: bool) -> EResult<()> {
+		self.map_page(mem_space, offset, write, None)
+	}
+
+	/// Returns the location of the page at offset `offset` of the mapping in the mapped file, if
+	/// mapping it requires to get it from the file.
+	///
+	/// The returned tuple contains the file, the offset of the page in it, and the offset of the
+	/// end of the mapping in it. Offsets are in pages.
+	pub(super) fn file_page(&self, offset: usize) -> Option<(Arc<File>, u64, u64)> {
+		let file = self.file.as_ref()?;
+		if self.pages.lock()[offset].is_some() {
+			return None;
+		}
+		let begin = self.off / PAGE_SIZE as u64;
+		Some((
+			file.clone(),
+			begin + offset as u64,
+			begin + self.size.get() as u64,
+		))
+	}
+
+	/// Same as [`Self::map`], except `file_page` is the page of the mapped file to use, if it has
+	/// already been retrieved with [`read_file_page`].
+	pub(super) fn map_page(
+		&self,
+		mem_space: &MemSpace,
+		offset: usize,
+		write: bool,
+		file_page: Option<RcPage>,
+	) -> EResult<()> {
 		let virtaddr = self.addr + offset * PAGE_SIZE;
 		let mut pages = self.pages.lock();
+		if self.map_huge(mem_space, &mut pages, offset, write)? {
+			return Ok(());
+		}
+		let present = mem_space.vmem.translate(virtaddr).is_some();
 		if let Some(page) = &pages[offset] {
 			// A page is already present, use it
 			let mut phys_addr = page.phys_addr();
-			let pending_cow = self.flags & MAP_SHARED == 0 && page.is_shared();
-			if pending_cow {
+			let mut cow = false;
+			if self.flags & MAP_SHARED == 0 && page.borrowed {
+				// The page belongs to the file: keep sharing it until it gets written
+				if write {
+					let page = init_page(&mem_space.vmem, self.prot, Some(page), virtaddr)?;
+					phys_addr = page.phys_addr();
+					pages[offset] = Some(MappedPage::new(page));
+				} else {
+					cow = true;
+				}
+			} else if self.flags & MAP_SHARED == 0 && page.is_shared() {
 				// The page cannot be shared: we need our own copy (regardless of whether we are
 				// reading or writing)
 				let page = init_page(&mem_space.vmem, self.prot, Some(page), virtaddr)?;
@@ -237,9 +469,9 @@ impl MemMapping {
 				pages[offset] = Some(MappedPage::new(page));
 			}
 			// Map the page
-			let flags = vmem_flags(self.prot, false);
+			let flags = vmem_flags(self.prot, cow);
 			mem_space.vmem.map(phys_addr, virtaddr, flags, 0);
-			shootdown_page(virtaddr, mem_space.bound_cpus());
+			invalidate(mem_space, virtaddr, present);
 			return Ok(());
 		}
 		// Else, Allocate a page
@@ -262,21 +494,36 @@ impl MemMapping {
 			// Mapped file
 			Some(file) => {
 				// Get page from file
-				let node = file.node();
-				let file_off = self.off / PAGE_SIZE as u64 + offset as u64;
-				let mut page = node.node_ops.read_page(node, file_off)?;
-				// If the mapping is private, we need our own copy
-				if self.flags & MAP_PRIVATE != 0 {
-					page = init_page(&mem_space.vmem, self.prot, Some(&page), virtaddr)?;
-				}
+				let page = match file_page {
+					Some(page) => page,
+					None => {
+						let begin = self.off / PAGE_SIZE as u64;
+						let end = begin + self.size.get() as u64;
+						read_file_page(file, begin + offset as u64, end)?
+					}
+				};
+				let page = if self.flags & MAP_PRIVATE == 0 {
+					MappedPage::new(page)
+				} else if !write {
+					// Map the page cache's frame directly, it gets copied when written
+					MappedPage::borrowed(page)
+				} else {
+					// The mapping is private, we need our own copy
+					MappedPage::new(init_page(
+						&mem_space.vmem,
+						self.prot,
+						Some(&page),
+						virtaddr,
+					)?)
+				};
 				let phys_addr = page.phys_addr();
-				pages[offset] = Some(MappedPage::new(page));
+				pages[offset] = Some(page);
 				// Map
 				let flags = vmem_flags(self.prot, !write);
 				mem_space.vmem.map(phys_addr, virtaddr, flags, 0);
 			}
 		}
-		shootdown_page(virtaddr, mem_space.bound_cpus());
+		invalidate(mem_space, virtaddr, present);
 		Ok(())
 	}
 
@@ -309,6 +556,7 @@ impl MemMapping {
 
 					file: self.file.clone(),
 					off: self.off,
+					huge: self.huge,
 
 					pages: Spin::new(Vec::try_from(&pages[..size.get()])?),
 				})
@@ -334,6 +582,7 @@ impl MemMapping {
 
 					file: self.file.clone(),
 					off: self.off + end as u64,
+					huge: self.huge,
 
 					pages: Spin::new(Vec::try_from(&pages[end..])?),
 				})
@@ -363,8 +612,8 @@ impl MemMapping {
 		}
 		let ts = current_time_ms(Clock::Boottime);
 		let pages = self.pages.lock();
+		vmem.poll_dirty(self.addr, self.size.get());
 		for frame in pages.iter().flatten() {
-			vmem.poll_dirty(self.addr, self.size.get());
 			if sync {
 				// TODO warn on error?
 				let _ = frame.writeback(Some(ts), false);
@@ -372,6 +621,34 @@ impl MemMapping {
 		}
 		Ok(())
 	}
+
+	/// Clones the mapping for process forking.
+	///
+	/// The pages present in `vmem` are mapped to `child` as well, so that the new process does not
+	/// have to fault on them. Unless the mapping is shared, writable pages are made read-only on
+	/// both sides for Copy-On-Write.
+	///
+	/// The returned boolean tells whether entries of `vmem` have been write-protected, in which
+	/// case the caller must invalidate the TLB for the mapping.
+	pub(super) fn fork(&self, vmem: &VMem, child: &VMem) -> AllocResult<(Self, bool)> {
+		// Keep the pages locked so that no page gets mapped in between
+		let pages = self.pages.lock();
+		let new = Self {
+			addr: self.addr,
+			size: self.size,
+			prot: self.prot,
+			flags: self.flags,
+
+			file: self.file.clone(),
+			off: self.off,
+			huge: self.huge,
+
+			pages: Spin::new(pages.try_clone()?),
+		};
+		let write_protect = self.flags & MAP_SHARED == 0 && self.prot & PROT_WRITE != 0;
+		vmem.fork_range(child, self.addr, self.size.get(), write_protect);
+		Ok((new, write_protect))
+	}
 }
 
 impl TryClone for MemMapping {
@@ -385,6 +662,7 @@ impl TryClone for MemMapping {
 
 			file: self.file.clone(),
 			off: self.off,
+			huge: self.huge,
 
 			pages: Spin::new(pages.try_clone()?),
 		})
@@ -36,17 +36,21 @@ use crate::{
 	memory::{
 		COMPAT_PROCESS_END, PROCESS_END, VirtAddr,
 		cache::RcPage,
+		readahead::Advice,
 		user::UserSlice,
-		vmem::{KERNEL_VMEM, VMem, shootdown_range},
+		vmem::{TlbBatch, VMem, flush},
 	},
 	process::{
 		Process,
-		mem_space::mapping::MappedPage,
+		mem_space::mapping::{HugePolicy, MappedPage},
 		scheduler::{cpu, cpu::per_cpu, critical},
 	},
 	sync::rwlock::IntRwLock,
 };
-use core::{alloc::AllocError, cmp::min, fmt, hint::unlikely, mem, num::NonZeroUsize, ptr};
+use core::{
+	alloc::AllocError, cmp::min, ffi::c_int, fmt, hint::unlikely, mem, num::NonZeroUsize,
+	ops::Range, ptr, sync::atomic::Ordering::Relaxed,
+};
 use gap::MemGap;
 use mapping::MemMapping;
 use transaction::MemSpaceTransaction;
@@ -78,6 +82,35 @@ pub const MAP_ANONYMOUS: i32 = 0x20;
 /// Interpret `addr` exactly, failing if already used
 pub const MAP_FIXED_NOREPLACE: i32 = 0x100000;
 
+/// No particular access pattern
+pub const MADV_NORMAL: i32 = 0;
+/// Random accesses
+pub const MADV_RANDOM: i32 = 1;
+/// Sequential accesses
+pub const MADV_SEQUENTIAL: i32 = 2;
+/// The pages are going to be accessed soon
+pub const MADV_WILLNEED: i32 = 3;
+/// The pages are not going to be accessed soon
+pub const MADV_DONTNEED: i32 = 4;
+/// The content of the pages is not needed anymore, but may be kept until memory is needed
+pub const MADV_FREE: i32 = 8;
+/// The pages may be merged with identical pages
+pub const MADV_MERGEABLE: i32 = 12;
+/// The pages must not be merged with identical pages anymore
+pub const MADV_UNMERGEABLE: i32 = 13;
+/// Enable transparent huge pages on the range
+pub const MADV_HUGEPAGE: i32 = 14;
+/// Disable transparent huge pages on the range
+pub const MADV_NOHUGEPAGE: i32 = 15;
+/// Exclude the pages from core dumps
+pub const MADV_DONTDUMP: i32 = 16;
+/// Include the pages in core dumps again
+pub const MADV_DODUMP: i32 = 17;
+/// The pages are not going to be accessed soon, but their content is needed
+pub const MADV_COLD: i32 = 20;
+/// The pages should be reclaimed now
+pub const MADV_PAGEOUT: i32 = 21;
+
 /// The virtual address of the buffer used to map pages for copy.
 const COPY_BUFFER: VirtAddr = VirtAddr(PROCESS_END.0 - PAGE_SIZE);
 
@@ -399,6 +432,10 @@ impl MemSpace {
 		file: Option<Arc<File>>,
 		off: u64,
 	) -> EResult<VirtAddr> {
+		if flags & MAP_FIXED != 0 {
+			// Mappings in the range are replaced
+			self.writeback(addr, size.get());
+		}
 		let mut transaction = MemSpaceTransaction::new(self);
 		let map = Self::map_impl(&mut transaction, addr, size, prot, flags, file, off)?;
 		let addr = map.addr;
@@ -461,6 +498,140 @@ impl MemSpace {
 		Ok(())
 	}
 
+	/// Maps the pages in the given range that are resident in the page cache, so that accessing
+	/// them does not fault.
+	///
+	/// Arguments:
+	/// - `addr` is the starting address of the range, which must be part of a single mapping
+	/// - `pages` is the number of pages
+	///
+	/// Pages that are not resident are left to be faulted in on access, so that the function
+	/// never waits for I/O. Pages are mapped in read-only, as for a read access. Since the
+	/// accesses do not actually happen, they are not accounted for the file's readahead.
+	///
+	/// **Note**: it is assumed the memory space is bound.
+	pub fn prefault(&self, addr: VirtAddr, pages: usize) -> EResult<()> {
+		let state = self.state.read();
+		let Some(mapping) = state.get_mapping_for_addr(addr) else {
+			return Ok(());
+		};
+		let Some(file) = &mapping.file else {
+			return Ok(());
+		};
+		let node = file.node();
+		let begin = (addr.0 - mapping.addr.0) / PAGE_SIZE;
+		let end = min(begin.saturating_add(pages), mapping.size.get());
+		for offset in begin..end {
+			let file_off = mapping.off / PAGE_SIZE as u64 + offset as u64;
+			// Holding the page keeps it from being evicted until it is mapped
+			let page = node.mapped.get(file_off).filter(|page| !page.is_reading());
+			if let Some(page) = page {
+				// Use the page directly, so that the file's readahead window is not affected
+				mapping.map_page(self, offset, false, Some(page))?;
+			}
+		}
+		Ok(())
+	}
+
+	/// Applies the access pattern hint `advice` to the given range of memory.
+	///
+	/// Arguments:
+	/// - `addr` is the starting address of the range
+	/// - `size` is the number of pages
+	///
+	/// Hints about the access pattern apply to the open file description the mappings are
+	/// backed by. Anonymous mappings are left untouched.
+	///
+	/// Hints about huge pages apply to the mappings themselves, which are split if necessary.
+	///
+	/// `MADV_DONTNEED` drops the pages of private mappings, so that their next access reads zeros
+	/// or the content of the file again. Pages of shared mappings are only unmapped.
+	///
+	/// Other valid advices are hints the kernel does not act on. If `advice` is invalid, the
+	/// function returns [`errno::EINVAL`].
+	///
+	/// If a part of the range is not mapped, the function returns [`errno::ENOMEM`].
+	pub fn advise(&self, addr: VirtAddr, size: usize, advice: c_int) -> EResult<()> {
+		if advice == MADV_DONTNEED {
+			// The pages are released only once the TLB shootdown of the transaction is done
+			let mut dropped = Vec::new();
+			return self.update_range(addr, size, true, |mapping| {
+				if mapping.flags & MAP_PRIVATE != 0 {
+					let mut pages = mapping.pages.lock();
+					dropped.reserve(pages.len())?;
+					for page in pages.iter_mut().filter_map(Option::take) {
+						dropped.push(page)?;
+					}
+				}
+				Ok(())
+			});
+		}
+		let huge = match advice {
+			MADV_HUGEPAGE => Some(HugePolicy::Always),
+			MADV_NOHUGEPAGE => Some(HugePolicy::Never),
+			_ => None,
+		};
+		if let Some(huge) = huge {
+			return self.update_range(addr, size, false, |mapping| {
+				mapping.huge = huge;
+				Ok(())
+			});
+		}
+		let ra_advice = match advice {
+			MADV_NORMAL => Some(Advice::Normal),
+			MADV_RANDOM => Some(Advice::Random),
+			MADV_SEQUENTIAL => Some(Advice::Sequential),
+			MADV_WILLNEED => None,
+			MADV_FREE | MADV_MERGEABLE | MADV_UNMERGEABLE | MADV_DONTDUMP | MADV_DODUMP
+			| MADV_COLD | MADV_PAGEOUT => return Ok(()),
+			_ => return Err(errno!(EINVAL)),
+		};
+		// Ranges of files to read, which is done after releasing the lock
+		let mut reads: Vec<(Arc<File>, Range<u64>)> = Vec::new();
+		let mut unmapped = false;
+		{
+			let state = self.state.read();
+			let mut i = 0;
+			while i < size {
+				let page_addr = addr + i * PAGE_SIZE;
+				let Some(mapping) = state.get_mapping_for_addr(page_addr) else {
+					unmapped = true;
+					i += 1;
+					continue;
+				};
+				// The range of pages of the mapping intersecting with the range
+				let begin = (page_addr.0 - mapping.addr.0) / PAGE_SIZE;
+				let end = min(mapping.size.get(), begin + (size - i));
+				i += end - begin;
+				let Some(file) = &mapping.file else {
+					continue;
+				};
+				match ra_advice {
+					Some(advice) => file.readahead.set_advice(advice),
+					None => {
+						let file_off = mapping.off / PAGE_SIZE as u64;
+						reads.push((
+							file.clone(),
+							(file_off + begin as u64)..(file_off + end as u64),
+						))?;
+					}
+				}
+			}
+		}
+		for (file, range) in reads {
+			let node = file.node();
+			let file_pages = file.stat().size.div_ceil(PAGE_SIZE as u64);
+			let range = range.start..min(range.end, file_pages);
+			if !range.is_empty() {
+				node.node_ops.readahead(node, range)?;
+			}
+		}
+		if unlikely(unmapped) {
+			return Err(errno!(ENOMEM));
+		}
+		Ok(())
+	}
+
 	/// Implementation for `unmap`.
 	///
 	/// If `nogap` is `true`, the function does not create any gap.
@@ -479,8 +650,15 @@ impl MemSpace {
 			let page_addr = addr + i * PAGE_SIZE;
 			// The mapping containing the page
 			let Some(mapping) = transaction.state.get_mapping_for_addr(page_addr) else {
-				// TODO jump to next mapping directly using binary tree (currently O(n log n))
-				i += 1;
+				// Jump to the next mapping
+				let next = transaction
+					.state
+					.mappings
+					.range(page_addr..)
+					.next()
+					.map(|(addr, _)| (addr.0 - page_addr.0) / PAGE_SIZE)
+					.unwrap_or(usize::MAX);
+				i = i.saturating_add(next);
 				continue;
 			};
 			// The pointer to the beginning of the mapping
@@ -547,6 +725,7 @@ impl MemSpace {
 		if unlikely(!addr.is_aligned_to(PAGE_SIZE)) {
 			return Err(errno!(ENOMEM));
 		}
+		self.writeback(addr, size.get());
 		let mut transaction = MemSpaceTransaction::new(self);
 		Self::unmap_impl(&mut transaction, addr, size, false)?;
 		transaction.commit();
@@ -556,11 +735,20 @@ impl MemSpace {
 	/// Binds the memory space to the current CPU.
 	pub fn bind(this: &Arc<Self>) {
 		if this.vmem.is_bound() {
+			critical(|| {
+				// Leave lazy TLB mode. Shootdowns may have been missed, so flush
+				if per_cpu().tlb_lazy.swap(false, Relaxed) {
+					this.bound_cpus.set_bit(core_id() as usize);
+					flush();
+				}
+			});
 			return;
 		}
 		critical(|| {
 			// Update per-CPU structure
-			let prev = per_cpu().mem_space.replace(Some(this.clone()));
+			let cpu = per_cpu();
+			let prev = cpu.mem_space.replace(Some(this.clone()));
+			cpu.tlb_lazy.store(false, Relaxed);
 			// Update new bitmap
 			let core_id = core_id() as usize;
 			this.bound_cpus.set_bit(core_id);
@@ -575,17 +763,23 @@ impl MemSpace {
 		});
 	}
 
-	/// Unbinds the current memory space, binding the kernel's virtual memory context instead.
+	/// Unbinds the current memory space, for a kernel thread.
+	///
+	/// To avoid reloading the virtual memory context when switching back to the same memory space,
+	/// the current CPU enters lazy TLB mode instead: the memory space stays bound, but the CPU
+	/// stops receiving its TLB shootdowns. This is fine since kernel threads do not access
+	/// userspace memory. The TLB is flushed when the memory space is bound again.
+	///
+	/// The memory space is kept alive until another one is bound.
 	pub fn unbind() {
 		critical(|| {
-			// Update per-CPU structure
-			let prev = per_cpu().mem_space.replace(None);
-			// Bind the kernel's vmem
-			KERNEL_VMEM.bind();
-			// Update old bitmap if any
-			if let Some(prev) = prev {
-				let core_id = core_id() as usize;
-				prev.bound_cpus.clear_bit(core_id);
+			let cpu = per_cpu();
+			let Some(cur) = cpu.mem_space.get() else {
+				// The kernel's context is already bound
+				return;
+			};
+			if !cpu.tlb_lazy.swap(true, Relaxed) {
+				cur.bound_cpus.clear_bit(core_id() as usize);
 			}
 		});
 	}
@@ -605,7 +799,9 @@ impl MemSpace {
 	pub fn switch<F: FnOnce(&Arc<Self>) -> T, T>(this: &Arc<Self>, f: F) -> T {
 		let proc = Process::current();
 		let old = critical(|| {
-			let old = per_cpu().mem_space.get();
+			// In lazy TLB mode, no memory space is active
+			let cpu = per_cpu();
+			let old = cpu.mem_space.get().filter(|_| !cpu.tlb_lazy.load(Relaxed));
 			*proc.active_mem_space.lock() = Some(this.clone());
 			Self::bind(this);
 			old
@@ -624,17 +820,24 @@ impl MemSpace {
 	/// Clones the current memory space for process forking.
 	pub fn fork(&self) -> AllocResult<MemSpace> {
 		let bound_cpus = cpu::Bitmap::new(false)?;
+		let vmem = unsafe { VMem::new() };
 		// Lock
 		let state = self.state.read();
-		// Clone first to mark as shared
-		let mappings = state.mappings.try_clone()?;
-		// Unmap to invalidate the virtual memory context
-		for (_, m) in &state.mappings {
-			if m.prot & PROT_WRITE != 0 {
-				self.vmem.unmap_range(m.addr, m.size.get());
-				shootdown_range(m.addr, m.size.get(), self.bound_cpus());
+		// Clone mappings along with their page table entries, so that the child does not fault
+		// on pages that are already present
+		let mut mappings = BTreeMap::new();
+		let mut tlb = TlbBatch::default();
+		let res = state.mappings.iter().try_for_each(|(addr, m)| {
+			let (new, write_protected) = m.fork(&self.vmem, &vmem)?;
+			if write_protected {
+				tlb.add(m.addr, m.size.get());
 			}
-		}
+			mappings.insert(*addr, new)?;
+			Ok(())
+		});
+		// Write-protected entries must be invalidated, even on failure
+		tlb.shootdown(self.bound_cpus());
+		res?;
 		Ok(Self {
 			state: IntRwLock::new(MemSpaceState {
 				gaps: state.gaps.try_clone()?,
@@ -645,7 +848,7 @@ impl MemSpace {
 
 				vmem_usage: state.vmem_usage,
 			}),
-			vmem: unsafe { VMem::new() },
+			vmem,
 
 			exe_info: self.exe_info.clone(),
 
@@ -653,29 +856,36 @@ impl MemSpace {
 		})
 	}
 
-	/// Sets protection for the given range of memory.
+	/// Applies `f` on the mappings in the given range of memory, splitting them so that `f` is
+	/// applied only to the part inside the range.
 	///
 	/// Arguments:
-	/// - `addr` is the address to the beginning of the range to be set
+	/// - `addr` is the address to the beginning of the range
 	/// - `pages` is the number of pages in the range
-	/// - `prot` is a set of mapping flags
+	/// - `unmap` tells whether the range must be unmapped from the virtual memory context, so that
+	///   the updated mappings are used on the next accesses
 	///
-	/// If a mapping to be modified is associated with a file, and the file doesn't have the
-	/// matching permissions, the function returns an error.
-	pub fn set_prot(&self, mut addr: VirtAddr, pages: usize, prot: u8) -> EResult<()> {
-		let start = addr;
+	/// If a part of the range is not mapped, the function returns [`errno::ENOMEM`]. If `f`
+	/// returns an error, the memory space is left unchanged.
+	fn update_range<F: FnMut(&mut MemMapping) -> EResult<()>>(
+		&self,
+		mut addr: VirtAddr,
+		pages: usize,
+		unmap: bool,
+		mut f: F,
+	) -> EResult<()> {
 		let end = pages
 			.checked_mul(PAGE_SIZE)
 			.and_then(|len| addr.0.checked_add(len))
 			.filter(|end| *end <= COPY_BUFFER.0)
 			.ok_or_else(|| errno!(EINVAL))?;
+		self.writeback(addr, pages);
 		let mut transaction = MemSpaceTransaction::new(self);
 		while addr.0 < end {
 			let mapping = transaction
 				.state
 				.get_mut_mapping_for_addr(addr)
 				.ok_or_else(|| errno!(ENOMEM))?;
-			check_write_perm(mapping.file.as_ref(), prot)?;
 			let mapping_addr = mapping.addr;
 			let mapping_pages = mapping.size.get();
 			let mapping_end = mapping_addr.0 + mapping_pages * PAGE_SIZE;
@@ -683,20 +893,27 @@ impl MemSpace {
 			let inner_off = (addr.0 - mapping_addr.0) / PAGE_SIZE;
 			let slice_pages = (min(end, mapping_end) - addr.0) / PAGE_SIZE;
 			if inner_off == 0 && slice_pages == mapping_pages {
-				// The mapping is entirely contained within the range, just change its protection
-				mapping.prot = prot;
+				// The mapping is entirely contained within the range, just update it
+				f(mapping)?;
+				if unmap {
+					// Keep track of dirty pages before losing the entries
+					mapping.sync(&self.vmem, false)?;
+					self.vmem.unmap_range(mapping_addr, mapping_pages);
+					transaction.tlb.add(mapping_addr, mapping_pages);
+				}
 			} else {
-				// Cut off the head [mapping_addr, addr) which keeps its old protection
+				// Removing the mapping unmaps it entirely
+				// Cut off the head [mapping_addr, addr) which is left unchanged
 				let (head, _, tail) = mapping.split(inner_off, 0)?;
 				transaction.remove_mapping(mapping_addr)?;
 				if let Some(m) = head {
 					transaction.insert_mapping(m)?;
 				}
-				// Split the tail into the protected slice and the unchanged remainder
+				// Split the tail into the updated slice and the unchanged remainder
 				if let Some(tail) = tail {
 					let (mid, _, rest) = tail.split(slice_pages, 0)?;
 					if let Some(mut m) = mid {
-						m.prot = prot;
+						f(&mut m)?;
 						transaction.insert_mapping(m)?;
 					}
 					if let Some(m) = rest {
@@ -707,10 +924,26 @@ impl MemSpace {
 			addr.0 = min(end, mapping_end);
 		}
 		transaction.commit();
-		shootdown_range(start, pages, self.bound_cpus());
 		Ok(())
 	}
 
+	/// Sets protection for the given range of memory.
+	///
+	/// Arguments:
+	/// - `addr` is the address to the beginning of the range to be set
+	/// - `pages` is the number of pages in the range
+	/// - `prot` is a set of mapping flags
+	///
+	/// If a mapping to be modified is associated with a file, and the file doesn't have the
+	/// matching permissions, the function returns an error.
+	pub fn set_prot(&self, addr: VirtAddr, pages: usize, prot: u8) -> EResult<()> {
+		self.update_range(addr, pages, true, |mapping| {
+			check_write_perm(mapping.file.as_ref(), prot)?;
+			mapping.prot = prot;
+			Ok(())
+		})
+	}
+
 	/// Performs the `brk` system call.
 	///
 	/// On failure, the function does nothing and returns the current brk address.
@@ -759,6 +992,34 @@ impl MemSpace {
 		addr
 	}
 
+	/// Writes back the dirty pages of shared file mappings in the given range, before the range is
+	/// modified.
+	///
+	/// Arguments:
+	/// - `addr` is the address to the beginning of the range
+	/// - `pages` is the number of pages in the range
+	///
+	/// Since this is done with the state locked for reading, the mappings removed by the
+	/// modification are left clean, so that no I/O is performed while the state is locked for
+	/// writing. Concurrent modifications of disjoint ranges thus only contend for the time it
+	/// takes to update the state.
+	///
+	/// Errors are ignored, since pages that are still dirty are written back on removal anyway.
+	fn writeback(&self, addr: VirtAddr, pages: usize) {
+		let state = self.state.read();
+		let end = addr + pages.saturating_mul(PAGE_SIZE);
+		// Start with the mapping containing the address, if any, then iterate on the next ones
+		let first = state.get_mapping_for_addr(addr);
+		let next = state
+			.mappings
+			.range(addr..end)
+			.map(|(_, m)| m)
+			.filter(|m| m.addr != addr);
+		for mapping in first.into_iter().chain(next) {
+			let _ = mapping.sync(&self.vmem, true);
+		}
+	}
+
 	/// Synchronizes memory to the backing storage on the given range.
 	///
 	/// Arguments:
@@ -789,23 +1050,48 @@ impl MemSpace {
 	/// - `code` is the error code given along with the error.
 	///
 	/// If the process should continue, the function returns `true`, else `false`.
+	///
+	/// The state of the memory space is locked for reading only, and never while waiting for I/O:
+	/// if the page has to be read from a file, the lock is released during the read, after which
+	/// the mapping is looked up again and checked to still map the same page of the same file.
+	/// Concurrent faults thus only contend on the lock of the mapping they access.
 	pub fn handle_page_fault(&self, addr: VirtAddr, code: u32) -> EResult<bool> {
-		let state = self.state.read();
-		let Some(mapping) = state.get_mapping_for_addr(addr) else {
-			return Ok(false);
-		};
-		// Check permissions
 		let write = code & PAGE_FAULT_WRITE != 0;
-		if unlikely(write && mapping.prot & PROT_WRITE == 0 && x86::is_write_protected()) {
-			return Ok(false);
-		}
-		if unlikely(code & PAGE_FAULT_INSTRUCTION != 0 && mapping.prot & PROT_EXEC == 0) {
-			return Ok(false);
+		// The page read from the file on the previous iteration, if any
+		let mut fetched: Option<(Arc<File>, u64, RcPage)> = None;
+		loop {
+			let (file, off, end) = {
+				let state = self.state.read();
+				let Some(mapping) = state.get_mapping_for_addr(addr) else {
+					return Ok(false);
+				};
+				// Check permissions
+				if unlikely(write && mapping.prot & PROT_WRITE == 0 && x86::is_write_protected()) {
+					return Ok(false);
+				}
+				if unlikely(code & PAGE_FAULT_INSTRUCTION != 0 && mapping.prot & PROT_EXEC == 0) {
+					return Ok(false);
+				}
+				// Map the accessed page
+				let page_offset = (addr.0 - mapping.addr.0) / PAGE_SIZE;
+				match (mapping.file_page(page_offset), fetched.take()) {
+					(None, _) => {
+						mapping.map(self, page_offset, write)?;
+						return Ok(true);
+					}
+					// The mapping did not change while reading the page
+					(Some((file, off, _)), Some((f, o, page)))
+						if ptr::eq(Arc::as_ptr(&file), Arc::as_ptr(&f)) && off == o =>
+					{
+						mapping.map_page(self, page_offset, write, Some(page))?;
+						return Ok(true);
+					}
+					(Some(loc), _) => loc,
+				}
+			};
+			let page = mapping::read_file_page(&file, off, end)?;
+			fetched = Some((file, off, page));
 		}
-		// Map the accessed page
-		let page_offset = (addr.0 - mapping.addr.0) / PAGE_SIZE;
-		mapping.map(self, page_offset, write)?;
-		Ok(true)
 	}
 }
 
@@ -20,7 +20,7 @@
 
 use super::{MemSpace, MemSpaceState, gap::MemGap, mapping::MemMapping};
 use crate::{
-	memory::{VirtAddr, vmem::shootdown_range},
+	memory::{VirtAddr, vmem::TlbBatch},
 	sync::rwlock::{INT_READ, INT_WRITE, WriteGuard},
 };
 use core::{alloc::AllocError, hash::Hash, mem};
@@ -107,6 +107,9 @@ pub(super) struct MemSpaceTransaction<'m> {
 
 	/// The new value for the `vmem_usage` field.
 	vmem_usage: usize,
+	/// TLB invalidations to perform on the CPUs binding the memory space, before the memory of
+	/// the removed mappings may be freed
+	pub tlb: TlbBatch,
 }
 
 impl<'m> MemSpaceTransaction<'m> {
@@ -125,6 +128,7 @@ impl<'m> MemSpaceTransaction<'m> {
 			mappings_discard: Default::default(),
 
 			vmem_usage,
+			tlb: TlbBatch::default(),
 		}
 	}
 
@@ -180,11 +184,7 @@ impl<'m> MemSpaceTransaction<'m> {
 			self.mem_space
 				.vmem
 				.unmap_range(mapping.addr, mapping.size.get());
-			shootdown_range(
-				mapping.addr,
-				mapping.size.get(),
-				self.mem_space.bound_cpus(),
-			);
+			self.tlb.add(mapping.addr, mapping.size.get());
 			// Update usage
 			self.vmem_usage -= mapping.size.get();
 		}
@@ -193,6 +193,8 @@ impl<'m> MemSpaceTransaction<'m> {
 
 	/// Commits the transaction.
 	pub fn commit(mut self) {
+		// Invalidate the TLB before discarded mappings release their pages
+		self.tlb.shootdown(self.mem_space.bound_cpus());
 		// Cancel rollback
 		self.gaps_complement.clear();
 		self.mappings_complement.clear();
@@ -211,6 +213,7 @@ impl<'m> MemSpaceTransaction<'m> {
 
 impl Drop for MemSpaceTransaction<'_> {
 	fn drop(&mut self) {
+		self.tlb.shootdown(self.mem_space.bound_cpus());
 		// If the transaction was not committed, rollback
 		let gaps_complement = mem::take(&mut self.gaps_complement);
 		rollback(&mut self.state.gaps, gaps_complement);
@@ -44,17 +44,21 @@ use crate::{
 	panic,
 	process::{
 		pid::{IDLE_PID, INIT_PID, PidHandle},
-		rusage::Rusage,
+		rusage::RusageCounters,
 		scheduler::{
-			cpu, critical, dequeue, enqueue, preempt, switch,
+			cpu,
+			cpu::{counter, counter::Counter},
+			critical, dequeue, enqueue, preempt, switch,
 			switch::{KThreadEntry, idle_task, save_segments},
 		},
 		signal::{AltStack, SIGNALS_COUNT, SigSet, SignalAction},
 	},
-	register_get,
+	profile, register_get,
 	sync::{atomic::AtomicU64, rwlock::IntRwLock, spin::Spin},
-	syscall::{FromSyscallArg, wait::WEXITED},
+	syscall::{FromSyscallArg, futex::FutexWaiter, wait::WEXITED},
 	time::timer::TimerManager,
+	trace,
+	trace::Kind,
 };
 use core::{
 	array,
@@ -65,7 +69,7 @@ use core::{
 	hint,
 	hint::unlikely,
 	mem,
-	ops::Deref,
+	ops::{Deref, Range},
 	ptr::NonNull,
 	sync::atomic::{
 		AtomicBool, AtomicI8, AtomicPtr, AtomicU8, AtomicU16, AtomicU32,
@@ -276,6 +280,12 @@ impl ProcessSignal {
 		self.sigpending
 	}
 
+	/// Discards all pending signals.
+	#[inline]
+	pub fn clear_pending(&mut self) {
+		self.sigpending = SigSet::default();
+	}
+
 	/// Atomically dequeues the lowest-numbered pending signal that's in `set` and returns
 	/// it, or `None` if none is pending.
 	pub fn dequeue_from(&mut self, set: SigSet) -> Option<Signal> {
@@ -331,12 +341,22 @@ pub struct Process {
 
 	/// The node in the scheduler's run queue.
 	sched_node: ListNode,
+	/// Tells whether the process is selected to run on a core, or running on it, and its context
+	/// has not been saved yet. Such a process must not be migrated
+	on_cpu: AtomicBool,
 	/// The process's affinity mask
 	pub affinity: cpu::Bitmap,
 	/// Process's niceness (`-20..=19`). Defines its scheduling priority (lower = higher priority)
 	pub nice: AtomicI8,
 	/// A queue the process is inserted in when waiting on a resource
 	pub(crate) wait_queue: ListNode,
+	/// The futex word the process waits on, when inserted in a futex bucket with `wait_queue`
+	pub(crate) futex: FutexWaiter,
+	/// The node in the waiters list of an I/O completion.
+	///
+	/// This is separate from `wait_queue` because waiting for I/O may happen while the process
+	/// is already queued elsewhere, for example when reading a futex word faults
+	pub(crate) io_wait: ListNode,
 
 	/// A pointer to the kernelspace stack.
 	kernel_stack: KernelStack,
@@ -379,7 +399,7 @@ pub struct Process {
 	pub parent_event: AtomicU8,
 
 	/// The process's resources usage.
-	pub rusage: Spin<Rusage>,
+	pub rusage: RusageCounters,
 }
 
 /// The list of all processes on the system.
@@ -425,17 +445,23 @@ pub(crate) fn register_callbacks() -> AllocResult<()> {
 	};
 	let page_fault_callback = |_id: u32, code: u32, frame: &mut IntFrame, ring: u8| {
 		let accessed_addr = VirtAddr(register_get!("cr2"));
+		trace::event(Kind::PageFault, accessed_addr.0 as _, code as _);
 		let pc = frame.get_program_counter();
-		let Some(mem_space) = per_cpu().mem_space.get() else {
+		// In lazy TLB mode, the bound memory space is not the current process's
+		let cpu = per_cpu();
+		let Some(mem_space) = cpu.mem_space.get().filter(|_| !cpu.tlb_lazy.load(Relaxed)) else {
 			panic::with_frame(frame);
 		};
 		// Check access
 		let sig = mem_space.handle_page_fault(accessed_addr, code);
 		match sig {
-			Ok(true) => {}
+			Ok(true) => {
+				counter::inc(Counter::PageFaults);
+				RusageCounters::add(&Process::current().rusage.minflt, 1);
+			}
 			Ok(false) => {
 				if ring < 3 {
-					// Check if the fault was caused by a user <-> kernel copy/zero
+					// Check if the fault was caused by a user <-> kernel copy/zero/cmpxchg
 					if (user::raw_copy as usize..user::raw_fault as usize).contains(&pc) {
 						// Jump to `raw_fault`
 						frame.set_program_counter(user::raw_fault as usize);
@@ -458,8 +484,12 @@ pub(crate) fn register_callbacks() -> AllocResult<()> {
 		int::register_callback(0x11, callback)?;
 		int::register_callback(0x13, callback)?;
 		int::register_callback(0x0e, page_fault_callback)?;
-		int::register_callback(0x20, |_, _, _, _| preempt())?;
+		int::register_callback(0x20, |_, _, frame, ring| {
+			profile::tick(frame, ring);
+			scheduler::tick();
+		})?;
 	}
+	profile::init_cpu()?;
 	// Re-enable timer since it has been disabled by delay functions
 	timer::apic::periodic(100_000_000);
 	Ok(())
@@ -555,9 +585,12 @@ impl Process {
 			links: Default::default(),
 
 			sched_node: ListNode::default(),
+			on_cpu: AtomicBool::new(false),
 			affinity: cpu::Bitmap::new(true)?,
 			nice: AtomicI8::new(nice),
 			wait_queue: ListNode::default(),
+			futex: FutexWaiter::default(),
+			io_wait: ListNode::default(),
 
 			kernel_stack,
 			kernel_sp: AtomicPtr::new(kernel_sp),
@@ -615,9 +648,12 @@ impl Process {
 			links: Spin::new(ProcessLinks::default()),
 
 			sched_node: ListNode::default(),
+			on_cpu: AtomicBool::new(false),
 			affinity: cpu::Bitmap::new(true)?,
 			nice: AtomicI8::new(0),
 			wait_queue: ListNode::default(),
+			futex: FutexWaiter::default(),
+			io_wait: ListNode::default(),
 
 			kernel_stack: KernelStack::new()?,
 			kernel_sp: AtomicPtr::default(),
@@ -810,7 +846,13 @@ impl Process {
 	/// Tells whether the vfork operation has completed.
 	#[inline]
 	pub fn is_vfork_done(&self) -> bool {
-		self.vfork_done.load(Relaxed)
+		self.vfork_done.load(Acquire)
+	}
+
+	/// Returns the range of addresses covered by the process's kernel stack.
+	#[inline]
+	pub fn kernel_stack_range(&self) -> Range<VirtAddr> {
+		VirtAddr::from(self.kernel_stack.0)..VirtAddr::from(self.kernel_stack.top())
 	}
 
 	/// Reads the last known userspace registers state.
@@ -900,9 +942,12 @@ impl Process {
 			}),
 
 			sched_node: ListNode::default(),
+			on_cpu: AtomicBool::new(false),
 			affinity: parent.affinity.try_clone()?,
 			nice: AtomicI8::new(0),
 			wait_queue: ListNode::default(),
+			futex: FutexWaiter::default(),
+			io_wait: ListNode::default(),
 
 			kernel_stack,
 			kernel_sp: AtomicPtr::new(kernel_sp),
@@ -996,7 +1041,7 @@ impl Process {
 	pub fn kill(this: &Arc<Self>, sig: Signal) {
 		let mut s = this.signal.lock();
 		// Statistics
-		this.rusage.lock().ru_nsignals += 1;
+		RusageCounters::add(&this.rusage.nsignals, 1);
 		#[cfg(feature = "strace")]
 		println!(
 			"[strace {pid}] received signal `{sig}`",
@@ -19,8 +19,7 @@
 //! Monitoring of the resource usage of processes.
 
 use crate::time::unit::Timeval;
-
-// TODO Place calls in kernel's code to update usage
+use core::sync::atomic::{AtomicU64, Ordering::Relaxed};
 
 /// Usage of each resource by a process.
 #[derive(Clone, Debug, Default)]
@@ -58,3 +57,44 @@ pub struct Rusage {
 	/// Involuntary context switches.
 	pub ru_nivcsw: i64,
 }
+
+/// Resource usage counters of a process.
+///
+/// Counters are updated without locking, mostly by the process itself, so that accounting does
+/// not add contention on hot paths. [`Self::get`] assembles them into a [`Rusage`].
+#[derive(Debug, Default)]
+pub struct RusageCounters {
+	/// Page reclaims (soft page faults)
+	pub minflt: AtomicU64,
+	/// Block input operations, in units of 512 bytes
+	pub inblock: AtomicU64,
+	/// Block output operations, in units of 512 bytes
+	pub oublock: AtomicU64,
+	/// Signals received
+	pub nsignals: AtomicU64,
+	/// Voluntary context switches
+	pub nvcsw: AtomicU64,
+	/// Involuntary context switches
+	pub nivcsw: AtomicU64,
+}
+
+impl RusageCounters {
+	/// Adds `n` to `counter`.
+	#[inline]
+	pub fn add(counter: &AtomicU64, n: u64) {
+		counter.fetch_add(n, Relaxed);
+	}
+
+	/// Returns the current resource usage.
+	pub fn get(&self) -> Rusage {
+		Rusage {
+			ru_minflt: self.minflt.load(Relaxed) as _,
+			ru_inblock: self.inblock.load(Relaxed) as _,
+			ru_oublock: self.oublock.load(Relaxed) as _,
+			ru_nsignals: self.nsignals.load(Relaxed) as _,
+			ru_nvcsw: self.nvcsw.load(Relaxed) as _,
+			ru_nivcsw: self.nivcsw.load(Relaxed) as _,
+			..Default::default()
+		}
+	}
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! Per-CPU statistics counters.
+//!
+//! Each CPU core updates its own copy of the counters, stored in [`PerCpu`], without taking any
+//! lock. Copies are summed when a value is read, which makes reading more expensive than
+//! updating.
+//!
+//! A core's copy may go negative, for example when memory is allocated on a core and freed on
+//! another. Only the sum is meaningful.
+
+use super::{PerCpu, cpus, try_per_cpu};
+use core::sync::atomic::{AtomicIsize, Ordering::Relaxed};
+
+/// A statistics counter.
+#[repr(usize)]
+#[derive(Clone, Copy, Debug, Eq, PartialEq)]
+pub enum Counter {
+	/// The number of free physical pages
+	FreePages,
+	/// The number of handled page faults
+	PageFaults,
+	/// The number of context switches
+	ContextSwitches,
+	/// The number of pages read from block devices
+	PagesIn,
+	/// The number of pages written to block devices
+	PagesOut,
+}
+
+/// The number of variants of [`Counter`].
+const COUNTERS_COUNT: usize = 5;
+
+/// A copy of each counter.
+#[derive(Default)]
+pub struct Counters([AtomicIsize; COUNTERS_COUNT]);
+
+/// Counters updated before per-CPU structures are available.
+static EARLY: Counters = Counters([const { AtomicIsize::new(0) }; COUNTERS_COUNT]);
+
+/// Adds `n` to `counter`.
+#[inline]
+pub fn add(counter: Counter, n: isize) {
+	let counters = try_per_cpu()
+		.map(|cpu: &PerCpu| &cpu.counters)
+		.unwrap_or(&EARLY);
+	counters.0[counter as usize].fetch_add(n, Relaxed);
+}
+
+/// Increments `counter`.
+#[inline]
+pub fn inc(counter: Counter) {
+	add(counter, 1);
+}
+
+/// Returns the value of `counter`, summed over all CPU cores.
+///
+/// Updates happening concurrently may or may not be accounted for.
+pub fn sum(counter: Counter) -> isize {
+	let i = counter as usize;
+	cpus()
+		.iter()
+		.map(|cpu| cpu.counters.0[i].load(Relaxed))
+		.fold(EARLY.0[i].load(Relaxed), isize::wrapping_add)
+}
+
+#[cfg(test)]
+mod test {
+	use super::*;
+
+	#[test_case]
+	fn counter_sum() {
+		let before = sum(Counter::PagesIn);
+		add(Counter::PagesIn, 3);
+		inc(Counter::PagesIn);
+		assert_eq!(sum(Counter::PagesIn), before + 4);
+		add(Counter::PagesIn, -4);
+		assert_eq!(sum(Counter::PagesIn), before);
+	}
+}
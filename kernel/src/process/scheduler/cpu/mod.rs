@@ -18,23 +18,29 @@
 
 //! Per-CPU structure, bitmaps and CPU topology
 
+pub mod counter;
 pub mod topology;
 
 use super::{RunQueue, Scheduler, defer::DeferredCallQueue};
 use crate::{
 	arch::x86::{gdt::Gdt, tss::Tss},
 	int::CallbackList,
+	memory::{buddy::CpuFrames, malloc::CpuCache},
 	process::{Process, mem_space::MemSpace},
-	sync::{atomic::AtomicU64, once::OnceInit, spin::IntSpin},
+	profile::CpuProfile,
+	sync::{atomic::AtomicU64, once::OnceInit, rcu, spin::IntSpin},
+	trace::CpuTrace,
 };
 use core::{
 	cell::UnsafeCell,
 	ops::Deref,
+	ptr,
 	sync::atomic::{
 		AtomicBool, AtomicU32, AtomicUsize,
 		Ordering::{Acquire, Release},
 	},
 };
+use counter::Counters;
 use topology::TopologyNode;
 use utils::{
 	TryClone,
@@ -55,6 +61,9 @@ pub struct PerCpu {
 	pub kernel_stack: AtomicUsize,
 	/// The stashed user stack
 	pub user_stack: AtomicUsize,
+	/// The address of the structure itself, read relative to `gs` to locate it without reading
+	/// the `gs` base register
+	this: AtomicUsize,
 
 	/// Processor ID
 	pub cpu_id: u8,
@@ -93,9 +102,27 @@ pub struct PerCpu {
 	///
 	/// The pointer stored by this field is returned by `Arc::into_raw`
 	pub mem_space: AtomicOptionalArc<MemSpace>,
+	/// Tells whether the CPU is in lazy TLB mode: `mem_space` is still bound, but the CPU does
+	/// not receive its TLB shootdowns anymore
+	pub tlb_lazy: AtomicBool,
 
 	/// Queue of deferred calls to be executed on this core
 	pub(super) deferred_calls: DeferredCallQueue,
+
+	/// Cache of free objects for the memory allocator
+	pub(crate) malloc_cache: CpuCache,
+	/// Cache of free frames for the buddy allocator
+	pub(crate) buddy_cache: CpuFrames,
+
+	/// The state of the RCU on this core
+	pub(crate) rcu: rcu::CpuState,
+
+	/// The core's tracing state
+	pub(crate) trace: CpuTrace,
+	/// The core's profiling state
+	pub(crate) profile: CpuProfile,
+	/// The core's copy of the statistics counters
+	pub(crate) counters: Counters,
 }
 
 impl PerCpu {
@@ -105,6 +132,7 @@ impl PerCpu {
 		Ok(Self {
 			kernel_stack: AtomicUsize::new(0),
 			user_stack: AtomicUsize::new(0),
+			this: AtomicUsize::new(0),
 
 			cpu_id,
 			apic_id,
@@ -123,8 +151,10 @@ impl PerCpu {
 			sched: Scheduler {
 				run_queue: IntSpin::new(RunQueue {
 					queue: list!(Process, sched_node),
-					len: 0,
 				}),
+				migrate_pending: AtomicBool::new(false),
+				nr_running: AtomicUsize::new(0),
+				load_avg: AtomicU32::new(0),
 				cur_proc: AtomicArc::from(idle_task.clone()),
 
 				idle_task: idle_task.clone(),
@@ -133,11 +163,27 @@ impl PerCpu {
 			preempt_counter: AtomicU32::new(1 << 31),
 
 			mem_space: AtomicOptionalArc::new(),
+			tlb_lazy: AtomicBool::new(false),
 
 			deferred_calls: DeferredCallQueue::new(),
+
+			malloc_cache: CpuCache::new(),
+			buddy_cache: CpuFrames::new(),
+
+			rcu: rcu::CpuState::new(),
+
+			trace: CpuTrace::default(),
+			profile: CpuProfile::default(),
+			counters: Counters::default(),
 		})
 	}
 
+	/// Returns the index of the CPU in [`CPU`], which is also its index in [`Bitmap`]s.
+	#[inline]
+	pub fn index(&self) -> usize {
+		unsafe { ptr::from_ref(self).offset_from(CPU.as_ptr()) as usize }
+	}
+
 	/// Returns a mutable reference to the TSS.
 	///
 	/// # Safety
@@ -150,6 +196,24 @@ impl PerCpu {
 	}
 }
 
+/// The self pointer read by [`try_per_cpu`] on a core on which [`store_per_cpu`] has not been
+/// called yet.
+#[cfg(target_arch = "x86_64")]
+static NO_PER_CPU: AtomicUsize = AtomicUsize::new(0);
+
+/// Points the `gs` base of the current CPU core to a placeholder, so that [`try_per_cpu`] returns
+/// `None` until [`store_per_cpu`] is called.
+///
+/// This function must be called on each core at boot, before allocating memory.
+pub(crate) fn init_per_cpu() {
+	#[cfg(target_arch = "x86_64")]
+	{
+		use crate::arch::x86;
+		let base = ptr::from_ref(&NO_PER_CPU).addr() - core::mem::offset_of!(PerCpu, this);
+		x86::wrmsr(x86::IA32_GS_BASE, base as _);
+	}
+}
+
 /// Sets, on the current CPU core, the register to make the associated [`PerCpu`] structure
 /// available.
 pub(crate) fn store_per_cpu() {
@@ -157,12 +221,32 @@ pub(crate) fn store_per_cpu() {
 	{
 		use crate::arch::{core_id, x86};
 		let local = &CPU[core_id() as usize];
+		let addr = ptr::from_ref(local).expose_provenance();
+		local.this.store(addr, Release);
 		// Set to `IA32_GS_BASE` instead of `IA32_KERNEL_GS_BASE` since it will get swapped
 		// when switching to userspace
-		x86::wrmsr(x86::IA32_GS_BASE, local as *const _ as u64);
+		x86::wrmsr(x86::IA32_GS_BASE, addr as _);
 	}
 }
 
+/// Reads the self pointer of the per-CPU structure of the current core, relative to `gs`.
+///
+/// This is much cheaper than reading the `gs` base register, which is serializing.
+#[cfg(target_arch = "x86_64")]
+#[inline(always)]
+fn read_this() -> usize {
+	let this: usize;
+	unsafe {
+		core::arch::asm!(
+			"mov {}, qword ptr gs:[{off}]",
+			out(reg) this,
+			off = const core::mem::offset_of!(PerCpu, this),
+			options(nostack, preserves_flags, readonly)
+		);
+	}
+	this
+}
+
 /// Returns the per-CPU structure for the current core.
 #[inline]
 pub fn per_cpu() -> &'static PerCpu {
@@ -172,16 +256,43 @@ pub fn per_cpu() -> &'static PerCpu {
 		&CPU[core_id() as usize]
 	}
 	#[cfg(target_arch = "x86_64")]
+	unsafe {
+		&*ptr::with_exposed_provenance(read_this())
+	}
+}
+
+/// Returns the per-CPU structure for the current core, or `None` if it is not yet available.
+///
+/// This is useful for code that may run early at boot, such as the memory allocator.
+#[inline]
+pub fn try_per_cpu() -> Option<&'static PerCpu> {
+	if !CPU_READY.load(Acquire) {
+		return None;
+	}
+	#[cfg(target_arch = "x86")]
+	{
+		use crate::arch::core_id;
+		CPU.get(core_id() as usize)
+	}
+	#[cfg(target_arch = "x86_64")]
 	{
-		use crate::{arch::x86, memory::VirtAddr};
-		let base = x86::rdmsr(x86::IA32_GS_BASE);
-		unsafe {
-			let ptr = VirtAddr(base as _).as_ptr::<PerCpu>();
-			&*ptr
+		// The pointer is null until `store_per_cpu` is called on the core
+		let this = read_this();
+		if this == 0 {
+			return None;
 		}
+		unsafe { Some(&*ptr::with_exposed_provenance(this)) }
 	}
 }
 
+/// Returns the list of per-CPU structures, or an empty list if it is not yet initialized.
+#[inline]
+pub fn cpus() -> &'static [PerCpu] {
+	if CPU_READY.load(Acquire) { &CPU } else { &[] }
+}
+
+/// Tells whether [`CPU`] is initialized.
+static CPU_READY: AtomicBool = AtomicBool::new(false);
 /// The list of core-local structures. There is one per CPU.
 pub static CPU: OnceInit<Vec<PerCpu>> = unsafe { OnceInit::new() };
 /// Bitmap of currently idle CPUs, atomically updated
@@ -198,6 +309,7 @@ pub(crate) fn init_cpu_list(mut cpu: Vec<PerCpu>) -> AllocResult<()> {
 	println!("{} CPU cores found", cpu.len());
 	unsafe {
 		OnceInit::init(&CPU, cpu);
+		CPU_READY.store(true, Release);
 	}
 	let idle_cpus = Bitmap::new(true)?;
 	unsafe {
@@ -254,6 +366,14 @@ impl Bitmap {
 		self.0[unit].fetch_and(!(1 << bit), Release);
 	}
 
+	/// Tells whether the bit for the given `cpu` is set
+	#[inline]
+	pub fn is_set(&self, cpu: usize) -> bool {
+		let unit = cpu / usize::BITS as usize;
+		let bit = cpu % usize::BITS as usize;
+		self.0[unit].load(Acquire) & (1 << bit) != 0
+	}
+
 	/// Iterates on bit values for each CPU
 	pub fn iter(&self) -> impl Iterator<Item = bool> {
 		self.0
@@ -266,11 +386,20 @@ impl Bitmap {
 	}
 
 	/// Copies the content of `other` into `self`.
+	///
+	/// Bits that are not present in `other` are cleared, and bits that do not correspond to a CPU
+	/// are ignored.
 	pub fn copy_from(&self, other: &[usize]) {
-		self.0
-			.iter()
-			.zip(other.iter())
-			.for_each(|(dst, src)| dst.store(*src, Release));
+		let last = self.0.len() - 1;
+		let bits = CPU.len() % usize::BITS as usize;
+		let last_mask = if bits == 0 { !0 } else { (1 << bits) - 1 };
+		self.0.iter().enumerate().for_each(|(i, dst)| {
+			let mut val = other.get(i).copied().unwrap_or(0);
+			if i == last {
+				val &= last_mask;
+			}
+			dst.store(val, Release);
+		});
 	}
 }
 
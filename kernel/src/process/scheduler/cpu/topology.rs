@@ -19,7 +19,10 @@
 //! CPU topology tree
 
 use crate::{
-	process::{Process, scheduler::cpu::PerCpu},
+	process::{
+		Process,
+		scheduler::{can_run_on, cpu::PerCpu},
+	},
 	sync::{once::OnceInit, spin::Spin},
 };
 use core::{cell::UnsafeCell, hint::likely, ptr};
@@ -106,13 +109,15 @@ pub static CPU_TOPOLOGY: TopologyNode = TopologyNode {
 fn find_core(node: &TopologyNode, proc: &Process) -> Option<&'static PerCpu> {
 	if let Some(cpu) = &node.cpu {
 		// This is a leaf, check if it is suitable
-		if cpu.sched.can_immediately_run(proc) {
+		if can_run_on(proc, cpu) && cpu.sched.can_immediately_run(proc) {
 			return Some(cpu);
 		}
 	} else {
 		// Lookup children
 		for node in node.children() {
-			find_core(node, proc);
+			if let Some(cpu) = find_core(node, proc) {
+				return Some(cpu);
+			}
 		}
 	}
 	None
@@ -120,7 +125,7 @@ fn find_core(node: &TopologyNode, proc: &Process) -> Option<&'static PerCpu> {
 
 /// Finds the closest core able to immediately run `proc`, starting from `start`
 pub fn find_closest_core(start: &'static PerCpu, proc: &Process) -> Option<&'static PerCpu> {
-	if likely(start.sched.can_immediately_run(proc)) {
+	if likely(can_run_on(proc, start) && start.sched.can_immediately_run(proc)) {
 		return Some(start);
 	}
 	let mut node = *start.topology_node;
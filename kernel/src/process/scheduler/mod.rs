@@ -21,6 +21,10 @@
 //!
 //! Scheduling can be disabled/enabled by entering a **critical section**, with
 //! [`preempt_disable`]/[`preempt_enable`], or with [`critical`].
+//!
+//! Each CPU core has its own run queue. Processes are spread across cores according to their
+//! load, which is a decaying average of the number of runnable processes, updated at each tick.
+//! When a core is about to become idle, it steals a process from the busiest core.
 
 pub mod cpu;
 pub mod defer;
@@ -33,21 +37,33 @@ use crate::{
 	},
 	process::{
 		Process, State,
-		scheduler::{cpu::per_cpu, switch::switch},
+		rusage::RusageCounters,
+		scheduler::{
+			cpu::{counter, counter::Counter, per_cpu},
+			switch::switch,
+		},
+	},
+	sync::{
+		rcu,
+		spin::{IntSpin, IntSpinGuard},
 	},
-	sync::spin::IntSpin,
 	time::{clock::Clock, sleep_for},
+	trace,
+	trace::Kind,
 };
 use core::{
 	cmp::Ordering,
 	hint::unlikely,
 	mem::swap,
 	ptr,
-	sync::atomic::Ordering::{Relaxed, Release},
+	sync::atomic::{
+		AtomicBool, AtomicU32, AtomicUsize,
+		Ordering::{Acquire, Relaxed, Release},
+	},
 };
 use cpu::{CPU, IDLE_CPUS, PerCpu};
 use utils::{
-	list_type,
+	list, list_type,
 	ptr::arc::{Arc, AtomicArc},
 };
 
@@ -58,12 +74,16 @@ const PREEMPT_FLAG: u32 = 1 << 31;
 /// The timeout, in milliseconds, after which processes are rebalanced
 const REBALANCE_TIMEOUT: u64 = 100;
 
+/// The number of fractional bits of a load value.
+const LOAD_SHIFT: u32 = 10;
+/// The shift applied to the previous load average at each tick. The previous average weighs
+/// `1 - 1/2^n` in the new one.
+const LOAD_DECAY: u32 = 3;
+
 /// Queue of processes to run
 struct RunQueue {
 	/// Queue of processes to run
 	queue: list_type!(Process, sched_node),
-	/// The number of processes in queue
-	len: usize,
 }
 
 /// A process scheduler.
@@ -72,6 +92,14 @@ struct RunQueue {
 pub struct Scheduler {
 	/// Run queue
 	run_queue: IntSpin<RunQueue>,
+	/// Tells whether processes in the run queue may not be allowed to run on this core anymore
+	migrate_pending: AtomicBool,
+	/// The number of processes in the run queue, including the running one
+	///
+	/// This is updated with the run queue locked, but can be read without locking.
+	nr_running: AtomicUsize,
+	/// Decaying average of `nr_running`, in fixed point with [`LOAD_SHIFT`] fractional bits
+	load_avg: AtomicU32,
 	/// The currently running process
 	cur_proc: AtomicArc<Process>,
 
@@ -100,24 +128,111 @@ impl Scheduler {
 		ord == Ordering::Less
 	}
 
-	/// Returns the number of processes in the run queue
+	/// Returns the number of processes in the run queue, without locking.
 	#[inline]
 	pub fn queue_len(&self) -> usize {
-		self.run_queue.lock().len
+		self.nr_running.load(Relaxed)
+	}
+
+	/// Returns the load of the scheduler, in fixed point with [`LOAD_SHIFT`] fractional bits.
+	///
+	/// The load is the maximum of the decaying average and the current number of processes, so
+	/// that bursts of enqueued processes are accounted for before the average catches up.
+	#[inline]
+	pub fn load(&self) -> u32 {
+		let cur = (self.queue_len() as u32) << LOAD_SHIFT;
+		self.load_avg.load(Relaxed).max(cur)
+	}
+
+	/// Updates the decaying load average. This function is called at each tick.
+	fn update_load(&self) {
+		let avg = self.load_avg.load(Relaxed);
+		let cur = (self.queue_len() as u32) << LOAD_SHIFT;
+		let avg = avg - (avg >> LOAD_DECAY) + (cur >> LOAD_DECAY);
+		self.load_avg.store(avg, Relaxed);
 	}
 
 	/// Returns the next process to run with its PID.
 	///
 	/// If no process is left to run, the function returns `None`.
 	fn get_next_process(&self) -> Option<Arc<Process>> {
-		let mut queue = self.run_queue.lock();
-		let proc = queue.queue.front()?;
-		queue.queue.rotate_left();
-		Some(proc)
+		// Affinity masks are indexed like `CPU`, not by APIC ID
+		let cpu = per_cpu().index();
+		let mut evicted = list!(Process, sched_node);
+		let next = {
+			let mut queue = self.run_queue.lock();
+			// Remove processes that are not allowed to run on this core anymore
+			if unlikely(self.migrate_pending.swap(false, Relaxed)) {
+				let cur = self.get_current_process();
+				let mut iter = queue.queue.iter();
+				while let Some(cursor) = iter.next() {
+					// The running process is removed at the next call, once it is switched out
+					if ptr::eq(cursor.value(), Arc::as_ptr(&cur)) {
+						continue;
+					}
+					if !cursor.value().affinity.is_set(cpu) {
+						let proc = cursor.remove();
+						proc.links.lock().cur_cpu = None;
+						self.nr_running.fetch_sub(1, Relaxed);
+						evicted.insert_back(proc);
+					}
+				}
+			}
+			let mut next = queue.queue.front();
+			queue.queue.rotate_left();
+			if let Some(proc) = &next {
+				if unlikely(!proc.affinity.is_set(cpu)) {
+					// This is the running process. Switch it out so that it can be migrated
+					self.migrate_pending.store(true, Relaxed);
+					let other = queue
+						.queue
+						.front()
+						.filter(|p| !ptr::eq(Arc::as_ptr(p), Arc::as_ptr(proc)));
+					queue.queue.rotate_left();
+					next = other;
+				}
+			}
+			// Prevent other cores from migrating the process until it has been switched out
+			if let Some(proc) = &next {
+				proc.on_cpu.store(true, Relaxed);
+			}
+			next
+		};
+		// Enqueue evicted processes on cores that are allowed to run them
+		while let Some(proc) = evicted.remove_front() {
+			// The process might have stopped running in the meantime
+			if proc.get_state() == State::Running {
+				enqueue(&proc);
+			}
+		}
+		next
 	}
 }
 
-// TODO take into account power-states and core affinity
+/// Tells whether `proc` is allowed to run on `cpu`, according to its affinity mask.
+#[inline]
+pub fn can_run_on(proc: &Process, cpu: &PerCpu) -> bool {
+	proc.affinity.is_set(cpu.index())
+}
+
+/// Migrates `proc` if it is queued on a core its affinity mask does not allow anymore.
+///
+/// This function must be called after modifying the affinity mask of `proc`.
+pub fn affinity_changed(proc: &Process) {
+	let Some(cpu) = proc.links.lock().cur_cpu else {
+		return;
+	};
+	if can_run_on(proc, cpu) {
+		return;
+	}
+	// The core removes the process at its next reschedule
+	cpu.sched.migrate_pending.store(true, Relaxed);
+	if ptr::eq(cpu, per_cpu()) {
+		preempt();
+	}
+}
+
+// TODO take into account power-states
 /// Enqueues `proc` onto a scheduler.
 ///
 /// This function attempts to select the scheduler that is the most suitable for the process, in an
@@ -133,13 +248,9 @@ pub(crate) fn enqueue(proc: &Arc<Process>) {
 		links.last_cpu
 	};
 	// Select the CPU to run the process
-	let cpu_cmp = |cpu0: &&PerCpu, cpu1: &&PerCpu| {
-		// TODO use other metrics than the amount of running processes
-		let cnt0 = cpu0.sched.queue_len();
-		let cnt1 = cpu1.sched.queue_len();
-		cnt0.cmp(&cnt1)
-	};
-	// Attempt to run on the last CPU that run the process, if any
+	let cpu_cmp = |cpu0: &&PerCpu, cpu1: &&PerCpu| cpu0.sched.load().cmp(&cpu1.sched.load());
+	// Attempt to run on the last CPU that run the process, if any, since its caches are likely to
+	// still hold the process's data
 	let cpu = last_cpu
 		.and_then(|cpu| {
 			// Explore the CPU topology to find the closest suitable core
@@ -150,22 +261,31 @@ pub(crate) fn enqueue(proc: &Arc<Process>) {
 			IDLE_CPUS
 				.iter()
 				.enumerate()
-				.find(|(_, idle)| *idle)
+				.find(|(id, idle)| *idle && proc.affinity.is_set(*id))
 				.map(|(id, _)| &CPU[id])
 		})
 		.or_else(|| {
-			// Select the scheduler with the least running processes among those able to run the
-			// process immediately
+			// Select the least loaded scheduler among those able to run the process immediately
 			CPU.iter()
-				.filter(|cpu| cpu.sched.can_immediately_run(proc))
+				.filter(|cpu| can_run_on(proc, cpu) && cpu.sched.can_immediately_run(proc))
 				.min_by(cpu_cmp)
 		})
 		.or_else(|| {
-			// Select the scheduler with the least running processes
-			CPU.iter().min_by(cpu_cmp)
+			// Stay on the last CPU if it is not busier than the others
+			let min = CPU
+				.iter()
+				.filter(|cpu| can_run_on(proc, cpu))
+				.min_by(cpu_cmp)?;
+			match last_cpu {
+				Some(last) if can_run_on(proc, last) && last.sched.load() <= min.sched.load() => {
+					Some(last)
+				}
+				_ => Some(min),
+			}
 		})
-		// There is at least one CPU on the system
-		.unwrap();
+		// The affinity mask allows at least one CPU. If it has been changed concurrently, fall
+		// back to the current CPU, which migrates the process later if necessary
+		.unwrap_or_else(per_cpu);
 	// FIXME: deadlock
 	/*#[cfg(feature = "strace")]
 	println!(
@@ -176,7 +296,7 @@ pub(crate) fn enqueue(proc: &Arc<Process>) {
 	// Enqueue
 	let mut run_queue = cpu.sched.run_queue.lock();
 	run_queue.queue.insert_back(proc.clone());
-	run_queue.len += 1;
+	cpu.sched.nr_running.fetch_add(1, Relaxed);
 	let mut links = proc.links.lock();
 	links.cur_cpu = Some(cpu);
 	links.last_cpu = Some(cpu);
@@ -196,74 +316,74 @@ pub(crate) fn dequeue(proc: &Arc<Process>) {
 	unsafe {
 		run_queue.queue.remove(proc);
 	}
-	run_queue.len -= 1;
+	cpu.sched.nr_running.fetch_sub(1, Relaxed);
 	let mut links = proc.links.lock();
 	let prev = links.cur_cpu.take();
 	links.last_cpu = prev;
 }
 
-/// Attempts to return the CPU cores with the least and most processes queued, without locking
+/// Attempts to return the CPU cores with the least and most load, without locking
 fn min_max() -> (&'static PerCpu, &'static PerCpu) {
 	let mut iter = CPU.iter();
 	let mut min = iter.next().unwrap(); // The system has at least one core
 	let mut max = min;
-	let mut min_cnt = min.sched.queue_len();
-	let mut max_cnt = min_cnt;
+	let mut min_load = min.sched.load();
+	let mut max_load = min_load;
 	for cpu in iter {
-		let proc_count = cpu.sched.queue_len();
-		if proc_count < min_cnt {
+		let load = cpu.sched.load();
+		if load < min_load {
 			min = cpu;
-			min_cnt = proc_count;
-		} else if proc_count > max_cnt {
+			min_load = load;
+		} else if load > max_load {
 			max = cpu;
-			max_cnt = proc_count;
+			max_load = load;
 		}
 	}
 	(min, max)
 }
 
-/// Rebalances processes across cores
-fn rebalance() {
-	/*
-	 * This function works by picking the CPUs with the least and most running processes, and
-	 * balancing processes across them
-	 *
-	 * Searching for the least and most loaded CPUs is done without locking. So the result is
-	 * not exact, but it does not matter since this function is called in a loop.
-	 *
-	 * The system tends more and more towards equilibrium at each call
-	 */
-	let (mut dst, mut src) = min_max();
-	if ptr::eq(dst, src) {
-		return;
-	}
-	// Lock both cores' queues
-	let mut dst_queue = dst.sched.run_queue.lock();
-	let mut src_queue = src.sched.run_queue.lock();
-	// Process counts might have changed before we locked
-	if dst_queue.len > src_queue.len {
-		swap(&mut dst, &mut src);
-		swap(&mut dst_queue, &mut src_queue);
-	}
-	// No need to do anything if no core has more than one process
-	if src_queue.len <= 1 {
-		return;
+/// Locks the run queues of the two distinct cores `a` and `b`.
+///
+/// To avoid deadlocks, queues are always locked in the same order.
+fn lock_pair<'c>(
+	a: &'c PerCpu,
+	b: &'c PerCpu,
+) -> (IntSpinGuard<'c, RunQueue>, IntSpinGuard<'c, RunQueue>) {
+	debug_assert!(!ptr::eq(a, b));
+	if ptr::from_ref(a) < ptr::from_ref(b) {
+		let a = a.sched.run_queue.lock();
+		(a, b.sched.run_queue.lock())
+	} else {
+		let b = b.sched.run_queue.lock();
+		(a.sched.run_queue.lock(), b)
 	}
-	// Compute the number of processes to move
-	let diff = src_queue.len - dst_queue.len;
+}
+
+/// Moves up to `count` processes from the queue of `src` to the queue of `dst`.
+///
+/// The process currently running on `src`, processes whose context has not been saved yet, and
+/// processes whose affinity does not allow `dst` are never moved.
+///
+/// The function returns the number of processes moved.
+fn migrate(
+	src: &'static PerCpu,
+	src_queue: &mut RunQueue,
+	dst: &'static PerCpu,
+	dst_queue: &mut RunQueue,
+	count: usize,
+) -> usize {
+	let cur = src.sched.get_current_process();
 	let mut iter = src_queue.queue.iter();
 	let mut migrated_count = 0;
-	// We must have more than one process to move, otherwise a process might get needlessly moved
-	// back and forth
-	for _ in 1..diff {
+	while migrated_count < count {
 		let Some(cursor) = iter.next() else {
 			break;
 		};
-		// Skip currently running process
-		if ptr::eq(
-			cursor.value(),
-			Arc::as_ptr(&src.sched.get_current_process()),
-		) {
+		// Skip currently running process, and processes that are being switched in or out
+		if ptr::eq(cursor.value(), Arc::as_ptr(&cur)) || cursor.value().on_cpu.load(Acquire) {
+			continue;
+		}
+		if !can_run_on(cursor.value(), dst) {
 			continue;
 		}
 		// Remove the process from its old queue
@@ -285,8 +405,65 @@ fn rebalance() {
 		dst_queue.queue.insert_back(proc);
 		migrated_count += 1;
 	}
-	dst_queue.len += migrated_count;
-	src_queue.len -= migrated_count;
+	src.sched.nr_running.fetch_sub(migrated_count, Relaxed);
+	dst.sched.nr_running.fetch_add(migrated_count, Relaxed);
+	migrated_count
+}
+
+/// Rebalances processes across cores
+fn rebalance() {
+	/*
+	 * This function works by picking the CPUs with the least and most load, and balancing
+	 * processes across them
+	 *
+	 * Searching for the least and most loaded CPUs is done without locking. So the result is
+	 * not exact, but it does not matter since this function is called in a loop.
+	 *
+	 * The system tends more and more towards equilibrium at each call
+	 */
+	let (mut dst, mut src) = min_max();
+	if ptr::eq(dst, src) {
+		return;
+	}
+	// Lock both cores' queues
+	let (mut dst_queue, mut src_queue) = lock_pair(dst, src);
+	// Process counts might have changed before we locked
+	if dst.sched.queue_len() > src.sched.queue_len() {
+		swap(&mut dst, &mut src);
+		swap(&mut dst_queue, &mut src_queue);
+	}
+	let src_len = src.sched.queue_len();
+	let dst_len = dst.sched.queue_len();
+	// No need to do anything if no core has more than one process
+	if src_len <= 1 {
+		return;
+	}
+	// We must have more than one process to move, otherwise a process might get needlessly moved
+	// back and forth
+	let count = (src_len - dst_len).saturating_sub(1);
+	migrate(src, &mut src_queue, dst, &mut dst_queue, count);
+}
+
+/// Steals a process from the busiest core and enqueues it on the current core.
+///
+/// This function is called when the current core is about to become idle.
+///
+/// The function returns `true` if a process has been stolen.
+fn steal() -> bool {
+	let dst = per_cpu();
+	let Some(src) = CPU
+		.iter()
+		.filter(|cpu| !ptr::eq(*cpu, dst) && cpu.sched.queue_len() > 1)
+		.max_by_key(|cpu| cpu.sched.load())
+	else {
+		return false;
+	};
+	let (mut src_queue, mut dst_queue) = lock_pair(src, dst);
+	// The queue might have changed before we locked
+	if src.sched.queue_len() <= 1 {
+		return false;
+	}
+	migrate(src, &mut src_queue, dst, &mut dst_queue, 1) > 0
 }
 
 /// The entry point of the kernel task rebalancing processes across CPU cores
@@ -315,12 +492,16 @@ pub fn schedule() {
 	debug_assert_eq!(old_preempt_counter & !PREEMPT_FLAG, 0);
 	// Make deferred calls
 	defer::consume();
+	// A context switch is a quiescent state
+	rcu::quiescent_state();
 	let sched = &per_cpu().sched;
 	let (prev, next) = {
 		let prev = sched.cur_proc.get();
-		// Find the next process to run
+		// Find the next process to run. If none, attempt to steal one from another core before
+		// becoming idle
 		let next = sched
 			.get_next_process()
+			.or_else(|| steal().then(|| sched.get_next_process()).flatten())
 			.unwrap_or_else(|| sched.idle_task.clone());
 		// If the process to run is the current, do nothing
 		if ptr::eq(next.as_ref(), prev.as_ref()) {
@@ -332,6 +513,15 @@ pub fn schedule() {
 		} else if next.is_idle_task() {
 			IDLE_CPUS.set_bit(core_id() as _);
 		}
+		trace::event(Kind::SchedSwitch, prev.get_pid() as _, next.get_pid() as _);
+		counter::inc(Counter::ContextSwitches);
+		// A process switched out while still runnable has been preempted
+		let rusage = &prev.rusage;
+		if prev.get_state() == State::Running {
+			RusageCounters::add(&rusage.nivcsw, 1);
+		} else {
+			RusageCounters::add(&rusage.nvcsw, 1);
+		}
 		// Swap current running process. We use pointers to avoid cloning the Arc
 		let next_ptr = Arc::as_ptr(&next);
 		let prev = sched.swap_current_process(next);
@@ -342,6 +532,18 @@ pub fn schedule() {
 	}
 }
 
+/// Handles a tick of the scheduler's timer on the current core.
+pub(crate) fn tick() {
+	let cpu = per_cpu();
+	cpu.sched.update_load();
+	// If the tick did not interrupt a critical section, no RCU read-side critical section is
+	// running on the core
+	if cpu.preempt_counter.load(Relaxed) & !PREEMPT_FLAG == 0 {
+		rcu::quiescent_state();
+	}
+	preempt();
+}
+
 /// Preempt at the next yield point outside a critical section
 pub fn preempt() {
 	per_cpu().preempt_counter.fetch_and(!PREEMPT_FLAG, Relaxed);
@@ -22,7 +22,7 @@ use crate::{
 	arch::x86::{fxrstor, fxsave, gdt, idt::IntFrame},
 	process::{Process, mem_space::MemSpace, scheduler::cpu::per_cpu},
 };
-use core::{arch::global_asm, mem::offset_of, ptr::NonNull};
+use core::{arch::global_asm, mem::offset_of, ptr::NonNull, sync::atomic::Ordering::Release};
 
 /// Saves the current FS and GS values to `proc`.
 pub fn save_segments(proc: &Process) {
@@ -236,6 +236,8 @@ pub extern "C" fn finish(prev: &Process, next: &Process) {
 	fxrstor(&next.fpu.lock());
 	// Save segments
 	save_segments(prev);
+	// The context of `prev` is saved, other cores may now migrate it
+	prev.on_cpu.store(false, Release);
 	// State is saved for `prev`, we may unlock its state so that it can be resumed if it is
 	// currently sleeping
 	prev.unlock_state();
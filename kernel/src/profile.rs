@@ -0,0 +1,276 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! Sampling CPU profiler.
+//!
+//! Each sample records the process running on the CPU core and, if the core was running kernel
+//! code, the interrupted program counter followed by the kernel backtrace.
+//!
+//! Samples are taken from the overflow interrupt of a performance monitoring counter counting
+//! core cycles if available, or from the scheduler's timer tick otherwise. They are stored in
+//! per-CPU lock-free rings, which are aggregated when reading `/proc/profile`.
+//!
+//! `/proc/profile` returns folded stacks: one line per distinct stack, with the PID followed by
+//! the frames from the outermost to the innermost, separated by `;`, then the number of samples.
+//! Writing `1` to this file clears the collected samples and starts profiling, and `0` stops it.
+
+use crate::{
+	arch::x86::{idt::IntFrame, pmu},
+	elf, int,
+	memory::{PROCESS_END, VirtAddr, ring_buffer::SpscRing},
+	process::{
+		Process,
+		pid::Pid,
+		scheduler::cpu::{cpus, per_cpu},
+	},
+	sync::{
+		mutex::{Mutex, MutexGuard},
+		spin::Spin,
+	},
+};
+use core::{
+	fmt,
+	fmt::Formatter,
+	num::NonZeroUsize,
+	ops::Range,
+	ptr,
+	sync::atomic::{
+		AtomicBool, AtomicPtr, AtomicU32,
+		Ordering::{Acquire, Relaxed, Release},
+	},
+};
+use utils::{
+	DisplayableStr,
+	boxed::Box,
+	collections::hashmap::HashMap,
+	errno::{AllocResult, EResult},
+};
+
+/// The maximum number of program counters recorded per sample.
+pub const DEPTH: usize = 16;
+/// The number of samples each CPU core's ring can hold.
+const RING_LEN: NonZeroUsize = NonZeroUsize::new(512).unwrap();
+/// The number of core cycles between two samples, when using performance counters.
+const PMU_PERIOD: u32 = 10_000_000;
+
+/// Tells whether profiling is enabled.
+static ENABLED: AtomicBool = AtomicBool::new(false);
+/// Lock serializing changes of the profiling state.
+static CONTROL: Spin<()> = Spin::new(());
+/// The number of occurrences of each collected sample.
+///
+/// Locking it also ensures the rings have a single consumer at a time.
+static PROFILE: Mutex<HashMap<Sample, u64>> = Mutex::new(HashMap::new());
+
+/// A profiling sample.
+#[derive(Clone, Copy, Eq, Hash, PartialEq)]
+pub struct Sample {
+	/// The PID of the process running when the sample was taken
+	pub pid: Pid,
+	/// The interrupted program counter, followed by the kernel backtrace. Unused entries are
+	/// null
+	///
+	/// If the core was running userspace code, all entries are null.
+	pub stack: [VirtAddr; DEPTH],
+}
+
+/// Per-CPU profiling state.
+#[derive(Default)]
+pub struct CpuProfile {
+	/// The core's ring, or null if not allocated yet
+	///
+	/// The pointer stored by this field is returned by `Box::into_raw`
+	ring: AtomicPtr<SpscRing<Sample>>,
+	/// The interrupt vector of the performance counter overflow, or zero if performance
+	/// counters are not used
+	vector: AtomicU32,
+	/// Tells whether the performance counter is running
+	armed: AtomicBool,
+}
+
+impl CpuProfile {
+	/// Returns the core's ring, if allocated.
+	fn ring(&self) -> Option<&SpscRing<Sample>> {
+		unsafe { self.ring.load(Acquire).as_ref() }
+	}
+}
+
+impl Drop for CpuProfile {
+	fn drop(&mut self) {
+		let ring = self.ring.swap(ptr::null_mut(), Acquire);
+		if !ring.is_null() {
+			drop(unsafe { Box::from_raw(ring) });
+		}
+	}
+}
+
+/// Fills `stack` with the return addresses found by following frame pointers from `fp`.
+///
+/// The entry code does not clear the frame pointer, so the outermost kernel frame links to a
+/// userspace frame. Since this function runs in interrupt context, where a page fault cannot be
+/// handled, the walk stops as soon as a frame does not lie within the kernel stack `bounds`,
+/// before reading it.
+fn walk_stack(mut fp: usize, bounds: Range<VirtAddr>, stack: &mut [VirtAddr]) {
+	// The frame holds the caller's frame pointer, followed by the return address
+	const FRAME_SIZE: usize = 2 * size_of::<usize>();
+	for f in stack {
+		if fp % align_of::<usize>() != 0 || fp < bounds.start.0 || fp > bounds.end.0 - FRAME_SIZE {
+			break;
+		}
+		let frame = ptr::with_exposed_provenance::<usize>(fp);
+		let (next, pc) = unsafe { (frame.read(), frame.add(1).read()) };
+		if pc < PROCESS_END.0 {
+			break;
+		}
+		*f = VirtAddr(pc);
+		// Callers' frames are above on the stack. This also prevents looping on a corrupted frame
+		if next <= fp {
+			break;
+		}
+		fp = next;
+	}
+}
+
+/// Records a sample of the interrupted context `frame`, with ring `ring`, on the current CPU
+/// core.
+///
+/// This function must be called with interruptions disabled.
+fn sample(frame: &IntFrame, ring: u8) {
+	let cpu = per_cpu();
+	let Some(buf) = cpu.profile.ring() else {
+		return;
+	};
+	let proc = Process::current();
+	let mut stack = [VirtAddr::default(); DEPTH];
+	if ring < 3 {
+		stack[0] = VirtAddr(frame.get_program_counter());
+		walk_stack(frame.rbp as _, proc.kernel_stack_range(), &mut stack[1..]);
+	}
+	let pid = proc.get_pid();
+	// A full ring means samples are not read fast enough: drop the sample
+	unsafe {
+		buf.push(Sample {
+			pid,
+			stack,
+		});
+	}
+}
+
+/// Sets up profiling on the current CPU core.
+pub(crate) fn init_cpu() -> AllocResult<()> {
+	if !pmu::is_present() {
+		return Ok(());
+	}
+	let handle = unsafe {
+		int::alloc_callback(|_, _, frame, ring| {
+			sample(frame, ring);
+			let vector = per_cpu().profile.vector.load(Relaxed);
+			pmu::rearm(vector as _, PMU_PERIOD);
+		})?
+	};
+	per_cpu().profile.vector.store(handle.id(), Relaxed);
+	Ok(())
+}
+
+/// Handles a tick of the scheduler's timer on the current core.
+///
+/// Performance counters are started and stopped here so that each core follows changes of the
+/// profiling state without the need for an inter-processor interrupt.
+pub(crate) fn tick(frame: &IntFrame, ring: u8) {
+	let prof = &per_cpu().profile;
+	let enabled = ENABLED.load(Relaxed);
+	let vector = prof.vector.load(Relaxed);
+	if vector != 0 {
+		if prof.armed.load(Relaxed) != enabled {
+			if enabled {
+				pmu::start(vector as _, PMU_PERIOD);
+			} else {
+				pmu::stop();
+			}
+			prof.armed.store(enabled, Relaxed);
+		}
+	} else if enabled {
+		sample(frame, ring);
+	}
+}
+
+/// Enables or disables profiling.
+///
+/// When enabling, previously collected samples are discarded.
+pub fn set_enabled(enabled: bool) -> EResult<()> {
+	let _guard = CONTROL.lock();
+	if enabled {
+		for cpu in cpus() {
+			if cpu.profile.ring().is_none() {
+				let ring = Box::new(SpscRing::new(RING_LEN)?)?;
+				cpu.profile.ring.store(Box::into_raw(ring), Release);
+			}
+		}
+		let mut profile = PROFILE.lock()?;
+		// Discard samples taken during the previous session
+		for cpu in cpus() {
+			if let Some(ring) = cpu.profile.ring() {
+				while unsafe { ring.pop() }.is_some() {}
+			}
+		}
+		profile.clear();
+	}
+	ENABLED.store(enabled, Release);
+	Ok(())
+}
+
+/// Returns the collected samples, along with their number of occurrences.
+///
+/// If `collect` is set, samples pending in the rings are aggregated first.
+pub fn samples(collect: bool) -> EResult<MutexGuard<'static, HashMap<Sample, u64>, true>> {
+	let mut profile = PROFILE.lock()?;
+	if collect {
+		for cpu in cpus() {
+			let Some(ring) = cpu.profile.ring() else {
+				continue;
+			};
+			// Safe since `PROFILE` is locked
+			while let Some(sample) = unsafe { ring.pop() } {
+				*profile.entry(sample).or_insert(0)? += 1;
+			}
+		}
+	}
+	Ok(profile)
+}
+
+/// Displays samples as folded stacks.
+pub struct FoldedDisplay<'p>(pub &'p HashMap<Sample, u64>);
+
+impl fmt::Display for FoldedDisplay<'_> {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		for (sample, count) in self.0.iter() {
+			write!(f, "{}", sample.pid)?;
+			if sample.stack[0].is_null() {
+				write!(f, ";[user]")?;
+			}
+			for pc in sample.stack.iter().rev().filter(|pc| !pc.is_null()) {
+				let name = elf::kernel::get_function_name(*pc).unwrap_or(b"???");
+				match str::from_utf8(name) {
+					Ok(name) => write!(f, ";{:#}", rustc_demangle::demangle(name))?,
+					Err(_) => write!(f, ";{}", DisplayableStr(name))?,
+				}
+			}
+			writeln!(f, " {count}")?;
+		}
+		Ok(())
+	}
+}
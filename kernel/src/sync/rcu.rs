@@ -18,17 +18,189 @@
 
 //! Read-Copy-Update allows several threads to read and update data structures concurrently without
 //! using locks.
+//!
+//! Readers access the data inside a *read-side critical section*, entered with [`read_lock`],
+//! during which preemption is disabled. Writers publish new versions of the data atomically, then
+//! wait for a *grace period* before freeing the old ones: once every CPU has gone through a
+//! *quiescent state* (a context switch, or a tick outside a critical section), no reader can
+//! still access them.
+//!
+//! Freeing can be deferred without waiting with [`call`]. Callbacks are run by a kernel task,
+//! after a grace period.
 
+use crate::{
+	arch::core_id,
+	process::scheduler::{
+		cpu::{CPU, per_cpu, try_per_cpu},
+		preempt_disable, preempt_enable,
+	},
+	sync::spin::IntSpin,
+	time::{clock::Clock, sleep_for},
+};
 use core::{
-	mem,
+	cell::UnsafeCell,
+	fmt,
+	fmt::Formatter,
+	marker::PhantomData,
+	mem, ptr,
 	ptr::NonNull,
 	sync::atomic::{
-		AtomicPtr,
-		Ordering::{Acquire, Relaxed, SeqCst},
+		AtomicPtr, AtomicUsize,
+		Ordering::{Acquire, Relaxed, Release, SeqCst},
 	},
 };
 use utils::ptr::arc::{Arc, ArcInner};
 
+/// The interval at which the RCU task runs callbacks, in milliseconds.
+const CALLBACK_INTERVAL: u64 = 10;
+
+/// Per-CPU state of the RCU.
+pub struct CpuState {
+	/// The number of quiescent states the CPU has gone through
+	qs: AtomicUsize,
+}
+
+impl CpuState {
+	/// Creates a new instance.
+	pub const fn new() -> Self {
+		Self {
+			qs: AtomicUsize::new(0),
+		}
+	}
+}
+
+/// Guard of a read-side critical section. The section ends when the guard is dropped.
+///
+/// The current task must not sleep while holding the guard.
+pub struct ReadGuard {
+	/// Tells whether preemption has been disabled
+	preempt: bool,
+	_marker: PhantomData<*const ()>,
+}
+
+impl Drop for ReadGuard {
+	fn drop(&mut self) {
+		if self.preempt {
+			unsafe {
+				preempt_enable();
+			}
+		}
+	}
+}
+
+/// Enters a read-side critical section.
+///
+/// Data retrieved inside the section remains valid until the returned guard is dropped.
+#[inline]
+pub fn read_lock() -> ReadGuard {
+	// Before CPUs are set up, there is no preemption
+	let preempt = try_per_cpu().is_some();
+	if preempt {
+		preempt_disable();
+	}
+	ReadGuard {
+		preempt,
+		_marker: PhantomData,
+	}
+}
+
+/// Reports a quiescent state on the current CPU.
+///
+/// This must be called only outside any read-side critical section.
+#[inline]
+pub(crate) fn quiescent_state() {
+	per_cpu().rcu.qs.fetch_add(1, Release);
+}
+
+/// Waits for a grace period to elapse. That is, until every read-side critical section that
+/// began before the call has ended.
+///
+/// This function sleeps, so it must not be called inside a critical section.
+pub fn synchronize() {
+	// The current CPU is not in a read-side critical section
+	let cur = core_id() as usize;
+	for (i, cpu) in CPU.iter().enumerate() {
+		if i == cur || !cpu.online.load(Acquire) {
+			continue;
+		}
+		// Any quiescent state reported after the snapshot happens after the pre-existing
+		// critical sections have ended
+		let snapshot = cpu.rcu.qs.load(Acquire);
+		while cpu.rcu.qs.load(Acquire) == snapshot {
+			let mut remain = 0;
+			let _ = sleep_for(Clock::Monotonic, 1_000_000, &mut remain);
+		}
+	}
+}
+
+/// Header embedded in a structure, to defer an operation on it after a grace period with [`call`].
+#[derive(Default)]
+pub struct RcuHead {
+	/// The next element in the list of pending callbacks
+	next: AtomicPtr<RcuHead>,
+	/// The callback
+	func: UnsafeCell<Option<unsafe fn(NonNull<RcuHead>)>>,
+}
+
+// The callback is accessed only while queueing it, or after removing the head from the stack
+unsafe impl Send for RcuHead {}
+
+unsafe impl Sync for RcuHead {}
+
+impl fmt::Debug for RcuHead {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.debug_struct("RcuHead").finish_non_exhaustive()
+	}
+}
+
+/// A stack of [`RcuHead`]s.
+struct Pending(*mut RcuHead);
+
+// Heads are accessed only while the stack is locked, or after being removed from it
+unsafe impl Send for Pending {}
+
+/// The callbacks waiting for a grace period.
+static PENDING: IntSpin<Pending> = IntSpin::new(Pending(ptr::null_mut()));
+
+/// Defers a call to `func` with `head`, after a grace period.
+///
+/// The function does not allocate memory, so that it can be used to free memory.
+///
+/// # Safety
+///
+/// `head` must remain valid until `func` is called, and must not be queued again before that.
+pub unsafe fn call(head: &RcuHead, func: unsafe fn(NonNull<RcuHead>)) {
+	let mut pending = PENDING.lock();
+	unsafe {
+		*head.func.get() = Some(func);
+	}
+	head.next.store(pending.0, Relaxed);
+	pending.0 = ptr::from_ref(head).cast_mut();
+}
+
+/// The entry point of the kernel task running RCU callbacks.
+pub(crate) fn rcu_task() -> ! {
+	loop {
+		let mut remain = 0;
+		let _ = sleep_for(Clock::Monotonic, CALLBACK_INTERVAL * 1_000_000, &mut remain);
+		// Callbacks queued from now on are for the next grace period
+		let mut head = mem::replace(&mut PENDING.lock().0, ptr::null_mut());
+		if head.is_null() {
+			continue;
+		}
+		synchronize();
+		while let Some(cur) = NonNull::new(head) {
+			unsafe {
+				head = cur.as_ref().next.load(Relaxed);
+				let func = (*cur.as_ref().func.get()).take();
+				if let Some(func) = func {
+					func(cur);
+				}
+			}
+		}
+	}
+}
+
 /// An [`Arc`], behind a RCU.
 pub struct RcuArc<T>(RcuOptionArc<T>);
 
@@ -77,7 +249,7 @@ impl<T> RcuOptionArc<T> {
 
 	/// Returns a reference to the inner [`Arc`].
 	pub fn get(&self) -> Option<Arc<T>> {
-		// TODO enter RCU read critical section
+		let _guard = read_lock();
 		let inner = self.inner.load(Acquire);
 		NonNull::new(inner).map(|inner| {
 			let inner_ref = unsafe { inner.as_ref() };
@@ -86,7 +258,6 @@ impl<T> RcuOptionArc<T> {
 				inner,
 			}
 		})
-		// TODO exit RCU read critical section before returning
 	}
 
 	/// Atomically swap the inner [`Arc`] for the given `other`.
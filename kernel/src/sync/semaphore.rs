@@ -107,6 +107,20 @@ impl<const INT: bool> Semaphore<INT> {
 }
 
 impl<const INT: bool> Semaphore<INT> {
+	/// Acquires a permit if one is available, without sleeping.
+	///
+	/// If no permit is available, the function returns `None`.
+	pub fn try_acquire(&self) -> Option<SemaphoreGuard<'_, INT>> {
+		let mut q = self.queue.lock();
+		if q.acquired >= self.permits {
+			return None;
+		}
+		q.acquired += 1;
+		Some(SemaphoreGuard {
+			sem: self,
+		})
+	}
+
 	/// Releases a permit, waking up the next process waiting for one, if any.
 	///
 	/// # Safety
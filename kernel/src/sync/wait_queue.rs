@@ -17,20 +17,74 @@
  */
 
 //! Queue of processes waiting on a resource.
+//!
+//! Besides processes, a queue can hold [`WaitHook`]s, which are notified each time the queue is
+//! woken up. This allows to watch several resources at once without sleeping on each of them, as
+//! `epoll` does.
 
 use crate::{
 	process,
 	process::{Process, State, scheduler::schedule},
 	sync::spin::IntSpin,
 };
-use core::{fmt, fmt::Formatter};
-use utils::{errno, errno::EResult, list, list_type, ptr::arc::Arc};
+use core::{fmt, fmt::Formatter, ptr::NonNull};
+use utils::{
+	collections::{list::ListNode, vec::Vec},
+	errno,
+	errno::{AllocResult, EResult},
+	list, list_type,
+	ptr::arc::Arc,
+};
+
+/// A callback notified when a [`WaitQueue`] is woken up.
+pub trait WakeCallback: Send + Sync {
+	/// Called each time the queue the callback is registered on is woken up.
+	///
+	/// The function is called with the queue locked, possibly from an interrupt handler, so it
+	/// must neither sleep nor access the resource the queue belongs to.
+	///
+	/// The function returns `true` if it made a process runnable.
+	fn wake(&self) -> bool;
+}
+
+/// A [`WakeCallback`] registered on a [`WaitQueue`].
+pub struct WaitHook {
+	/// The node in the queue's list of hooks
+	node: ListNode,
+	/// The callback
+	callback: Arc<dyn WakeCallback>,
+	/// If `true`, only one exclusive hook is notified per wake up: the first one that made a
+	/// process runnable
+	exclusive: bool,
+}
+
+struct Inner {
+	/// The processes waiting on the queue
+	procs: list_type!(Process, wait_queue),
+	/// The hooks registered on the queue
+	hooks: list_type!(WaitHook, node),
+}
+
+impl Inner {
+	/// Notifies the registered hooks.
+	fn notify_hooks(&mut self) {
+		let mut exclusive_done = false;
+		for cursor in self.hooks.iter() {
+			let hook = cursor.value();
+			if !hook.exclusive {
+				hook.callback.wake();
+			} else if !exclusive_done {
+				exclusive_done = hook.callback.wake();
+			}
+		}
+	}
+}
 
 /// Queue of processes waiting on a resource.
 ///
 /// While waiting, the process is turned to the [`State::IntSleeping`] or [`State::Sleeping`]
 /// state.
-pub struct WaitQueue(IntSpin<list_type!(Process, wait_queue)>);
+pub struct WaitQueue(IntSpin<Inner>);
 
 impl Default for WaitQueue {
 	fn default() -> Self {
@@ -41,18 +95,21 @@ impl Default for WaitQueue {
 impl WaitQueue {
 	/// Creates a new empty queue.
 	pub const fn new() -> Self {
-		Self(IntSpin::new(list!(Process, wait_queue)))
+		Self(IntSpin::new(Inner {
+			procs: list!(Process, wait_queue),
+			hooks: list!(WaitHook, node),
+		}))
 	}
 
 	fn enqueue(&self) {
 		let mut queue = self.0.lock();
-		queue.insert_back(Process::current());
+		queue.procs.insert_back(Process::current());
 		process::set_state(State::IntSleeping);
 	}
 
 	fn dequeue(&self, proc: &Arc<Process>) {
 		unsafe {
-			self.0.lock().remove(proc);
+			self.0.lock().procs.remove(proc);
 		}
 	}
 
@@ -111,22 +168,29 @@ impl WaitQueue {
 
 	/// Returns whether the queue has no pending waiters.
 	pub fn is_empty(&self) -> bool {
-		self.0.lock().is_empty()
+		self.0.lock().procs.is_empty()
 	}
 
 	/// Wakes the next process in queue, if any.
-	pub fn wake_next(&self) {
-		if let Some(proc) = self.0.lock().remove_front() {
-			Process::wake_from(&proc, State::IntSleeping as u8);
-		}
+	///
+	/// The function returns `true` if a process has been woken up.
+	pub fn wake_next(&self) -> bool {
+		let mut queue = self.0.lock();
+		queue.notify_hooks();
+		let Some(proc) = queue.procs.remove_front() else {
+			return false;
+		};
+		Process::wake_from(&proc, State::IntSleeping as u8);
+		true
 	}
 
 	/// Wakes up to `n` processes in queue. Returns the number of processes woken up.
 	pub fn wake_n(&self, n: usize) -> usize {
 		let mut queue = self.0.lock();
+		queue.notify_hooks();
 		let mut count = 0;
 		while count < n {
-			let Some(proc) = queue.remove_front() else {
+			let Some(proc) = queue.procs.remove_front() else {
 				break;
 			};
 			Process::wake_from(&proc, State::IntSleeping as u8);
@@ -138,7 +202,8 @@ impl WaitQueue {
 	/// Wakes all processes in queue, if any.
 	pub fn wake_all(&self) {
 		let mut queue = self.0.lock();
-		for node in queue.iter() {
+		queue.notify_hooks();
+		for node in queue.procs.iter() {
 			let proc = node.remove();
 			Process::wake_from(&proc, State::IntSleeping as u8);
 		}
@@ -147,6 +212,74 @@ impl WaitQueue {
 
 unsafe impl Sync for WaitQueue {}
 
+/// The set of [`WaitHook`]s registered by a single watcher, for example an `epoll` instance
+/// watching a file.
+///
+/// Dropping the table unregisters all its hooks.
+pub struct PollTable {
+	/// The callback to register
+	callback: Arc<dyn WakeCallback>,
+	/// Tells whether hooks are exclusive
+	exclusive: bool,
+	/// The registered hooks, along with the queue they are registered on
+	hooks: Vec<(NonNull<WaitQueue>, Arc<WaitHook>)>,
+}
+
+impl PollTable {
+	/// Creates a new table, without any hook registered.
+	///
+	/// `exclusive` tells whether the table's hooks are exclusive. See [`WaitHook`].
+	pub fn new(callback: Arc<dyn WakeCallback>, exclusive: bool) -> Self {
+		Self {
+			callback,
+			exclusive,
+			hooks: Vec::new(),
+		}
+	}
+
+	/// Registers the table's callback on `queue`.
+	///
+	/// # Safety
+	///
+	/// `queue` must remain valid until the table is cleared or dropped.
+	pub unsafe fn add(&mut self, queue: &WaitQueue) -> AllocResult<()> {
+		let hook = Arc::new(WaitHook {
+			node: ListNode::default(),
+			callback: self.callback.clone(),
+			exclusive: self.exclusive,
+		})?;
+		self.hooks.push((NonNull::from(queue), hook.clone()))?;
+		queue.0.lock().hooks.insert_back(hook);
+		Ok(())
+	}
+
+	/// Unregisters all the hooks of the table.
+	pub fn clear(&mut self) {
+		while let Some((queue, hook)) = self.hooks.pop() {
+			unsafe {
+				queue.as_ref().0.lock().hooks.remove(&hook);
+			}
+		}
+	}
+}
+
+impl Drop for PollTable {
+	fn drop(&mut self) {
+		self.clear();
+	}
+}
+
+// The queues are valid as long as the table is registered on them
+unsafe impl Send for PollTable {}
+
+impl fmt::Debug for PollTable {
+	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
+		f.debug_struct("PollTable")
+			.field("hooks", &self.hooks.len())
+			.finish()
+	}
+}
+
 impl fmt::Debug for WaitQueue {
 	fn fmt(&self, f: &mut Formatter<'_>) -> fmt::Result {
 		f.write_str("WaitQueue")
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2026 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! The `epoll` system calls allow to watch a large set of files for events.
+
+use crate::{
+	file::{
+		File, FileType, O_CLOEXEC, O_RDWR,
+		epoll::{EpollEvent, EventPoll},
+		fd::{FD_CLOEXEC, fd_to_file},
+		fs::float,
+	},
+	memory::user::{UserPtr, UserSlice},
+	process::Process,
+	time::unit::{TimeUnit, Timespec, Timestamp},
+};
+use core::{ffi::c_int, hint::unlikely, mem::size_of};
+use utils::{errno, errno::EResult};
+
+/// Adds a file to the interest list.
+const EPOLL_CTL_ADD: c_int = 1;
+/// Removes a file from the interest list.
+const EPOLL_CTL_DEL: c_int = 2;
+/// Changes the events watched on a file of the interest list.
+const EPOLL_CTL_MOD: c_int = 3;
+
+/// The maximum number of events that can be returned at once.
+const EP_MAX_EVENTS: usize = c_int::MAX as usize / size_of::<EpollEvent>();
+
+fn do_epoll_create(flags: c_int) -> EResult<usize> {
+	let entry = float::get_entry(EventPoll::new()?, FileType::Regular)?;
+	let file = File::open_floating(entry, O_RDWR)?;
+	let fd_flags = if flags & O_CLOEXEC != 0 {
+		FD_CLOEXEC
+	} else {
+		0
+	};
+	let (fd, _) = Process::current()
+		.file_descriptors()
+		.lock()
+		.create_fd(fd_flags, file)?;
+	Ok(fd as _)
+}
+
+pub fn epoll_create(size: c_int) -> EResult<usize> {
+	// The size is only a hint
+	if unlikely(size <= 0) {
+		return Err(errno!(EINVAL));
+	}
+	do_epoll_create(0)
+}
+
+pub fn epoll_create1(flags: c_int) -> EResult<usize> {
+	if unlikely(flags & !O_CLOEXEC != 0) {
+		return Err(errno!(EINVAL));
+	}
+	do_epoll_create(flags)
+}
+
+pub fn epoll_ctl(epfd: c_int, op: c_int, fd: c_int, event: UserPtr<EpollEvent>) -> EResult<usize> {
+	let ep_file = fd_to_file(epfd)?;
+	let file = fd_to_file(fd)?;
+	let ep = ep_file
+		.get_buffer::<EventPoll>()
+		.ok_or_else(|| errno!(EINVAL))?;
+	if unlikely(fd == epfd) {
+		return Err(errno!(EINVAL));
+	}
+	match op {
+		EPOLL_CTL_ADD => {
+			let event = event.copy_from_user()?.ok_or_else(|| errno!(EFAULT))?;
+			ep.add(fd, file, event)?;
+		}
+		EPOLL_CTL_MOD => {
+			let event = event.copy_from_user()?.ok_or_else(|| errno!(EFAULT))?;
+			ep.modify(fd, &file, event)?;
+		}
+		EPOLL_CTL_DEL => ep.delete(fd, &file)?,
+		_ => return Err(errno!(EINVAL)),
+	}
+	Ok(0)
+}
+
+/// Common implementation of the `epoll_wait` system calls.
+///
+/// `timeout` is the maximum duration to wait for, in nanoseconds. If `None`, the function waits
+/// indefinitely.
+fn do_epoll_wait(
+	epfd: c_int,
+	events: *mut EpollEvent,
+	maxevents: c_int,
+	timeout: Option<Timestamp>,
+) -> EResult<usize> {
+	if unlikely(maxevents <= 0 || maxevents as usize > EP_MAX_EVENTS) {
+		return Err(errno!(EINVAL));
+	}
+	let events = UserSlice::from_user(events, maxevents as _)?;
+	let ep_file = fd_to_file(epfd)?;
+	let ep = ep_file
+		.get_buffer::<EventPoll>()
+		.ok_or_else(|| errno!(EINVAL))?;
+	ep.wait(events, timeout)
+}
+
+/// Converts the timeout of `epoll_wait` and `epoll_pwait`, in milliseconds, to nanoseconds.
+fn timeout_ms(timeout: c_int) -> Option<Timestamp> {
+	(timeout >= 0).then(|| timeout as Timestamp * 1_000_000)
+}
+
+pub fn epoll_wait(
+	epfd: c_int,
+	events: *mut EpollEvent,
+	maxevents: c_int,
+	timeout: c_int,
+) -> EResult<usize> {
+	do_epoll_wait(epfd, events, maxevents, timeout_ms(timeout))
+}
+
+pub fn epoll_pwait(
+	epfd: c_int,
+	events: *mut EpollEvent,
+	maxevents: c_int,
+	timeout: c_int,
+	sigmask: *mut u8,
+	_sigsetsize: usize,
+) -> EResult<usize> {
+	// Swapping the signal mask while waiting is not supported
+	if unlikely(!sigmask.is_null()) {
+		return Err(errno!(EINVAL));
+	}
+	do_epoll_wait(epfd, events, maxevents, timeout_ms(timeout))
+}
+
+pub fn epoll_pwait2(
+	epfd: c_int,
+	events: *mut EpollEvent,
+	maxevents: c_int,
+	timeout: UserPtr<Timespec>,
+	sigmask: *mut u8,
+	_sigsetsize: usize,
+) -> EResult<usize> {
+	// Swapping the signal mask while waiting is not supported
+	if unlikely(!sigmask.is_null()) {
+		return Err(errno!(EINVAL));
+	}
+	let timeout = timeout.copy_from_user()?.map(|ts| ts.to_nano());
+	do_epoll_wait(epfd, events, maxevents, timeout)
+}
@@ -19,7 +19,11 @@
 //! The `fcntl` syscall call allows to manipulate a file descriptor.
 
 use crate::{
-	file::{fd::NewFDConstraint, pipe::PipeBuffer},
+	file::{
+		fd::NewFDConstraint,
+		perm::is_privileged,
+		pipe::{PIPE_MAX_SIZE, PipeBuffer},
+	},
 	process::Process,
 };
 use core::ffi::{c_int, c_void};
@@ -174,7 +178,17 @@ pub fn do_fcntl(fd: c_int, cmd: c_int, arg: *mut c_void, _fcntl64: bool) -> ERes
 			let (id, _) = fds.duplicate_fd(fd, NewFDConstraint::Min(arg as _), true)?;
 			Ok(id as _)
 		}
-		F_SETPIPE_SZ => todo!(),
+		F_SETPIPE_SZ => {
+			let file = fds.get_fd(fd)?.get_file();
+			let Some(fifo) = file.get_buffer::<PipeBuffer>() else {
+				return Err(errno!(EBADF));
+			};
+			let size = arg as usize as u32 as usize;
+			if size > PIPE_MAX_SIZE && !is_privileged() {
+				return Err(errno!(EPERM));
+			}
+			fifo.set_capacity(size)
+		}
 		F_GETPIPE_SZ => {
 			let file = fds.get_fd(fd)?.get_file();
 			match file.get_buffer::<PipeBuffer>() {
@@ -32,7 +32,10 @@ use crate::{
 		vfs,
 		vfs::{ResolutionSettings, Resolved},
 	},
-	memory::user::{UserPtr, UserSlice, UserString},
+	memory::{
+		readahead::Advice,
+		user::{UserPtr, UserSlice, UserString},
+	},
 	process::Process,
 	syscall::util::{
 		at,
@@ -44,7 +47,11 @@ use crate::{
 	},
 };
 use core::{ffi::c_int, hint::unlikely, sync::atomic::Ordering::Release};
-use utils::{errno, errno::EResult, limits::SYMLINK_MAX};
+use utils::{
+	errno,
+	errno::EResult,
+	limits::{PAGE_SIZE, SYMLINK_MAX},
+};
 
 /// `access` flag: Checks for existence of the file.
 const F_OK: i32 = 0;
@@ -55,6 +62,19 @@ const W_OK: i32 = 2;
 /// `access` flag: Checks the file can be executed.
 const X_OK: i32 = 1;
 
+/// `posix_fadvise` advice: No particular access pattern.
+const POSIX_FADV_NORMAL: c_int = 0;
+/// `posix_fadvise` advice: Random accesses.
+const POSIX_FADV_RANDOM: c_int = 1;
+/// `posix_fadvise` advice: Sequential accesses.
+const POSIX_FADV_SEQUENTIAL: c_int = 2;
+/// `posix_fadvise` advice: The data is going to be accessed soon.
+const POSIX_FADV_WILLNEED: c_int = 3;
+/// `posix_fadvise` advice: The data is not going to be accessed soon.
+const POSIX_FADV_DONTNEED: c_int = 4;
+/// `posix_fadvise` advice: The data is going to be accessed only once.
+const POSIX_FADV_NOREUSE: c_int = 5;
+
 /// `rename` flag: Don't replace new path if it exists. Return an error instead.
 const RENAME_NOREPLACE: c_int = 1;
 /// `rename` flag: Exchanges old and new paths atomically.
@@ -355,8 +375,35 @@ pub fn faccessat2(
 	do_access(Some(dir_fd), pathname, mode, flags)
 }
 
-pub fn fadvise64_64(_fd: c_int, _offset: u64, _len: u64, _advice: c_int) -> EResult<usize> {
-	// TODO
+pub fn fadvise64_64(fd: c_int, offset: u64, len: u64, advice: c_int) -> EResult<usize> {
+	let file = fd_to_file(fd)?;
+	let stat = file.stat();
+	if unlikely(stat.get_type() == Some(FileType::Fifo)) {
+		return Err(errno!(ESPIPE));
+	}
+	match advice {
+		POSIX_FADV_NORMAL => file.readahead.set_advice(Advice::Normal),
+		POSIX_FADV_RANDOM => file.readahead.set_advice(Advice::Random),
+		POSIX_FADV_SEQUENTIAL => file.readahead.set_advice(Advice::Sequential),
+		POSIX_FADV_WILLNEED => {
+			let Some(node) = file.vfs_entry.node.as_ref() else {
+				return Ok(0);
+			};
+			// A length of zero means until the end of the file
+			let end = match len {
+				0 => stat.size,
+				len => offset.saturating_add(len).min(stat.size),
+			};
+			let start = offset / PAGE_SIZE as u64;
+			let end = end.div_ceil(PAGE_SIZE as u64);
+			if start < end {
+				node.node_ops.readahead(node, start..end)?;
+			}
+		}
+		// Pages are reclaimed by the cache when needed
+		POSIX_FADV_DONTNEED | POSIX_FADV_NOREUSE => {}
+		_ => return Err(errno!(EINVAL)),
+	}
 	Ok(0)
 }
 
@@ -15,26 +15,48 @@
  * You should have received a copy of the GNU General Public License along with
  * Maestro. If not, see <https://www.gnu.org/licenses/>.
  */
-
 //! The `futex` system call provides fast userspace mutual exclusion primitives.
+//!
+//! Waiting processes are queued in a fixed-size hash table of buckets, each with its own lock, so
+//! that unrelated futexes rarely contend. A process is linked directly in its bucket through its
+//! [`Process::wait_queue`] node, and remembers the key of the futex word it waits on in a
+//! [`FutexWaiter`], so that waiting does not allocate memory.
+//!
+//! Several futex words may hash to the same bucket: operations only consider the waiters whose
+//! key matches.
 
 use crate::{
 	memory::user::UserPtr,
-	process::{Process, State},
-	sync::{spin::Spin, wait_queue::WaitQueue},
+	process,
+	process::{Process, State, scheduler::schedule},
+	sync::spin::IntSpin,
 	time::{
 		clock::{Clock, current_time_ns},
 		timer::Timer,
 		unit::{TimeUnit, Timespec, Timespec32, Timestamp},
 	},
 };
-use core::{ffi::c_int, hint::unlikely, ptr::NonNull};
-use utils::{collections::hashmap::HashMap, errno, errno::EResult, ptr::arc::Arc};
+use core::{
+	ffi::c_int,
+	hint::unlikely,
+	ptr::NonNull,
+	sync::atomic::{AtomicU32, AtomicUsize, Ordering::Relaxed},
+};
+use utils::{errno, errno::EResult, list, list_type, ptr::arc::Arc};
 
 /// Wait if `*uaddr == val`.
 const FUTEX_WAIT: c_int = 0;
 /// Wake up to `val` waiters on `uaddr`.
 const FUTEX_WAKE: c_int = 1;
+/// Wake up to `val` waiters on `uaddr`, then move up to `val2` of the remaining waiters to
+/// `uaddr2`.
+const FUTEX_REQUEUE: c_int = 3;
+/// Like [`FUTEX_REQUEUE`], but fails with `EAGAIN` if `*uaddr != val3`.
+const FUTEX_CMP_REQUEUE: c_int = 4;
+/// Atomically modify `*uaddr2` according to `val3`, then wake up to `val` waiters on `uaddr`,
+/// and up to `val2` waiters on `uaddr2` if the previous value of `*uaddr2` passes the comparison
+/// encoded in `val3`.
+const FUTEX_WAKE_OP: c_int = 5;
 /// Like [`FUTEX_WAIT`] but with an absolute timeout and a 32-bit bitset filter.
 const FUTEX_WAIT_BITSET: c_int = 9;
 /// Like [`FUTEX_WAKE`] but with a 32-bit bitset filter.
@@ -47,8 +69,42 @@ const FUTEX_CLOCK_REALTIME: c_int = 256;
 
 const FUTEX_CMD_MASK: c_int = !(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME);
 
+/// Bitset matching all waiters.
+const FUTEX_BITSET_MATCH_ANY: u32 = !0;
+
+/// `FUTEX_WAKE_OP` operation: `*uaddr2 = oparg`.
+const FUTEX_OP_SET: u32 = 0;
+/// `FUTEX_WAKE_OP` operation: `*uaddr2 += oparg`.
+const FUTEX_OP_ADD: u32 = 1;
+/// `FUTEX_WAKE_OP` operation: `*uaddr2 |= oparg`.
+const FUTEX_OP_OR: u32 = 2;
+/// `FUTEX_WAKE_OP` operation: `*uaddr2 &= !oparg`.
+const FUTEX_OP_ANDN: u32 = 3;
+/// `FUTEX_WAKE_OP` operation: `*uaddr2 ^= oparg`.
+const FUTEX_OP_XOR: u32 = 4;
+/// `FUTEX_WAKE_OP` operation flag: use `1 << oparg` as operand.
+const FUTEX_OP_OPARG_SHIFT: u32 = 8;
+
+/// `FUTEX_WAKE_OP` comparison: `oldval == cmparg`.
+const FUTEX_OP_CMP_EQ: u32 = 0;
+/// `FUTEX_WAKE_OP` comparison: `oldval != cmparg`.
+const FUTEX_OP_CMP_NE: u32 = 1;
+/// `FUTEX_WAKE_OP` comparison: `oldval < cmparg`.
+const FUTEX_OP_CMP_LT: u32 = 2;
+/// `FUTEX_WAKE_OP` comparison: `oldval <= cmparg`.
+const FUTEX_OP_CMP_LE: u32 = 3;
+/// `FUTEX_WAKE_OP` comparison: `oldval > cmparg`.
+const FUTEX_OP_CMP_GT: u32 = 4;
+/// `FUTEX_WAKE_OP` comparison: `oldval >= cmparg`.
+const FUTEX_OP_CMP_GE: u32 = 5;
+
+/// The base-2 logarithm of the number of buckets in the hash table.
+const BUCKETS_SHIFT: u32 = 8;
+/// The number of buckets in the hash table.
+const BUCKETS_COUNT: usize = 1 << BUCKETS_SHIFT;
+
 /// Identifies a futex word.
-#[derive(Clone, Copy, Eq, Hash, PartialEq)]
+#[derive(Clone, Copy, Eq, PartialEq)]
 struct FutexKey {
 	/// Raw pointer of the [`crate::process::mem_space::MemSpace`] holding the address.
 	mem_space: usize,
@@ -56,11 +112,61 @@ struct FutexKey {
 	addr: usize,
 }
 
-/// Map from futex words to wait queues.
+impl FutexKey {
+	/// Returns the index of the bucket holding the waiters of the futex word.
+	#[inline]
+	fn bucket(&self) -> usize {
+		// Fibonacci hashing
+		let hash = (self.addr ^ self.mem_space.rotate_left(usize::BITS / 2))
+			.wrapping_mul(0x9e3779b97f4a7c15u64 as usize);
+		hash >> (usize::BITS - BUCKETS_SHIFT)
+	}
+}
+
+/// The futex wait state of a process.
 ///
-/// Entries are reclaimed by [`cleanup_if_unused`] when no waiters remain and the only
-/// outstanding [`Arc`] references are the map's and the caller's.
-static FUTEXES: Spin<HashMap<FutexKey, Arc<WaitQueue>>> = Spin::new(HashMap::new());
+/// The state is modified only while the process is not queued, or while the bucket it is queued
+/// in is locked.
+#[derive(Debug, Default)]
+pub struct FutexWaiter {
+	/// The memory space of the key of the futex word the process waits on
+	mem_space: AtomicUsize,
+	/// The address of the key of the futex word the process waits on
+	addr: AtomicUsize,
+	/// The bitset given with `FUTEX_WAIT_BITSET`
+	bitset: AtomicU32,
+}
+
+impl FutexWaiter {
+	/// Returns the key of the futex word the process waits on.
+	#[inline]
+	fn key(&self) -> FutexKey {
+		FutexKey {
+			mem_space: self.mem_space.load(Relaxed),
+			addr: self.addr.load(Relaxed),
+		}
+	}
+
+	/// Sets the key of the futex word the process waits on.
+	#[inline]
+	fn set_key(&self, key: FutexKey) {
+		self.mem_space.store(key.mem_space, Relaxed);
+		self.addr.store(key.addr, Relaxed);
+	}
+
+	/// Tells whether a wake operation on `key` with `bitset` applies to the process.
+	#[inline]
+	fn matches(&self, key: &FutexKey, bitset: u32) -> bool {
+		self.key() == *key && self.bitset.load(Relaxed) & bitset != 0
+	}
+}
+
+/// A list of waiting processes.
+type WaitList = list_type!(Process, wait_queue);
+
+/// The hash table of waiting processes.
+static BUCKETS: [IntSpin<WaitList>; BUCKETS_COUNT] =
+	[const { IntSpin::new(list!(Process, wait_queue)) }; BUCKETS_COUNT];
 
 fn make_key(addr: usize) -> FutexKey {
 	let mem_space = Arc::as_ptr(Process::current().mem_space()) as usize;
@@ -70,53 +176,108 @@ fn make_key(addr: usize) -> FutexKey {
 	}
 }
 
-fn lookup(key: &FutexKey) -> Option<Arc<WaitQueue>> {
-	FUTEXES.lock().get(key).cloned()
+/// Validates that `uaddr` is non-null and 4-byte aligned, returning a [`UserPtr`] on it.
+fn user_word(uaddr: *mut u32) -> EResult<UserPtr<u32>> {
+	if unlikely(uaddr.is_null() || (uaddr as usize) % 4 != 0) {
+		return Err(errno!(EINVAL));
+	}
+	Ok(UserPtr(NonNull::new(uaddr)))
 }
 
-fn lookup_or_create(key: FutexKey) -> EResult<Arc<WaitQueue>> {
-	let mut map = FUTEXES.lock();
-	if let Some(q) = map.get(&key) {
-		return Ok(q.clone());
+/// Removes `proc` from the bucket it is queued in, if any.
+///
+/// The function returns `true` if the process was still queued, which means it has not been
+/// woken up by a futex operation.
+fn dequeue(proc: &Arc<Process>) -> bool {
+	loop {
+		let idx = proc.futex.key().bucket();
+		let mut bucket = BUCKETS[idx].lock();
+		// A requeue may have moved the process to another bucket before the lock was acquired
+		if unlikely(proc.futex.key().bucket() != idx) {
+			continue;
+		}
+		if !proc.wait_queue.is_linked() {
+			return false;
+		}
+		unsafe {
+			bucket.remove(proc);
+		}
+		return true;
 	}
-	let q = Arc::new(WaitQueue::new())?;
-	map.insert(key, q.clone())?;
-	Ok(q)
 }
 
-/// Removes the map entry for `key` if the queue has no waiters
-fn cleanup_if_unused(key: &FutexKey, queue: &Arc<WaitQueue>) {
-	let mut map = FUTEXES.lock();
-	if Arc::strong_count(queue) > 2 || !queue.is_empty() {
-		return;
-	}
-	// Only remove if the map still points at *our* queue
-	if let Some(stored) = map.get(key)
-		&& Arc::as_ptr(stored) == Arc::as_ptr(queue)
-	{
-		map.remove(key);
+/// Wakes up to `n` processes waiting on `key` with a bitset intersecting `bitset`.
+///
+/// The function returns the number of processes woken up.
+fn wake(key: &FutexKey, n: usize, bitset: u32) -> usize {
+	let mut bucket = BUCKETS[key.bucket()].lock();
+	let mut count = 0;
+	for cursor in bucket.iter() {
+		if count >= n {
+			break;
+		}
+		if !cursor.value().futex.matches(key, bitset) {
+			continue;
+		}
+		let proc = cursor.remove();
+		Process::wake_from(&proc, State::IntSleeping as u8);
+		count += 1;
 	}
+	count
 }
 
-/// Validates that `uaddr` is non-null and 4-byte aligned, returning a [`UserPtr`] on it.
-fn user_word(uaddr: *mut u32) -> EResult<UserPtr<u32>> {
-	if unlikely(uaddr.is_null() || (uaddr as usize) % 4 != 0) {
-		return Err(errno!(EINVAL));
+/// Wakes up to `nr_wake` processes waiting on `from` in `src`, then makes up to `nr_requeue` of
+/// the remaining ones wait on `to` instead.
+///
+/// `dst` is the bucket of `to`. If `None`, both keys share the same bucket.
+///
+/// The function returns the number of processes woken up or requeued.
+fn requeue_in(
+	src: &mut WaitList,
+	mut dst: Option<&mut WaitList>,
+	from: &FutexKey,
+	to: &FutexKey,
+	nr_wake: usize,
+	nr_requeue: usize,
+) -> usize {
+	let mut woken = 0;
+	let mut requeued = 0;
+	for cursor in src.iter() {
+		if woken >= nr_wake && requeued >= nr_requeue {
+			break;
+		}
+		if cursor.value().futex.key() != *from {
+			continue;
+		}
+		if woken < nr_wake {
+			let proc = cursor.remove();
+			Process::wake_from(&proc, State::IntSleeping as u8);
+			woken += 1;
+		} else {
+			cursor.value().futex.set_key(*to);
+			if let Some(dst) = dst.as_deref_mut() {
+				dst.insert_back(cursor.remove());
+			}
+			requeued += 1;
+		}
 	}
-	Ok(UserPtr(NonNull::new(uaddr)))
+	woken + requeued
 }
 
 /// Performs `FUTEX_WAIT` / `FUTEX_WAIT_BITSET`.
 ///
 /// `delay` is the relative timeout, in nanoseconds. `0` means "no timeout".
-fn do_wait(uaddr: *mut u32, val: u32, clock: Clock, delay: Timestamp) -> EResult<()> {
+fn do_wait(uaddr: *mut u32, val: u32, bitset: u32, clock: Clock, delay: Timestamp) -> EResult<()> {
 	let user = user_word(uaddr)?;
+	if unlikely(bitset == 0) {
+		return Err(errno!(EINVAL));
+	}
 	let key = make_key(uaddr as usize);
-	let queue = lookup_or_create(key)?;
+	let proc = Process::current();
 	// Set up a timer if a timeout was given. Dropping the timer at the end of the function
 	// removes it from the timer queue.
 	let _timer = if delay > 0 {
-		let proc = Process::current();
+		let proc = proc.clone();
 		let mut t = Timer::new(clock, move || {
 			Process::wake_from(&proc, State::IntSleeping as u8);
 		})?;
@@ -130,44 +291,219 @@ fn do_wait(uaddr: *mut u32, val: u32, clock: Clock, delay: Timestamp) -> EResult
 	} else {
 		None
 	};
-	let res = queue.wait_check(|| {
-		let cur = user.copy_from_user()?.ok_or_else(|| errno!(EFAULT))?;
-		if cur != val {
-			return Err(errno!(EAGAIN));
+	// Queue before checking the value, so that a concurrent wake either finds the process or
+	// happens before the check
+	{
+		let mut bucket = BUCKETS[key.bucket()].lock();
+		proc.futex.set_key(key);
+		proc.futex.bitset.store(bitset, Relaxed);
+		bucket.insert_back(proc.clone());
+		process::set_state(State::IntSleeping);
+	}
+	let check = user
+		.copy_from_user()
+		.and_then(|cur| cur.ok_or_else(|| errno!(EFAULT)))
+		.and_then(|cur| {
+			if cur != val {
+				return Err(errno!(EAGAIN));
+			}
+			Ok(())
+		});
+	if let Err(e) = check {
+		// If the process has already been woken up, it is not sleeping anymore
+		if dequeue(&proc) {
+			process::cancel_sleep();
 		}
-		Ok(())
-	});
-	cleanup_if_unused(&key, &queue);
-	// Convert a normal wake into `ETIMEDOUT` if the timer has expired
-	if res.is_ok()
-		&& let Some(deadline) = deadline
+		return Err(e);
+	}
+	schedule();
+	if !dequeue(&proc) {
+		// Woken up by a futex operation
+		return Ok(());
+	}
+	if proc.has_pending_signal() {
+		return Err(errno!(EINTR));
+	}
+	if let Some(deadline) = deadline
 		&& current_time_ns(clock) >= deadline
 	{
 		return Err(errno!(ETIMEDOUT));
 	}
-	res
+	// Spurious wake up
+	Ok(())
 }
 
 /// Performs `FUTEX_WAKE` / `FUTEX_WAKE_BITSET`.
-fn do_wake(uaddr: *mut u32, val: u32) -> EResult<usize> {
+fn do_wake(uaddr: *mut u32, val: u32, bitset: u32) -> EResult<usize> {
 	user_word(uaddr)?;
+	if unlikely(bitset == 0) {
+		return Err(errno!(EINVAL));
+	}
 	let key = make_key(uaddr as usize);
-	let Some(queue) = lookup(&key) else {
-		return Ok(0);
+	Ok(wake(&key, val as usize, bitset))
+}
+
+/// Performs `FUTEX_REQUEUE` / `FUTEX_CMP_REQUEUE`.
+///
+/// If `cmpval` is specified, the operation fails with [`errno::EAGAIN`] if `*uaddr` does not
+/// equal it.
+fn do_requeue(
+	uaddr: *mut u32,
+	uaddr2: *mut u32,
+	nr_wake: u32,
+	nr_requeue: u32,
+	cmpval: Option<u32>,
+) -> EResult<usize> {
+	let user = user_word(uaddr)?;
+	user_word(uaddr2)?;
+	if unlikely((nr_wake as c_int) < 0 || (nr_requeue as c_int) < 0) {
+		return Err(errno!(EINVAL));
+	}
+	// The value is checked before locking buckets, since page faults cannot be handled while
+	// they are locked. Waiters check the value after queueing, so a concurrent change is still
+	// noticed by them.
+	if let Some(cmpval) = cmpval {
+		let cur = user.copy_from_user()?.ok_or_else(|| errno!(EFAULT))?;
+		if cur != cmpval {
+			return Err(errno!(EAGAIN));
+		}
+	}
+	let from = make_key(uaddr as usize);
+	let to = make_key(uaddr2 as usize);
+	let (nr_wake, nr_requeue) = (nr_wake as usize, nr_requeue as usize);
+	let (a, b) = (from.bucket(), to.bucket());
+	if a == b {
+		let mut bucket = BUCKETS[a].lock();
+		return Ok(requeue_in(
+			&mut bucket,
+			None,
+			&from,
+			&to,
+			nr_wake,
+			nr_requeue,
+		));
+	}
+	// To avoid deadlocks, buckets are always locked in the same order. Guards are dropped in
+	// reverse order, which restores the interrupt state correctly
+	let mut first = BUCKETS[a.min(b)].lock();
+	let mut second = BUCKETS[a.max(b)].lock();
+	let (src, dst) = if a < b {
+		(&mut *first, &mut *second)
+	} else {
+		(&mut *second, &mut *first)
 	};
-	let woken = queue.wake_n(val as usize);
-	cleanup_if_unused(&key, &queue);
-	Ok(woken)
+	Ok(requeue_in(src, Some(dst), &from, &to, nr_wake, nr_requeue))
+}
+
+/// A decoded `FUTEX_WAKE_OP` operation.
+struct WakeOp {
+	/// The operation to apply on `*uaddr2`
+	op: u32,
+	/// The operand of the operation
+	oparg: u32,
+	/// The comparison to perform on the previous value of `*uaddr2`
+	cmp: u32,
+	/// The operand of the comparison
+	cmparg: i32,
+}
+
+impl WakeOp {
+	/// Decodes the operation from the `val3` argument of the system call.
+	fn decode(val3: u32) -> EResult<Self> {
+		let op = val3 >> 28;
+		let cmp = (val3 >> 24) & 0xf;
+		// Both arguments are sign-extended 12-bit values
+		let mut oparg = ((val3 << 8) as i32 >> 20) as u32;
+		let cmparg = (val3 << 20) as i32 >> 20;
+		if op & FUTEX_OP_OPARG_SHIFT != 0 {
+			oparg = 1 << (oparg & 31);
+		}
+		let op = op & !FUTEX_OP_OPARG_SHIFT;
+		if unlikely(op > FUTEX_OP_XOR || cmp > FUTEX_OP_CMP_GE) {
+			return Err(errno!(ENOSYS));
+		}
+		Ok(Self {
+			op,
+			oparg,
+			cmp,
+			cmparg,
+		})
+	}
+
+	/// Returns the result of the operation on `old`.
+	fn apply(&self, old: u32) -> u32 {
+		match self.op {
+			FUTEX_OP_SET => self.oparg,
+			FUTEX_OP_ADD => old.wrapping_add(self.oparg),
+			FUTEX_OP_OR => old | self.oparg,
+			FUTEX_OP_ANDN => old & !self.oparg,
+			FUTEX_OP_XOR => old ^ self.oparg,
+			_ => unreachable!(),
+		}
+	}
+
+	/// Tells whether `old` passes the comparison.
+	fn compare(&self, old: u32) -> bool {
+		let old = old as i32;
+		match self.cmp {
+			FUTEX_OP_CMP_EQ => old == self.cmparg,
+			FUTEX_OP_CMP_NE => old != self.cmparg,
+			FUTEX_OP_CMP_LT => old < self.cmparg,
+			FUTEX_OP_CMP_LE => old <= self.cmparg,
+			FUTEX_OP_CMP_GT => old > self.cmparg,
+			FUTEX_OP_CMP_GE => old >= self.cmparg,
+			_ => unreachable!(),
+		}
+	}
+}
+
+/// Performs `FUTEX_WAKE_OP`.
+fn do_wake_op(
+	uaddr: *mut u32,
+	uaddr2: *mut u32,
+	nr_wake: u32,
+	nr_wake2: u32,
+	val3: u32,
+) -> EResult<usize> {
+	user_word(uaddr)?;
+	let user2 = user_word(uaddr2)?;
+	let op = WakeOp::decode(val3)?;
+	// Apply the operation atomically, retrying until no concurrent change happened
+	let mut old = 0;
+	loop {
+		let cur = user2.compare_exchange(old, op.apply(old))?;
+		if cur == old {
+			break;
+		}
+		old = cur;
+	}
+	let mut count = wake(
+		&make_key(uaddr as usize),
+		nr_wake as usize,
+		FUTEX_BITSET_MATCH_ANY,
+	);
+	if op.compare(old) {
+		count += wake(
+			&make_key(uaddr2 as usize),
+			nr_wake2 as usize,
+			FUTEX_BITSET_MATCH_ANY,
+		);
+	}
+	Ok(count)
 }
 
 /// Common dispatch for `futex`, parameterized on the timespec ABI.
 ///
-/// `timeout_ns` returns the timespec at the given userspace pointer in nanoseconds.
+/// `timeout_ns` returns the timespec at the given userspace pointer in nanoseconds. For
+/// operations that take no timeout, the pointer is reinterpreted as the integer `val2`.
 fn do_futex(
 	uaddr: *mut u32,
 	op: c_int,
 	val: u32,
 	timeout_ns: impl FnOnce() -> EResult<Timestamp>,
+	val2: u32,
+	uaddr2: *mut u32,
+	val3: u32,
 ) -> EResult<usize> {
 	let cmd = op & FUTEX_CMD_MASK;
 	let clock = if op & FUTEX_CLOCK_REALTIME != 0 {
@@ -178,7 +514,7 @@ fn do_futex(
 	match cmd {
 		FUTEX_WAIT => {
 			let delay = timeout_ns()?;
-			do_wait(uaddr, val, Clock::Monotonic, delay)?;
+			do_wait(uaddr, val, FUTEX_BITSET_MATCH_ANY, Clock::Monotonic, delay)?;
 			Ok(0)
 		}
 		FUTEX_WAIT_BITSET => {
@@ -192,10 +528,14 @@ fn do_futex(
 					ts - now
 				}
 			};
-			do_wait(uaddr, val, clock, delay)?;
+			do_wait(uaddr, val, val3, clock, delay)?;
 			Ok(0)
 		}
-		FUTEX_WAKE | FUTEX_WAKE_BITSET => do_wake(uaddr, val),
+		FUTEX_WAKE => do_wake(uaddr, val, FUTEX_BITSET_MATCH_ANY),
+		FUTEX_WAKE_BITSET => do_wake(uaddr, val, val3),
+		FUTEX_REQUEUE => do_requeue(uaddr, uaddr2, val, val2, None),
+		FUTEX_CMP_REQUEUE => do_requeue(uaddr, uaddr2, val, val2, Some(val3)),
+		FUTEX_WAKE_OP => do_wake_op(uaddr, uaddr2, val, val2, val3),
 		_ => Err(errno!(ENOSYS)),
 	}
 }
@@ -206,15 +546,24 @@ pub fn futex(
 	op: c_int,
 	val: u32,
 	timeout: UserPtr<Timespec32>,
-	_uaddr2: *mut u32,
-	_val3: u32,
+	uaddr2: *mut u32,
+	val3: u32,
 ) -> EResult<usize> {
-	do_futex(uaddr, op, val, || {
-		Ok(timeout
-			.copy_from_user()?
-			.map(|ts| ts.to_nano())
-			.unwrap_or(0))
-	})
+	let val2 = timeout.as_ptr() as usize as u32;
+	do_futex(
+		uaddr,
+		op,
+		val,
+		|| {
+			Ok(timeout
+				.copy_from_user()?
+				.map(|ts| ts.to_nano())
+				.unwrap_or(0))
+		},
+		val2,
+		uaddr2,
+		val3,
+	)
 }
 
 /// 64-bit ABI: `timeout` points to a [`Timespec`].
@@ -223,13 +572,22 @@ pub fn futex_time64(
 	op: c_int,
 	val: u32,
 	timeout: UserPtr<Timespec>,
-	_uaddr2: *mut u32,
-	_val3: u32,
+	uaddr2: *mut u32,
+	val3: u32,
 ) -> EResult<usize> {
-	do_futex(uaddr, op, val, || {
-		Ok(timeout
-			.copy_from_user()?
-			.map(|ts| ts.to_nano())
-			.unwrap_or(0))
-	})
+	let val2 = timeout.as_ptr() as usize as u32;
+	do_futex(
+		uaddr,
+		op,
+		val,
+		|| {
+			Ok(timeout
+				.copy_from_user()?
+				.map(|ts| ts.to_nano())
+				.unwrap_or(0))
+		},
+		val2,
+		uaddr2,
+		val3,
+	)
 }
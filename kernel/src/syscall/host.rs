@@ -23,7 +23,7 @@ use crate::{
 	arch::ARCH,
 	file::perm::is_privileged,
 	memory::{
-		stats::MEM_INFO,
+		stats,
 		user::{UserPtr, UserSlice},
 	},
 	power,
@@ -123,7 +123,7 @@ pub struct Sysinfo {
 }
 
 pub fn sysinfo(info: UserPtr<Sysinfo>) -> EResult<usize> {
-	let mem_info = MEM_INFO.lock().clone();
+	let mem_info = stats::mem_info();
 	info.copy_to_user(&Sysinfo {
 		uptime: current_time_sec(Clock::Boottime) as _,
 		loads: [0; 3], // TODO
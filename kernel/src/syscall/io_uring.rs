@@ -0,0 +1,120 @@
+/*
+ * Copyright 2026 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! The `io_uring` system calls allow to submit I/O operations in batches, and to complete them
+//! asynchronously.
+
+use crate::{
+	file::{
+		File, FileType, O_RDWR,
+		fd::{FD_CLOEXEC, fd_to_file},
+		fs::float,
+		uring::{
+			IORING_ENTER_GETEVENTS, IORING_SETUP_CLAMP, IORING_SETUP_CQSIZE, IoUring, MAX_ENTRIES,
+			Params,
+		},
+	},
+	memory::user::UserPtr,
+	process::Process,
+};
+use core::{
+	ffi::{c_uint, c_void},
+	hint::unlikely,
+};
+use utils::{errno, errno::EResult};
+
+pub fn io_uring_setup(entries: u32, params: UserPtr<Params>) -> EResult<usize> {
+	let mut p = params.copy_from_user()?.ok_or_else(|| errno!(EFAULT))?;
+	if unlikely(p.flags & !(IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP) != 0) {
+		return Err(errno!(EINVAL));
+	}
+	let clamp = p.flags & IORING_SETUP_CLAMP != 0;
+	// Compute the sizes of the queues
+	if unlikely(entries == 0 || (entries > MAX_ENTRIES && !clamp)) {
+		return Err(errno!(EINVAL));
+	}
+	let sq_entries = entries.min(MAX_ENTRIES).next_power_of_two();
+	let cq_entries = if p.flags & IORING_SETUP_CQSIZE != 0 {
+		let max = MAX_ENTRIES * 2;
+		if unlikely(p.cq_entries == 0 || (p.cq_entries > max && !clamp)) {
+			return Err(errno!(EINVAL));
+		}
+		let cq_entries = p.cq_entries.min(max).next_power_of_two();
+		if unlikely(cq_entries < sq_entries) {
+			return Err(errno!(EINVAL));
+		}
+		cq_entries
+	} else {
+		sq_entries * 2
+	};
+	let ring = IoUring::new(sq_entries, cq_entries)?;
+	let proc = Process::current();
+	let mem_space = proc.mem_space();
+	ring.map(mem_space, &mut p)?;
+	let res = (|| {
+		let entry = float::get_entry(ring, FileType::Regular)?;
+		let file = File::open_floating(entry, O_RDWR)?;
+		let (fd, _) = proc.file_descriptors().lock().create_fd(FD_CLOEXEC, file)?;
+		params.copy_to_user(&p)?;
+		Ok(fd)
+	})();
+	match res {
+		Ok(fd) => Ok(fd as _),
+		Err(e) => {
+			let _ = IoUring::unmap(mem_space, &p);
+			Err(e)
+		}
+	}
+}
+
+pub fn io_uring_enter(
+	fd: c_uint,
+	to_submit: u32,
+	min_complete: u32,
+	flags: u32,
+	sig: *mut c_void,
+	_sigsz: usize,
+) -> EResult<usize> {
+	// Swapping the signal mask while waiting is not supported
+	if unlikely(!sig.is_null()) {
+		return Err(errno!(EINVAL));
+	}
+	if unlikely(flags & !IORING_ENTER_GETEVENTS != 0) {
+		return Err(errno!(EINVAL));
+	}
+	let file = fd_to_file(fd as _)?;
+	let ring = file
+		.get_buffer::<IoUring>()
+		.ok_or_else(|| errno!(EOPNOTSUPP))?;
+	let submitted = ring.submit(to_submit)?;
+	if flags & IORING_ENTER_GETEVENTS != 0 {
+		ring.wait(min_complete)?;
+	}
+	Ok(submitted as _)
+}
+
+pub fn io_uring_register(
+	_fd: c_uint,
+	_opcode: c_uint,
+	_arg: *mut c_void,
+	_nr_args: c_uint,
+) -> EResult<usize> {
+	// Registered buffers and files are not supported. Requests referencing them are rejected at
+	// submission
+	Err(errno!(EINVAL))
+}
@@ -110,8 +110,12 @@ pub fn mincore(addr: VirtAddr, length: usize, vec: *mut u8) -> EResult<usize> {
 	Ok(0)
 }
 
-pub fn madvise(_addr: VirtAddr, _length: usize, _advice: c_int) -> EResult<usize> {
-	// TODO
+pub fn madvise(addr: VirtAddr, length: usize, advice: c_int) -> EResult<usize> {
+	if unlikely(!addr.is_aligned_to(PAGE_SIZE)) {
+		return Err(errno!(EINVAL));
+	}
+	let pages = length.div_ceil(PAGE_SIZE);
+	Process::current().mem_space().advise(addr, pages, advice)?;
 	Ok(0)
 }
 
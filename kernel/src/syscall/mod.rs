@@ -22,13 +22,15 @@
 //! command: `man 2 <syscall>`
 
 mod dirent;
+mod epoll;
 mod execve;
 mod fcntl;
 mod fd;
 mod fs;
-mod futex;
+pub mod futex;
 mod getrandom;
 mod host;
+mod io_uring;
 pub mod ioctl;
 mod mem;
 mod module;
@@ -38,6 +40,7 @@ mod process;
 pub mod select;
 mod signal;
 mod socket;
+mod splice;
 mod stat;
 mod sync;
 mod time;
@@ -57,6 +60,7 @@ use crate::{
 	},
 	syscall::{
 		dirent::{getdents, getdents64},
+		epoll::{epoll_create, epoll_create1, epoll_ctl, epoll_pwait, epoll_pwait2, epoll_wait},
 		execve::execve,
 		execve::execveat,
 		fcntl::{fcntl, fcntl64},
@@ -74,16 +78,17 @@ use crate::{
 		futex::{futex, futex_time64},
 		getrandom::getrandom,
 		host::{reboot, sethostname, sysinfo, uname},
+		io_uring::{io_uring_enter, io_uring_register, io_uring_setup},
 		ioctl::ioctl,
 		mem::{brk, madvise, mincore, mmap, mmap2, mprotect, munmap},
 		module::{delete_module, finit_module, init_module},
 		mount::{mount, umount, umount2},
 		pipe::{pipe, pipe2},
 		process::{
-			_exit, arch_prctl, clone, compat_clone, exit_group, fork, getpgid, getpid, getppid,
-			getpriority, getrusage, gettid, membarrier, nice, prctl, prlimit64, sched_getaffinity,
-			sched_setaffinity, sched_yield, set_thread_area, set_tid_address, setpgid,
-			setpriority, vfork,
+			_exit, arch_prctl, clone, compat_clone, exit_group, fork, getcpu, getpgid, getpid,
+			getppid, getpriority, getrusage, gettid, membarrier, nice, prctl, prlimit64,
+			sched_getaffinity, sched_setaffinity, sched_yield, set_thread_area, set_tid_address,
+			setpgid, setpriority, vfork,
 		},
 		select::{_newselect, poll, pselect6, select},
 		signal::{
@@ -94,14 +99,15 @@ use crate::{
 			bind, connect, getsockname, getsockopt, sendto, setsockopt, shutdown, socket,
 			socketpair,
 		},
+		splice::{compat_sendfile, sendfile, sendfile64, splice, tee, vmsplice},
 		stat::{
 			fstat, fstat64, fstatat64, fstatfs, fstatfs64, lstat, lstat64, newfstatat, oldfstat,
 			oldlstat, oldstat, stat, stat64, statfs, statfs64, statx,
 		},
 		sync::{fdatasync, fsync, msync, sync, syncfs},
 		time::{
-			clock_gettime, clock_gettime64, nanosleep32, nanosleep64, time32, time64,
-			timer_create, timer_delete, timer_settime, timer_settime64,
+			clock_gettime, clock_gettime64, gettimeofday, nanosleep32, nanosleep64, time32,
+			time64, timer_create, timer_delete, timer_settime, timer_settime64,
 		},
 		user::{
 			getegid, geteuid, getgid, getgroups, getgroups32, getresgid, getresuid, getuid,
@@ -109,6 +115,8 @@ use crate::{
 		},
 		wait::{wait4, waitpid},
 	},
+	trace,
+	trace::Kind,
 };
 use core::{fmt, hint::unlikely, ptr};
 use utils::{
@@ -443,7 +451,7 @@ fn do_syscall32(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x0b8 => syscall!(capget, frame),
 		// TODO 0x0b9 => syscall!(capset, frame),
 		0x0ba => syscall!(compat_sigaltstack, frame),
-		// TODO 0x0bb => syscall!(sendfile, frame),
+		0x0bb => syscall!(compat_sendfile, frame),
 		// 0x0bc: unimplemented (getpmsg),
 		// 0x0bd: unimplemented (putpmsg),
 		0x0be => syscall!(vfork, frame),
@@ -493,7 +501,7 @@ fn do_syscall32(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x0ec => syscall!(lremovexattr, frame),
 		// TODO 0x0ed => syscall!(fremovexattr, frame),
 		0x0ee => syscall!(tkill, frame),
-		// TODO 0x0ef => syscall!(sendfile64, frame),
+		0x0ef => syscall!(sendfile64, frame),
 		0x0f0 => syscall!(futex, frame),
 		0x0f1 => syscall!(sched_setaffinity, frame),
 		0x0f2 => syscall!(sched_getaffinity, frame),
@@ -507,9 +515,9 @@ fn do_syscall32(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x0fa => syscall!(fadvise64, frame),
 		0x0fc => syscall!(exit_group, frame),
 		// TODO 0x0fd => syscall!(lookup_dcookie, frame),
-		// TODO 0x0fe => syscall!(epoll_create, frame),
-		// TODO 0x0ff => syscall!(epoll_ctl, frame),
-		// TODO 0x100 => syscall!(epoll_wait, frame),
+		0x0fe => syscall!(epoll_create, frame),
+		0x0ff => syscall!(epoll_ctl, frame),
+		0x100 => syscall!(epoll_wait, frame),
 		// TODO 0x101 => syscall!(remap_file_pages, frame),
 		0x102 => syscall!(set_tid_address, frame),
 		0x103 => syscall!(timer_create, frame),
@@ -565,13 +573,13 @@ fn do_syscall32(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x136 => syscall!(unshare, frame),
 		// TODO 0x137 => syscall!(set_robust_list, frame),
 		// TODO 0x138 => syscall!(get_robust_list, frame),
-		// TODO 0x139 => syscall!(splice, frame),
+		0x139 => syscall!(splice, frame),
 		// TODO 0x13a => syscall!(sync_file_range, frame),
-		// TODO 0x13b => syscall!(tee, frame),
-		// TODO 0x13c => syscall!(vmsplice, frame),
+		0x13b => syscall!(tee, frame),
+		0x13c => syscall!(vmsplice, frame),
 		// TODO 0x13d => syscall!(move_pages, frame),
-		// TODO 0x13e => syscall!(getcpu, frame),
-		// TODO 0x13f => syscall!(epoll_pwait, frame),
+		0x13e => syscall!(getcpu, frame),
+		0x13f => syscall!(epoll_pwait, frame),
 		0x140 => syscall!(utimensat, frame),
 		// TODO 0x141 => syscall!(signalfd, frame),
 		// TODO 0x142 => syscall!(timerfd_create, frame),
@@ -581,7 +589,7 @@ fn do_syscall32(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x146 => syscall!(timerfd_gettime, frame),
 		// TODO 0x147 => syscall!(signalfd4, frame),
 		// TODO 0x148 => syscall!(eventfd2, frame),
-		// TODO 0x149 => syscall!(epoll_create1, frame),
+		0x149 => syscall!(epoll_create1, frame),
 		// TODO 0x14a => syscall!(dup3, frame),
 		0x14b => syscall!(pipe2, frame),
 		// TODO 0x14c => syscall!(inotify_init1, frame),
@@ -670,9 +678,9 @@ fn do_syscall32(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		0x1a6 => syscall!(futex_time64, frame),
 		// TODO 0x1a7 => syscall!(sched_rr_get_interval_time64, frame),
 		// TODO 0x1a8 => syscall!(pidfd_send_signal, frame),
-		// TODO 0x1a9 => syscall!(io_uring_setup, frame),
-		// TODO 0x1aa => syscall!(io_uring_enter, frame),
-		// TODO 0x1ab => syscall!(io_uring_register, frame),
+		0x1a9 => syscall!(io_uring_setup, frame),
+		0x1aa => syscall!(io_uring_enter, frame),
+		0x1ab => syscall!(io_uring_register, frame),
 		// TODO 0x1ac => syscall!(open_tree, frame),
 		// TODO 0x1ad => syscall!(move_mount, frame),
 		// TODO 0x1ae => syscall!(fsopen, frame),
@@ -686,7 +694,7 @@ fn do_syscall32(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x1b6 => syscall!(pidfd_getfd, frame),
 		0x1b7 => syscall!(faccessat2, frame),
 		// TODO 0x1b8 => syscall!(process_madvise, frame),
-		// TODO 0x1b9 => syscall!(epoll_pwait2, frame),
+		0x1b9 => syscall!(epoll_pwait2, frame),
 		// TODO 0x1ba => syscall!(mount_setattr, frame),
 		// TODO 0x1bb => syscall!(quotactl_fd, frame),
 		// TODO 0x1bc => syscall!(landlock_create_ruleset, frame),
@@ -744,7 +752,7 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x025 => syscall!(alarm, frame),
 		// TODO 0x026 => syscall!(setitimer, frame),
 		0x027 => syscall!(getpid, frame),
-		// TODO 0x028 => syscall!(sendfile, frame),
+		0x028 => syscall!(sendfile, frame),
 		0x029 => syscall!(socket, frame),
 		0x02a => syscall!(connect, frame),
 		// TODO 0x02b => syscall!(accept, frame),
@@ -800,7 +808,7 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		0x05d => syscall!(fchown, frame),
 		0x05e => syscall!(lchown, frame),
 		0x05f => syscall!(umask, frame),
-		// TODO 0x060 => syscall!(gettimeofday, frame),
+		0x060 => syscall!(gettimeofday, frame),
 		// TODO 0x061 => syscall!(getrlimit, frame),
 		0x062 => syscall!(getrusage, frame),
 		0x063 => syscall!(sysinfo, frame),
@@ -917,7 +925,7 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x0d2 => syscall!(io_cancel, frame),
 		// TODO 0x0d3 => syscall!(get_thread_are, frame),
 		// TODO 0x0d4 => syscall!(lookup_dcooki, frame),
-		// TODO 0x0d5 => syscall!(epoll_create, frame),
+		0x0d5 => syscall!(epoll_create, frame),
 		// TODO 0x0d6 => syscall!(epoll_ctl_ol, frame),
 		// TODO 0x0d7 => syscall!(epoll_wait_ol, frame),
 		// TODO 0x0d8 => syscall!(remap_file_pages, frame),
@@ -925,7 +933,7 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		0x0da => syscall!(set_tid_address, frame),
 		// TODO 0x0db => syscall!(restart_syscall, frame),
 		// TODO 0x0dc => syscall!(semtimedop, frame),
-		// TODO 0x0dd => syscall!(fadvise64, frame),
+		0x0dd => syscall!(fadvise64_64, frame),
 		0x0de => syscall!(timer_create, frame),
 		0x0df => syscall!(timer_settime64, frame),
 		// TODO 0x0e0 => syscall!(timer_gettime, frame),
@@ -936,8 +944,8 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x0e5 => syscall!(clock_getres, frame),
 		// TODO 0x0e6 => syscall!(clock_nanosleep, frame),
 		0x0e7 => syscall!(exit_group, frame),
-		// TODO 0x0e8 => syscall!(epoll_wait, frame),
-		// TODO 0x0e9 => syscall!(epoll_ctl, frame),
+		0x0e8 => syscall!(epoll_wait, frame),
+		0x0e9 => syscall!(epoll_ctl, frame),
 		// TODO 0x0ea => syscall!(tgkill, frame),
 		0x0eb => syscall!(utimes, frame),
 		// TODO 0x0ec => syscall!(vserver, frame),
@@ -979,13 +987,13 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x110 => syscall!(unshare, frame),
 		// TODO 0x111 => syscall!(set_robust_list, frame),
 		// TODO 0x112 => syscall!(get_robust_list, frame),
-		// TODO 0x113 => syscall!(splice, frame),
-		// TODO 0x114 => syscall!(tee, frame),
+		0x113 => syscall!(splice, frame),
+		0x114 => syscall!(tee, frame),
 		// TODO 0x115 => syscall!(sync_file_range, frame),
-		// TODO 0x116 => syscall!(vmsplice, frame),
+		0x116 => syscall!(vmsplice, frame),
 		// TODO 0x117 => syscall!(move_pages, frame),
 		0x118 => syscall!(utimensat, frame),
-		// TODO 0x119 => syscall!(epoll_pwait, frame),
+		0x119 => syscall!(epoll_pwait, frame),
 		// TODO 0x11a => syscall!(signalfd, frame),
 		// TODO 0x11b => syscall!(timerfd_create, frame),
 		// TODO 0x11c => syscall!(eventfd, frame),
@@ -995,7 +1003,7 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x120 => syscall!(accept4, frame),
 		// TODO 0x121 => syscall!(signalfd4, frame),
 		// TODO 0x122 => syscall!(eventfd2, frame),
-		// TODO 0x123 => syscall!(epoll_create1, frame),
+		0x123 => syscall!(epoll_create1, frame),
 		// TODO 0x124 => syscall!(dup3, frame),
 		0x125 => syscall!(pipe2, frame),
 		// TODO 0x126 => syscall!(inotify_init1, frame),
@@ -1013,7 +1021,7 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		0x132 => syscall!(syncfs, frame),
 		// TODO 0x133 => syscall!(sendmmsg, frame),
 		// TODO 0x134 => syscall!(setns, frame),
-		// TODO 0x135 => syscall!(getcpu, frame),
+		0x135 => syscall!(getcpu, frame),
 		// TODO 0x136 => syscall!(process_vm_readv, frame),
 		// TODO 0x137 => syscall!(process_vm_writev, frame),
 		// TODO 0x138 => syscall!(kcmp, frame),
@@ -1040,9 +1048,9 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x14d => syscall!(io_pgetevents, frame),
 		// TODO 0x14e => syscall!(rseq, frame),
 		// TODO 0x1a8 => syscall!(pidfd_send_signal, frame),
-		// TODO 0x1a9 => syscall!(io_uring_setup, frame),
-		// TODO 0x1aa => syscall!(io_uring_enter, frame),
-		// TODO 0x1ab => syscall!(io_uring_register, frame),
+		0x1a9 => syscall!(io_uring_setup, frame),
+		0x1aa => syscall!(io_uring_enter, frame),
+		0x1ab => syscall!(io_uring_register, frame),
 		// TODO 0x1ac => syscall!(open_tree, frame),
 		// TODO 0x1ad => syscall!(move_mount, frame),
 		// TODO 0x1ae => syscall!(fsopen, frame),
@@ -1056,7 +1064,7 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 		// TODO 0x1b6 => syscall!(pidfd_getfd, frame),
 		0x1b7 => syscall!(faccessat2, frame),
 		// TODO 0x1b8 => syscall!(process_madvise, frame),
-		// TODO 0x1b9 => syscall!(epoll_pwait2, frame),
+		0x1b9 => syscall!(epoll_pwait2, frame),
 		// TODO 0x1ba => syscall!(mount_setattr, frame),
 		// TODO 0x1bb => syscall!(quotactl_fd, frame),
 		// TODO 0x1bc => syscall!(landlock_create_ruleset, frame),
@@ -1080,6 +1088,7 @@ fn do_syscall64(id: usize, frame: &mut IntFrame) -> EResult<usize> {
 #[unsafe(no_mangle)]
 pub extern "C" fn syscall_handler(frame: &mut IntFrame) {
 	let id = frame.get_syscall_id();
+	trace::event(Kind::SyscallEnter, id as _, 0);
 	#[cfg(target_arch = "x86")]
 	let res = do_syscall32(id, frame);
 	#[cfg(target_arch = "x86_64")]
@@ -1089,6 +1098,11 @@ pub extern "C" fn syscall_handler(frame: &mut IntFrame) {
 		do_syscall64(id, frame)
 	};
 	frame.set_syscall_return(res);
+	let ret = match res {
+		Ok(val) => val as u64,
+		Err(e) => (-e.as_int() as i64) as u64,
+	};
+	trace::event(Kind::SyscallExit, id as _, ret);
 	// If the system call does not exist, kill the process with SIGSYS
 	if unlikely(matches!(res, Err(e) if e.as_int() == ENOSYS)) {
 		let proc = Process::current();
@@ -21,7 +21,10 @@
 #[cfg(target_arch = "x86_64")]
 use crate::{arch::x86, syscall::FromSyscallArg};
 use crate::{
-	arch::x86::{cli, gdt, idt::IntFrame},
+	arch::{
+		core_id,
+		x86::{cli, gdt, idt::IntFrame},
+	},
 	file::perm::{can_kill, is_privileged},
 	memory::user::{UserPtr, UserSlice},
 	process,
@@ -29,6 +32,7 @@ use crate::{
 		ForkOptions, PROCESS_FLAG_LINUX, Process, State,
 		pid::Pid,
 		rusage::Rusage,
+		scheduler,
 		scheduler::{
 			cpu::{CPU, iter_online},
 			defer, schedule,
@@ -37,7 +41,8 @@ use crate::{
 	},
 };
 use core::{
-	ffi::{c_int, c_ulong, c_void},
+	cmp::min,
+	ffi::{c_int, c_uint, c_ulong, c_void},
 	hint::unlikely,
 	ptr::null_mut,
 	sync::atomic::{
@@ -263,8 +268,14 @@ pub fn compat_clone(
 		},
 	)?;
 	if flags & CLONE_VFORK != 0 {
-		while !child.is_vfork_done() {
+		loop {
+			// Put to sleep before checking to make sure the child does not try to wake us up
+			// before we sleep
 			process::set_state(State::Sleeping);
+			if child.is_vfork_done() {
+				process::cancel_sleep();
+				break;
+			}
 			schedule();
 		}
 	}
@@ -394,7 +405,7 @@ pub fn prctl(op: c_int, arg0: usize, arg1: usize, arg2: usize, arg3: usize) -> E
 pub fn getrusage(who: c_int, usage: UserPtr<Rusage>) -> EResult<usize> {
 	let proc = Process::current();
 	let rusage = match who {
-		RUSAGE_SELF => proc.rusage.lock().clone(),
+		RUSAGE_SELF => proc.rusage.get(),
 		RUSAGE_CHILDREN => {
 			// TODO Return resources of terminated children
 			Rusage::default()
@@ -515,29 +526,28 @@ pub fn sched_getaffinity(pid: Pid, cpusetsize: usize, mask: *mut AtomicUsize) ->
 	} else {
 		Process::get_by_pid(pid).ok_or_else(|| errno!(ESRCH))?
 	};
+	// The mask must be large enough to hold a bit for each CPU
+	if unlikely(cpusetsize * 8 < CPU.len() || cpusetsize % size_of::<usize>() != 0) {
+		return Err(errno!(EINVAL));
+	}
 	// Check pointer
-	let slice = UserSlice::from_user(mask, cpusetsize)?;
+	let len = min(cpusetsize / size_of::<usize>(), proc.affinity.len());
+	let slice = UserSlice::from_user(mask, len)?;
 	if unlikely(slice.is_null()) {
 		return Err(errno!(EFAULT));
 	}
 	// Copy
-	let len = slice.copy_to_user(0, &proc.affinity)?;
-	Ok(len)
+	let len = slice.copy_to_user(0, &proc.affinity[..len])?;
+	Ok(len * size_of::<usize>())
 }
 
+/// Tells whether `mask` allows at least one CPU on the system.
 fn is_valid_affinity_mask(mask: &[usize]) -> bool {
-	let mut iter = mask.iter().rev();
-	// Check last unit (special case since it may not be used entirely)
-	let Some(last) = iter.next() else {
-		return true;
-	};
-	let bit_cnt = CPU.len() % usize::BITS as usize;
-	let mask = (1 << bit_cnt) - 1;
-	if *last & mask != 0 {
-		return true;
-	}
-	// Check remaining units
-	iter.any(|n| *n != 0)
+	(0..CPU.len()).any(|cpu| {
+		let unit = cpu / usize::BITS as usize;
+		let bit = cpu % usize::BITS as usize;
+		mask.get(unit).is_some_and(|n| n & (1 << bit) != 0)
+	})
 }
 
 pub fn sched_setaffinity(pid: Pid, cpusetsize: usize, mask: *mut usize) -> EResult<usize> {
@@ -556,7 +566,7 @@ pub fn sched_setaffinity(pid: Pid, cpusetsize: usize, mask: *mut usize) -> EResu
 		}
 	}
 	// Check pointer
-	let slice = UserSlice::from_user(mask, cpusetsize)?;
+	let slice = UserSlice::from_user(mask, cpusetsize / size_of::<usize>())?;
 	let Some(mask) = slice.copy_from_user_vec(0)? else {
 		return Err(errno!(EFAULT));
 	};
@@ -566,7 +576,14 @@ pub fn sched_setaffinity(pid: Pid, cpusetsize: usize, mask: *mut usize) -> EResu
 	}
 	// Copy
 	dst.affinity.copy_from(&mask);
-	// TODO if the process is not on a core that can run it anymore, migrate it
+	// If the process is not on a core that can run it anymore, migrate it
+	scheduler::affinity_changed(&dst);
+	Ok(0)
+}
+
+pub fn getcpu(cpu: UserPtr<c_uint>, node: UserPtr<c_uint>) -> EResult<usize> {
+	cpu.copy_to_user(&core_id())?;
+	node.copy_to_user(&0)?;
 	Ok(0)
 }
 
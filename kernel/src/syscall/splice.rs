@@ -0,0 +1,320 @@
+/*
+ * Copyright 2026 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! The `splice`, `tee`, `vmsplice` and `sendfile` system calls transfer data between files
+//! through pipes, referencing pages instead of copying their content whenever possible.
+
+use crate::{
+	file::{
+		File, O_APPEND, O_NONBLOCK,
+		fd::fd_to_file,
+		pipe::{PipeBuf, PipeBuffer},
+		socket::Socket,
+	},
+	memory::user::{UserIOVec, UserPtr, UserSlice},
+};
+use core::{
+	cmp::min,
+	ffi::{c_int, c_uint},
+	hint::unlikely,
+	ptr,
+	sync::atomic::Ordering::{Acquire, Release},
+};
+use utils::{errno, errno::EResult, limits::IOV_MAX};
+
+/// Hint: attempt to move pages instead of copying them.
+const SPLICE_F_MOVE: c_uint = 1;
+/// Do not block on pipe operations.
+const SPLICE_F_NONBLOCK: c_uint = 2;
+/// Hint: more data will be sent.
+const SPLICE_F_MORE: c_uint = 4;
+/// Hint: `vmsplice` may give the user pages to the pipe.
+const SPLICE_F_GIFT: c_uint = 8;
+/// The mask of all valid flags.
+const SPLICE_F_ALL: c_uint = SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT;
+
+/// Tells whether operations on the pipe `file` must not block, with the given `flags`.
+#[inline]
+fn is_nonblock(file: &File, flags: c_uint) -> bool {
+	flags & SPLICE_F_NONBLOCK != 0 || file.get_flags() & O_NONBLOCK != 0
+}
+
+/// Writes the content of `buf` to `file`, at offset `off`.
+fn write_buf(file: &File, off: u64, buf: &PipeBuf) -> EResult<usize> {
+	// Sockets reference the page instead of copying it
+	if let Some(sock) = file.get_buffer::<Socket>() {
+		return sock.send_page(buf.page(), buf.off(), buf.len());
+	}
+	let slice = unsafe { UserSlice::from_slice(buf.as_slice()) };
+	file.ops.write(file, off, slice)
+}
+
+/// Reads the offset pointed to by `off`.
+///
+/// If the pointer is null, the function returns `None`.
+fn read_off(off: &UserPtr<i64>) -> EResult<Option<u64>> {
+	match off.copy_from_user()? {
+		Some(o @ 0..) => Ok(Some(o as u64)),
+		Some(_) => Err(errno!(EINVAL)),
+		None => Ok(None),
+	}
+}
+
+pub fn splice(
+	fd_in: c_int,
+	off_in: UserPtr<i64>,
+	fd_out: c_int,
+	off_out: UserPtr<i64>,
+	len: usize,
+	flags: c_uint,
+) -> EResult<usize> {
+	if unlikely(flags & !SPLICE_F_ALL != 0) {
+		return Err(errno!(EINVAL));
+	}
+	let file_in = fd_to_file(fd_in)?;
+	let file_out = fd_to_file(fd_out)?;
+	if unlikely(!file_in.can_read() || !file_out.can_write()) {
+		return Err(errno!(EBADF));
+	}
+	if unlikely(len == 0) {
+		return Ok(0);
+	}
+	match (
+		file_in.get_buffer::<PipeBuffer>(),
+		file_out.get_buffer::<PipeBuffer>(),
+	) {
+		(Some(pipe_in), Some(pipe_out)) => {
+			if unlikely(!off_in.is_null() || !off_out.is_null()) {
+				return Err(errno!(ESPIPE));
+			}
+			if unlikely(ptr::eq(pipe_in, pipe_out)) {
+				return Err(errno!(EINVAL));
+			}
+			let nonblock = is_nonblock(&file_in, flags) || is_nonblock(&file_out, flags);
+			pipe_in.splice_to(pipe_out, len, nonblock)
+		}
+		(Some(pipe_in), None) => {
+			if unlikely(!off_in.is_null()) {
+				return Err(errno!(ESPIPE));
+			}
+			let user_off = read_off(&off_out)?;
+			if unlikely(user_off.is_some() && file_out.get_flags() & O_APPEND != 0) {
+				return Err(errno!(EINVAL));
+			}
+			let start = user_off.unwrap_or_else(|| file_out.get_offset());
+			let mut off = start;
+			let len = pipe_in.splice_out(len, is_nonblock(&file_in, flags), |buf, _| {
+				let len = write_buf(&file_out, off, buf)?;
+				off += len as u64;
+				Ok(len)
+			})?;
+			if user_off.is_some() {
+				off_out.copy_to_user(&(off as i64))?;
+			} else {
+				file_out.off.store(off, Release);
+			}
+			Ok(len)
+		}
+		(None, Some(pipe_out)) => {
+			if unlikely(!off_out.is_null()) {
+				return Err(errno!(ESPIPE));
+			}
+			let user_off = read_off(&off_in)?;
+			let start = user_off.unwrap_or_else(|| file_in.off.load(Acquire));
+			let len = min(len, i32::MAX as usize);
+			let nonblock = is_nonblock(&file_out, flags);
+			let len = file_in
+				.ops
+				.splice_read(&file_in, start, pipe_out, len, nonblock)?;
+			let off = start.saturating_add(len as u64);
+			if user_off.is_some() {
+				off_in.copy_to_user(&(off as i64))?;
+			} else {
+				file_in.off.store(off, Release);
+			}
+			Ok(len)
+		}
+		(None, None) => Err(errno!(EINVAL)),
+	}
+}
+
+pub fn tee(fd_in: c_int, fd_out: c_int, len: usize, flags: c_uint) -> EResult<usize> {
+	if unlikely(flags & !SPLICE_F_ALL != 0) {
+		return Err(errno!(EINVAL));
+	}
+	let file_in = fd_to_file(fd_in)?;
+	let file_out = fd_to_file(fd_out)?;
+	if unlikely(!file_in.can_read() || !file_out.can_write()) {
+		return Err(errno!(EBADF));
+	}
+	let (Some(pipe_in), Some(pipe_out)) = (
+		file_in.get_buffer::<PipeBuffer>(),
+		file_out.get_buffer::<PipeBuffer>(),
+	) else {
+		return Err(errno!(EINVAL));
+	};
+	if unlikely(ptr::eq(pipe_in, pipe_out)) {
+		return Err(errno!(EINVAL));
+	}
+	if unlikely(len == 0) {
+		return Ok(0);
+	}
+	let nonblock = is_nonblock(&file_in, flags) || is_nonblock(&file_out, flags);
+	pipe_in.tee(pipe_out, len, nonblock)
+}
+
+// TODO map user pages in the pipe instead of copying them (`SPLICE_F_GIFT`)
+pub fn vmsplice(fd: c_int, iov: UserIOVec, nr_segs: usize, flags: c_uint) -> EResult<usize> {
+	if unlikely(flags & !SPLICE_F_ALL != 0 || nr_segs > IOV_MAX) {
+		return Err(errno!(EINVAL));
+	}
+	let file = fd_to_file(fd)?;
+	let Some(pipe) = file.get_buffer::<PipeBuffer>() else {
+		return Err(errno!(EBADF));
+	};
+	let write = file.can_write();
+	if unlikely(!write && !file.can_read()) {
+		return Err(errno!(EBADF));
+	}
+	let nonblock = is_nonblock(&file, flags);
+	let mut total = 0;
+	for i in iov.iter(nr_segs) {
+		let i = i?;
+		// The size to transfer. This is limited to avoid an overflow on the total length
+		let len = min(i.iov_len, i32::MAX as usize - total);
+		let buf = UserSlice::<u8>::from_user(i.iov_base, len)?;
+		// Do not block once data has been transferred
+		let nonblock = nonblock || total > 0;
+		let res = if write {
+			pipe.write_user(buf, nonblock)
+		} else {
+			pipe.read_user(buf, nonblock)
+		};
+		let l = match res {
+			Ok(l) => l,
+			Err(e) if total == 0 => return Err(e),
+			Err(_) => break,
+		};
+		total += l;
+		if l < len {
+			break;
+		}
+	}
+	Ok(total)
+}
+
+/// Transfers up to `count` bytes from `in_fd` to `out_fd`, through a pipe.
+///
+/// If `off` is `None`, the input file's offset is used and updated.
+///
+/// The function returns the number of bytes transferred and the offset of the end of the
+/// transfer in the input file.
+fn do_sendfile(
+	out_fd: c_int,
+	in_fd: c_int,
+	off: Option<u64>,
+	count: usize,
+) -> EResult<(usize, u64)> {
+	let file_in = fd_to_file(in_fd)?;
+	let file_out = fd_to_file(out_fd)?;
+	if unlikely(!file_in.can_read() || !file_out.can_write()) {
+		return Err(errno!(EBADF));
+	}
+	if unlikely(file_out.get_flags() & O_APPEND != 0) {
+		return Err(errno!(EINVAL));
+	}
+	let count = min(count, i32::MAX as usize);
+	let mut in_off = off.unwrap_or_else(|| file_in.off.load(Acquire));
+	let mut out_off = file_out.get_offset();
+	let pipe = PipeBuffer::direct()?;
+	let mut total = 0;
+	while total < count {
+		let res = file_in
+			.ops
+			.splice_read(&file_in, in_off, &pipe, count - total, true);
+		let len = match res {
+			Ok(0) => break,
+			Ok(len) => len,
+			Err(e) if total == 0 => return Err(e),
+			Err(_) => break,
+		};
+		let res = pipe.splice_out(len, true, |buf, _| {
+			let len = write_buf(&file_out, out_off, buf)?;
+			out_off += len as u64;
+			Ok(len)
+		});
+		let written = match res {
+			Ok(written) => written,
+			Err(e) if total == 0 => return Err(e),
+			Err(_) => 0,
+		};
+		in_off += written as u64;
+		total += written;
+		// What has not been written remains in the pipe and is discarded
+		if written < len {
+			break;
+		}
+	}
+	if off.is_none() {
+		file_in.off.store(in_off, Release);
+	}
+	file_out.off.store(out_off, Release);
+	Ok((total, in_off))
+}
+
+pub fn sendfile(
+	out_fd: c_int,
+	in_fd: c_int,
+	offset: UserPtr<i64>,
+	count: usize,
+) -> EResult<usize> {
+	let off = read_off(&offset)?;
+	let (len, end) = do_sendfile(out_fd, in_fd, off, count)?;
+	if off.is_some() {
+		offset.copy_to_user(&(end as i64))?;
+	}
+	Ok(len)
+}
+
+pub fn compat_sendfile(
+	out_fd: c_int,
+	in_fd: c_int,
+	offset: UserPtr<i32>,
+	count: usize,
+) -> EResult<usize> {
+	let off = match offset.copy_from_user()? {
+		Some(o @ 0..) => Some(o as u64),
+		Some(_) => return Err(errno!(EINVAL)),
+		None => None,
+	};
+	let (len, end) = do_sendfile(out_fd, in_fd, off, count)?;
+	if off.is_some() {
+		let end = i32::try_from(end).map_err(|_| errno!(EOVERFLOW))?;
+		offset.copy_to_user(&end)?;
+	}
+	Ok(len)
+}
+
+pub fn sendfile64(
+	out_fd: c_int,
+	in_fd: c_int,
+	offset: UserPtr<i64>,
+	count: usize,
+) -> EResult<usize> {
+	sendfile(out_fd, in_fd, offset, count)
+}
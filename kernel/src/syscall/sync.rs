@@ -60,8 +60,7 @@ fn do_fsync(fd: c_int, metadata: bool) -> EResult<usize> {
 	let node = file.node();
 	node.sync_data()?;
 	if metadata {
-		// TODO sync only the file, not the whole filesystem
-		node.fs.ops.sync_fs()?;
+		node.sync_metadata()?;
 	}
 	Ok(0)
 }
@@ -29,7 +29,9 @@ use crate::{
 		clock::{Clock, current_time_ns, current_time_sec},
 		sleep_for,
 		timer::TimerManager,
-		unit::{ClockIdT, ITimerspec, ITimerspec32, TimeUnit, TimerT, Timespec, Timespec32},
+		unit::{
+			ClockIdT, ITimerspec, ITimerspec32, TimeUnit, TimerT, Timespec, Timespec32, Timeval,
+		},
 	},
 };
 use core::ffi::c_int;
@@ -51,6 +53,14 @@ pub fn time64(tloc: UserPtr<u64>) -> EResult<usize> {
 	Ok(time as _)
 }
 
+pub fn gettimeofday(tv: UserPtr<Timeval>, tz: UserPtr<[c_int; 2]>) -> EResult<usize> {
+	let ts = current_time_ns(Clock::Realtime);
+	tv.copy_to_user(&Timeval::from_nano(ts))?;
+	// The timezone is always UTC
+	tz.copy_to_user(&[0; 2])?;
+	Ok(0)
+}
+
 pub fn clock_gettime(clockid: ClockIdT, tp: UserPtr<Timespec>) -> EResult<usize> {
 	let clk = Clock::from_id(clockid).ok_or_else(|| errno!(EINVAL))?;
 	let ts = current_time_ns(clk);
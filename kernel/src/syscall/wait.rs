@@ -122,7 +122,7 @@ fn get_waitable(
 	};
 	// Write values back
 	wstatus.copy_to_user(&get_wstatus(&proc))?;
-	rusage.copy_to_user(&proc.rusage.lock())?;
+	rusage.copy_to_user(&proc.rusage.get())?;
 	// Remove zombie process if requested
 	let pid = proc.get_pid();
 	if options & WNOWAIT == 0 && proc.get_state() == State::Zombie {
@@ -19,13 +19,10 @@
 //! System clocks.
 
 use crate::{
-	sync::atomic::AtomicU64,
-	time::{Timestamp, unit::ClockIdT},
-};
-use core::{
-	cmp::max,
-	sync::atomic::Ordering::{Acquire, Relaxed, Release},
+	arch::x86::timer::tsc,
+	time::{Timestamp, unit::ClockIdT, vvar},
 };
+use core::cmp::max;
 
 /// Available clocks
 #[derive(Clone, Copy, Debug)]
@@ -68,28 +65,34 @@ impl Clock {
 	}
 }
 
-// TODO allow accessing clocks through an address shared with userspace (vDSO)
-
-/// The current timestamp of the real time clock, in nanoseconds.
-static REALTIME: AtomicU64 = AtomicU64::new(0);
-/// On time adjustment, this value is updated with the previous value of the real time clock so
-/// that it can be used if the clock went backwards in time.
-static MONOTONIC: AtomicU64 = AtomicU64::new(0);
-/// The time elapsed since boot time, in nanoseconds.
-static BOOTTIME: AtomicU64 = AtomicU64::new(0);
-
 /// Initializes clocks with the given value in nanoseconds.
 pub(crate) fn init(ts: Timestamp) {
-	REALTIME.store(ts, Relaxed);
-	MONOTONIC.store(ts, Relaxed);
-	BOOTTIME.store(ts, Relaxed);
+	vvar::write(|snap| {
+		snap.realtime = ts;
+		snap.monotonic = ts;
+		snap.boottime = ts;
+	});
 }
 
-/// Updates clocks with the given delta value in nanoseconds.
+/// Updates clocks at a clock tick.
+///
+/// `delta` is the time elapsed since the previous tick in nanoseconds. If the TSC is usable, it
+/// is used instead since it is more precise.
 pub fn update(delta: Timestamp) {
-	REALTIME.fetch_add(delta, Release);
-	MONOTONIC.fetch_add(delta, Release);
-	BOOTTIME.fetch_add(delta, Release);
+	vvar::write(|snap| {
+		let delta = if snap.tsc_enabled != 0 {
+			let elapsed = snap.elapsed();
+			snap.tsc_base = tsc::read();
+			elapsed
+		} else {
+			delta
+		};
+		snap.realtime += delta;
+		// On time adjustment, the monotonic clock keeps the previous value of the real time clock
+		// so that it does not go backwards
+		snap.monotonic = max(snap.monotonic + delta, snap.realtime);
+		snap.boottime += delta;
+	});
 }
 
 /// Returns the current timestamp in nanoseconds.
@@ -100,14 +103,13 @@ pub fn update(delta: Timestamp) {
 ///
 /// If the clock is invalid, the function returns an error.
 pub fn current_time_ns(clk: Clock) -> Timestamp {
+	let snap = vvar::read();
 	match clk {
-		Clock::Realtime | Clock::RealtimeAlarm => REALTIME.load(Acquire),
-		Clock::Monotonic => {
-			let realtime = REALTIME.load(Acquire);
-			let monotonic = MONOTONIC.load(Acquire);
-			max(realtime, monotonic)
-		}
-		Clock::Boottime | Clock::BoottimeAlarm => BOOTTIME.load(Acquire),
+		Clock::Realtime | Clock::RealtimeAlarm => snap.realtime + snap.elapsed(),
+		Clock::Monotonic => snap.monotonic + snap.elapsed(),
+		Clock::Boottime | Clock::BoottimeAlarm => snap.boottime + snap.elapsed(),
+		Clock::RealtimeCoarse => snap.realtime,
+		Clock::MonotonicCoarse => snap.monotonic,
 		// TODO implement all clocks
 		_ => 0,
 	}
@@ -27,6 +27,7 @@
 pub mod clock;
 pub mod timer;
 pub mod unit;
+pub mod vvar;
 
 use crate::{
 	arch::{
@@ -76,6 +77,7 @@ pub fn sleep_for(clock: Clock, delay: Timestamp, remain: &mut Timestamp) -> ERes
 
 /// Initializes timekeeping
 pub(crate) fn init() -> EResult<()> {
+	vvar::init()?;
 	clock::init(rtc::read_time());
 	const FREQUENCY: u32 = 1024;
 	rtc::set_frequency(FREQUENCY);
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//! The vvar page is a page of data shared read-only with userspace, which allows the vDSO to
+//! read clocks without a system call.
+//!
+//! The kernel updates the page at each clock tick. Readers take a snapshot of the page, which is
+//! protected by a sequence counter: the counter is odd while an update is in progress, and
+//! readers retry if it changed while they were reading.
+//!
+//! Between ticks, readers interpolate the time with the TSC, if usable.
+
+use crate::{
+	arch::x86::{cpuid, timer::tsc},
+	memory::cache::RcPage,
+	sync::{once::OnceInit, spin::IntSpin},
+};
+use core::{
+	hint, ptr,
+	sync::atomic::{
+		AtomicPtr, AtomicU32,
+		Ordering::{Acquire, Relaxed, Release},
+		fence,
+	},
+};
+use utils::errno::AllocResult;
+
+/// The values the clocks are computed from.
+///
+/// The offsets of the fields must remain in sync with the vDSO sources.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+pub struct Snapshot {
+	/// If non-zero, the TSC can be used to interpolate between updates
+	pub tsc_enabled: u32,
+	/// The multiplier to convert TSC cycles to nanoseconds, with 32 fractional bits
+	pub tsc_mult: u32,
+	/// The value of the TSC at the last update
+	pub tsc_base: u64,
+	/// The real time clock at the last update, in nanoseconds
+	pub realtime: u64,
+	/// The monotonic clock at the last update, in nanoseconds
+	pub monotonic: u64,
+	/// The time elapsed since boot at the last update, in nanoseconds
+	pub boottime: u64,
+}
+
+impl Snapshot {
+	/// Returns the time elapsed since the last update, in nanoseconds.
+	///
+	/// If the TSC is not usable, the function returns zero.
+	pub fn elapsed(&self) -> u64 {
+		if self.tsc_enabled == 0 {
+			return 0;
+		}
+		// The TSC of the current core may lag slightly behind the one of the updater
+		let Some(delta) = tsc::read().checked_sub(self.tsc_base) else {
+			return 0;
+		};
+		((delta as u128 * self.tsc_mult as u128) >> 32) as u64
+	}
+}
+
+/// The layout of the vvar page.
+///
+/// The offsets of the fields must remain in sync with the vDSO sources.
+#[repr(C)]
+pub struct VvarData {
+	/// Sequence counter. Odd while an update is in progress
+	seq: AtomicU32,
+	/// If non-zero, `rdtscp` returns the ID of the current core
+	getcpu: u32,
+	/// The protected data
+	snap: Snapshot,
+}
+
+/// Data used before the vvar page is allocated.
+static BOOT_DATA: VvarData = VvarData {
+	seq: AtomicU32::new(0),
+	getcpu: 0,
+	snap: Snapshot {
+		tsc_enabled: 0,
+		tsc_mult: 0,
+		tsc_base: 0,
+		realtime: 0,
+		monotonic: 0,
+		boottime: 0,
+	},
+};
+/// The current location of the data.
+static DATA: AtomicPtr<VvarData> = AtomicPtr::new(ptr::from_ref(&BOOT_DATA).cast_mut());
+/// Lock serializing updates.
+static WRITE_LOCK: IntSpin<()> = IntSpin::new(());
+/// The vvar page.
+static PAGE: OnceInit<RcPage> = unsafe { OnceInit::new() };
+
+/// Returns a consistent copy of the clock data.
+pub fn read() -> Snapshot {
+	let data = unsafe { &*DATA.load(Acquire) };
+	loop {
+		let seq = data.seq.load(Acquire);
+		if seq & 1 != 0 {
+			hint::spin_loop();
+			continue;
+		}
+		let snap = unsafe { ptr::read_volatile(&data.snap) };
+		fence(Acquire);
+		if data.seq.load(Relaxed) == seq {
+			break snap;
+		}
+	}
+}
+
+/// Updates the clock data with `f`.
+pub fn write<F: FnOnce(&mut Snapshot)>(f: F) {
+	let _guard = WRITE_LOCK.lock();
+	let data = DATA.load(Relaxed);
+	unsafe {
+		let seq = (*data).seq.load(Relaxed);
+		(*data).seq.store(seq.wrapping_add(1), Relaxed);
+		fence(Release);
+		let snap = &raw mut (*data).snap;
+		let mut val = ptr::read_volatile(snap);
+		f(&mut val);
+		ptr::write_volatile(snap, val);
+		(*data).seq.store(seq.wrapping_add(2), Release);
+	}
+}
+
+/// Returns the vvar page, to be mapped in userspace.
+#[inline]
+pub fn page() -> &'static RcPage {
+	&PAGE
+}
+
+/// Allocates the vvar page and moves the clock data to it.
+///
+/// This function must be called only once, at boot.
+pub(crate) fn init() -> AllocResult<()> {
+	let page = RcPage::new_zeroed()?;
+	let data = page.virt_addr().as_ptr::<VvarData>();
+	{
+		let _guard = WRITE_LOCK.lock();
+		let mut snap = unsafe { ptr::read_volatile(&BOOT_DATA.snap) };
+		// TSC cycles to nanoseconds. Only frequencies above 1 GHz fit the multiplier
+		if let Some(freq) = tsc::frequency_khz().filter(|f| *f > 1_000_000) {
+			snap.tsc_enabled = 1;
+			snap.tsc_mult = ((1_000_000u64 << 32) / freq as u64) as u32;
+			snap.tsc_base = tsc::read();
+		}
+		unsafe {
+			data.write(VvarData {
+				seq: AtomicU32::new(0),
+				getcpu: cpuid::has_rdtscp() as u32,
+				snap,
+			});
+		}
+		DATA.store(data, Release);
+	}
+	unsafe {
+		OnceInit::init(&PAGE, page);
+	}
+	Ok(())
+}
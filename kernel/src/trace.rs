@@ -0,0 +1,209 @@
+/*
+ * Copyright 2024 Luc Lenôtre
+ *
+ * This file is part of Maestro.
+ *
+ * Maestro is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * Maestro is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Maestro. If not, see <https://www.gnu.org/licenses/>.
+ */
+//! Kernel event tracing.
+//!
+//! Tracepoints are always compiled in. While tracing is disabled, a tracepoint costs a single
+//! relaxed atomic load.
+//!
+//! When enabled, each CPU core records [`Event`]s into its own lock-free ring, written only by
+//! that core with interruptions masked, so that recording never contends with other cores. If a
+//! ring is full, the event is dropped and accounted for, then reported to the consumer as a
+//! [`Kind::Lost`] event, like perf's `PERF_RECORD_LOST`.
+//!
+//! Events are exported as a binary stream of [`Event`] structures by `/proc/trace`. Writing `1`
+//! to this file enables tracing, and `0` disables it.
+
+use crate::{
+	arch::x86::idt::disable_int,
+	memory::ring_buffer::SpscRing,
+	process::scheduler::cpu::{PerCpu, cpus, try_per_cpu},
+	sync::spin::Spin,
+	time::clock::{Clock, current_time_ns},
+};
+use core::{
+	hint::likely,
+	num::NonZeroUsize,
+	ptr,
+	sync::atomic::{
+		AtomicBool, AtomicPtr, AtomicUsize,
+		Ordering::{Acquire, Relaxed, Release},
+	},
+};
+use utils::{boxed::Box, bytes::AnyRepr, errno::AllocResult};
+
+/// The number of events each CPU core's ring can hold.
+const RING_LEN: NonZeroUsize = NonZeroUsize::new(4096).unwrap();
+
+/// Tells whether tracing is enabled.
+static ENABLED: AtomicBool = AtomicBool::new(false);
+/// Lock serializing changes of the tracing state.
+static CONTROL: Spin<()> = Spin::new(());
+
+/// The kind of a traced event.
+///
+/// The values are part of the exported format and must not be changed.
+#[repr(u16)]
+#[derive(Clone, Copy, Debug, Eq, PartialEq)]
+pub enum Kind {
+	/// Events have been dropped because the ring was full. Arguments: number of dropped events
+	Lost = 0,
+	/// Entry in a system call. Arguments: system call ID
+	SyscallEnter = 1,
+	/// Return from a system call. Arguments: system call ID, returned value
+	SyscallExit = 2,
+	/// Context switch. Arguments: previous PID, next PID
+	SchedSwitch = 3,
+	/// Page fault. Arguments: faulting address, error code
+	PageFault = 4,
+	/// Submission of block I/O requests. Arguments: completion ID, number of requests in flight
+	BlkSubmit = 5,
+	/// Completion of a block I/O request. Arguments: completion ID, success
+	BlkComplete = 6,
+	/// Allocation of frames. Arguments: physical address, order
+	FrameAlloc = 7,
+	/// Freeing of frames. Arguments: physical address, order
+	FrameFree = 8,
+	/// Allocation of an object. Arguments: address, size
+	Malloc = 9,
+	/// Freeing of an object. Arguments: address, size
+	Free = 10,
+}
+
+/// A traced event, as exported to userspace.
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct Event {
+	/// The monotonic timestamp of the event, in nanoseconds
+	pub timestamp: u64,
+	/// The kind of event. See [`Kind`]
+	pub kind: u16,
+	/// The ID of the CPU core the event occurred on
+	pub cpu: u16,
+	/// Padding
+	pub _pad: u32,
+	/// Arguments, depending on the kind of event
+	pub args: [u64; 2],
+}
+
+unsafe impl AnyRepr for Event {}
+
+/// Per-CPU tracing state.
+#[derive(Default)]
+pub struct CpuTrace {
+	/// The core's ring, or null if not allocated yet
+	///
+	/// The pointer stored by this field is returned by `Box::into_raw`
+	ring: AtomicPtr<SpscRing<Event>>,
+	/// The number of events dropped since the last [`Kind::Lost`] event
+	lost: AtomicUsize,
+}
+
+impl CpuTrace {
+	/// Returns the core's ring, if allocated.
+	fn ring(&self) -> Option<&SpscRing<Event>> {
+		unsafe { self.ring.load(Acquire).as_ref() }
+	}
+}
+
+impl Drop for CpuTrace {
+	fn drop(&mut self) {
+		let ring = self.ring.swap(ptr::null_mut(), Acquire);
+		if !ring.is_null() {
+			drop(unsafe { Box::from_raw(ring) });
+		}
+	}
+}
+
+/// Tells whether tracing is enabled.
+#[inline]
+pub fn is_enabled() -> bool {
+	ENABLED.load(Relaxed)
+}
+
+/// Enables or disables tracing.
+///
+/// Rings are allocated the first time tracing is enabled. They are then kept so that events
+/// remain readable after tracing is disabled.
+pub fn set_enabled(enabled: bool) -> AllocResult<()> {
+	let _guard = CONTROL.lock();
+	if enabled {
+		for cpu in cpus() {
+			if cpu.trace.ring().is_none() {
+				let ring = Box::new(SpscRing::new(RING_LEN)?)?;
+				cpu.trace.ring.store(Box::into_raw(ring), Release);
+			}
+		}
+	}
+	ENABLED.store(enabled, Release);
+	Ok(())
+}
+
+/// Records an event of kind `kind`, with the given arguments, on the current CPU core.
+#[inline(always)]
+pub fn event(kind: Kind, arg0: u64, arg1: u64) {
+	if likely(!is_enabled()) {
+		return;
+	}
+	record(kind, arg0, arg1);
+}
+
+/// Slow path of [`event`].
+#[inline(never)]
+fn record(kind: Kind, arg0: u64, arg1: u64) {
+	// Interruptions are masked so that the core's ring has a single producer at a time, and so
+	// that the current process cannot be migrated to another core
+	disable_int(|| {
+		let Some(cpu) = try_per_cpu() else {
+			return;
+		};
+		let Some(ring) = cpu.trace.ring() else {
+			return;
+		};
+		let event = Event {
+			timestamp: current_time_ns(Clock::Monotonic),
+			kind: kind as _,
+			cpu: cpu.cpu_id as _,
+			_pad: 0,
+			args: [arg0, arg1],
+		};
+		if unsafe { !ring.push(event) } {
+			cpu.trace.lost.fetch_add(1, Relaxed);
+		}
+	})
+}
+
+/// Takes the next event to be read from `cpu`'s ring.
+///
+/// If events have been dropped since the last call, a [`Kind::Lost`] event is returned first.
+///
+/// # Safety
+///
+/// Only one consumer may call this function at a time.
+pub unsafe fn consume(cpu: &PerCpu) -> Option<Event> {
+	let lost = cpu.trace.lost.swap(0, Relaxed);
+	if lost > 0 {
+		return Some(Event {
+			timestamp: current_time_ns(Clock::Monotonic),
+			kind: Kind::Lost as _,
+			cpu: cpu.cpu_id as _,
+			_pad: 0,
+			args: [lost as _, 0],
+		});
+	}
+	unsafe { cpu.trace.ring()?.pop() }
+}
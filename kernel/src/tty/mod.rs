@@ -33,7 +33,10 @@ use crate::{
 	memory::{user::UserSlice, vmem::KERNEL_VMEM},
 	multiboot::BootInfo,
 	process::{Process, pid::Pid, signal::Signal},
-	sync::{spin::IntSpin, wait_queue::WaitQueue},
+	sync::{
+		spin::IntSpin,
+		wait_queue::{PollTable, WaitQueue},
+	},
 	tty::{
 		ansi::{ANSIBuffer, ESCAPE},
 		termios::{Termios, consts::*},
@@ -43,6 +46,7 @@ use crate::{
 use core::{cmp::min, hint::unlikely, mem, ptr};
 use utils::{
 	collections::vec::Vec,
+	errno,
 	errno::{AllocResult, EResult},
 	ptr::arc::Arc,
 	vec,
@@ -770,8 +774,10 @@ impl TTY {
 	// TODO Implement IUTF8
 	/// Reads inputs from the TTY and writes it into the buffer `buf`.
 	///
+	/// If `nonblock` is set, the function does not wait for input.
+	///
 	/// The function returns the number of bytes read.
-	pub fn read(&self, buf: UserSlice<u8>) -> EResult<usize> {
+	pub fn read(&self, buf: UserSlice<u8>, nonblock: bool) -> EResult<usize> {
 		self.rd_queue.wait_until(|| {
 			let mut input = self.input.lock();
 			let termios = self.get_termios();
@@ -784,7 +790,7 @@ impl TTY {
 			};
 			// If not enough data is available, wait
 			if input.available_size < min_chars {
-				return None;
+				return nonblock.then(|| Err(errno!(EAGAIN)));
 			}
 			let mut len = min(buf.len(), input.available_size);
 			if canon {
@@ -822,6 +828,12 @@ impl TTY {
 		})?
 	}
 
+	/// Registers `table` to be notified when data may become available to read.
+	pub fn poll_wait(&self, table: &mut PollTable) -> AllocResult<()> {
+		// The TTY is never freed
+		unsafe { table.add(&self.rd_queue) }
+	}
+
 	/// Tells whether the TTY has any data available to be read.
 	pub fn has_input_available(&self) -> bool {
 		let termios = self.get_termios();
@@ -22,9 +22,24 @@
 .global __kernel_rt_sigreturn
 .global __kernel_sigreturn
 .global __vdso_clock_gettime
+.global __vdso_clock_gettime64
 .global __vdso_gettimeofday
 .global __vdso_time
 
+.hidden __vvar
+
+# Offsets in the vvar page. They must remain in sync with `src/time/vvar.rs`
+.set VVAR_SEQ, 0
+.set VVAR_TSC_ENABLED, 8
+.set VVAR_TSC_MULT, 12
+.set VVAR_TSC_BASE, 16
+.set VVAR_REALTIME, 24
+.set VVAR_MONOTONIC, 32
+.set VVAR_BOOTTIME, 40
+
+.set SYS_CLOCK_GETTIME, 0x109
+.set SYS_CLOCK_GETTIME64, 0x193
+
 __kernel_vsyscall:
 	int $0x80
 	ret
@@ -37,14 +52,191 @@ __kernel_sigreturn:
 	# TODO
 	ud2
 
+# Reads a clock from the vvar page.
+#
+# Arguments:
+# - %eax: the offset of the clock in the vvar page
+# - %edx: if non-zero, the time elapsed since the last update is added, using the TSC
+#
+# The function returns the timestamp in nanoseconds in %edx:%eax.
+#
+# Clobbers %ecx.
+read_clock:
+	push %ebp
+	push %ebx
+	push %esi
+	push %edi
+	call 1f
+1:
+	pop %ebx
+	lea __vvar-1b(%ebx), %ebx
+	mov %eax, %ebp
+	mov %edx, %edi
+2:
+	mov VVAR_SEQ(%ebx), %ecx
+	test $1, %ecx
+	jnz 6f
+	push %ecx
+	# %esi holds the time elapsed since the last update
+	xor %esi, %esi
+	test %edi, %edi
+	jz 5f
+	cmpl $0, VVAR_TSC_ENABLED(%ebx)
+	je 5f
+	lfence
+	rdtsc
+	sub VVAR_TSC_BASE(%ebx), %eax
+	sbb VVAR_TSC_BASE+4(%ebx), %edx
+	# The TSC of the current core may lag slightly behind the one of the updater
+	js 5f
+	# Saturate to 32 bits. Updates happen much more often than that
+	test %edx, %edx
+	jz 4f
+	mov $-1, %eax
+4:
+	mull VVAR_TSC_MULT(%ebx)
+	mov %edx, %esi
+5:
+	mov (%ebx,%ebp), %eax
+	mov 4(%ebx,%ebp), %edx
+	pop %ecx
+	# Retry if the data has been updated in the meantime
+	cmp VVAR_SEQ(%ebx), %ecx
+	jne 2b
+	add %esi, %eax
+	adc $0, %edx
+	pop %edi
+	pop %esi
+	pop %ebx
+	pop %ebp
+	ret
+6:
+	pause
+	jmp 2b
+
+# Selects the clock to read for the clock ID in %ecx.
+#
+# The function sets %eax and %edx to the arguments of `read_clock`. If the clock is not
+# available from the vvar page, %eax is set to zero.
+clock_params:
+	mov $1, %edx
+	mov $VVAR_REALTIME, %eax
+	cmp $0, %ecx # CLOCK_REALTIME
+	je 1f
+	cmp $8, %ecx # CLOCK_REALTIME_ALARM
+	je 1f
+	mov $VVAR_MONOTONIC, %eax
+	cmp $1, %ecx # CLOCK_MONOTONIC
+	je 1f
+	mov $VVAR_BOOTTIME, %eax
+	cmp $7, %ecx # CLOCK_BOOTTIME
+	je 1f
+	cmp $9, %ecx # CLOCK_BOOTTIME_ALARM
+	je 1f
+	xor %edx, %edx
+	mov $VVAR_REALTIME, %eax
+	cmp $5, %ecx # CLOCK_REALTIME_COARSE
+	je 1f
+	mov $VVAR_MONOTONIC, %eax
+	cmp $6, %ecx # CLOCK_MONOTONIC_COARSE
+	je 1f
+	xor %eax, %eax
+1:
+	ret
+
+# Performs the system call `%eax` with the two arguments of the caller.
+#
+# This function must be jumped to, so that it returns directly to the caller.
+syscall2:
+	push %ebx
+	mov 8(%esp), %ebx
+	mov 12(%esp), %ecx
+	int $0x80
+	pop %ebx
+	ret
+
+# int clock_gettime(clockid_t clockid, struct timespec *tp)
+#
+# `struct timespec` has 32 bits fields.
 __vdso_clock_gettime:
-	# TODO
-	ud2
+	mov 4(%esp), %ecx
+	call clock_params
+	test %eax, %eax
+	jz 1f
+	call read_clock
+	mov $1000000000, %ecx
+	div %ecx
+	mov 8(%esp), %ecx
+	mov %eax, (%ecx)
+	mov %edx, 4(%ecx)
+	xor %eax, %eax
+	ret
+1:
+	mov $SYS_CLOCK_GETTIME, %eax
+	jmp syscall2
 
+# int clock_gettime64(clockid_t clockid, struct __kernel_timespec *tp)
+#
+# `struct __kernel_timespec` has 64 bits fields.
+__vdso_clock_gettime64:
+	mov 4(%esp), %ecx
+	call clock_params
+	test %eax, %eax
+	jz 1f
+	call read_clock
+	mov $1000000000, %ecx
+	div %ecx
+	mov 8(%esp), %ecx
+	mov %eax, (%ecx)
+	movl $0, 4(%ecx)
+	mov %edx, 8(%ecx)
+	movl $0, 12(%ecx)
+	xor %eax, %eax
+	ret
+1:
+	mov $SYS_CLOCK_GETTIME64, %eax
+	jmp syscall2
+
+# int gettimeofday(struct timeval *tv, struct timezone *tz)
 __vdso_gettimeofday:
-	# TODO
-	ud2
+	mov $VVAR_REALTIME, %eax
+	mov $1, %edx
+	call read_clock
+	mov 4(%esp), %ecx
+	test %ecx, %ecx
+	jz 1f
+	push %ebx
+	mov %ecx, %ebx
+	mov $1000000000, %ecx
+	div %ecx
+	mov %eax, (%ebx)
+	mov %edx, %eax
+	xor %edx, %edx
+	mov $1000, %ecx
+	div %ecx
+	mov %eax, 4(%ebx)
+	pop %ebx
+1:
+	# The timezone is always UTC
+	mov 8(%esp), %ecx
+	test %ecx, %ecx
+	jz 2f
+	movl $0, (%ecx)
+	movl $0, 4(%ecx)
+2:
+	xor %eax, %eax
+	ret
 
+# time_t time(time_t *tloc)
 __vdso_time:
-	# TODO
-	ud2
+	mov $VVAR_REALTIME, %eax
+	xor %edx, %edx
+	call read_clock
+	mov $1000000000, %ecx
+	div %ecx
+	mov 4(%esp), %ecx
+	test %ecx, %ecx
+	jz 1f
+	mov %eax, (%ecx)
+1:
+	ret
@@ -23,18 +23,175 @@
 .global __vdso_gettimeofday
 .global __vdso_time
 
+.hidden __vvar
+
+# Offsets in the vvar page. They must remain in sync with `src/time/vvar.rs`
+.set VVAR_SEQ, 0
+.set VVAR_GETCPU, 4
+.set VVAR_TSC_ENABLED, 8
+.set VVAR_TSC_MULT, 12
+.set VVAR_TSC_BASE, 16
+.set VVAR_REALTIME, 24
+.set VVAR_MONOTONIC, 32
+.set VVAR_BOOTTIME, 40
+
+.set SYS_CLOCK_GETTIME, 228
+.set SYS_GETCPU, 309
+
+# Reads a clock from the vvar page.
+#
+# Arguments:
+# - %r9: the offset of the clock in the vvar page
+# - %r10: if non-zero, the time elapsed since the last update is added, using the TSC
+#
+# The function returns the timestamp in nanoseconds in %rax.
+#
+# Clobbers %rcx, %rdx, %rsi, %rdi and %r8.
+read_clock:
+	lea __vvar(%rip), %r8
+1:
+	mov VVAR_SEQ(%r8), %ecx
+	test $1, %ecx
+	jnz 4f
+	mov (%r8,%r9), %rsi
+	xor %eax, %eax
+	test %r10, %r10
+	jz 3f
+	cmpl $0, VVAR_TSC_ENABLED(%r8)
+	je 3f
+	mov VVAR_TSC_MULT(%r8), %edi
+	lfence
+	rdtsc
+	shl $32, %rdx
+	or %rdx, %rax
+	sub VVAR_TSC_BASE(%r8), %rax
+	jns 2f
+	# The TSC of the current core may lag slightly behind the one of the updater
+	xor %eax, %eax
+	jmp 3f
+2:
+	mul %rdi
+	shrd $32, %rdx, %rax
+3:
+	add %rsi, %rax
+	# Retry if the data has been updated in the meantime
+	cmp VVAR_SEQ(%r8), %ecx
+	jne 1b
+	ret
+4:
+	pause
+	jmp 1b
+
+# Selects the clock to read for the clock ID in %edi.
+#
+# The function sets %r9 and %r10 to the arguments of `read_clock`. If the clock is not
+# available from the vvar page, %r9 is set to zero.
+clock_params:
+	mov $1, %r10d
+	mov $VVAR_REALTIME, %r9d
+	cmp $0, %edi # CLOCK_REALTIME
+	je 1f
+	cmp $8, %edi # CLOCK_REALTIME_ALARM
+	je 1f
+	mov $VVAR_MONOTONIC, %r9d
+	cmp $1, %edi # CLOCK_MONOTONIC
+	je 1f
+	mov $VVAR_BOOTTIME, %r9d
+	cmp $7, %edi # CLOCK_BOOTTIME
+	je 1f
+	cmp $9, %edi # CLOCK_BOOTTIME_ALARM
+	je 1f
+	xor %r10d, %r10d
+	mov $VVAR_REALTIME, %r9d
+	cmp $5, %edi # CLOCK_REALTIME_COARSE
+	je 1f
+	mov $VVAR_MONOTONIC, %r9d
+	cmp $6, %edi # CLOCK_MONOTONIC_COARSE
+	je 1f
+	xor %r9d, %r9d
+1:
+	ret
+
+# int clock_gettime(clockid_t clockid, struct timespec *tp)
 __vdso_clock_gettime:
-	# TODO
-	ud2
+	call clock_params
+	test %r9d, %r9d
+	jz 1f
+	mov %rsi, %r11
+	call read_clock
+	xor %edx, %edx
+	mov $1000000000, %ecx
+	div %rcx
+	mov %rax, (%r11)
+	mov %rdx, 8(%r11)
+	xor %eax, %eax
+	ret
+1:
+	mov $SYS_CLOCK_GETTIME, %eax
+	syscall
+	ret
 
+# int getcpu(unsigned int *cpu, unsigned int *node, void *cache)
 __vdso_getcpu:
-    # TODO
-    ud2
+	lea __vvar(%rip), %r8
+	cmpl $0, VVAR_GETCPU(%r8)
+	je 3f
+	# The kernel sets `TSC_AUX` to the ID of the core
+	rdtscp
+	test %rdi, %rdi
+	jz 1f
+	mov %ecx, (%rdi)
+1:
+	test %rsi, %rsi
+	jz 2f
+	movl $0, (%rsi)
+2:
+	xor %eax, %eax
+	ret
+3:
+	mov $SYS_GETCPU, %eax
+	syscall
+	ret
 
+# int gettimeofday(struct timeval *tv, struct timezone *tz)
 __vdso_gettimeofday:
-	# TODO
-	ud2
+	push %rsi
+	mov %rdi, %r11
+	mov $VVAR_REALTIME, %r9d
+	mov $1, %r10d
+	call read_clock
+	pop %rsi
+	test %r11, %r11
+	jz 1f
+	xor %edx, %edx
+	mov $1000000000, %ecx
+	div %rcx
+	mov %rax, (%r11)
+	mov %rdx, %rax
+	xor %edx, %edx
+	mov $1000, %ecx
+	div %rcx
+	mov %rax, 8(%r11)
+1:
+	# The timezone is always UTC
+	test %rsi, %rsi
+	jz 2f
+	movq $0, (%rsi)
+2:
+	xor %eax, %eax
+	ret
 
+# time_t time(time_t *tloc)
 __vdso_time:
-	# TODO
-	ud2
+	mov %rdi, %r11
+	mov $VVAR_REALTIME, %r9d
+	xor %r10d, %r10d
+	call read_clock
+	xor %edx, %edx
+	mov $1000000000, %ecx
+	div %rcx
+	test %r11, %r11
+	jz 1f
+	mov %rax, (%r11)
+1:
+	ret
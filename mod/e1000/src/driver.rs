@@ -76,7 +76,9 @@ impl Driver for E1000Driver {
 						// TODO do not unwrap errors
 						// TODO figure out how to get the name of the interface
 						let name = b"TODO".try_into().unwrap();
+						let napi = nic.napi().clone();
 						let iface = Arc::new(Spin::new(nic)).unwrap();
+						napi.attach(iface.clone());
 
 						let mut ifaces = net::INTERFACES.lock();
 						ifaces.insert(name, iface).unwrap();
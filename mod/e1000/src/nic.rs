@@ -18,25 +18,46 @@
 
 //! NIC structure, representing an e1000-compatible NIC.
 
-use core::{cmp::min, hint::unlikely, mem::size_of, num::NonZeroUsize, ptr, slice};
+use core::{
+	mem::size_of,
+	num::NonZeroUsize,
+	ptr,
+	sync::atomic::{Ordering::Release, fence},
+};
 use kernel::{
 	device::{bar::Bar, manager::PhysicalDevice},
 	int,
 	int::CallbackHandle,
-	memory::{PhysAddr, VirtAddr, buddy},
+	memory::{VirtAddr, buddy},
 	net,
-	net::{BindAddress, MAC, buf::BufList},
-	utils::{errno::EResult, limits::PAGE_SIZE},
+	net::{
+		BindAddress, MAC,
+		buf::{Checksum, HEADROOM, PacketBuf},
+		napi,
+		napi::Napi,
+	},
+	utils::{
+		collections::vec::Vec,
+		errno,
+		errno::{AllocResult, EResult},
+		limits::PAGE_SIZE,
+		ptr::arc::Arc,
+	},
 };
 
 /// The number of receive descriptors.
 const RX_DESC_COUNT: usize = 128;
 /// The size of a receive descriptor's buffer.
-const RX_BUFF_SIZE: usize = 16384;
+const RX_BUFF_SIZE: usize = 2048;
 /// The number of transmit descriptors.
 const TX_DESC_COUNT: usize = 128;
-/// The size of a transmit descriptor's buffer.
-const TX_BUFF_SIZE: usize = 16384;
+
+/// The length of the Ethernet header.
+const ETH_HDR_LEN: usize = 14;
+/// EtherType: IPv4
+const ETHERTYPE_IPV4: u16 = 0x0800;
+/// EtherType: IPv6
+const ETHERTYPE_IPV6: u16 = 0x86dd;
 
 /// Register address: EEPROM/Flash Control & Data
 const REG_EECD: u16 = 0x10;
@@ -49,6 +70,8 @@ const REG_ICR: u16 = 0xc0;
 const REG_ITR: u16 = 0xc4;
 /// Register address: Interrupt Mask Set/Read Register
 const REG_IMS: u16 = 0xd0;
+/// Register address: Interrupt Mask Clear Register
+const REG_IMC: u16 = 0xd8;
 
 /// Register address: Receive Control
 const REG_RCTL: u16 = 0x100;
@@ -94,6 +117,14 @@ const IMS_RXO: u32 = 1 << 6;
 /// Interrupt Mask Set flag: Receiver Timer Interrupt
 const IMS_RTX0: u32 = 1 << 7;
 
+/// The interrupts enabled on the device.
+const INT_MASK: u32 = IMS_TXDW | IMS_LSC | IMS_RXDMT0 | IMS_RXO | IMS_RTX0;
+/// The minimum interval between two interrupts, in units of 256 nanoseconds.
+///
+/// This limits the device to about 8000 interrupts per second, the rest of the work being done by
+/// polling.
+const ITR_INTERVAL: u32 = 488;
+
 /// RCTL flag: Receiver Enable
 const RCTL_EN: u32 = 1 << 1;
 /// RCTL flag: Store Bad Packets
@@ -147,6 +178,11 @@ const RX_STA_IPCS: u8 = 1 << 6;
 /// Receive descriptor status flag: Passed in-exact filter
 const RX_STA_PIF: u8 = 1 << 7;
 
+/// Receive descriptor error flag: TCP/UDP Checksum Error
+const RX_ERR_TCPE: u8 = 1 << 5;
+/// Receive descriptor error flag: IP Checksum Error
+const RX_ERR_IPE: u8 = 1 << 6;
+
 /// Transmit descriptor command flag: End of Packet
 const TX_CMD_EOP: u8 = 0x01;
 /// Transmit descriptor command flag: Insertion of FCS
@@ -171,8 +207,6 @@ const TX_STA_LC: u8 = 1 << 2;
 /// Transmit descriptor status flag: Transmit Underrun
 const TX_STA_TU: u8 = 1 << 3;
 
-// TODO caches need to be flushed before reading/writing from/to receive/transmit buffers
-
 /// The receive descriptor.
 #[derive(Default)]
 #[repr(C, packed)]
@@ -218,6 +252,8 @@ pub struct Nic {
 	bar0: Bar,
 	/// The hook of the interrupt handler.
 	int_hook: CallbackHandle,
+	/// The polling state of the device.
+	napi: Arc<Napi>,
 
 	/// Tells whether the EEPROM exist.
 	eeprom_exists: bool,
@@ -227,13 +263,20 @@ pub struct Nic {
 
 	/// The list of receive descriptors.
 	rx_descs: *mut RXDesc,
+	/// The packet buffers the device receives into, for each receive descriptor.
+	rx_bufs: Vec<Option<PacketBuf>>,
 	/// The cursor in the receive ring buffer.
 	rx_cur: usize,
 
 	/// The list of transmit descriptors.
 	tx_descs: *mut TXDesc,
+	/// The packets being transmitted, kept alive until the device is done with them. A packet is
+	/// stored at the index of the last descriptor it uses.
+	tx_bufs: Vec<Option<PacketBuf>>,
 	/// The cursor in the transmit ring buffer.
 	tx_cur: usize,
+	/// The first transmit descriptor that has not been reclaimed.
+	tx_clean: usize,
 }
 
 impl Nic {
@@ -241,11 +284,18 @@ impl Nic {
 	pub fn new(dev: &dyn PhysicalDevice) -> Result<Self, &str> {
 		let bar0 = dev.get_bars()[0].clone().ok_or("Invalid BAR for NIC")?;
 
+		let napi = Arc::new(Napi::default()).map_err(|_| "Memory allocation failed")?;
 		let int_line = dev.get_interrupt_line().ok_or("Invalid BAR for NIC")?;
-		let int_hook = unsafe {
-			int::register_callback(int_line as _, |_, _, _, _| todo!())
+		let int_hook = {
+			let bar0 = bar0.clone();
+			let napi = napi.clone();
+			unsafe {
+				int::register_callback(int_line as _, move |_, _, _, _| {
+					Self::handle_int(&bar0, &napi)
+				})
 				.map_err(|_| "Memory allocation failed")?
 				.unwrap()
+			}
 		};
 
 		let rx_pages =
@@ -266,16 +316,20 @@ impl Nic {
 		let mut n = Self {
 			bar0,
 			int_hook,
+			napi,
 
 			eeprom_exists: false,
 
 			mac: [0; 6],
 
 			rx_descs: rx_descs.as_ptr() as _,
+			rx_bufs: Vec::new(),
 			rx_cur: 0,
 
 			tx_descs: tx_descs.as_ptr() as _,
+			tx_bufs: Vec::new(),
 			tx_cur: 0,
+			tx_clean: 0,
 		};
 		n.detect_eeprom();
 		n.read_mac();
@@ -341,22 +395,36 @@ impl Nic {
 		self.mac[5] = ((val >> 8) & 0xff) as u8;
 	}
 
+	/// Gives a new packet buffer to the receive descriptor at index `i`.
+	///
+	/// On failure, the descriptor is left untouched.
+	fn rx_refill(&mut self, i: usize) -> AllocResult<()> {
+		let mut pkt = PacketBuf::new(HEADROOM)?;
+		// Cannot fail since the head is larger than a receive buffer
+		let buf = pkt.put(RX_BUFF_SIZE).unwrap();
+		let addr = VirtAddr::from(buf.as_mut_ptr())
+			.kernel_to_physical()
+			.unwrap();
+		let desc = unsafe { &mut *self.rx_descs.add(i) };
+		desc.addr = addr.0 as _;
+		desc.status = 0;
+		self.rx_bufs[i] = Some(pkt);
+		Ok(())
+	}
+
 	/// Initializes transmit and receive descriptors.
-	fn init_desc(&self) -> EResult<()> {
-		// Set interrupts mask
-		self.write_command(REG_IMS, IMS_TXQE | IMS_RXDMT0);
+	fn init_desc(&mut self) -> EResult<()> {
+		// Set interrupts mask and rate
+		self.write_command(REG_ITR, ITR_INTERVAL);
+		self.write_command(REG_IMS, INT_MASK);
 
 		// Init receive ring buffer
-		let rx_buffs_pages =
-			NonZeroUsize::new((RX_DESC_COUNT * RX_BUFF_SIZE).div_ceil(PAGE_SIZE)).unwrap();
-		let rx_buffs_order = buddy::get_order(rx_buffs_pages);
-		let rx_buffs = buddy::alloc_kernel(rx_buffs_order, 0)?;
 		for i in 0..RX_DESC_COUNT {
-			let desc = unsafe { &mut *self.rx_descs.add(i) };
-			let ptr = unsafe { rx_buffs.add(i * TX_BUFF_SIZE) };
-
-			*desc = RXDesc::default();
-			desc.addr = ptr.as_ptr() as _;
+			unsafe {
+				*self.rx_descs.add(i) = RXDesc::default();
+			}
+			self.rx_bufs.push(None)?;
+			self.rx_refill(i)?;
 		}
 
 		// Set receive ring buffer address
@@ -371,23 +439,16 @@ impl Nic {
 		self.write_command(REG_RDH, 0);
 		self.write_command(REG_RDT, (RX_DESC_COUNT - 1) as _);
 
-		// Set receive flags
-		let mut flags = RCTL_EN | RCTL_UPE | RCTL_MPE | RCTL_BAM;
-		flags |= RCTL_BSEX | (0b01 << 16); // 16K buffer
+		// Set receive flags. The buffer size field is left to zero, for 2048 bytes buffers
+		let flags = RCTL_EN | RCTL_UPE | RCTL_MPE | RCTL_BAM | RCTL_SECRC;
 		self.write_command(REG_RCTL, flags);
 
 		// Init transmit ring buffer
-		let tx_buffs_pages =
-			NonZeroUsize::new((TX_DESC_COUNT * TX_BUFF_SIZE).div_ceil(PAGE_SIZE)).unwrap();
-		let tx_buffs_order = buddy::get_order(tx_buffs_pages);
-		let tx_buffs = buddy::alloc_kernel(tx_buffs_order, 0)?;
 		for i in 0..TX_DESC_COUNT {
 			let desc = unsafe { &mut *self.tx_descs.add(i) };
-			let ptr = unsafe { tx_buffs.add(i * TX_BUFF_SIZE) };
-
 			*desc = TXDesc::default();
-			desc.addr = ptr.as_ptr() as _;
 			desc.status = TX_STA_DD;
+			self.tx_bufs.push(None)?;
 		}
 
 		// Set transmit ring buffer address
@@ -414,6 +475,113 @@ impl Nic {
 	}
 }
 
+impl Nic {
+	/// Returns the polling state of the device.
+	///
+	/// The interface must be attached to it once registered.
+	pub fn napi(&self) -> &Arc<Napi> {
+		&self.napi
+	}
+
+	/// Handles an interrupt of the device with the BAR `bar0`.
+	///
+	/// Interrupts are masked until the scheduled poll is complete.
+	fn handle_int(bar0: &Bar, napi: &Arc<Napi>) {
+		// Reading the register acknowledges the interrupt
+		let icr = unsafe { bar0.read::<u32>(REG_ICR as _) };
+		// The interrupt line may be shared with other devices
+		if icr == 0 {
+			return;
+		}
+		unsafe {
+			bar0.write::<u32>(REG_IMC as _, INT_MASK);
+		}
+		napi::schedule(napi);
+	}
+
+	/// Passes the frame `pkt`, received by a descriptor with the given `status` and `errors`, to
+	/// the network stack.
+	fn deliver(mut pkt: PacketBuf, len: usize, status: u8, errors: u8) {
+		// Long packets are disabled, so a frame always fits in a single descriptor
+		if status & RX_STA_EOP == 0 {
+			return;
+		}
+		pkt.trim(len);
+		let csum_checked = status & RX_STA_IXSM == 0 && status & RX_STA_TCPCS != 0;
+		if csum_checked && errors & (RX_ERR_TCPE | RX_ERR_IPE) == 0 {
+			pkt.set_csum(Checksum::Unnecessary);
+		}
+		let Some(hdr) = pkt.pull(ETH_HDR_LEN) else {
+			return;
+		};
+		let ethertype = u16::from_be_bytes([hdr[12], hdr[13]]);
+		if matches!(ethertype, ETHERTYPE_IPV4 | ETHERTYPE_IPV6) {
+			net::receive(pkt);
+		}
+	}
+
+	/// Passes up to `budget` received packets to the network stack, giving new buffers to their
+	/// descriptors.
+	///
+	/// Received data is not copied: the buffer the device wrote to is passed up the stack.
+	/// Descriptors are given back to the device all at once at the end.
+	///
+	/// The function returns the number of processed descriptors.
+	fn receive(&mut self, budget: usize) -> usize {
+		let mut count = 0;
+		while count < budget {
+			let i = self.rx_cur;
+			let desc = unsafe { &*self.rx_descs.add(i) };
+			let status = unsafe { ptr::read_volatile(&raw const desc.status) };
+			if status & RX_STA_DD == 0 {
+				break;
+			}
+			let len = desc.length as usize;
+			let errors = desc.errors;
+			let pkt = self.rx_bufs[i].take();
+			if self.rx_refill(i).is_ok() {
+				if let Some(pkt) = pkt {
+					Self::deliver(pkt, len, status, errors);
+				}
+			} else {
+				// Out of memory: drop the frame and reuse its buffer
+				self.rx_bufs[i] = pkt;
+				unsafe {
+					(*self.rx_descs.add(i)).status = 0;
+				}
+			}
+			count += 1;
+			self.rx_cur = (i + 1) % RX_DESC_COUNT;
+		}
+		if count > 0 {
+			// Give the descriptors back to the device
+			fence(Release);
+			let tail = (self.rx_cur + RX_DESC_COUNT - 1) % RX_DESC_COUNT;
+			self.write_command(REG_RDT, tail as _);
+		}
+		count
+	}
+
+	/// Releases the packets the device is done transmitting.
+	fn tx_reclaim(&mut self) {
+		while self.tx_clean != self.tx_cur {
+			let desc = unsafe { &*self.tx_descs.add(self.tx_clean) };
+			let status = unsafe { ptr::read_volatile(&raw const desc.status) };
+			if status & TX_STA_DD == 0 {
+				break;
+			}
+			self.tx_bufs[self.tx_clean] = None;
+			self.tx_clean = (self.tx_clean + 1) % TX_DESC_COUNT;
+		}
+	}
+
+	/// Returns the number of available transmit descriptors.
+	fn tx_free(&self) -> usize {
+		// One descriptor is left unused to tell a full ring from an empty one
+		(self.tx_clean + TX_DESC_COUNT - self.tx_cur - 1) % TX_DESC_COUNT
+	}
+}
+
 impl net::Interface for Nic {
 	fn get_name(&self) -> &[u8] {
 		b"eth"
@@ -431,134 +599,91 @@ impl net::Interface for Nic {
 		todo!()
 	}
 
-	fn read(&mut self, buff: &mut [u8]) -> EResult<u64> {
-		let mut i = 0;
-		let mut prev_cursor = None;
-
-		while i < buff.len() {
-			let desc = unsafe { &mut *self.tx_descs.add(self.rx_cur) };
-			if desc.status & RX_STA_DD == 0 {
-				break;
+	fn transmit(&mut self, mut pkt: PacketBuf) -> EResult<()> {
+		// Each segment of the packet is given to the device with its own descriptor, so that data
+		// is never copied
+		let ethertype = match pkt.data().first().map(|b| b >> 4) {
+			Some(4) => ETHERTYPE_IPV4,
+			Some(6) => ETHERTYPE_IPV6,
+			_ => return Err(errno!(EINVAL)),
+		};
+		let hdr = pkt.push(ETH_HDR_LEN)?;
+		// TODO resolve the destination's address (ARP/NDP) instead of broadcasting
+		hdr[..6].fill(0xff);
+		hdr[6..12].copy_from_slice(&self.mac);
+		hdr[12..].copy_from_slice(&ethertype.to_be_bytes());
+		// Checksum offload
+		let (css, cso, ic) = match pkt.csum() {
+			Checksum::Partial {
+				start,
+				off,
+			} => {
+				let css = u8::try_from(start).map_err(|_| errno!(EINVAL))?;
+				let cso = u8::try_from(start + off).map_err(|_| errno!(EINVAL))?;
+				(css, cso, TX_CMD_IC)
 			}
-
-			let addr = PhysAddr(desc.addr as _).kernel_to_virtual().unwrap();
-			let len = min(buff.len() - i, desc.length as usize);
-			let slice = unsafe { slice::from_raw_parts(addr.as_ptr(), len) };
-			buff[i..(i + len)].copy_from_slice(slice);
-
-			desc.status = 0;
-
-			i += len;
-
-			prev_cursor = Some(self.rx_cur);
-			self.rx_cur = (self.rx_cur + 1) % RX_DESC_COUNT;
-		}
-
-		if let Some(prev_cursor) = prev_cursor {
-			self.write_command(REG_RDT, prev_cursor as _);
-		}
-
-		todo!() // return number of read bytes
-	}
-
-	fn write(&mut self, mut buf: &BufList<'_>) -> EResult<u64> {
-		// The function takes a set of input buffers and has to write them onto another set of
-		// buffers (the descriptors in use in the device's ring buffer) which may have a different
-		// size.
-		//
-		// To do so, it uses a loop which iterates on both buffers and copies data at each
-		// iteration.
-		//
-		// The length of the copy is the smallest length of remaining data in both buffer, to make
-		// sure there is no overflow.
-		//
-		// At each iteration, at least one of both buffers will be exhausted, which means at least
-		// the complexity is at least `O(min(a, b))` and at most `O(max(a, b))`, where `a` and `b`
-		// are the number of input buffers and the number of descriptors.
-		//
-		// If the next descriptors are busy, the function must wait until it becomes available by
-		// waiting for an interruption.
-
-		let descriptors = unsafe { slice::from_raw_parts_mut(self.tx_descs, TX_DESC_COUNT) };
-
-		// get the next descriptor and wait if necessary
-		fn next_desc(s: &mut Nic, descriptors: &[TXDesc]) {
-			s.tx_cur = (s.tx_cur + 1) % TX_DESC_COUNT;
-			let desc = &descriptors[s.tx_cur];
-
-			// if the descriptor is busy, wait for it to become available again
-			loop {
-				let status = unsafe { ptr::read(&desc.status) };
-				if status & RX_STA_DD == 0 {
-					break;
-				}
-
-				// TODO wait for transmit interrupt
-				todo!()
+			_ => (0, 0, 0),
+		};
+		// Transmitted packets are reclaimed by the poll. Do it here only if the ring is full
+		let count = pkt.segments().count();
+		if count > self.tx_free() {
+			self.tx_reclaim();
+			if count > self.tx_free() {
+				return Err(errno!(ENOBUFS));
 			}
 		}
-
-		let mut buf_off = 0;
-		if unlikely(buf.len() == 0) {
-			return Ok(0);
-		}
-		let mut buf = Some(buf);
-
-		while let Some(b) = buf {
-			let desc = &mut descriptors[self.tx_cur];
-			let desc_len = desc.length as usize;
-			// if the descriptor is full, go to next
-			if desc_len >= TX_BUFF_SIZE {
-				next_desc(self, descriptors);
-				continue;
+		let mut last = self.tx_cur;
+		for (n, seg) in pkt.segments().enumerate() {
+			let addr = VirtAddr::from(seg.as_ptr()).kernel_to_physical().unwrap();
+			let mut cmd = TX_CMD_RS | ic;
+			if n == count - 1 {
+				cmd |= TX_CMD_EOP | TX_CMD_IFCS;
 			}
-
-			let dst = unsafe { slice::from_raw_parts_mut(desc.addr as *mut u8, TX_BUFF_SIZE) };
-
-			// copy data
-			let copy_len = min(b.data.len() - buf_off, TX_BUFF_SIZE - desc_len);
-			dst[desc_len..].copy_from_slice(&b.data[buf_off..(buf_off + copy_len)]);
-			buf_off += copy_len;
-
-			desc.length = (desc_len + copy_len) as _;
-			desc.cmd = TX_CMD_RS;
-			desc.status = 0;
-
-			// get next buffer if the current is exhausted
-			if buf_off >= b.data.len() {
-				buf = b.next();
-				buf_off = 0;
+			unsafe {
+				*self.tx_descs.add(self.tx_cur) = TXDesc {
+					addr: addr.0 as _,
+					length: seg.len() as _,
+					cso,
+					cmd,
+					status: 0,
+					css,
+					special: 0,
+				};
 			}
+			last = self.tx_cur;
+			self.tx_cur = (self.tx_cur + 1) % TX_DESC_COUNT;
 		}
-
-		// flush descriptors
-		let desc = &mut descriptors[self.tx_cur];
-		desc.cmd |= TX_CMD_EOP | TX_CMD_IFCS;
+		self.tx_bufs[last] = Some(pkt);
+		// Flush descriptors
+		fence(Release);
 		self.write_command(REG_TDT, self.tx_cur as _);
+		Ok(())
+	}
 
-		todo!() // return the number of bytes written
+	fn poll(&mut self, budget: usize) -> usize {
+		self.tx_reclaim();
+		let count = self.receive(budget);
+		if count < budget {
+			// No more work, enable interrupts back
+			self.write_command(REG_IMS, INT_MASK);
+		}
+		count
 	}
 }
 
 impl Drop for Nic {
 	fn drop(&mut self) {
+		// Stop the device before freeing the buffers it uses
+		self.write_command(REG_IMC, INT_MASK);
+		self.write_command(REG_RCTL, 0);
+		self.write_command(REG_TCTL, 0);
 		unsafe {
-			let rx_buffs_pages =
-				NonZeroUsize::new((RX_DESC_COUNT * RX_BUFF_SIZE).div_ceil(PAGE_SIZE)).unwrap();
-			let rx_buffs_order = buddy::get_order(rx_buffs_pages);
-			buddy::free_kernel((*self.rx_descs).addr as _, rx_buffs_order);
-
 			let rx_pages =
 				NonZeroUsize::new((RX_DESC_COUNT * size_of::<RXDesc>()).div_ceil(PAGE_SIZE))
 					.unwrap();
 			let rx_order = buddy::get_order(rx_pages);
 			buddy::free_kernel(self.rx_descs as _, rx_order);
 
-			let tx_buffs_pages =
-				NonZeroUsize::new((TX_DESC_COUNT * TX_BUFF_SIZE).div_ceil(PAGE_SIZE)).unwrap();
-			let tx_buffs_order = buddy::get_order(tx_buffs_pages);
-			buddy::free_kernel((*self.tx_descs).addr as _, tx_buffs_order);
-
 			let tx_pages =
 				NonZeroUsize::new((TX_DESC_COUNT * size_of::<TXDesc>()).div_ceil(PAGE_SIZE))
 					.unwrap();